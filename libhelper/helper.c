@@ -82,6 +82,7 @@
 #include "../libiapp/fd_types.h"
 #include "../libiapp/comm_types.h"
 #include "../libiapp/comm.h"
+#include "../libiapp/event.h"
 
 #include "ipc.h"
 #include "helper.h"
@@ -96,6 +97,9 @@ static helper_stateful_request *StatefulDequeue(statefulhelper * hlp);
 static helper_server *GetFirstAvailable(helper * hlp);
 static helper_stateful_server *StatefulGetFirstAvailable(statefulhelper * hlp);
 static void helperDispatch(helper_server * srv, helper_request * r);
+static void helperServerSetReady(helper_server * srv);
+static void helperScheduleFlush(helper_server * srv);
+static EVH helperFlushQueue;
 static void helperStatefulDispatch(helper_stateful_server * srv, helper_stateful_request * r);
 static void helperKickQueue(helper * hlp);
 static void helperStatefulKickQueue(statefulhelper * hlp);
@@ -179,6 +183,7 @@ helperOpenServers(helper * hlp)
 	srv->parent = hlp;
 	cbdataLock(hlp);	/* lock because of the parent backlink */
 	dlinkAddTail(srv, &srv->link, &hlp->servers);
+	helperServerSetReady(srv);
 	if (rfd == wfd) {
 	    snprintf(fd_note_buf, FD_DESC_SZ, "%s #%d", shortname, k + 1);
 	    fd_note(rfd, fd_note_buf);
@@ -305,6 +310,7 @@ helperSubmit(helper * hlp, const char *buf, HLPCB * callback, void *data)
     r->callback = callback;
     r->data = data;
     r->buf = xstrdup(buf);
+    r->queue_time = current_time;
     cbdataLock(r->data);
     if ((srv = GetFirstAvailable(hlp)))
 	helperDispatch(srv, r);
@@ -417,6 +423,10 @@ helperShutdown(helper * hlp)
     pid_t pid;
     int no;
 #endif
+    /* Push out anything still sitting in the write queues */
+    if (hlp->flush_pending)
+	eventDelete(helperFlushQueue, hlp);
+    helperFlushQueue(hlp);
     while (link) {
 	int wfd;
 	helper_server *srv;
@@ -430,6 +440,7 @@ helperShutdown(helper * hlp)
 	hlp->n_active--;
 	assert(hlp->n_active >= 0);
 	srv->flags.shutdown = 1;	/* request it to shut itself down */
+	helperServerSetReady(srv);
 	if (srv->flags.writing) {
 	    debugs(84, 3, "helperShutdown: %s #%d is BUSY.",
 		hlp->id_name, srv->index + 1);
@@ -541,6 +552,8 @@ helperCreate(const char *name)
     CBDATA_INIT_TYPE(helper);
     hlp = cbdataAlloc(helper);
     hlp->id_name = name;
+    statHistLogInit(&hlp->stats.queue_time, 300, 0.0, 60000.0 * 10.0);
+    statHistLogInit(&hlp->stats.svc_time, 300, 0.0, 60000.0 * 10.0);
     return hlp;
 }
 
@@ -564,6 +577,8 @@ helperFree(helper * hlp)
     if (hlp->queue.head)
 	debugs(84, 0, "WARNING: freeing %s helper with %d requests queued",
 	    hlp->id_name, hlp->stats.queue_size);
+    statHistClean(&hlp->stats.queue_time);
+    statHistClean(&hlp->stats.svc_time);
     cbdataFree(hlp);
 }
 
@@ -611,6 +626,11 @@ helperServerFree(int fd, void *data)
     safe_free(srv->requests);
     if (srv->wfd != srv->rfd && srv->wfd != -1)
 	comm_close(srv->wfd);
+    if (srv->flags.ready)
+	dlinkDelete(&srv->ready_link, &hlp->ready);
+    if (srv->flags.flush)
+	dlinkDelete(&srv->flush_link, &hlp->flush);
+    srv->flags.ready = srv->flags.flush = 0;
     dlinkDelete(&srv->link, &hlp->servers);
     hlp->n_running--;
     assert(hlp->n_running >= 0);
@@ -678,13 +698,23 @@ static void
 helperHandleRead(int fd, void *data)
 {
     int len;
+    char *s;
     char *t = NULL;
     helper_server *srv = data;
     helper *hlp = srv->parent;
     assert(fd == srv->rfd);
     assert(cbdataValid(data));
     CommStats.syscalls.sock.reads++;
-    /* XXX srv->rbuf should be reallocated if needed.. and start out quite small (not fixed 8KB as now..) */
+    /* Grow the buffer if a partial reply has filled it up */
+    if (srv->roffset + 1 >= srv->rbuf_sz) {
+	if (srv->rbuf_sz >= HELPER_MAX_RBUF) {
+	    debugs(84, 0, "WARNING: %s #%d sent a reply longer than %d bytes, closing it",
+		hlp->id_name, srv->index + 1, HELPER_MAX_RBUF);
+	    comm_close(fd);
+	    return;
+	}
+	srv->rbuf = memReallocBuf(srv->rbuf, XMIN(srv->rbuf_sz * 2, HELPER_MAX_RBUF), &srv->rbuf_sz);
+    }
     assert(srv->roffset < srv->rbuf_sz);
     len = FD_READ_METHOD(fd, srv->rbuf + srv->roffset, srv->rbuf_sz - srv->roffset - 1);
     fd_bytes(fd, len, FD_READ);
@@ -712,19 +742,24 @@ helperHandleRead(int fd, void *data)
 	srv->roffset = 0;
 	srv->rbuf[0] = '\0';
     }
-    while ((t = strchr(srv->rbuf, '\n'))) {
+    /*
+     * Walk every complete reply in the buffer and only shift the
+     * trailing partial reply down once at the end.
+     */
+    s = srv->rbuf;
+    while ((t = strchr(s, '\n'))) {
 	helper_request *r;
-	char *msg = srv->rbuf;
+	char *msg = s;
 	int i = 0;
 	/* end of reply found */
-	debugs(84, 3, "helperHandleRead: end of reply found: %s", srv->rbuf);
-	if (t > srv->rbuf && t[-1] == '\r')
+	debugs(84, 3, "helperHandleRead: end of reply found: %s", s);
+	if (t > s && t[-1] == '\r')
 	    t[-1] = '\0';
 	*t++ = '\0';
 	if (hlp->concurrency) {
 	    errno = 0;
 	    i = strtol(msg, &msg, 10);
-	    if (msg == srv->rbuf || errno)
+	    if (msg == s || errno)
 		i = -1;
 	    while (*msg && xisspace(*msg))
 		msg++;
@@ -738,18 +773,23 @@ helperHandleRead(int fd, void *data)
 	    if (cbdataValid(r->data))
 		r->callback(r->data, msg);
 	    srv->stats.pending--;
+	    helperServerSetReady(srv);
 	    hlp->stats.replies++;
 	    hlp->stats.avg_svc_time =
 		intAverage(hlp->stats.avg_svc_time,
 		tvSubUsec(r->dispatch_time, current_time),
 		hlp->stats.replies, REDIRECT_AV_FACTOR);
+	    statHistCount(&hlp->stats.svc_time, tvSubMsec(r->dispatch_time, current_time));
 	    helperRequestFree(r);
 	} else {
 	    debugs(84, 1, "helperHandleRead: unexpected reply on channel %d from %s #%d '%s'",
-		i, hlp->id_name, srv->index + 1, srv->rbuf);
+		i, hlp->id_name, srv->index + 1, s);
 	}
-	srv->roffset -= (t - srv->rbuf);
-	memmove(srv->rbuf, t, srv->roffset + 1);
+	s = t;
+    }
+    if (s != srv->rbuf) {
+	srv->roffset -= (s - srv->rbuf);
+	memmove(srv->rbuf, s, srv->roffset + 1);
     }
     if (srv->flags.shutdown && !srv->stats.pending) {
 	if (!srv->flags.closing) {
@@ -891,38 +931,40 @@ StatefulDequeue(statefulhelper * hlp)
     return r;
 }
 
+/*
+ * Servers with at least one free request slot sit on hlp->ready.
+ * Idle servers are kept at the head and partially loaded ones at
+ * the tail, so the head is always the "least" loaded server (approx).
+ */
 static helper_server *
 GetFirstAvailable(helper * hlp)
 {
-    dlink_node *n;
-    helper_server *srv;
-    helper_server *selected = NULL;
     if (hlp->n_running == 0)
 	return NULL;
-    /* Find "least" loaded helper (approx) */
-    for (n = hlp->servers.head; n != NULL; n = n->next) {
-	srv = n->data;
-	if (selected && selected->stats.pending <= srv->stats.pending)
-	    continue;
-	if (srv->flags.shutdown)
-	    continue;
-	if (srv->flags.closing)
-	    continue;
-	if (selected) {
-	    selected = srv;
-	    break;
-	}
-	selected = srv;
-	if (!selected->stats.pending)
-	    break;
-    }
-    /* Check for overload */
-    if (!selected)
-	return NULL;
-    if (selected->stats.pending >= (hlp->concurrency ? hlp->concurrency : 1))
+    if (!hlp->ready.head)
 	return NULL;
+    return hlp->ready.head->data;
+}
 
-    return selected;
+/*
+ * Put the server on (or take it off) the ready queue according to
+ * its current load and state.
+ */
+static void
+helperServerSetReady(helper_server * srv)
+{
+    helper *hlp = srv->parent;
+    int ready = !srv->flags.shutdown && !srv->flags.closing &&
+    srv->stats.pending < (hlp->concurrency ? hlp->concurrency : 1);
+    if (srv->flags.ready)
+	dlinkDelete(&srv->ready_link, &hlp->ready);
+    srv->flags.ready = ready;
+    if (!ready)
+	return;
+    if (srv->stats.pending == 0)
+	dlinkAdd(srv, &srv->ready_link, &hlp->ready);
+    else
+	dlinkAddTail(srv, &srv->ready_link, &hlp->ready);
 }
 
 static helper_stateful_server *
@@ -960,6 +1002,7 @@ helperDispatch_done(int fd, char *buf, size_t size, int status, void *data)
     } else if (!memBufIsNull(&srv->wqueue)) {
 	MemBuf mb = srv->wqueue;
 	srv->wqueue = MemBufNull;
+	srv->parent->stats.writes++;
 	comm_write_mbuf(srv->wfd,
 	    mb,
 	    helperDispatch_done,	/* Handler */
@@ -1009,26 +1052,71 @@ helperDispatch(helper_server * srv, helper_request * r)
     assert(ptr);
     *ptr = r;
     srv->stats.pending += 1;
+    helperServerSetReady(srv);
     r->dispatch_time = current_time;
+    statHistCount(&hlp->stats.queue_time, tvSubMsec(r->queue_time, current_time));
     if (memBufIsNull(&srv->wqueue))
 	memBufDefInit(&srv->wqueue);
     if (hlp->concurrency)
 	memBufPrintf(&srv->wqueue, "%d %s", slot, r->buf);
     else
 	memBufAppend(&srv->wqueue, r->buf, strlen(r->buf));
-    if (!srv->flags.writing) {
-	MemBuf mb = srv->wqueue;
+    /*
+     * Don't write right away; requests dispatched during this loop
+     * iteration are coalesced and written out in one go by
+     * helperFlushQueue().  If a write is already in progress the
+     * completion handler picks up the queued data.
+     */
+    if (!srv->flags.writing)
+	helperScheduleFlush(srv);
+    debugs(84, 5, "helperDispatch: Request queued to %s #%d[%d], %d bytes",
+	hlp->id_name, srv->index + 1, slot, (int) strlen(r->buf));
+    srv->stats.uses++;
+    hlp->stats.requests++;
+}
+
+static void
+helperScheduleFlush(helper_server * srv)
+{
+    helper *hlp = srv->parent;
+    if (!srv->flags.flush) {
+	srv->flags.flush = 1;
+	dlinkAddTail(srv, &srv->flush_link, &hlp->flush);
+    }
+    if (!hlp->flush_pending) {
+	hlp->flush_pending = 1;
+	eventAdd("helperFlushQueue", helperFlushQueue, hlp, 0.0, 0);
+    }
+}
+
+/*
+ * Write out the queued requests of every server which had requests
+ * dispatched to it since the last flush, one write per server.
+ */
+static void
+helperFlushQueue(void *data)
+{
+    helper *hlp = data;
+    helper_server *srv;
+    MemBuf mb;
+    hlp->flush_pending = 0;
+    while ((srv = dlinkRemoveHead(&hlp->flush))) {
+	srv->flags.flush = 0;
+	if (srv->flags.writing || memBufIsNull(&srv->wqueue))
+	    continue;
+	if (srv->wfd < 0)
+	    continue;
+	mb = srv->wqueue;
 	srv->wqueue = MemBufNull;
 	srv->flags.writing = 1;
+	hlp->stats.writes++;
+	debugs(84, 5, "helperFlushQueue: %s #%d, %d bytes",
+	    hlp->id_name, srv->index + 1, (int) mb.size);
 	comm_write_mbuf(srv->wfd,
 	    mb,
 	    helperDispatch_done,	/* Handler */
 	    srv);
     }
-    debugs(84, 5, "helperDispatch: Request sent to %s #%d[%d], %d bytes",
-	hlp->id_name, srv->index + 1, slot, (int) strlen(r->buf));
-    srv->stats.uses++;
-    hlp->stats.requests++;
 }
 
 static void
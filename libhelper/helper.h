@@ -2,6 +2,7 @@
 #define	__LIBHELPER_HELPER_H__
 
 #define HELPER_MAX_ARGS 64
+#define HELPER_MAX_RBUF (64 * 1024)	/* longest reply line accepted from a helper */
 #define REDIRECT_AV_FACTOR 1000
 
 typedef void HLPCB(void *, char *buf);
@@ -20,6 +21,7 @@ struct _helper_request {
     char *buf;
     HLPCB *callback;
     void *data;
+    struct timeval queue_time;
     struct timeval dispatch_time;
     dlink_node n;
 };
@@ -36,19 +38,25 @@ struct _helper {
     wordlist *cmdline;
     dlink_list servers;
     dlink_list queue;
+    dlink_list ready;		/* servers with a free request slot */
+    dlink_list flush;		/* servers with unwritten requests in wqueue */
     const char *id_name;
     int n_to_start;
     int n_running;
     int n_active;
     int ipc_type;
     int concurrency;
+    int flush_pending;
     time_t last_queue_warn;
     struct {
         int requests;
         int replies;
+        int writes;
         int queue_size;
         int max_queue_size;
         int avg_svc_time;
+        StatHist queue_time;	/* msec from submit to dispatch */
+        StatHist svc_time;	/* msec from dispatch to reply */
     } stats;
     time_t last_restart;
 };
@@ -88,12 +96,16 @@ struct _helper_server {
     size_t rbuf_sz;
     int roffset;
     dlink_node link;
+    dlink_node ready_link;
+    dlink_node flush_link;
     helper *parent;
     helper_request **requests;
     struct _helper_flags {
         unsigned int writing:1;
         unsigned int closing:1;
         unsigned int shutdown:1;
+        unsigned int ready:1;
+        unsigned int flush:1;
     } flags;
     struct {
         int uses;
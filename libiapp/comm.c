@@ -61,6 +61,9 @@
 #if HAVE_NETDB_H
 #include <netdb.h>
 #endif
+#ifndef _SQUID_MSWIN_
+#include <sys/uio.h>
+#endif
 
 #include "../include/Array.h"
 #include "../include/Stack.h"
@@ -289,6 +292,8 @@ comm_fdopen6(int new_socket,
 	commSetCloseOnExec(new_socket);
     if ((flags & COMM_REUSEADDR))
 	commSetReuseAddr(new_socket);
+    if ((flags & COMM_REUSEPORT))
+	commSetReusePort(new_socket);
     if ((flags & COMM_TPROXY_LCL))
       F->flags.tproxy_lcl = 1;
     if ((flags & COMM_TPROXY_REM))
@@ -511,6 +516,8 @@ comm_connect_try(int fd, void *data)
 
 	/* completion has occured either way - call the callback with the connect results */
 	debugs(5, 3, "comm_connect_try: FD %d: completed (%s)!", fd, r == COMM_OK ? "OK" : "FAIL");
+	if (r == COMM_OK)
+	    F->flags.edge = 1;
 	cb = F->comm.connect.cb;
 	cbdata = F->comm.connect.cbdata;
 	F->comm.connect.cb = NULL;
@@ -647,6 +654,10 @@ comm_connect_addr(int sock, const sqaddr_t *addr)
     return status;
 }
 
+#if defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+static int have_accept4 = 1;
+#endif
+
 /* Wait for an incoming connection on FD.  FD should be a socket returned
  * from comm_listen. */
 int
@@ -654,6 +665,7 @@ comm_accept(int fd, sqaddr_t *pn, sqaddr_t *me)
 {
     int sock;
     int ret = COMM_OK;
+    int flags_set = 0;
     sqaddr_t loc, rem;
 
     socklen_t Slen;
@@ -664,7 +676,20 @@ comm_accept(int fd, sqaddr_t *pn, sqaddr_t *me)
     Slen = sqinet_get_maxlength(&rem);
 
     CommStats.syscalls.sock.accepts++;
-    if ((sock = accept(fd, sqinet_get_entry(&rem), &Slen)) < 0) {
+#if defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+    /* accept4() saves the two fcntl() round trips below */
+    if (have_accept4) {
+	sock = accept4(fd, sqinet_get_entry(&rem), &Slen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (sock < 0 && errno == ENOSYS) {
+	    have_accept4 = 0;
+	    Slen = sqinet_get_maxlength(&rem);
+	    sock = accept(fd, sqinet_get_entry(&rem), &Slen);
+	} else if (sock >= 0)
+	    flags_set = 1;
+    } else
+#endif
+    sock = accept(fd, sqinet_get_entry(&rem), &Slen);
+    if (sock < 0) {
 	if (ignoreErrno(errno) || errno == ECONNREFUSED || errno == ECONNABORTED) {
 	    debugs(5, 5, "comm_accept: FD %d: %s", fd, xstrerror());
             ret = COMM_NOMESSAGE;
@@ -685,7 +710,8 @@ comm_accept(int fd, sqaddr_t *pn, sqaddr_t *me)
     getsockname(sock, sqinet_get_entry(&loc), &Slen);
     if (me)
         sqinet_copy(me, &loc);
-    commSetCloseOnExec(sock);
+    if (!flags_set)
+	commSetCloseOnExec(sock);
     /* fdstat update */
     fd_open(sock, FD_SOCKET, NULL);
     fd_note_static(sock, "HTTP Request");
@@ -694,7 +720,12 @@ comm_accept(int fd, sqaddr_t *pn, sqaddr_t *me)
     sqinet_copy(&F->remote_address, &rem);
     F->remote_port = sqinet_get_port(&rem);
     F->local_port = sqinet_get_port(&loc);
-    commSetNonBlocking(sock);
+    if (flags_set) {
+	F->flags.nonblocking = 1;
+	F->flags.close_on_exec = 1;
+    } else
+	commSetNonBlocking(sock);
+    F->flags.edge = 1;
     ret = sock;
 finish:
     sqinet_done(&loc);
@@ -1164,6 +1195,59 @@ commSetReuseAddr(int fd)
 	debugs(5, 1, "commSetReuseAddr: FD %d: %s", fd, xstrerror());
 }
 
+/*
+ * Let several processes bind their own listening socket to the same
+ * address; the kernel then spreads new connections over them.
+ */
+void
+commSetReusePort(int fd)
+{
+#ifdef SO_REUSEPORT
+    int on = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (char *) &on, sizeof(on)) < 0)
+	debugs(5, 1, "commSetReusePort: FD %d: %s", fd, xstrerror());
+#else
+    debugs(5, 1, "commSetReusePort: FD %d: SO_REUSEPORT not supported on this platform", fd);
+#endif
+}
+
+/*
+ * Prefer this listening socket for connections whose packets are
+ * processed on the given CPU (within a SO_REUSEPORT group).
+ */
+void
+commSetIncomingCpu(int fd, int cpu)
+{
+#ifdef SO_INCOMING_CPU
+    if (setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, (char *) &cpu, sizeof(cpu)) < 0)
+	debugs(5, 1, "commSetIncomingCpu: FD %d, CPU %d: %s", fd, cpu, xstrerror());
+#endif
+}
+
+/* Only wake the listener up once a new connection has data to read */
+void
+commSetDeferAccept(int fd, int seconds)
+{
+#ifdef TCP_DEFER_ACCEPT
+    if (setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, (char *) &seconds, sizeof(seconds)) < 0)
+	debugs(5, 1, "commSetDeferAccept: FD %d, %d seconds: %s", fd, seconds, xstrerror());
+#else
+    debugs(5, 1, "commSetDeferAccept: FD %d: TCP_DEFER_ACCEPT not supported", fd);
+#endif
+}
+
+/* Accept data in the SYN from up to qlen not yet accepted clients */
+void
+commSetTcpFastOpen(int fd, int qlen)
+{
+#ifdef TCP_FASTOPEN
+    if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, (char *) &qlen, sizeof(qlen)) < 0)
+	debugs(5, 1, "commSetTcpFastOpen: FD %d, queue %d: %s", fd, qlen, xstrerror());
+#else
+    debugs(5, 1, "commSetTcpFastOpen: FD %d: TCP_FASTOPEN not supported", fd);
+#endif
+}
+
 void
 commSetTcpRcvbuf(int fd, int size)
 {
@@ -1400,6 +1484,29 @@ comm_init(void)
     statHistIntInit(&select_fds_hist, 256);
 }
 
+/* The part of a comm_writev() the previous writes didn't get to */
+static int
+commWritevMore(int fd, CommWriteStateData * state)
+{
+    struct iovec iov[COMM_WRITEV_MAX];
+    size_t skip = state->offset;
+    int i, n = 0;
+
+    for (i = 0; i < state->iovcnt; i++) {
+	if (skip >= state->iov[i].iov_len) {
+	    skip -= state->iov[i].iov_len;
+	    continue;
+	}
+	iov[n].iov_base = (char *) state->iov[i].iov_base + skip;
+	iov[n].iov_len = state->iov[i].iov_len - skip;
+	skip = 0;
+	n++;
+    }
+    if (n == 0)
+	return FD_WRITE_METHOD(fd, NULL, 0);
+    return fd_writev(fd, iov, n);
+}
+
 /* Write to FD. */
 static void
 commHandleWrite(int fd, void *data)
@@ -1414,7 +1521,9 @@ commHandleWrite(int fd, void *data)
 	fd, (long int) state->offset, (long int) state->header_size, (long int) state->size);
 
     nleft = state->size + state->header_size - state->offset;
-    if (state->offset < state->header_size)
+    if (state->iov)
+	len = commWritevMore(fd, state);
+    else if (state->offset < state->header_size)
 	len = FD_WRITE_METHOD(fd, state->header + state->offset, state->header_size - state->offset);
     else
 	len = FD_WRITE_METHOD(fd, state->buf + state->offset - state->header_size, nleft);
@@ -1576,6 +1685,7 @@ comm_write(int fd, const char *buf, int size, CWCB * handler, void *handler_data
     state->size = size;
     state->header_size = 0;
     state->offset = 0;
+    state->iov = NULL;
     state->handler = handler;
     state->handler_data = handler_data;
     state->free_func = free_func;
@@ -1616,6 +1726,7 @@ comm_write_header(int fd, const char *buf, int size, const char *header, size_t
     state->buf = (char *) buf;
     state->size = size;
     state->offset = 0;
+    state->iov = NULL;
     state->handler = handler;
     state->handler_data = handler_data;
     cbdataLock(handler_data);
@@ -1627,6 +1738,50 @@ comm_write_header(int fd, const char *buf, int size, const char *header, size_t
     commSetSelect(fd, COMM_SELECT_WRITE, commHandleWrite, NULL, 0);
 }
 
+/*!
+ * @function
+ *	comm_writev
+ * @abstract
+ *	Write the segments in {iov, iovcnt} to the given file descriptor
+ *	with as few system calls as possible.
+ *
+ *	Call {handler, handler_data} on completion IFF handler_data is still valid.
+ *
+ *	Call free_func on free_buf on completion.
+ *
+ * @discussion
+ *	As with comm_write() the caller MUST keep the data valid for the
+ *	duration of the call, and the iov array itself with it.  free_buf
+ *	is typically the storage some of the segments point into.
+ */
+void
+comm_writev(int fd, const struct iovec *iov, int iovcnt, CWCB * handler, void *handler_data, char *free_buf, FREE * free_func)
+{
+    CommWriteStateData *state = &fd_table[fd].rwstate;
+    int i;
+    debugs(5, 5, "comm_writev: FD %d: %d segments: hndl %p: data %p.",
+	fd, iovcnt, handler, handler_data);
+    assert(iovcnt <= COMM_WRITEV_MAX);
+    if (state->valid) {
+	debugs(5, 1, "comm_writev: fd_table[%d].rwstate.valid == true!", fd);
+	fd_table[fd].rwstate.valid = 0;
+    }
+    state->buf = free_buf;
+    state->size = 0;
+    for (i = 0; i < iovcnt; i++)
+	state->size += iov[i].iov_len;
+    state->header_size = 0;
+    state->offset = 0;
+    state->iov = iov;
+    state->iovcnt = iovcnt;
+    state->handler = handler;
+    state->handler_data = handler_data;
+    state->free_func = free_func;
+    state->valid = 1;
+    cbdataLock(handler_data);
+    commSetSelect(fd, COMM_SELECT_WRITE, commHandleWrite, NULL, 0);
+}
+
 /* a wrapper around comm_write to allow for MemBuf to be comm_written in a snap */
 void
 comm_write_mbuf(int fd, MemBuf mb, CWCB * handler, void *handler_data)
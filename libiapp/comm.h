@@ -47,11 +47,18 @@ struct _close_handler {
     close_handler *next;
 };
 
+struct iovec;
+
+/* most segments comm_writev() takes in one go */
+#define COMM_WRITEV_MAX	16
+
 struct _CommWriteStateData {
     int valid;
     char *buf;
     size_t size;
     size_t offset;
+    const struct iovec *iov;	/* comm_writev(): the data; buf is only freed */
+    int iovcnt;
     CWCB *handler;
     void *handler_data;
     FREE *free_func;
@@ -85,12 +92,17 @@ struct _fde {
         unsigned int dnsfailed:1;       /* did the dns lookup fail */
 	unsigned int tproxy_lcl:1;		/* should this listen socket have its listen details spoofed via comm_ips_lcl_bind()? */
 	unsigned int tproxy_rem:1;		/* should the source address of this FD be spoofed via comm_ips_rem_bind()? */
+	unsigned int ktls_send:1;	/* SSL records are built by the kernel, plain writes are fine */
+	unsigned int edge:1;		/* all I/O goes through fd_bytes(), may be edge triggered */
+	unsigned int read_ready:1;	/* edge triggered: more may be read before the next event */
+	unsigned int write_ready:1;	/* edge triggered: more may be written before the next event */
     } flags;
     comm_pending read_pending;
     comm_pending write_pending;
     squid_off_t bytes_read;
     squid_off_t bytes_written;
     int uses;                   /* ie # req's over persistent conn */
+    int loop;                   /* id of the event loop owning this fd */
     struct {
     	struct {
 		char *buf;
@@ -130,6 +142,7 @@ struct _fde {
 #endif
 #if DELAY_POOLS
     int slow_id;
+    int defer_id;
 #endif
 };
 
@@ -158,11 +171,15 @@ struct _CommStatStruct {
             int sendtos;
         } sock;
         int polls;
+        int pollctls;		/* interest set updates, eg. epoll_ctl() */
         int selects;
     } syscalls;
     int select_fds;
     int select_loops;
     int select_time;
+    double loop_lag;		/* moving average of the seconds spent per busy loop */
+    int msgs;			/* messages run from other threads */
+    int msg_wakeups;		/* loop wakeups to run them */
 };
 
 typedef struct _CommStatStruct CommStatStruct;
@@ -178,6 +195,9 @@ extern void fdDumpOpen(void);
 extern int fdNFree(void);
 extern int fdUsageHigh(void);
 extern void fdAdjustReserved(void);
+extern int default_write_method(int fd, const char *buf, int len);
+extern int fd_readv(int fd, struct iovec *iov, int iovcnt);
+extern int fd_writev(int fd, const struct iovec *iov, int iovcnt);
 
 extern int commSetNonBlocking(int fd);
 extern int commUnsetNonBlocking(int fd);
@@ -210,6 +230,8 @@ extern void commDeferFD(int fd);
 extern void commResumeFD(int fd);
 extern void commSetSelect(int, unsigned int, PF *, void *, time_t);
 extern void commRemoveSlow(int fd);
+extern void commRemoveDeferred(int fd);
+extern void commRecheckDeferred(void);
 extern void comm_add_close_handler(int fd, PF *, void *);
 extern void comm_remove_close_handler(int fd, PF *, void *);
 extern void comm_condition_remove_close_handler(int fd, PF *, CDT *);
@@ -231,6 +253,13 @@ extern void comm_write_header(int fd,
     void *handler_data,
     FREE *);
 extern void comm_write_mbuf_header(int fd, MemBuf mb, const char *header, size_t header_size, CWCB * handler, void *handler_data);
+extern void comm_writev(int fd,
+    const struct iovec *iov,
+    int iovcnt,
+    CWCB * handler,
+    void *handler_data,
+    char *free_buf,
+    FREE *);
 #if 0
 /* comm_read / comm_read_cancel two functions are in testing and not to be used! */
 extern void comm_read(int fd, char *buf, int size, CRCB *cb, void *data);
@@ -247,6 +276,10 @@ extern int commBind(int s, sqaddr_t *addr);
 extern void commSetTcpNoDelay(int);
 extern void commSetTcpRcvbuf(int, int);
 extern void commSetReuseAddr(int fd);
+extern void commSetReusePort(int fd);
+extern void commSetIncomingCpu(int fd, int cpu);
+extern void commSetDeferAccept(int fd, int seconds);
+extern void commSetTcpFastOpen(int fd, int qlen);
 
 extern int comm_create_fifopair(int *prfd, int *pwfd, int *crfd, int *cwfd);
 extern int comm_create_unix_stream_pair(int *prfd, int *pwfd, int *crfd, int *cwfd, int buflen);
@@ -259,7 +292,11 @@ extern int comm_create_unix_dgram_pair(int *prfd, int *pwfd, int *crfd, int *cwf
 extern void comm_select_init(void);
 extern void comm_select_postinit(void);
 extern void comm_select_shutdown(void);
-extern int comm_select(int);
+struct _iapp_loop;
+extern int comm_select(struct _iapp_loop *, int);
+extern int comm_select_loops(void);
+extern int comm_select_loop_init(struct _iapp_loop *);
+extern void commSetLoop(int fd, int loop);
 extern void commUpdateEvents(int fd);
 extern void commSetEvents(int fd, int need_read, int need_write);
 extern void commClose(int fd);
@@ -71,17 +71,52 @@
 #include "fd_types.h"
 #include "comm_types.h"
 #include "comm.h"
+#include "mainloop.h"
 
 #include <sys/epoll.h>
 
 #define MAX_EVENTS	256	/* max events to process in one go */
 
-/* epoll structs */
-static int kdpfd;
-static struct epoll_event events[MAX_EVENTS];
-static int epoll_fds = 0;
+/*
+ * Each event loop has its own epoll set and lists; the per-fd state
+ * is shared and the fd is on the set of the loop owning it (fde.loop).
+ */
+typedef struct {
+    int kdpfd;
+    struct epoll_event events[MAX_EVENTS];
+    int epoll_fds;
+    int *updates;
+    int n_updates;
+    int *ready;
+    int n_ready;
+    int *run;
+} epoll_loop;
+
+static epoll_loop epoll_loops[IAPP_MAX_LOOPS];
 static unsigned *epoll_state;	/* keep track of the epoll state */
 
+/*
+ * Interest changes are only recorded by commSetEvents() and handed
+ * to the kernel in one pass right before epoll_wait(), so an fd whose
+ * interest flips back and forth within one loop costs no syscall.
+ */
+static unsigned *epoll_want;	/* state wanted at the next flush */
+static char *epoll_queued;	/* on the update (1) and/or ready (2) list */
+static unsigned char *epoll_queued_loop;	/* ... of this loop; other lists' entries are stale */
+
+/*
+ * Edge triggered mode: data connections are registered for both
+ * directions once and never modified.  As the kernel only reports new
+ * readiness, fds still flagged ready after their handler ran are
+ * kept on the ready list and served again on the next loop, until
+ * an I/O call comes back short or a handler makes no more progress.
+ */
+static int epoll_edge = 0;
+
+#define EPOLL_QUEUED_UPDATE	1
+#define EPOLL_QUEUED_READY	2
+
+#define COMM_SELECT_LOOPS	IAPP_MAX_LOOPS
 #include "comm_generic.c"
 
 static const char *
@@ -103,37 +138,192 @@ epolltype_atoi(int x)
     }
 }
 
+static int
+comm_epoll_loop_init(int loop)
+{
+    epoll_loop *el = &epoll_loops[loop];
+
+    el->kdpfd = epoll_create(Squid_MaxFD);
+    if (el->kdpfd < 0) {
+	debugs(5, 1, "comm_select_loop_init: epoll_create(): %s", xstrerror());
+	return 0;
+    }
+    fd_open(el->kdpfd, FD_UNKNOWN, "epoll ctl");
+    commSetCloseOnExec(el->kdpfd);
+    el->epoll_fds = 0;
+    el->updates = xcalloc(Squid_MaxFD, sizeof(*el->updates));
+    el->ready = xcalloc(Squid_MaxFD, sizeof(*el->ready));
+    el->run = xcalloc(Squid_MaxFD, sizeof(*el->run));
+    el->n_updates = 0;
+    el->n_ready = 0;
+    return 1;
+}
+
 static void
 do_select_init()
 {
-    kdpfd = epoll_create(Squid_MaxFD);
-    if (kdpfd < 0)
+    epoll_state = xcalloc(Squid_MaxFD, sizeof(*epoll_state));
+    epoll_want = xcalloc(Squid_MaxFD, sizeof(*epoll_want));
+    epoll_queued = xcalloc(Squid_MaxFD, sizeof(*epoll_queued));
+    epoll_queued_loop = xcalloc(Squid_MaxFD, sizeof(*epoll_queued_loop));
+    epoll_edge = iapp_epollEdgeTriggered;
+    if (!comm_epoll_loop_init(0))
 	err(1, "comm_select_init: epoll_create()");
-    fd_open(kdpfd, FD_UNKNOWN, "epoll ctl");
-    commSetCloseOnExec(kdpfd);
+}
 
-    epoll_state = xcalloc(Squid_MaxFD, sizeof(*epoll_state));
+/* Set up the epoll set of an additional event loop */
+int
+comm_select_loop_init(iapp_loop *loop)
+{
+    return comm_epoll_loop_init(loop->id);
 }
 
 void
 comm_select_postinit()
 {
-    debugs(5, 1, "Using epoll for the IO loop");
+    debugs(5, 1, "Using epoll for the IO loop%s", epoll_edge ? " (edge triggered)" : "");
 }
 
 static void
 do_select_shutdown()
 {
-    fd_close(kdpfd);
-    close(kdpfd);
-    kdpfd = -1;
+    int i;
+    for (i = 0; i < iapp_nloops; i++) {
+	epoll_loop *el = &epoll_loops[i];
+	fd_close(el->kdpfd);
+	close(el->kdpfd);
+	el->kdpfd = -1;
+	safe_free(el->updates);
+	safe_free(el->ready);
+	safe_free(el->run);
+    }
     safe_free(epoll_state);
+    safe_free(epoll_want);
+    safe_free(epoll_queued);
+    safe_free(epoll_queued_loop);
 }
 
 const char *
 comm_select_status(void)
 {
-    return("epoll");
+    static char buf[128];
+    snprintf(buf, sizeof(buf), "epoll%s, %d epoll_ctl calls",
+	epoll_edge ? " (edge triggered)" : "", CommStats.syscalls.pollctls);
+    return buf;
+}
+
+/* May the fd be edge triggered? Only if all its I/O is accounted by fd_bytes() */
+static inline int
+comm_epoll_edge(int fd)
+{
+    fde *F = &fd_table[fd];
+    if (!epoll_edge || !F->flags.edge)
+	return 0;
+#if USE_SSL
+    if (F->ssl)
+	return 0;		/* SSL buffers data the kernel can't tell us about */
+#endif
+    return 1;
+}
+
+static void
+comm_epoll_ctl(int fd, unsigned events)
+{
+    epoll_loop *el = &epoll_loops[fd_table[fd].loop];
+    int epoll_ctl_type;
+    struct epoll_event ev;
+
+    if (RUNNING_ON_VALGRIND) {
+	/* Keep valgrind happy.. complains about uninitialized bytes otherwise */
+	memset(&ev, 0, sizeof(ev));
+    }
+    ev.events = events;
+    ev.data.fd = fd;
+
+    /* If the struct is already in epoll MOD or DEL, else ADD */
+    if (!events) {
+	epoll_ctl_type = EPOLL_CTL_DEL;
+    } else if (epoll_state[fd]) {
+	epoll_ctl_type = EPOLL_CTL_MOD;
+    } else {
+	epoll_ctl_type = EPOLL_CTL_ADD;
+    }
+
+    /* Update the state */
+    epoll_state[fd] = events;
+
+    CommStats.syscalls.pollctls++;
+    if (epoll_ctl(el->kdpfd, epoll_ctl_type, fd, &ev) < 0) {
+	debugs(5, 1, "commSetEvents: epoll_ctl(%s): failed on fd=%d: %s",
+	    epolltype_atoi(epoll_ctl_type), fd, xstrerror());
+    }
+    switch (epoll_ctl_type) {
+    case EPOLL_CTL_ADD:
+	el->epoll_fds++;
+	break;
+    case EPOLL_CTL_DEL:
+	el->epoll_fds--;
+	break;
+    default:
+	break;
+    }
+}
+
+/* Drop the entries other loops took over from a full list */
+static int
+comm_epoll_compact(int *list, int n, int loop)
+{
+    int i, j;
+    for (i = j = 0; i < n; i++)
+	if (epoll_queued_loop[list[i]] == loop)
+	    list[j++] = list[i];
+    return j;
+}
+
+/*
+ * Put fd on the update or ready list of the loop owning it, and wake
+ * that loop if it's another one.  The flags only count for the loop
+ * in epoll_queued_loop; entries left on other lists are skipped.
+ */
+static void
+comm_epoll_queue(int fd, int which)
+{
+    int loop = fd_table[fd].loop;
+    epoll_loop *el = &epoll_loops[loop];
+    int **list = which == EPOLL_QUEUED_UPDATE ? &el->updates : &el->ready;
+    int *n = which == EPOLL_QUEUED_UPDATE ? &el->n_updates : &el->n_ready;
+
+    if (epoll_queued_loop[fd] != loop) {
+	epoll_queued_loop[fd] = loop;
+	epoll_queued[fd] = 0;
+    }
+    if (epoll_queued[fd] & which)
+	return;
+    epoll_queued[fd] |= which;
+    if (*n == Squid_MaxFD)
+	*n = comm_epoll_compact(*list, *n, loop);
+    (*list)[(*n)++] = fd;
+    if (loop != iapp_loop_current->id)
+	iapp_loop_wake(&iapp_loops[loop]);
+}
+
+/* Hand the interest changes of this loop to the kernel */
+static void
+comm_flush_updates(iapp_loop *loop)
+{
+    epoll_loop *el = &epoll_loops[loop->id];
+    int i;
+    int fd;
+    debugs(5, 8, "comm_flush_updates: %d fds queued", el->n_updates);
+    for (i = 0; i < el->n_updates; i++) {
+	fd = el->updates[i];
+	if (epoll_queued_loop[fd] != loop->id)
+	    continue;
+	epoll_queued[fd] &= ~EPOLL_QUEUED_UPDATE;
+	if (epoll_want[fd] != epoll_state[fd])
+	    comm_epoll_ctl(fd, epoll_want[fd]);
+    }
+    el->n_updates = 0;
 }
 
 void
@@ -144,94 +334,172 @@ commOpen(int fd)
 void
 commClose(int fd)
 {
-    commSetEvents(fd, 0, 0);
+    fde *F = &fd_table[fd];
+    /*
+     * The fd is about to be closed and may be reused right away, so
+     * drop it from the kernel now rather than at the next flush.  The
+     * list entries stay and are skipped as their state then matches.
+     */
+    epoll_want[fd] = 0;
+    if (epoll_state[fd])
+	comm_epoll_ctl(fd, 0);
+    F->flags.read_ready = 0;
+    F->flags.write_ready = 0;
+}
+
+/*
+ * Move fd to another event loop: take it off the epoll set of its
+ * current loop and let the new one register it at its next flush.
+ */
+void
+commSetLoop(int fd, int loop)
+{
+    fde *F = &fd_table[fd];
+    int ready;
+
+    assert(loop >= 0 && loop < IAPP_MAX_LOOPS);
+    if (F->loop == loop)
+	return;
+    ready = epoll_queued_loop[fd] == F->loop && (epoll_queued[fd] & EPOLL_QUEUED_READY);
+    if (epoll_state[fd])
+	comm_epoll_ctl(fd, 0);
+    F->loop = loop;
+    if (epoll_want[fd])
+	comm_epoll_queue(fd, EPOLL_QUEUED_UPDATE);
+    if (ready)
+	comm_epoll_queue(fd, EPOLL_QUEUED_READY);
 }
 
 void
 commSetEvents(int fd, int need_read, int need_write)
 {
-    int epoll_ctl_type = 0;
-    struct epoll_event ev;
+    fde *F = &fd_table[fd];
+    unsigned events = 0;
 
     assert(fd >= 0);
-    debugs(5, 8, "commSetEvents(fd=%d)", fd);
-
-    if (RUNNING_ON_VALGRIND) {
-	/* Keep valgrind happy.. complains about uninitialized bytes otherwise */
-	memset(&ev, 0, sizeof(ev));
-    }
-    ev.events = 0;
-    ev.data.fd = fd;
+    debugs(5, 8, "commSetEvents(fd=%d, read=%d, write=%d, ready=%d/%d)", fd, need_read, need_write,
+	F->flags.read_ready, F->flags.write_ready);
 
     if (need_read)
-	ev.events |= EPOLLIN;
+	events |= EPOLLIN;
 
     if (need_write)
-	ev.events |= EPOLLOUT;
-
-    if (ev.events)
-	ev.events |= EPOLLHUP | EPOLLERR;
-
-    if (ev.events != epoll_state[fd]) {
-	/* If the struct is already in epoll MOD or DEL, else ADD */
-	if (!ev.events) {
-	    epoll_ctl_type = EPOLL_CTL_DEL;
-	} else if (epoll_state[fd]) {
-	    epoll_ctl_type = EPOLL_CTL_MOD;
-	} else {
-	    epoll_ctl_type = EPOLL_CTL_ADD;
-	}
+	events |= EPOLLOUT;
+
+    if (events && comm_epoll_edge(fd)) {
+	/* Serve readiness the kernel told us about earlier but we didn't use up */
+	if ((need_read && F->flags.read_ready) || (need_write && F->flags.write_ready))
+	    comm_epoll_queue(fd, EPOLL_QUEUED_READY);
+	events = EPOLLIN | EPOLLOUT | EPOLLET;
+    } else if (!events && (epoll_state[fd] & EPOLLET)) {
+	return;			/* stays registered until closed */
+    }
 
-	/* Update the state */
-	epoll_state[fd] = ev.events;
+    if (events)
+	events |= EPOLLHUP | EPOLLERR;
 
-	if (epoll_ctl(kdpfd, epoll_ctl_type, fd, &ev) < 0) {
-	    debugs(5, 1, "commSetEvents: epoll_ctl(%s): failed on fd=%d: %s",
-		epolltype_atoi(epoll_ctl_type), fd, xstrerror());
-	}
-	switch (epoll_ctl_type) {
-	case EPOLL_CTL_ADD:
-	    epoll_fds++;
-	    break;
-	case EPOLL_CTL_DEL:
-	    epoll_fds--;
-	    break;
-	default:
-	    break;
-	}
+    if (events != epoll_want[fd]) {
+	epoll_want[fd] = events;
+	comm_epoll_queue(fd, EPOLL_QUEUED_UPDATE);
+    }
+}
+
+/*
+ * Call the handlers of fds left ready by the previous loop.  A handler
+ * that moved no data through the socket found it drained and waits
+ * for the next edge.  A deferred read isn't done and keeps its flag.
+ */
+static void
+comm_call_ready(iapp_loop *loop, int n)
+{
+    epoll_loop *el = &epoll_loops[loop->id];
+    int i;
+    for (i = 0; i < n; i++) {
+	int fd = el->run[i];
+	fde *F = &fd_table[fd];
+	squid_off_t bytes_read, bytes_written;
+	unsigned int read_calls, write_calls;
+	int do_read, do_write;
+	if (!F->flags.open || F->loop != loop->id || !comm_epoll_edge(fd))
+	    continue;
+	do_read = F->flags.read_ready && F->read_handler;
+	do_write = F->flags.write_ready && F->write_handler;
+	if (!do_read && !do_write)
+	    continue;
+	bytes_read = F->bytes_read;
+	bytes_written = F->bytes_written;
+	read_calls = comm_read_calls;
+	write_calls = comm_write_calls;
+	comm_call_handlers(fd, do_read, do_write);
+	if (read_calls != comm_read_calls && F->bytes_read == bytes_read)
+	    F->flags.read_ready = 0;
+	if (write_calls != comm_write_calls && F->bytes_written == bytes_written)
+	    F->flags.write_ready = 0;
     }
 }
 
 static int
-do_comm_select(int msec)
+do_comm_select(iapp_loop *loop, int msec)
 {
+    epoll_loop *el = &epoll_loops[loop->id];
+    struct epoll_event *events = el->events;
     int i;
     int num, saved_errno;
+    int n_run;
+    int rc = COMM_OK;
 
-    if (epoll_fds == 0) {
+    comm_flush_updates(loop);
+    if (el->epoll_fds == 0) {
 	assert(shutting_down);
 	return COMM_SHUTDOWN;
     }
+    /* take the ready list; handlers queue their fds again as needed */
+    for (i = n_run = 0; i < el->n_ready; i++) {
+	int fd = el->ready[i];
+	if (epoll_queued_loop[fd] != loop->id)
+	    continue;
+	epoll_queued[fd] &= ~EPOLL_QUEUED_READY;
+	el->run[n_run++] = fd;
+    }
+    el->n_ready = 0;
+    if (n_run)
+	msec = 0;
     CommStats.syscalls.polls++;
-    num = epoll_wait(kdpfd, events, MAX_EVENTS, msec);
+    /* other loops may run handlers while this one waits */
+    iapp_loop_release();
+    num = epoll_wait(el->kdpfd, events, MAX_EVENTS, msec);
     saved_errno = errno;
+    iapp_loop_acquire(loop);
     getCurrentTime();
     debugs(5, 5, "do_comm_select: %d fds ready", num);
     if (num < 0) {
-	if (ignoreErrno(saved_errno))
-	    return COMM_OK;
-
-	debugs(5, 1, "comm_select: epoll failure: %s", xstrerror());
-	return COMM_ERROR;
+	if (!ignoreErrno(saved_errno)) {
+	    debugs(5, 1, "comm_select: epoll failure: %s", xstrerror());
+	    rc = COMM_ERROR;
+	}
+	/* the ready list was taken, serve it anyway */
+	comm_call_ready(loop, n_run);
+	return rc;
     }
     statHistCount(&select_fds_hist, num);
 
-    if (num == 0)
+    if (num == 0 && n_run == 0)
 	return COMM_TIMEOUT;
 
     for (i = 0; i < num; i++) {
-	comm_call_handlers(events[i].data.fd, events[i].events & ~EPOLLOUT, events[i].events & ~EPOLLIN);
+	int fd = events[i].data.fd;
+	if (fd_table[fd].loop != loop->id)
+	    continue;		/* moved or reused while this loop waited */
+	if (epoll_state[fd] & EPOLLET) {
+	    fde *F = &fd_table[fd];
+	    if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		F->flags.read_ready = 1;
+	    if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+		F->flags.write_ready = 1;
+	}
+	comm_call_handlers(fd, events[i].events & ~EPOLLOUT, events[i].events & ~EPOLLIN);
     }
+    comm_call_ready(loop, n_run);
 
-    return COMM_OK;
+    return rc;
 }
@@ -37,11 +37,29 @@
  * the comm loops using it
  */
 
+#include "mainloop.h"
+
+/*
+ * Backends able to run several event loops define COMM_SELECT_LOOPS
+ * and do_comm_select(loop, msec), plus comm_select_loop_init() and
+ * commSetLoop().  The others only ever run loop 0.
+ */
+#ifndef COMM_SELECT_LOOPS
+#define COMM_SELECT_LOOPS	1
+#define DO_COMM_SELECT(loop, msec)	do_comm_select(msec)
+#else
+#define DO_COMM_SELECT(loop, msec)	do_comm_select(loop, msec)
+#endif
+
 static int MAX_POLL_TIME = 1000;	/* see also comm_quick_poll_required() */
 
 #if DELAY_POOLS
 static int *slow_fds = NULL;
 static int n_slow_fds = 0;
+/* backed off fds, so delay pools can recheck them without a full scan */
+static int *deferred_fds = NULL;
+static int n_deferred_fds = 0;
+static void commAddDeferred(int fd);
 #endif
 
 static void do_select_init(void);
@@ -51,6 +69,7 @@ comm_select_init(void)
 {
 #if DELAY_POOLS
     slow_fds = xmalloc(sizeof(int) * Squid_MaxFD);
+    deferred_fds = xmalloc(sizeof(int) * Squid_MaxFD);
 #endif
     do_select_init();
 }
@@ -63,6 +82,7 @@ comm_select_shutdown(void)
     do_select_shutdown();
 #if DELAY_POOLS
     safe_free(slow_fds);
+    safe_free(deferred_fds);
 #endif
 }
 
@@ -79,6 +99,9 @@ commDeferFD(int fd)
 	return;
 
     F->flags.backoff = 1;
+#if DELAY_POOLS
+    commAddDeferred(fd);
+#endif
     commUpdateEvents(fd);
 }
 
@@ -90,6 +113,10 @@ commResumeFD(int fd)
 
     assert(fd >= 0);
 
+#if DELAY_POOLS
+    if (F->defer_id)
+	commRemoveDeferred(fd);
+#endif
     if (!F->flags.open) {
 	debugs(5, 1, "commResumeFD: fd %d is closed. Ignoring", fd);
 	F->flags.backoff = 0;
@@ -139,11 +166,67 @@ commRemoveSlow(int fd)
     }
     F->slow_id = 0;
 }
+
+static void
+commAddDeferred(int fd)
+{
+    fde *F = &fd_table[fd];
+    if (F->defer_id)
+	return;
+    F->defer_id = ++n_deferred_fds;
+    assert(n_deferred_fds < Squid_MaxFD);
+    deferred_fds[n_deferred_fds] = fd;
+}
+
+void
+commRemoveDeferred(int fd)
+{
+    int fd2;
+    fde *F = &fd_table[fd];
+    if (!F->defer_id)
+	return;
+    fd2 = deferred_fds[n_deferred_fds--];
+    if (F->defer_id <= n_deferred_fds) {
+	deferred_fds[F->defer_id] = fd2;
+	fd_table[fd2].defer_id = F->defer_id;
+    }
+    F->defer_id = 0;
+}
+
+/*
+ * Re-run the defer check of all backed off fds.  Called by the delay
+ * pools when a bucket has refilled, so deferred readers need not wait
+ * for the once a second sweep in checkTimeouts().
+ */
+void
+commRecheckDeferred(void)
+{
+    int i;
+    int fd;
+    /* walk backwards; commResumeFD() moves the last entry into the hole */
+    for (i = n_deferred_fds; i > 0; i--) {
+	if (i > n_deferred_fds)
+	    continue;
+	fd = deferred_fds[i];
+	switch (commDeferRead(fd)) {
+	case 0:
+	    commResumeFD(fd);
+	    break;
+	case -1:
+	    commAddSlow(fd);
+	    break;
+	}
+    }
+}
 #endif
 
 static int comm_select_handled;
 
+#if COMM_SELECT_LOOPS > 1
+static inline int do_comm_select(iapp_loop *loop, int msec);
+#else
 static inline int do_comm_select(int msec);
+#endif
 
 static inline void comm_call_handlers(int fd, int read_event, int write_event);
 
@@ -202,8 +285,10 @@ comm_call_slowfds(void)
 	    hdl(fd, hdl_data);
 	    /* backoff check is for delayed connections kicked alive from checkTimeouts */
 	    if (F->flags.open && (!F->read_handler || F->flags.backoff)) {
-		if (F->flags.backoff && commDeferRead(fd) != 1)
+		if (F->flags.backoff && commDeferRead(fd) != 1) {
 		    F->flags.backoff = 0;
+		    commRemoveDeferred(fd);
+		}
 		commUpdateEvents(fd);
 	    }
 #endif
@@ -214,11 +299,20 @@ comm_call_slowfds(void)
 }
 #endif
 
+/* when the first handler of this loop ran, 0 if none did yet */
+static double comm_dispatch_start = 0.0;
+
+/* handlers called so far, to tell a deferred read from one that was done */
+static unsigned int comm_read_calls = 0;
+static unsigned int comm_write_calls = 0;
+
 static inline void
 comm_call_handlers(int fd, int read_event, int write_event)
 {
     fde *F = &fd_table[fd];
     const int do_incoming = read_event == 1 || write_event == 1;
+    if (comm_dispatch_start == 0.0)
+	comm_dispatch_start = current_dtime;
     debugs(5, 8, "comm_call_handlers(): got fd=%d read_event=%x write_event=%x F->read_handler=%p F->write_handler=%p"
 	,fd, read_event, write_event, F->read_handler, F->write_handler);
     if (F->read_handler) {
@@ -253,6 +347,7 @@ comm_call_handlers(int fd, int read_event, int write_event)
 		break;
 	    case 0:
 		debugs(5, 8, "comm_call_handlers(): Calling read handler on fd=%d", fd);
+		comm_read_calls++;
 #if SIMPLE_COMM_HANDLER
 		commUpdateReadHandler(fd, NULL, NULL);
 		hdl(fd, hdl_data);
@@ -289,6 +384,7 @@ comm_call_handlers(int fd, int read_event, int write_event)
 	if (do_write) {
 	    PF *hdl = F->write_handler;
 	    void *hdl_data = F->write_data;
+	    comm_write_calls++;
 #if SIMPLE_COMM_HANDLER
 	    commUpdateWriteHandler(fd, NULL, NULL);
 	    hdl(fd, hdl_data);
@@ -309,7 +405,7 @@ comm_call_handlers(int fd, int read_event, int write_event)
 }
 
 static void
-checkTimeouts(void)
+checkTimeouts(iapp_loop *loop)
 {
     int fd;
     fde *F = NULL;
@@ -318,6 +414,8 @@ checkTimeouts(void)
 	F = &fd_table[fd];
 	if (!F->flags.open)
 	    continue;
+	if (F->loop != loop->id)
+	    continue;
 	if (F->flags.backoff) {
 	    switch (commDeferRead(fd)) {
 	    case 0:
@@ -351,9 +449,8 @@ checkTimeouts(void)
 
 
 int
-comm_select(int msec)
+comm_select(iapp_loop *loop, int msec)
 {
-    static double last_timeout = 0.0;
     int rc;
     double start = current_dtime;
 
@@ -371,23 +468,33 @@ comm_select(int msec)
     CommStats.select_loops++;
 
     /* Check timeouts once per second */
-    if (last_timeout + 0.999 < current_dtime) {
-	last_timeout = current_dtime;
-	checkTimeouts();
+    if (loop->last_timeout + 0.999 < current_dtime) {
+	loop->last_timeout = current_dtime;
+	checkTimeouts(loop);
     } else {
-	int max_timeout = (last_timeout + 1.0 - current_dtime) * 1000;
+	int max_timeout = (loop->last_timeout + 1.0 - current_dtime) * 1000;
 	if (max_timeout < msec)
 	    msec = max_timeout;
     }
     comm_select_handled = 0;
+    comm_dispatch_start = 0.0;
 
-    rc = do_comm_select(msec);
+    rc = DO_COMM_SELECT(loop, msec);
 
 #if DELAY_POOLS
     comm_call_slowfds();
 #endif
     getCurrentTime();
     CommStats.select_time += (current_dtime - start);
+    /*
+     * Track how long the handlers of a loop take; a new connection
+     * waits about that long before it is accepted.  Idle loops pull
+     * the average down quickly once the load is gone.
+     */
+    if (comm_dispatch_start > 0.0)
+	CommStats.loop_lag += (current_dtime - comm_dispatch_start - CommStats.loop_lag) / 8;
+    else if (rc == COMM_TIMEOUT)
+	CommStats.loop_lag /= 2;
 
     if (rc == COMM_TIMEOUT)
 	debugs(5, 8, "comm_select: time out");
@@ -395,6 +502,27 @@ comm_select(int msec)
     return rc;
 }
 
+/* How many event loops this backend can run */
+int
+comm_select_loops(void)
+{
+    return COMM_SELECT_LOOPS;
+}
+
+#if COMM_SELECT_LOOPS == 1
+int
+comm_select_loop_init(iapp_loop *loop)
+{
+    return 0;
+}
+
+void
+commSetLoop(int fd, int loop)
+{
+    assert(loop == 0);
+}
+#endif
+
 /* Called by async-io or diskd to speed up the polling */
 void
 comm_quick_poll_required(void)
@@ -32,7 +32,8 @@ typedef enum {
         COMM_REUSEADDR = 4,
         COMM_DOBIND = 8,
         COMM_TPROXY_LCL = 16,
-        COMM_TPROXY_REM = 32
+        COMM_TPROXY_REM = 32,
+        COMM_REUSEPORT = 64
 } comm_flags_t;
 
 
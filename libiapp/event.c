@@ -60,9 +60,14 @@
 #include "../libcb/cbdata.h"
 
 #include "event.h"
+#include "mainloop.h"
 
-
-struct ev_entry *tasks = NULL;
+/*
+ * Each iapp_loop keeps its own list of timed events.  Events are added
+ * to the loop running the caller; deleting or finding one looks at
+ * all loops, as the caller may run on a different loop than the one
+ * that added it.
+ */
 static int run_id = 0;
 const char *last_event_ran = NULL;
 static MemPool * pool_event = NULL;
@@ -85,7 +90,7 @@ eventAdd(const char *name, EVH * func, void *arg, double when, int weight)
 	cbdataLock(arg);
     debugs(41, 7, "eventAdd: Adding '%s', in %f seconds", name, when);
     /* Insert after the last event with the same or earlier time */
-    for (E = &tasks; *E; E = &(*E)->next) {
+    for (E = &iapp_loop_current->tasks; *E; E = &(*E)->next) {
 	if ((*E)->when > event->when)
 	    break;
     }
@@ -113,16 +118,19 @@ eventDeleteNoAssert(EVH * func, void *arg)
 {
     struct ev_entry **E;
     struct ev_entry *event;
-    for (E = &tasks; (event = *E) != NULL; E = &(*E)->next) {
-	if (event->func != func)
-	    continue;
-	if (arg && event->arg != arg)
-	    continue;
-	*E = event->next;
-	if (NULL != event->arg)
-	    cbdataUnlock(event->arg);
-	memPoolFree(pool_event, event);
-	return;
+    int i;
+    for (i = 0; i < iapp_nloops; i++) {
+	for (E = &iapp_loops[i].tasks; (event = *E) != NULL; E = &(*E)->next) {
+	    if (event->func != func)
+		continue;
+	    if (arg && event->arg != arg)
+		continue;
+	    *E = event->next;
+	    if (NULL != event->arg)
+		cbdataUnlock(event->arg);
+	    memPoolFree(pool_event, event);
+	    return;
+	}
     }
 }
 
@@ -131,16 +139,19 @@ eventDelete(EVH * func, void *arg)
 {
     struct ev_entry **E;
     struct ev_entry *event;
-    for (E = &tasks; (event = *E) != NULL; E = &(*E)->next) {
-	if (event->func != func)
-	    continue;
-	if (arg && event->arg != arg)
-	    continue;
-	*E = event->next;
-	if (NULL != event->arg)
-	    cbdataUnlock(event->arg);
-	memPoolFree(pool_event, event);
-	return;
+    int i;
+    for (i = 0; i < iapp_nloops; i++) {
+	for (E = &iapp_loops[i].tasks; (event = *E) != NULL; E = &(*E)->next) {
+	    if (event->func != func)
+		continue;
+	    if (arg && event->arg != arg)
+		continue;
+	    *E = event->next;
+	    if (NULL != event->arg)
+		cbdataUnlock(event->arg);
+	    memPoolFree(pool_event, event);
+	    return;
+	}
     }
     /* We shouldn't get here if the event had an argument! */
     assert(arg == NULL);
@@ -152,7 +163,9 @@ eventConditionDelete(int fd, EVH * func, EVCDT* condition)
     struct ev_entry **E;
     struct ev_entry *event;
 	int count = 0;
-    for (E = &tasks; (event = *E) != NULL; ++count) 
+	int i;
+    for (i = 0; i < iapp_nloops; i++)
+    for (E = &iapp_loops[i].tasks; (event = *E) != NULL; ++count) 
 	{
 		if (event->func != func)
 			{
@@ -185,7 +198,9 @@ eventTravel(int fd, EVH * func, EVCDT* travel)
     struct ev_entry **E;
     struct ev_entry *event;
 	int count = 0;
-    for (E = &tasks; (event = *E) != NULL; ++count) 
+	int i;
+    for (i = 0; i < iapp_nloops; i++)
+    for (E = &iapp_loops[i].tasks; (event = *E) != NULL; ++count) 
 	{
 		if (event->func != func)
 		{
@@ -200,19 +215,20 @@ eventTravel(int fd, EVH * func, EVCDT* travel)
 }
 
 void
-eventRun(void)
+eventRun(iapp_loop * loop)
 {
+    struct ev_entry **tasks = &loop->tasks;
     struct ev_entry *event = NULL;
     EVH *func;
     void *arg;
     int weight = 0;
-    if (NULL == tasks)
+    if (NULL == *tasks)
 	return;
-    if (tasks->when > current_dtime)
+    if ((*tasks)->when > current_dtime)
 	return;
     run_id++;
     debugs(41, 5, "eventRun: RUN ID %d", run_id);
-    while ((event = tasks)) {
+    while ((event = *tasks)) {
 	int valid = 1;
 	if (event->when > current_dtime)
 	    break;
@@ -224,7 +240,7 @@ eventRun(void)
 	arg = event->arg;
 	event->func = NULL;
 	event->arg = NULL;
-	tasks = event->next;
+	*tasks = event->next;
 	if (NULL != arg) {
 	    valid = cbdataValid(arg);
 	    cbdataUnlock(arg);
@@ -244,29 +260,33 @@ eventRun(void)
 void
 eventCleanup(void)
 {
-    struct ev_entry **p = &tasks;
+    struct ev_entry **p;
+    int i;
 
     debugs(41, 2, "eventCleanup");
 
-    while (*p) {
-	struct ev_entry *event = *p;
-	if (!cbdataValid(event->arg)) {
-	    debugs(41, 2, "eventCleanup: cleaning '%s'", event->name);
-	    *p = event->next;
-	    cbdataUnlock(event->arg);
-	    memPoolFree(pool_event, event);
-	} else {
-	    p = &event->next;
+    for (i = 0; i < iapp_nloops; i++) {
+	p = &iapp_loops[i].tasks;
+	while (*p) {
+	    struct ev_entry *event = *p;
+	    if (!cbdataValid(event->arg)) {
+		debugs(41, 2, "eventCleanup: cleaning '%s'", event->name);
+		*p = event->next;
+		cbdataUnlock(event->arg);
+		memPoolFree(pool_event, event);
+	    } else {
+		p = &event->next;
+	    }
 	}
     }
 }
 
 int
-eventNextTime(void)
+eventNextTime(iapp_loop * loop)
 {
-    if (!tasks)
+    if (!loop->tasks)
 	return 10000;
-    return ceil((tasks->when - current_dtime) * 1000);
+    return ceil((loop->tasks->when - current_dtime) * 1000);
 }
 
 void
@@ -279,22 +299,27 @@ void
 eventFreeMemory(void)
 {
     struct ev_entry *event;
-    while ((event = tasks)) {
-	tasks = event->next;
-	if (NULL != event->arg)
-	    cbdataUnlock(event->arg);
-	memPoolFree(pool_event, event);
+    int i;
+    for (i = 0; i < iapp_nloops; i++) {
+	while ((event = iapp_loops[i].tasks)) {
+	    iapp_loops[i].tasks = event->next;
+	    if (NULL != event->arg)
+		cbdataUnlock(event->arg);
+	    memPoolFree(pool_event, event);
+	}
     }
-    tasks = NULL;
 }
 
 int
 eventFind(EVH * func, void *arg)
 {
     struct ev_entry *event;
-    for (event = tasks; event != NULL; event = event->next) {
-	if (event->func == func && event->arg == arg)
-	    return 1;
+    int i;
+    for (i = 0; i < iapp_nloops; i++) {
+	for (event = iapp_loops[i].tasks; event != NULL; event = event->next) {
+	    if (event->func == func && event->arg == arg)
+		return 1;
+	}
     }
     return 0;
 }
@@ -16,13 +16,14 @@ struct ev_entry {
     int id;
 };
 
-extern struct ev_entry *tasks;
+struct _iapp_loop;
+
 extern const char * last_event_ran;
 
 extern void eventAdd(const char *name, EVH * func, void *arg, double when, int);
 extern void eventAddIsh(const char *name, EVH * func, void *arg, double delta_ish, int);
-extern void eventRun(void);
-extern int eventNextTime(void);
+extern void eventRun(struct _iapp_loop *);
+extern int eventNextTime(struct _iapp_loop *);
 extern void eventDelete(EVH * func, void *arg);
 void eventDeleteNoAssert(EVH * func, void *arg);
 void eventTravel(int fd, EVH * func, EVCDT* travel);
@@ -43,6 +43,9 @@
 #if HAVE_SYS_SOCKET_H
 #include <sys/socket.h>
 #endif
+#ifndef _SQUID_MSWIN_
+#include <sys/uio.h>
+#endif
 #if HAVE_NETINET_IN_H
 #include <netinet/in.h>
 #endif
@@ -69,6 +72,7 @@
 #include "fd_types.h"
 #include "comm_types.h"
 #include "comm.h"
+#include "mainloop.h"
 
 fde *fd_table = NULL;
 int Biggest_FD = -1;
@@ -143,6 +147,8 @@ fd_close(int fd)
 #if DELAY_POOLS
     if (F->slow_id)
 	commRemoveSlow(fd);
+    if (F->defer_id)
+	commRemoveDeferred(fd);
 #endif
     fdUpdateBiggest(fd, 0);
     Number_FD--;
@@ -190,16 +196,63 @@ msghdr_write_method(int fd, const char *buf, int len)
     return i > 0 ? len : i; // len is imprecise but the caller expects a match
 }
 
+/* A short read or write means the socket is drained or full for now */
 int
 default_read_method(int fd, char *buf, int len)
 {
-    return (read(fd, buf, len));
+    const int n = read(fd, buf, len);
+    if (n < len)
+	fd_table[fd].flags.read_ready = 0;
+    return n;
 }
 
 int
 default_write_method(int fd, const char *buf, int len)
 {
-    return (write(fd, buf, len));
+    const int n = write(fd, buf, len);
+    if (n < len)
+	fd_table[fd].flags.write_ready = 0;
+    return n;
+}
+
+/*
+ * Scatter read for callers with several buffers to fill.  Sockets
+ * with their own read method (SSL, Windows) only get the first
+ * buffer filled.
+ */
+int
+fd_readv(int fd, struct iovec *iov, int iovcnt)
+{
+    int n, len = 0, i;
+#ifndef _SQUID_MSWIN_
+    if (fd_table[fd].read_method == &default_read_method && iovcnt > 1) {
+	for (i = 0; i < iovcnt; i++)
+	    len += iov[i].iov_len;
+	n = readv(fd, iov, iovcnt);
+	if (n < len)
+	    fd_table[fd].flags.read_ready = 0;
+	return n;
+    }
+#endif
+    return FD_READ_METHOD(fd, iov[0].iov_base, iov[0].iov_len);
+}
+
+/* Gather write, the counterpart of fd_readv() */
+int
+fd_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    int n, len = 0, i;
+#ifndef _SQUID_MSWIN_
+    if (fd_table[fd].write_method == &default_write_method && iovcnt > 1) {
+	for (i = 0; i < iovcnt; i++)
+	    len += iov[i].iov_len;
+	n = writev(fd, iov, iovcnt);
+	if (n < len)
+	    fd_table[fd].flags.write_ready = 0;
+	return n;
+    }
+#endif
+    return FD_WRITE_METHOD(fd, iov[0].iov_base, iov[0].iov_len);
 }
 
 void
@@ -216,6 +269,7 @@ fd_open(int fd, unsigned int type, const char *desc)
     debugs(51, 3, "fd_open FD %d %s", fd, desc);
     F->type = type;
     F->flags.open = 1;
+    F->loop = iapp_loop_current->id;
     commOpen(fd);
 #ifdef _SQUID_MSWIN_
     F->win32.handle = _get_osfhandle(fd);
@@ -8,6 +8,7 @@ int reconfiguring = 0;
 int opt_reuseaddr = 1;
 int iapp_tcpRcvBufSz = 0;
 int iapp_incomingRate;
+int iapp_epollEdgeTriggered = 0;
 const char * iapp_useAcceptFilter = NULL;
 int NHttpSockets = 0;
 int HttpSockets[MAXHTTPPORTS];
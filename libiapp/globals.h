@@ -13,6 +13,7 @@ extern int HttpSockets[MAXHTTPPORTS];
 extern int theInIcpConnection;  /* -1 */
 extern int theOutIcpConnection; /* -1 */
 extern int iapp_incomingRate;
+extern int iapp_epollEdgeTriggered;
 extern StatHist select_fds_hist;
 extern int need_linux_tproxy;   /* 0 */
 
@@ -11,6 +11,9 @@
 #include <netinet/in.h>
 #endif
 #include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 
 /*
  * The bulk of the following are because the disk code requires
@@ -22,6 +25,8 @@
 #include "../libcore/gb.h"
 #include "../libcore/kb.h"
 #include "../libcore/varargs.h"
+#include "../libcore/debug.h"
+#include "../libcore/tools.h"
 #include "../libmem/MemPool.h"
 #include "../libmem/MemBufs.h"
 #include "../libmem/MemBuf.h"
@@ -59,16 +64,260 @@ iapp_init(void)
 	comm_select_init();
 }
 
+/*
+ * The event loops.  All loops share iapp_loop_mutex and hold it
+ * except while waiting for I/O in comm_select(), so application
+ * handlers still run one at a time.  With a single loop the mutex is
+ * never touched.
+ */
+iapp_loop iapp_loops[IAPP_MAX_LOOPS] = {
+	{0, 0, NULL, 0.0, PTHREAD_MUTEX_INITIALIZER, NULL, &iapp_loops[0].msg_head, -1, -1, 0}
+};
+int iapp_nloops = 1;
+iapp_loop *iapp_loop_current = &iapp_loops[0];
+static pthread_mutex_t iapp_loop_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int iapp_loop_rr = 0;
+
+void
+iapp_loop_release(void)
+{
+	if (iapp_nloops > 1)
+		pthread_mutex_unlock(&iapp_loop_mutex);
+}
+
+void
+iapp_loop_acquire(iapp_loop *loop)
+{
+	if (iapp_nloops > 1)
+		pthread_mutex_lock(&iapp_loop_mutex);
+	iapp_loop_current = loop;
+}
+
+/*
+ * Messages posted to a loop from other threads or loops.
+ *
+ * Any thread may queue a message; the loop runs the handlers in the
+ * order they were posted, from the normal comm dispatch.  Messages
+ * are embedded in the caller's own structures so posting never
+ * allocates.  The wakeup pipe is only written when the queue goes
+ * from empty to non-empty, so a burst of posts costs one wakeup.
+ */
+static void
+iapp_msg_handler(int fd, void *data)
+{
+	iapp_loop *loop = data;
+	char junk[256];
+	iapp_msg *list, *m;
+
+	FD_READ_METHOD(fd, junk, sizeof(junk));
+	commSetSelect(fd, COMM_SELECT_READ, iapp_msg_handler, loop, 0);
+	CommStats.msg_wakeups++;
+
+	pthread_mutex_lock(&loop->msg_mutex);
+	list = loop->msg_head;
+	loop->msg_head = NULL;
+	loop->msg_tail = &loop->msg_head;
+	loop->msg_wake = 0;
+	pthread_mutex_unlock(&loop->msg_mutex);
+
+	while ((m = list) != NULL) {
+		/* the handler may free the structure holding m */
+		list = m->next;
+		m->next = NULL;
+		CommStats.msgs++;
+		m->handler(m->data);
+	}
+}
+
+static int
+iapp_loop_msg_init(iapp_loop *loop)
+{
+	int p[2];
+
+	if (loop->msg_fd_read >= 0)
+		return 1;
+	if (pipe(p) < 0) {
+		debugs(5, 1, "iapp_msg_init: pipe: %s", xstrerror());
+		return 0;
+	}
+	loop->msg_fd_read = p[0];
+	loop->msg_fd = p[1];
+	fd_open(loop->msg_fd_read, FD_PIPE, "loop message queue: read");
+	fd_open(loop->msg_fd, FD_PIPE, "loop message queue: write");
+	commSetNonBlocking(loop->msg_fd_read);
+	commSetNonBlocking(loop->msg_fd);
+	commSetCloseOnExec(loop->msg_fd_read);
+	commSetCloseOnExec(loop->msg_fd);
+	commSetLoop(loop->msg_fd_read, loop->id);
+	commSetSelect(loop->msg_fd_read, COMM_SELECT_READ, iapp_msg_handler, loop, 0);
+	return 1;
+}
+
+/*
+ * Set up the message queue of loop 0.  Must be called from the main
+ * thread, after any fork, before the first iapp_msg_post().  Returns
+ * 0 if the wakeup pipe can't be created.
+ */
 int
-iapp_runonce(int msec)
+iapp_msg_init(void)
+{
+	return iapp_loop_msg_init(&iapp_loops[0]);
+}
+
+/*
+ * Queue handler(data) to run on the given loop.  Safe to call from
+ * any thread; m must stay valid until the handler has been called.
+ */
+void
+iapp_loop_post(iapp_loop *loop, iapp_msg *m, IAPPMSG *handler, void *data)
+{
+	int wake;
+
+	assert(loop->msg_fd >= 0);
+	m->handler = handler;
+	m->data = data;
+	m->next = NULL;
+
+	pthread_mutex_lock(&loop->msg_mutex);
+	wake = !loop->msg_wake;
+	loop->msg_wake = 1;
+	*loop->msg_tail = m;
+	loop->msg_tail = &m->next;
+	pthread_mutex_unlock(&loop->msg_mutex);
+
+	/*
+	 * Plain write(): fd_table belongs to the loop thread.  A full
+	 * pipe already guarantees a wakeup, so EAGAIN is fine.
+	 */
+	if (wake)
+		while (write(loop->msg_fd, "!", 1) < 0 && errno == EINTR);
+}
+
+/* Queue handler(data) to run on loop 0 */
+void
+iapp_msg_post(iapp_msg *m, IAPPMSG *handler, void *data)
+{
+	iapp_loop_post(&iapp_loops[0], m, handler, data);
+}
+
+/*
+ * Interrupt the I/O wait of a loop, e.g. after another loop changed
+ * the events one of its fds waits for.
+ */
+void
+iapp_loop_wake(iapp_loop *loop)
+{
+	int wake;
+
+	if (loop == iapp_loop_current || loop->msg_fd < 0)
+		return;
+	pthread_mutex_lock(&loop->msg_mutex);
+	wake = !loop->msg_wake;
+	loop->msg_wake = 1;
+	pthread_mutex_unlock(&loop->msg_mutex);
+	if (wake)
+		while (write(loop->msg_fd, "!", 1) < 0 && errno == EINTR);
+}
+
+/*
+ * Move fd to another loop and run handler(data) there.  The fd must
+ * not have handlers set; the handler sets them up on its new loop.
+ */
+void
+iapp_loop_handoff(int fd, iapp_loop *loop, iapp_msg *m, IAPPMSG *handler, void *data)
+{
+	commSetLoop(fd, loop->id);
+	if (loop == iapp_loop_current)
+		handler(data);
+	else
+		iapp_loop_post(loop, m, handler, data);
+}
+
+/* Pick the loop for the next connection, round robin */
+iapp_loop *
+iapp_loop_next(void)
+{
+	if (iapp_nloops == 1)
+		return &iapp_loops[0];
+	iapp_loop_rr = (iapp_loop_rr + 1) % iapp_nloops;
+	return &iapp_loops[iapp_loop_rr];
+}
+
+static int
+iapp_loop_runonce(iapp_loop *loop, int msec)
 {
 	int loop_delay;
 
-	eventRun();
-	loop_delay = eventNextTime();
+	eventRun(loop);
+	loop_delay = eventNextTime(loop);
 	if (loop_delay < 0)
 		loop_delay = 0;
 	if (loop_delay > msec)
 		loop_delay = msec;
-	return comm_select(loop_delay);
+	return comm_select(loop, loop_delay);
+}
+
+static void *
+iapp_loop_main(void *data)
+{
+	iapp_loop *loop = data;
+
+	iapp_loop_acquire(loop);
+	for (;;)
+		iapp_loop_runonce(loop, 1000);
+	/* NOTREACHED */
+	return NULL;
+}
+
+/*
+ * Start loops 1 .. n-1, each in its own thread.  Called once from the
+ * main thread after the application is set up; signals stay with the
+ * main thread.  Returns the number of loops running.
+ */
+int
+iapp_loops_start(int n)
+{
+	sigset_t all, old;
+	iapp_loop *loop;
+	int i;
+
+	if (n > IAPP_MAX_LOOPS)
+		n = IAPP_MAX_LOOPS;
+	if (n > comm_select_loops()) {
+		debugs(5, 1, "WARNING: the %s IO loop can't run %d loops, using %d", comm_select_status(), n, comm_select_loops());
+		n = comm_select_loops();
+	}
+	if (n <= iapp_nloops)
+		return iapp_nloops;
+	if (!iapp_msg_init())
+		return iapp_nloops;
+	for (i = iapp_nloops; i < n; i++) {
+		loop = &iapp_loops[i];
+		memset(loop, '\0', sizeof(*loop));
+		loop->id = i;
+		pthread_mutex_init(&loop->msg_mutex, NULL);
+		loop->msg_tail = &loop->msg_head;
+		loop->msg_fd = loop->msg_fd_read = -1;
+		if (!comm_select_loop_init(loop) || !iapp_loop_msg_init(loop))
+			break;
+	}
+	n = i;
+	/* from here on the main thread only runs handlers with the lock held */
+	pthread_mutex_lock(&iapp_loop_mutex);
+	iapp_nloops = n;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (i = 1; i < n; i++) {
+		if (pthread_create(&iapp_loops[i].thread, NULL, iapp_loop_main, &iapp_loops[i]) != 0)
+			libcore_fatalf("iapp_loops_start: pthread_create: %s\n", xstrerror());
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	debugs(5, 1, "Running %d event loops", n);
+	return n;
+}
+
+int
+iapp_runonce(int msec)
+{
+	return iapp_loop_runonce(&iapp_loops[0], msec);
 }
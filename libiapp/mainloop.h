@@ -1,7 +1,57 @@
 #ifndef	__LIBIAPP_MAINLOOP_H__
 #define	__LIBIAPP_MAINLOOP_H__
 
+#include <pthread.h>
+
+typedef void IAPPMSG(void *data);
+
+typedef struct _iapp_msg iapp_msg;
+struct _iapp_msg {
+	IAPPMSG *handler;
+	void *data;
+	iapp_msg *next;
+};
+
+#define IAPP_MAX_LOOPS	16
+
+/*
+ * One event loop.  Loop 0 is run by the main thread through
+ * iapp_runonce(); iapp_loops_start() adds more, each in its own
+ * thread.  A loop owns the fds whose fde.loop is its id, its own
+ * timed events and its own message queue.
+ *
+ * The loops share one lock, dropped only while a loop waits for I/O,
+ * so handlers never run concurrently and may use the application's
+ * globals as before.  iapp_loop_current is the loop holding it.
+ */
+typedef struct _iapp_loop iapp_loop;
+struct _iapp_loop {
+	int id;
+	pthread_t thread;
+	struct ev_entry *tasks;		/* see event.c */
+	double last_timeout;		/* last checkTimeouts() run */
+	pthread_mutex_t msg_mutex;
+	iapp_msg *msg_head;
+	iapp_msg **msg_tail;
+	int msg_fd;
+	int msg_fd_read;
+	int msg_wake;			/* a wakeup byte is in the pipe */
+};
+
+extern iapp_loop iapp_loops[IAPP_MAX_LOOPS];
+extern int iapp_nloops;
+extern iapp_loop *iapp_loop_current;
+
 extern void iapp_init(void);
+extern int iapp_msg_init(void);
+extern void iapp_msg_post(iapp_msg *m, IAPPMSG *handler, void *data);
+extern void iapp_loop_post(iapp_loop *loop, iapp_msg *m, IAPPMSG *handler, void *data);
+extern void iapp_loop_wake(iapp_loop *loop);
+extern void iapp_loop_handoff(int fd, iapp_loop *loop, iapp_msg *m, IAPPMSG *handler, void *data);
+extern iapp_loop *iapp_loop_next(void);
+extern int iapp_loops_start(int n);
+extern void iapp_loop_release(void);
+extern void iapp_loop_acquire(iapp_loop *loop);
 extern int iapp_runonce(int msec);
 
 #endif
@@ -294,6 +294,11 @@ static struct ssl_option {
     {
 	"NO_TLSv1", SSL_OP_NO_TLSv1
     },
+#endif
+#ifdef SSL_OP_ENABLE_KTLS
+    {
+	"ENABLE_KTLS", SSL_OP_ENABLE_KTLS
+    },
 #endif
     {
 	"", 0
@@ -883,6 +888,40 @@ ssl_shutdown_method(int fd)
     return ret;
 }
 
+/*
+ * Called once a handshake has completed.  With options=ENABLE_KTLS
+ * (OpenSSL 3 on Linux) OpenSSL may have handed the record layer to the
+ * kernel.  When it did for transmit, the socket takes plain data so
+ * writes skip SSL_write(), and write(), sendfile() and splice() can be
+ * used on it.  Reads keep going through SSL_read() which also deals
+ * with records that are not application data.
+ *
+ * Returns a mask of SSL_KTLS_SEND and SSL_KTLS_RECV.
+ */
+int
+ssl_ktls_check(int fd)
+{
+    int r = 0;
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    SSL *ssl = fd_table[fd].ssl;
+
+    if (BIO_get_ktls_send(SSL_get_wbio(ssl))) {
+	r |= SSL_KTLS_SEND;
+	/* anything OpenSSL still holds has to go out through it first */
+	if (SSL_want(ssl) == SSL_NOTHING) {
+	    fd_table[fd].write_method = &default_write_method;
+	    fd_table[fd].flags.ktls_send = 1;
+	}
+    }
+    if (BIO_get_ktls_recv(SSL_get_rbio(ssl)))
+	r |= SSL_KTLS_RECV;
+    if (r)
+	debugs(83, 3, "ssl_ktls_check: FD %d kernel TLS%s%s", fd,
+	    (r & SSL_KTLS_SEND) ? " send" : "", (r & SSL_KTLS_RECV) ? " recv" : "");
+#endif
+    return r;
+}
+
 static const char *
 ssl_get_attribute(X509_NAME * name, const char *attribute_name)
 {
@@ -53,6 +53,10 @@ SSL_CTX *sslCreateClientContext(const char *certfile, const char *keyfile, int v
 int ssl_read_method(int, char *, int);
 int ssl_write_method(int, const char *, int);
 int ssl_shutdown_method(int);
+
+#define SSL_KTLS_SEND	(1<<0)
+#define SSL_KTLS_RECV	(1<<1)
+int ssl_ktls_check(int fd);
 int ssl_verify_domain(const char *host, SSL *);
 
 const char *sslGetUserEmail(SSL * ssl);
@@ -449,6 +449,22 @@ CpuAffinityReconfigure()
     CpuAffinityInit();
 }
 
+/// the CPU this process is pinned to by cpu_affinity_map, or -1 if none or several
+int
+CpuAffinityCore()
+{
+    int i;
+    if (!TheCpuAffinitySet || !CpuAffinitySetApplied(TheCpuAffinitySet))
+        return -1;
+    if (CPU_COUNT(&TheCpuAffinitySet->theCpuSet) != 1)
+        return -1;
+    for (i = 0; i < CPU_SETSIZE; ++i) {
+        if (CPU_ISSET(i, &TheCpuAffinitySet->theCpuSet))
+            return i;
+    }
+    return -1;
+}
+
 /// computes name and ID for the current kid process
 void 
 ConfigureCurrentKid(const char *processName)
@@ -113,6 +113,7 @@ extern void CpuAffinityCheck();
 extern void CpuAffinityInit();
 extern void CpuAffinityPrint();
 extern void CpuAffinityReconfigure();
+extern int CpuAffinityCore();
 extern void ConfigureCurrentKid(const char *processName);
 extern int IamMasterProcess();
 extern int IamWorkerProcess();
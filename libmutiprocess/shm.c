@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "multiprocess.h"
+#include "shm.h"
+#include "../src/squid.h"
+
+#define SHM_LOCK_SPINS	1000
+
+/// pid of the process which owns the segment namespace (the master)
+static pid_t
+shmOwnerPid(void)
+{
+	if (InDaemonMode() && !IamMasterProcess())
+		return getppid();
+	return getpid();
+}
+
+/*
+ * Map the named segment, creating it if no other kid has done so yet.
+ * A freshly created segment is zero filled so callers can treat an all
+ * zero layout as "empty".  Returns NULL on failure or when an existing
+ * segment has a different size.
+ */
+void *
+shmSegmentOpen(ShmSegment *seg, const char *tag, size_t size)
+{
+	struct stat sb;
+	int fd;
+	void *mem;
+
+	memset(seg, 0, sizeof(*seg));
+	snprintf(seg->name, sizeof(seg->name), "/%s-%d-%s", APP_SHORTNAME, (int) shmOwnerPid(), tag);
+
+	fd = shm_open(seg->name, O_CREAT | O_RDWR, 0600);
+	if (fd < 0) {
+		debugs(54, 1, "shmSegmentOpen: shm_open(%s): %s", seg->name, xstrerror());
+		return NULL;
+	}
+	if (fstat(fd, &sb) < 0) {
+		debugs(54, 1, "shmSegmentOpen: fstat(%s): %s", seg->name, xstrerror());
+		close(fd);
+		return NULL;
+	}
+	if (sb.st_size == 0) {
+		if (ftruncate(fd, size) < 0) {
+			debugs(54, 1, "shmSegmentOpen: ftruncate(%s, %d): %s", seg->name, (int) size, xstrerror());
+			close(fd);
+			return NULL;
+		}
+		seg->created = 1;
+	} else if ((size_t) sb.st_size != size) {
+		debugs(54, 1, "shmSegmentOpen: %s has size %d, expected %d", seg->name, (int) sb.st_size, (int) size);
+		close(fd);
+		return NULL;
+	}
+	mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		debugs(54, 1, "shmSegmentOpen: mmap(%s): %s", seg->name, xstrerror());
+		return NULL;
+	}
+	seg->mem = mem;
+	seg->size = size;
+	debugs(54, 2, "shmSegmentOpen: %s %s, %d bytes", seg->created ? "created" : "attached", seg->name, (int) size);
+	return mem;
+}
+
+void
+shmSegmentClose(ShmSegment *seg)
+{
+	if (seg->mem)
+		munmap(seg->mem, seg->size);
+	seg->mem = NULL;
+	seg->size = 0;
+}
+
+/// remove the segment name; existing mappings stay valid
+void
+shmSegmentUnlink(ShmSegment *seg)
+{
+	if (seg->name[0])
+		shm_unlink(seg->name);
+}
+
+/*
+ * Slow path of shmLockAcquire(): spin for a while, then yield the CPU
+ * between attempts.  Every so often check that the owner still exists
+ * and take the lock over if it died holding it.
+ */
+int
+shmLockWait(ShmLock *lock, pid_t self)
+{
+	int spins = 0;
+	pid_t owner;
+
+	for (;;) {
+		owner = *lock;
+		if (owner == 0) {
+			if (__sync_bool_compare_and_swap(lock, 0, self))
+				return 0;
+			continue;
+		}
+		if (++spins < SHM_LOCK_SPINS)
+			continue;
+		spins = 0;
+		if (owner != self && kill(owner, 0) < 0 && errno == ESRCH &&
+		    __sync_bool_compare_and_swap(lock, owner, self)) {
+			debugs(54, 1, "WARNING: shared memory lock held by dead process %d, taking it over", (int) owner);
+			return 1;
+		}
+		sched_yield();
+	}
+}
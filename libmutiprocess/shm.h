@@ -0,0 +1,51 @@
+#ifndef __SHM_H__
+#define __SHM_H__
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#define SHM_NAME_LEN 64
+
+/*
+ * A named shared memory segment which all kids of one squid instance
+ * can map.  The segment name is derived from the master process pid so
+ * several instances on one box do not share each others segments.
+ */
+typedef struct _ShmSegment
+{
+	char name[SHM_NAME_LEN];	///< name passed to shm_open()
+	size_t size;			///< mapped size
+	void *mem;			///< mapping, NULL when not attached
+	int created;			///< whether we created (and zeroed) it
+}ShmSegment;
+
+/*
+ * Spinlock living inside a shared segment.  It holds the pid of the
+ * owner, 0 when free, so a zero filled segment starts out unlocked and
+ * a lock left behind by a kid which died holding it can be taken over.
+ */
+typedef volatile pid_t ShmLock;
+
+extern void *shmSegmentOpen(ShmSegment *seg, const char *tag, size_t size);
+extern void shmSegmentClose(ShmSegment *seg);
+extern void shmSegmentUnlink(ShmSegment *seg);
+extern int shmLockWait(ShmLock *lock, pid_t self);
+
+/// returns 1 if the lock was taken over from a dead owner, in which
+/// case whatever it protects may be half updated
+static inline int
+shmLockAcquire(ShmLock *lock)
+{
+	pid_t self = getpid();
+	if (__sync_bool_compare_and_swap(lock, 0, self))
+		return 0;
+	return shmLockWait(lock, self);
+}
+
+static inline void
+shmLockRelease(ShmLock *lock)
+{
+	__sync_lock_release(lock);
+}
+
+#endif
@@ -79,6 +79,8 @@
 
 #include "../libsqinet/sqinet.h"
 
+#include "../libstat/StatHist.h"
+
 #include "../libhelper/ipc.h"
 #include "../libhelper/helper.h"
 
@@ -86,8 +88,6 @@
 
 #include "../libiapp/event.h"
 
-#include "../libstat/StatHist.h"
-
 
 #include "../libsqdns/dns.h"
 #include "../libsqdns/dns_internal.h"
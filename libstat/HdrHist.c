@@ -0,0 +1,144 @@
+/*
+ * DEBUG: section 62    Generic Histogram
+ *
+ * SQUID Web Proxy Cache          http://www.squid-cache.org/
+ * ----------------------------------------------------------
+ *
+ *  Squid is the result of efforts by numerous individuals from
+ *  the Internet community; see the CONTRIBUTORS file for full
+ *  details.   Many organizations have provided support for Squid's
+ *  development; see the SPONSORS file for full details.  Squid is
+ *  Copyrighted (C) 2001 by the Regents of the University of
+ *  California; see the COPYRIGHT file for full details.  Squid
+ *  incorporates software developed and/or copyrighted by other
+ *  sources; see the CREDITS file for full details.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *  
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111, USA.
+ *
+ */
+
+#include "../include/config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "HdrHist.h"
+
+static int
+hdrHistMsb(unsigned long long v)
+{
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(v);
+#else
+    int msb = 0;
+    while (v >>= 1)
+	msb++;
+    return msb;
+#endif
+}
+
+static int
+hdrHistBin(unsigned long long v)
+{
+    int shift;
+    if (v < HDRHIST_SUB)
+	return (int) v;
+    shift = hdrHistMsb(v) - (HDRHIST_SUB_BITS - 1);
+    if (shift > HDRHIST_MAX_BITS - HDRHIST_SUB_BITS)
+	return HDRHIST_BINS - 1;
+    return HDRHIST_SUB + (shift - 1) * HDRHIST_HALF + (int) ((v >> shift) - HDRHIST_HALF);
+}
+
+unsigned long long
+hdrHistBinLow(int bin)
+{
+    int k, shift;
+    if (bin < HDRHIST_SUB)
+	return bin;
+    k = bin - HDRHIST_SUB;
+    shift = k / HDRHIST_HALF + 1;
+    return (unsigned long long) (k % HDRHIST_HALF + HDRHIST_HALF) << shift;
+}
+
+unsigned long long
+hdrHistBinHigh(int bin)
+{
+    if (bin == HDRHIST_BINS - 1)
+	return ~0ULL;
+    return hdrHistBinLow(bin + 1) - 1;
+}
+
+void
+hdrHistReset(HdrHist * H)
+{
+    memset(H, 0, sizeof(*H));
+}
+
+void
+hdrHistRecord(HdrHist * H, unsigned long long v)
+{
+    H->bins[hdrHistBin(v)]++;
+    if (H->count == 0 || v < H->min)
+	H->min = v;
+    if (v > H->max)
+	H->max = v;
+    H->count++;
+    H->sum += v;
+}
+
+void
+hdrHistMerge(HdrHist * Dest, const HdrHist * Src)
+{
+    int i;
+    if (Src->count == 0)
+	return;
+    for (i = 0; i < HDRHIST_BINS; i++)
+	Dest->bins[i] += Src->bins[i];
+    if (Dest->count == 0 || Src->min < Dest->min)
+	Dest->min = Src->min;
+    if (Src->max > Dest->max)
+	Dest->max = Src->max;
+    Dest->count += Src->count;
+    Dest->sum += Src->sum;
+}
+
+/*
+ * The value below which pct percent of the samples fall, reported as
+ * the top of the bin it lands in (clamped to the largest sample).
+ */
+unsigned long long
+hdrHistPercentile(const HdrHist * H, double pct)
+{
+    unsigned long long want, seen = 0;
+    unsigned long long v;
+    int i;
+    if (H->count == 0)
+	return 0;
+    want = (unsigned long long) (pct / 100.0 * H->count + 0.5);
+    if (want < 1)
+	want = 1;
+    for (i = 0; i < HDRHIST_BINS; i++) {
+	seen += H->bins[i];
+	if (seen >= want) {
+	    v = hdrHistBinHigh(i);
+	    if (v > H->max)
+		v = H->max;
+	    if (v < H->min)
+		v = H->min;
+	    return v;
+	}
+    }
+    return H->max;
+}
@@ -0,0 +1,39 @@
+#ifndef	__LIBSTAT_HDRHIST_H__
+#define	__LIBSTAT_HDRHIST_H__
+
+/*
+ * High dynamic range histogram.
+ *
+ * Values below HDRHIST_SUB get a bin each; above that every power of
+ * two is split into HDRHIST_HALF bins, so the relative error stays
+ * under 1/HDRHIST_HALF (about 1.5%) over the whole range.  Values of
+ * 2^HDRHIST_MAX_BITS and more go into the last bin.
+ *
+ * The structure is flat, so it can live in shared memory and be merged
+ * bin by bin.  Recording is a handful of plain increments; there must
+ * only be one writer per histogram.
+ */
+
+#define HDRHIST_SUB_BITS	7
+#define HDRHIST_SUB		(1 << HDRHIST_SUB_BITS)
+#define HDRHIST_HALF		(HDRHIST_SUB >> 1)
+#define HDRHIST_MAX_BITS	34
+#define HDRHIST_BINS		(HDRHIST_SUB + (HDRHIST_MAX_BITS - HDRHIST_SUB_BITS) * HDRHIST_HALF)
+
+struct _HdrHist {
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long min;
+    unsigned long long max;
+    unsigned int bins[HDRHIST_BINS];
+};
+typedef struct _HdrHist HdrHist;
+
+extern void hdrHistReset(HdrHist * H);
+extern void hdrHistRecord(HdrHist * H, unsigned long long v);
+extern void hdrHistMerge(HdrHist * Dest, const HdrHist * Src);
+extern unsigned long long hdrHistPercentile(const HdrHist * H, double pct);
+extern unsigned long long hdrHistBinLow(int bin);
+extern unsigned long long hdrHistBinHigh(int bin);
+
+#endif
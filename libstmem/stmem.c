@@ -55,6 +55,10 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <stddef.h>
+#ifndef _SQUID_MSWIN_
+#include <sys/uio.h>
+#endif
 
 #include "../include/Array.h"
 #include "../include/Stack.h"
@@ -216,6 +220,87 @@ stmemAppend(mem_hdr * mem, const char *data, int len)
     }
 }
 
+/*!
+ * @function
+ *	stmemAppendReserve
+ * @abstract
+ *	Hand out room at the end of the stmem list to read data into.
+ * @param	mem	stmem list to append to.
+ * @param	iov	vector to describe the room in.
+ * @param	iovcnt	number of entries in iov.
+ * @param	len	amount of room wanted.
+ * @return	the number of iov entries used.
+ *
+ * @discussion
+ *	The first entry is the free space in the tail page, if any; the
+ *	rest are fresh pages which aren't on the list yet.  Every reserve
+ *	must be followed by stmemAppendCommit() with the same vector,
+ *	which links the pages that got data and frees the others.  Less
+ *	than len may be reserved if iov is too short.
+ */
+int
+stmemAppendReserve(mem_hdr * mem, struct iovec *iov, int iovcnt, int len)
+{
+    mem_node *p;
+    int n = 0;
+    if (mem->tail && mem->tail->len < SM_PAGE_SIZE) {
+	iov[n].iov_base = mem->tail->data + mem->tail->len;
+	iov[n].iov_len = XMIN(len, SM_PAGE_SIZE - mem->tail->len);
+	len -= iov[n].iov_len;
+	n++;
+    }
+    while (len > 0 && n < iovcnt) {
+	p = memPoolAlloc(pool_mem_node);
+	iov[n].iov_base = p->data;
+	iov[n].iov_len = XMIN(len, SM_PAGE_SIZE);
+	len -= iov[n].iov_len;
+	n++;
+    }
+    return n;
+}
+
+/*!
+ * @function
+ *	stmemAppendCommit
+ * @abstract
+ *	Account for len bytes placed in room from stmemAppendReserve().
+ * @param	mem	stmem list the room was reserved on.
+ * @param	iov	vector stmemAppendReserve() filled in.
+ * @param	iovcnt	its return value.
+ * @param	len	bytes actually stored, 0 if none.
+ */
+void
+stmemAppendCommit(mem_hdr * mem, struct iovec *iov, int iovcnt, int len)
+{
+    mem_node *p;
+    int i, n;
+    debugs(19, 6, "stmemAppendCommit: len %d", len);
+    for (i = 0; i < iovcnt; i++) {
+	n = XMIN(len, (int) iov[i].iov_len);
+	len -= n;
+	if (i == 0 && mem->tail && iov[i].iov_base == mem->tail->data + mem->tail->len) {
+	    mem->tail->len += n;
+	    continue;
+	}
+	p = (mem_node *) ((char *) iov[i].iov_base - offsetof(mem_node, data));
+	if (n == 0) {
+	    memPoolFree(pool_mem_node, p);
+	    continue;
+	}
+	p->next = NULL;
+	p->len = n;
+	p->uses = 0;
+	store_mem_size += SM_PAGE_SIZE;
+	if (!mem->head) {
+	    mem->head = mem->tail = p;
+	} else {
+	    mem->tail->next = p;
+	    mem->tail = p;
+	}
+    }
+    assert(len == 0);
+}
+
 /*
  * Fetch a page from the store mem.
  *
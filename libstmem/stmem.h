@@ -36,9 +36,13 @@ typedef struct _mem_node_ref mem_node_ref;
 
 extern unsigned long store_mem_size;
 
+struct iovec;
+
 extern void stmemInitMem(void);
 extern squid_off_t stmemFreeDataUpto(mem_hdr *, squid_off_t);
 extern void stmemAppend(mem_hdr *, const char *, int);
+extern int stmemAppendReserve(mem_hdr *, struct iovec *, int, int);
+extern void stmemAppendCommit(mem_hdr *, struct iovec *, int, int);
 extern ssize_t stmemCopy(const mem_hdr *, squid_off_t, char *, size_t);
 extern void stmemFree(mem_hdr *);
 extern void stmemFreeData(mem_hdr *);
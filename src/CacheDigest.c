@@ -52,34 +52,59 @@ static void cacheDigestHashKey(const CacheDigest * cd, const cache_key * key);
 static u_num32 hashed_keys[4];
 
 static void
-cacheDigestInit(CacheDigest * cd, int capacity, int bpe)
+cacheDigestInit(CacheDigest * cd, int capacity, int bpe, int blocked)
 {
-    const size_t mask_size = cacheDigestCalcMaskSize(capacity, bpe);
+    const size_t mask_size = cacheDigestCalcMaskSizeBlocked(capacity, bpe, blocked);
     assert(cd);
     assert(capacity > 0 && bpe > 0);
     assert(mask_size > 0);
     cd->capacity = capacity;
     cd->bits_per_entry = bpe;
     cd->mask_size = mask_size;
+    cd->blocked = blocked;
     cd->mask = xcalloc(cd->mask_size, 1);
-    debugs(70, 2, "cacheDigestInit: capacity: %d entries, bpe: %d; size: %d bytes",
-	cd->capacity, cd->bits_per_entry, cd->mask_size);
+    debugs(70, 2, "cacheDigestInit: capacity: %d entries, bpe: %d; size: %d bytes%s",
+	cd->capacity, cd->bits_per_entry, cd->mask_size, blocked ? ", blocked" : "");
 }
 
 CacheDigest *
 cacheDigestCreate(int capacity, int bpe)
+{
+    return cacheDigestCreateBlocked(capacity, bpe, 0);
+}
+
+/*
+ * A blocked digest keeps all bits of a key inside one CD_BLOCK_SIZE
+ * block, so a lookup touches a single cache line.
+ */
+CacheDigest *
+cacheDigestCreateBlocked(int capacity, int bpe, int blocked)
 {
     CacheDigest *cd = memPoolAlloc(pool_cache_digest);
     assert(SQUID_MD5_DIGEST_LENGTH == 16);	/* our hash functions rely on 16 byte keys */
-    cacheDigestInit(cd, capacity, bpe);
+    cd->counts = NULL;
+    cacheDigestInit(cd, capacity, bpe, blocked);
     return cd;
 }
 
+/*
+ * Keep a saturating counter per bit so cacheDigestDel() can turn bits
+ * off again.  Must be called while the digest is still empty.
+ */
+void
+cacheDigestEnableCounting(CacheDigest * cd)
+{
+    assert(cd && cd->count == 0);
+    if (!cd->counts)
+	cd->counts = xcalloc(cd->mask_size * 8, 1);
+}
+
 static void
 cacheDigestClean(CacheDigest * cd)
 {
     assert(cd);
     safe_free(cd->mask);
+    safe_free(cd->counts);
 }
 
 void
@@ -95,7 +120,7 @@ cacheDigestClone(const CacheDigest * cd)
 {
     CacheDigest *clone;
     assert(cd);
-    clone = cacheDigestCreate(cd->capacity, cd->bits_per_entry);
+    clone = cacheDigestCreateBlocked(cd->capacity, cd->bits_per_entry, cd->blocked);
     clone->count = cd->count;
     clone->del_count = cd->del_count;
     assert(cd->mask_size == clone->mask_size);
@@ -109,15 +134,22 @@ cacheDigestClear(CacheDigest * cd)
     assert(cd);
     cd->count = cd->del_count = 0;
     memset(cd->mask, 0, cd->mask_size);
+    if (cd->counts)
+	memset(cd->counts, 0, cd->mask_size * 8);
 }
 
 /* changes mask size, resets bits to 0, preserves "cd" pointer */
 void
 cacheDigestChangeCap(CacheDigest * cd, int new_cap)
 {
+    int counting;
     assert(cd);
+    counting = cd->counts != NULL;
     cacheDigestClean(cd);
-    cacheDigestInit(cd, new_cap, cd->bits_per_entry);
+    cacheDigestInit(cd, new_cap, cd->bits_per_entry, cd->blocked);
+    cd->count = cd->del_count = 0;
+    if (counting)
+	cacheDigestEnableCounting(cd);
 }
 
 /* returns true if the key belongs to the digest */
@@ -141,6 +173,12 @@ cacheDigestAdd(CacheDigest * cd, const cache_key * key)
     assert(cd && key);
     /* hash */
     cacheDigestHashKey(cd, key);
+    if (cd->counts) {
+	int i;
+	for (i = 0; i < 4; i++)
+	    if (cd->counts[hashed_keys[i]] < 255)
+		cd->counts[hashed_keys[i]]++;
+    }
     /* turn on corresponding bits */
 #if CD_FAST_ADD
     CBIT_SET(cd->mask, hashed_keys[0]);
@@ -175,9 +213,23 @@ cacheDigestAdd(CacheDigest * cd, const cache_key * key)
 void
 cacheDigestDel(CacheDigest * cd, const cache_key * key)
 {
+    int i;
     assert(cd && key);
     cd->del_count++;
-    /* we do not support deletions from the digest */
+    /* without counters we do not support deletions from the digest */
+    if (!cd->counts)
+	return;
+    cacheDigestHashKey(cd, key);
+    for (i = 0; i < 4; i++) {
+	unsigned char *c = &cd->counts[hashed_keys[i]];
+	/* a saturated counter has lost track; leave the bit on */
+	if (*c == 0 || *c == 255)
+	    continue;
+	if (--*c == 0)
+	    CBIT_CLR(cd->mask, hashed_keys[i]);
+    }
+    if (cd->count > 0)
+	cd->count--;
 }
 
 /* returns mask utilization parameters */
@@ -285,9 +337,12 @@ cacheDigestReport(CacheDigest * cd, const char *label, StoreEntry * e)
 	cd->capacity,
 	xpercentInt(cd->count, cd->capacity)
 	);
-    storeAppendPrintf(e, "\t deletion attempts: %d\n",
-	cd->del_count
+    storeAppendPrintf(e, "\t deletion attempts: %d%s\n",
+	cd->del_count,
+	cd->counts ? " (counting)" : ""
 	);
+    if (cd->blocked)
+	storeAppendPrintf(e, "\t layout: blocked, %d byte blocks\n", CD_BLOCK_SIZE);
     storeAppendPrintf(e, "\t bits: per entry: %d on: %d capacity: %d util: %d%%\n",
 	cd->bits_per_entry,
 	stats.bit_on_count, stats.bit_count,
@@ -305,6 +360,15 @@ cacheDigestCalcMaskSize(int cap, int bpe)
     return (size_t) (cap * bpe + 7) / 8;
 }
 
+size_t
+cacheDigestCalcMaskSizeBlocked(int cap, int bpe, int blocked)
+{
+    size_t size = cacheDigestCalcMaskSize(cap, bpe);
+    if (blocked)
+	size = (size + CD_BLOCK_SIZE - 1) / CD_BLOCK_SIZE * CD_BLOCK_SIZE;
+    return size;
+}
+
 static void
 cacheDigestHashKey(const CacheDigest * cd, const cache_key * key)
 {
@@ -312,6 +376,19 @@ cacheDigestHashKey(const CacheDigest * cd, const cache_key * key)
     unsigned int tmp_keys[4];
     /* we must memcpy to ensure alignment */
     xmemcpy(tmp_keys, key, sizeof(tmp_keys));
+    if (cd->blocked) {
+	/* first word picks the block, the rest the bits inside it */
+	const unsigned int block_bits = CD_BLOCK_SIZE * 8;
+	const unsigned int base = (htonl(tmp_keys[0]) % (bit_count / block_bits)) * block_bits;
+	const unsigned int w1 = htonl(tmp_keys[1]);
+	const unsigned int w2 = htonl(tmp_keys[2]);
+	const unsigned int w3 = htonl(tmp_keys[3]);
+	hashed_keys[0] = base + w1 % block_bits;
+	hashed_keys[1] = base + w2 % block_bits;
+	hashed_keys[2] = base + w3 % block_bits;
+	hashed_keys[3] = base + ((w1 >> 16) ^ (w2 >> 16) ^ (w3 >> 16)) % block_bits;
+	return;
+    }
     hashed_keys[0] = htonl(tmp_keys[0]) % bit_count;
     hashed_keys[1] = htonl(tmp_keys[1]) % bit_count;
     hashed_keys[2] = htonl(tmp_keys[2]) % bit_count;
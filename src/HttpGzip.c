@@ -1,37 +1,122 @@
 
 #include "HttpGzip.h"
 #include <stdlib.h>
+#include <pthread.h>
 
+static void httpGzipContextFree(HttpGzipContext *ctx);
 
-int 
-httpGzipNeed(request_t *request, HttpReply *reply)
+/* Does this Accept-Encoding list item carry q=0? */
+static int
+httpGzipQZero(const char *item, int ilen)
 {
-    char *type_list = "text/html";
+    const char *end = item + ilen;
+    const char *p = memchr(item, ';', ilen);
+
+    while (p != NULL) {
+	p++;
+	while (p < end && xisspace(*p))
+	    p++;
+	if (end - p >= 2 && (*p == 'q' || *p == 'Q') && p[1] == '=') {
+	    p += 2;
+	    if (p >= end || *p != '0')
+		return 0;
+	    p++;
+	    if (p < end && *p == '.') {
+		p++;
+		while (p < end && *p == '0')
+		    p++;
+	    }
+	    return p >= end || !xisdigit(*p);
+	}
+	p = memchr(p, ';', end - p);
+    }
+    return 0;
+}
 
+/*
+ * Which coding this client gets, or 0 if it takes neither gzip nor
+ * deflate (or only with q=0).
+ */
+static int
+httpGzipAccepted(request_t *request)
+{
     String s;
-    HttpHeader *header;
+    const char *item;
+    const char *pos = NULL;
+    int ilen;
+    int gzip = 0, deflate = 0;
+
+    s = httpHeaderGetStrOrList(&request->header, HDR_ACCEPT_ENCODING);
+    while (strListGetItem(&s, ',', &item, &ilen, &pos)) {
+	const char *q = memchr(item, ';', ilen);
+	int len = q ? q - item : ilen;
+	while (len > 0 && xisspace(item[len - 1]))
+	    len--;
+	if (httpGzipQZero(item, ilen))
+	    continue;
+	if (len == 4 && strncasecmp(item, "gzip", 4) == 0)
+	    gzip = 1;
+	else if (len == 7 && strncasecmp(item, "deflate", 7) == 0)
+	    deflate = 1;
+    }
+    stringClean(&s);
 
-    header = &request->header;
+    if (deflate && (Config.http_gzip.prefer_deflate || !gzip))
+	return SQUID_CACHE_DEFLATE;
+    if (gzip && (Config.http_gzip.prefer_gzip || !deflate))
+	return SQUID_CACHE_GZIP;
+    return 0;
+}
 
-    /**
-     * Checks the request's Accept-Encoding header if the client does understand
-     * gzip compression at all.
-     */
-    s = httpHeaderGetStrOrList(header, HDR_ACCEPT_ENCODING);
-    if (strBuf(s) == NULL ||
-	    (strStr(s, "gzip") == NULL && strStr(s, "deflate") == NULL) ){
-	return 0;
+/*
+ * Matches the media type of the reply, without parameters, against
+ * http_gzip_types.  Entries may be separated by spaces or commas, and
+ * a subtype of "*" takes the whole top level type.
+ */
+static int
+httpGzipTypeMatch(const char *ctype, int clen)
+{
+    static wordlist def = {"text/html", NULL};
+    const wordlist *w = Config.http_gzip.types ? Config.http_gzip.types : &def;
+    const char *semi = memchr(ctype, ';', clen);
+
+    if (semi)
+	clen = semi - ctype;
+    while (clen > 0 && xisspace(ctype[clen - 1]))
+	clen--;
+    for (; w; w = w->next) {
+	const char *p = w->key;
+	while (*p) {
+	    int len = strcspn(p, ", \t");
+	    if (len == clen && strncasecmp(p, ctype, len) == 0)
+		return 1;
+	    if (len >= 2 && len <= clen && strncmp(p + len - 2, "/*", 2) == 0 &&
+		strncasecmp(p, ctype, len - 1) == 0)
+		return 1;
+	    p += len;
+	    p += strspn(p, ", \t");
+	}
     }
+    return 0;
+}
+
+/* Could this reply be compressed for a client that asks for it? */
+static int
+httpGzipReplyOk(HttpReply *reply)
+{
+    String s;
+    HttpHeader *header = &reply->header;
+    int ok;
 
-    header = &reply->header;
     /**
      * Checks if the response Cache-Control header allows transformation of the
      * response.
      */
     s = httpHeaderGetStrOrList(header, HDR_CACHE_CONTROL);
-    if (strBuf(s) != NULL && strStr(s, "no-transform") != NULL ){
+    ok = strBuf(s) == NULL || strStr(s, "no-transform") == NULL;
+    stringClean(&s);
+    if (!ok)
 	return 0;
-    }
 
     /**
      * Do not compress if response has a content-range header and status code "206
@@ -42,18 +127,14 @@ httpGzipNeed(request_t *request, HttpReply *reply)
     }
 
     /**
-     * Checks the Content-Type response header.
-     * At this time, only responses with "text/html" content-type are allowed to
-     * be compressed.
+     * Checks the Content-Type response header against http_gzip_types
+     * (text/html when not set).
      */
-    if (Config.http_gzip.types != NULL) {
-	type_list = Config.http_gzip.types;
-    }
-
     s = httpHeaderGetStrOrList(header, HDR_CONTENT_TYPE);
-    if (strBuf(s) == NULL || strstr(type_list, strBuf(s)) == NULL ){
+    ok = strBuf(s) != NULL && httpGzipTypeMatch(strBuf(s), strLen(s));
+    stringClean(&s);
+    if (!ok)
 	return 0;
-    }
 
     /**
      * Checks the Content-Encoding response header.
@@ -71,23 +152,49 @@ httpGzipNeed(request_t *request, HttpReply *reply)
     return 1;
 }
 
+int 
+httpGzipNeed(request_t *request, HttpReply *reply)
+{
+    /**
+     * Checks the request's Accept-Encoding header if the client does understand
+     * gzip compression at all.
+     */
+    if (!httpGzipAccepted(request)) {
+	return 0;
+    }
+
+    return httpGzipReplyOk(reply);
+}
+
+static void
+httpGzipAddVary(HttpReply *reply)
+{
+    String s;
+
+    /* Add "Vary: Accept-Encoding" response header" */
+    s = httpHeaderGetStrOrList(&reply->header, HDR_VARY);
+    if (strBuf(s) == NULL || strStr(s, "Accept-Encoding") == NULL ){
+	httpHeaderPutStr(&reply->header, HDR_VARY, "Accept-Encoding");
+    }
+    stringClean(&s);
+}
+
 void 
 httpGzipClearHeaders(HttpReply *reply, int type) 
 {
-    String s;
     HttpHeader *header;
     header = &reply->header;
 
+    httpGzipAddVary(reply);
+
+    /* the uncompressed variant only needs to say that there are others */
+    if (type & SQUID_CACHE_IDENTITY)
+	return;
+
     /* delete ContentLength header because we may change the length */
     reply->content_length = -1;
     httpHeaderDelById(header, HDR_CONTENT_LENGTH);
 
-    /* Add "Vary: Accept-Encoding" response header" */
-    s = httpHeaderGetStrOrList(header, HDR_VARY);
-    if (strBuf(s) == NULL || strStr(s, "Accept-Encoding") == NULL ){
-	httpHeaderPutStr(header, HDR_VARY, "Accept-Encoding");
-    }
-
     httpHeaderDelById(header, HDR_CONTENT_LOCATION);
 
     httpHeaderDelById(header, HDR_ETAG);
@@ -112,7 +219,18 @@ httpGzipStart(HttpStateData *httpState)
     HttpReply *reply = entry->mem_obj->reply;
     HttpGzipContext *ctx = NULL;
 
-    if (!httpGzipNeed(request, reply)) {
+    if (!httpGzipReplyOk(reply)) {
+	return;
+    }
+
+    /*
+     * Clients that can't take it still get a Vary, so their plain copy
+     * is cached as one more variant rather than replacing the
+     * compressed ones.
+     */
+    if (!httpGzipAccepted(request)) {
+	httpGzipClearHeaders(reply, SQUID_CACHE_IDENTITY);
+	entry->compression_type = SQUID_CACHE_IDENTITY;
 	return;
     }
 
@@ -121,6 +239,7 @@ httpGzipStart(HttpStateData *httpState)
     if (ctx) {
 	httpGzipClearHeaders(reply, ctx->compression_type);
 	entry->compression_type = ctx->compression_type;
+	ctx->owner = httpState;
     }
 
     httpState->context = ctx;
@@ -128,98 +247,106 @@ httpGzipStart(HttpStateData *httpState)
     return;
 }
 
+static pthread_mutex_t gzip_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gzip_queue_cond = PTHREAD_COND_INITIALIZER;
+static HttpGzipContext *gzip_jobs = NULL;
+static HttpGzipContext **gzip_jobs_tail = &gzip_jobs;
+static int gzip_tried = 0;
+static int gzip_nthreads = 0;
+
+static int httpGzipThreadsInit(void);
+
 void * 
 httpGzipContextInitialize(request_t *request)
 {
-    String s;
-    int gzip, deflate;
     HttpGzipContext *ctx = NULL;
-    HttpHeader *header;
-
 
-    ctx = (HttpGzipContext *) xmalloc(sizeof(HttpGzipContext));
+    ctx = (HttpGzipContext *) xcalloc(1, sizeof(HttpGzipContext));
 
-    if (ctx) {
-	memset(ctx, 0, sizeof(HttpGzipContext));
-
-	gzip = deflate = 0;
-	header = &request->header;
-	s = httpHeaderGetStrOrList(header, HDR_ACCEPT_ENCODING);
-	if ( strStr(s, "gzip") != NULL) {
-	    gzip = 1;
-	} 
-
-	if (strStr(s, "deflate") != NULL){
-	    deflate = 1;
-	}
-
-	if (deflate && Config.http_gzip.prefer_deflate) {
-	    ctx->compression_type = SQUID_CACHE_DEFLATE;
-	}
-	else if (gzip && Config.http_gzip.prefer_gzip) {
-	    ctx->compression_type = SQUID_CACHE_GZIP;
-	}
-	else {
-	    /*This could not happen.*/
-	    return NULL;
-	}
+    ctx->compression_type = httpGzipAccepted(request);
+    if (!ctx->compression_type) {
+	/*This could not happen.*/
+	xfree(ctx);
+	return NULL;
+    }
 
-	/*
-	 * We preallocate a memory for zlib in one buffer (default:256K), this
-	 * decreases a number of malloc() and free() calls and also probably
-	 * decreases a number of syscalls (sbrk()/mmap() and so on).
-	 * Besides we free the memory as soon as a gzipping will complete
-	 * and do not wait while a whole response will be sent to a client.
-	 */
-	ctx->allocated = Config.http_gzip.prealloc_size;
-	ctx->gzipBuffer = (unsigned char *) xmalloc(ctx->allocated);
-	if (ctx->gzipBuffer == NULL) {
-	    return NULL;
-	}
+    /*
+     * We preallocate a memory for zlib in one buffer (default:256K), this
+     * decreases a number of malloc() and free() calls and also probably
+     * decreases a number of syscalls (sbrk()/mmap() and so on).
+     * Besides we free the memory as soon as a gzipping will complete
+     * and do not wait while a whole response will be sent to a client.
+     */
+    ctx->allocated = Config.http_gzip.prealloc_size;
+    ctx->gzipBuffer = (unsigned char *) xmalloc(ctx->allocated);
+
+    if (deflateInit2(&ctx->zstream, Config.http_gzip.level, Z_DEFLATED, 
+		-(Config.http_gzip.wbits), Config.http_gzip.memlevel, 
+		Z_DEFAULT_STRATEGY) != Z_OK){
+	xfree(ctx->gzipBuffer);
+	xfree(ctx);
+	return NULL;
+    }
 
-	if (deflateInit2(&ctx->zstream, Config.http_gzip.level, Z_DEFLATED, 
-		    -(Config.http_gzip.wbits), Config.http_gzip.memlevel, 
-		    Z_DEFAULT_STRATEGY) != Z_OK){
-	    return NULL;
-	}
+    if (!(ctx->compression_type & SQUID_CACHE_DEFLATE)) {
+	ctx->checksum = crc32(0, Z_NULL, 0);
+
+	ctx->gzipBuffer[0] = (unsigned char)31;         //Magic number #1
+	ctx->gzipBuffer[1] = (unsigned char)139;        //Magic number #2
+	ctx->gzipBuffer[2] = (unsigned char)Z_DEFLATED; //Method
+	ctx->gzipBuffer[3] = (unsigned char)0;          //Flags
+	ctx->gzipBuffer[4] = (unsigned char)0;	    //Mtime #1
+	ctx->gzipBuffer[5] = (unsigned char)0;	    //Mtime #2
+	ctx->gzipBuffer[6] = (unsigned char)0;          //Mtime #3
+	ctx->gzipBuffer[7] = (unsigned char)0;          //Mtime #4
+	ctx->gzipBuffer[8] = (unsigned char)0;          //Extra flags
+	ctx->gzipBuffer[9] = (unsigned char)3;          //Operatin system: UNIX
+
+	ctx->zstream.total_out = 10;
+    }
 
-	if (!(ctx->compression_type & SQUID_CACHE_DEFLATE)) {
-	    ctx->checksum = crc32(0, Z_NULL, 0);
-
-	    ctx->gzipBuffer[0] = (unsigned char)31;         //Magic number #1
-	    ctx->gzipBuffer[1] = (unsigned char)139;        //Magic number #2
-	    ctx->gzipBuffer[2] = (unsigned char)Z_DEFLATED; //Method
-	    ctx->gzipBuffer[3] = (unsigned char)0;          //Flags
-	    ctx->gzipBuffer[4] = (unsigned char)0;	    //Mtime #1
-	    ctx->gzipBuffer[5] = (unsigned char)0;	    //Mtime #2
-	    ctx->gzipBuffer[6] = (unsigned char)0;          //Mtime #3
-	    ctx->gzipBuffer[7] = (unsigned char)0;          //Mtime #4
-	    ctx->gzipBuffer[8] = (unsigned char)0;          //Extra flags
-	    ctx->gzipBuffer[9] = (unsigned char)3;          //Operatin system: UNIX
-
-	    ctx->zstream.total_out = 10;
-	}
+    ctx->flush = Z_NO_FLUSH;
 
-	ctx->flush = Z_NO_FLUSH;
+    /* compress on the threads when there are any, inline otherwise */
+    if (Config.http_gzip.threads > 0 && httpGzipThreadsInit()) {
+	memBufDefInit(&ctx->in);
     }
 
     return ctx;
 }
 
+static void
+httpGzipContextFree(HttpGzipContext *ctx)
+{
+    /* Z_STREAM_ERROR if httpGzipDone() already ended it, which is fine */
+    deflateEnd(&ctx->zstream);
+    if (ctx->gzipBuffer != NULL) {
+	xfree(ctx->gzipBuffer);
+    }
+    if (!memBufIsNull(&ctx->in)) {
+	memBufClean(&ctx->in);
+    }
+    xfree(ctx);
+}
+
 void 
 httpGzipContextFinalize(HttpStateData *httpState)
 {
     HttpGzipContext *ctx = (HttpGzipContext *)httpState->context;
 
-    if (ctx != NULL) {
-	if (ctx->gzipBuffer != NULL) {
-	    xfree(ctx->gzipBuffer);
-	}
+    httpState->context = NULL;
 
-	xfree(httpState->context);
+    if (ctx == NULL) {
+	return;
     }
 
-    httpState->context = NULL;
+    if (ctx->busy) {
+	/* a thread still has it; free it when the job comes back */
+	ctx->owner = NULL;
+	return;
+    }
+
+    httpGzipContextFree(ctx);
 }
 
 static int 
@@ -243,11 +370,16 @@ httpGzipStreamOutReset(HttpGzipContext *ctx)
     return 0;
 }
 
-int
-httpGzipCompress(HttpStateData *httpState, const char *buf, ssize_t len)
+/*
+ * Feeds buf to the compressor.  Touches nothing but the context, so
+ * the compression threads can run it.  With sync set the output is
+ * flushed out to a byte boundary whenever the buffer gets 3/4 full,
+ * for callers that hand it on as they go; otherwise the buffer just
+ * grows until the caller takes the output.
+ */
+static int
+httpGzipDeflate(HttpGzipContext *ctx, const char *buf, ssize_t len, int sync)
 {
-    HttpGzipContext *ctx = httpState->context;
-
     ctx->originalSize += len;
     ctx->lastChunkSize = len;
 
@@ -280,7 +412,7 @@ httpGzipCompress(HttpStateData *httpState, const char *buf, ssize_t len)
 	}
 
 	/*flush the buffer when total_out > 3/4 * allocated's buffer.*/
-	if (ctx->zstream.total_out > ((ctx->allocated * 3) >> 2 )) {
+	if (sync && ctx->zstream.total_out > ((ctx->allocated * 3) >> 2 )) {
 	    ctx->flush = Z_SYNC_FLUSH;
 	    continue;
 	}
@@ -292,12 +424,16 @@ httpGzipCompress(HttpStateData *httpState, const char *buf, ssize_t len)
 }
 
 int
-httpGzipDone(HttpStateData *httpState)
+httpGzipCompress(HttpStateData *httpState, const char *buf, ssize_t len)
+{
+    return httpGzipDeflate(httpState->context, buf, len, 1);
+}
+
+/* Ends the stream and adds the gzip trailer; thread safe like httpGzipDeflate() */
+static int
+httpGzipFinish(HttpGzipContext *ctx)
 {
     int rc;
-    StoreEntry *entry = httpState->entry;
-    HttpReply *reply = entry->mem_obj->reply;
-    HttpGzipContext *ctx = httpState->context;
 
     while (1) {
 	ctx->zstream.next_out   = &ctx->gzipBuffer[ctx->zstream.total_out];
@@ -327,6 +463,13 @@ httpGzipDone(HttpStateData *httpState)
 	return GZIP_ERROR;
     }
 
+    /* the trailer needs 8 more bytes */
+    if (ctx->allocated - ctx->zstream.total_out < 8) {
+	if (httpGzipIncreaseBuffer(ctx) < 0) {
+	    return GZIP_ERROR;
+	}
+    }
+
     /*GZIP Footer*/
     if (!(ctx->compression_type & SQUID_CACHE_DEFLATE)) {
 	ctx->gzipBuffer[ctx->zstream.total_out++] = (unsigned char) ctx->checksum & 0xff;
@@ -342,8 +485,225 @@ httpGzipDone(HttpStateData *httpState)
 
     ctx->compressedSize += ctx->zstream.total_out;
 
+    return GZIP_OK;
+}
+
+int
+httpGzipDone(HttpStateData *httpState)
+{
+    StoreEntry *entry = httpState->entry;
+    HttpReply *reply = entry->mem_obj->reply;
+    HttpGzipContext *ctx = httpState->context;
+
+    if (httpGzipFinish(ctx) < 0) {
+	return GZIP_ERROR;
+    }
+
     reply->content_length = ctx->compressedSize;
     httpHeaderPutSize(&reply->header, HDR_CONTENT_LENGTH, reply->content_length);
 
     return GZIP_OK;
 }
+
+/*
+ * Compression threads.
+ *
+ * A context is queued with the body read since its last job in
+ * ctx->in and is owned by the threads until it comes back through
+ * the loop message queue, so each stream has at most one job in
+ * flight and its output stays in order.  The server side stops reading while
+ * its job is out and httpGzipResume() picks up where
+ * httpAppendBody() left off.
+ */
+
+static void
+httpGzipRunJob(HttpGzipContext *ctx)
+{
+    ctx->rc = GZIP_OK;
+    if (ctx->in.size > 0) {
+	ctx->rc = httpGzipDeflate(ctx, ctx->in.buf, ctx->in.size, 0);
+    }
+    if (ctx->rc >= 0 && ctx->finish) {
+	ctx->rc = httpGzipFinish(ctx);
+    }
+}
+
+static void httpGzipJobDone(void *data);
+
+static void *
+httpGzipThreadLoop(void *unused)
+{
+    HttpGzipContext *ctx;
+    sigset_t new;
+
+    /* leave the signals to the main thread */
+    sigfillset(&new);
+    pthread_sigmask(SIG_BLOCK, &new, NULL);
+
+    while (1) {
+	pthread_mutex_lock(&gzip_queue_mutex);
+	while (gzip_jobs == NULL) {
+	    pthread_cond_wait(&gzip_queue_cond, &gzip_queue_mutex);
+	}
+	ctx = gzip_jobs;
+	gzip_jobs = ctx->next;
+	if (gzip_jobs == NULL) {
+	    gzip_jobs_tail = &gzip_jobs;
+	}
+	pthread_mutex_unlock(&gzip_queue_mutex);
+
+	httpGzipRunJob(ctx);
+	iapp_msg_post(&ctx->done, httpGzipJobDone, ctx);
+    }
+    /* NOTREACHED */
+    return NULL;
+}
+
+static void
+httpGzipJobDone(void *data)
+{
+    HttpGzipContext *ctx = data;
+
+    ctx->next = NULL;
+    ctx->busy = 0;
+    if (ctx->owner) {
+	httpGzipResume(ctx->owner);
+    } else {
+	httpGzipContextFree(ctx);
+    }
+}
+
+static int
+httpGzipThreadsInit(void)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    int i;
+
+    if (gzip_nthreads > 0) {
+	return 1;
+    }
+    if (gzip_tried) {
+	/* tried before and could not start any */
+	return 0;
+    }
+    gzip_tried = 1;
+
+    if (!iapp_msg_init()) {
+	return 0;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (i = 0; i < Config.http_gzip.threads; i++) {
+	if (pthread_create(&thread, &attr, httpGzipThreadLoop, NULL) != 0) {
+	    debugs(11, 1, "httpGzipThreadsInit: thread creation failed: %s", xstrerror());
+	    break;
+	}
+	gzip_nthreads++;
+    }
+    pthread_attr_destroy(&attr);
+
+    debugs(11, 1, "Started %d gzip compression threads", gzip_nthreads);
+
+    return gzip_nthreads > 0;
+}
+
+int
+httpGzipAsync(HttpGzipContext *ctx)
+{
+    return !memBufIsNull(&ctx->in);
+}
+
+void
+httpGzipSubmit(HttpGzipContext *ctx, int finish)
+{
+    assert(!ctx->busy);
+    ctx->busy = 1;
+    ctx->finish = finish;
+    ctx->next = NULL;
+
+    pthread_mutex_lock(&gzip_queue_mutex);
+    *gzip_jobs_tail = ctx;
+    gzip_jobs_tail = &ctx->next;
+    pthread_cond_signal(&gzip_queue_cond);
+    pthread_mutex_unlock(&gzip_queue_mutex);
+}
+
+/*
+ * Stores what the last job produced.  After the final job the reply
+ * gets its real Content-Length and the context is released.
+ */
+int
+httpGzipCollect(HttpStateData *httpState)
+{
+    HttpGzipContext *ctx = httpState->context;
+    StoreEntry *entry = httpState->entry;
+    HttpReply *reply = entry->mem_obj->reply;
+
+    memBufReset(&ctx->in);
+
+    if (ctx->rc < 0) {
+	return GZIP_ERROR;
+    }
+
+    if (ctx->zstream.total_out > 0) {
+	storeAppend(entry, (char *) ctx->gzipBuffer, ctx->zstream.total_out);
+    }
+
+    if (ctx->finish) {
+	reply->content_length = ctx->compressedSize;
+	httpHeaderPutSize(&reply->header, HDR_CONTENT_LENGTH, reply->content_length);
+	httpGzipContextFinalize(httpState);
+    } else {
+	httpGzipStreamOutReset(ctx);
+    }
+
+    return GZIP_OK;
+}
+
+/*
+ * Vary key value for Accept-Encoding: the codings the client takes,
+ * lower cased, sorted and without q-values, so spelling and order do
+ * not split one variant into many.
+ */
+char *
+httpGzipVaryValue(const String *accept_encoding)
+{
+    const char *item;
+    const char *pos = NULL;
+    int ilen;
+    char *codings[16];
+    int n = 0, i, j;
+    String out = StringNull;
+    char *result;
+
+    while (strListGetItem(accept_encoding, ',', &item, &ilen, &pos) && n < 16) {
+	const char *q = memchr(item, ';', ilen);
+	int len = q ? q - item : ilen;
+	char *c;
+	while (len > 0 && xisspace(item[len - 1]))
+	    len--;
+	if (len == 0 || httpGzipQZero(item, ilen))
+	    continue;
+	c = xstrndup(item, len + 1);
+	Tolower(c);
+	for (i = 0; i < n && strcmp(codings[i], c) < 0; i++);
+	if (i < n && strcmp(codings[i], c) == 0) {
+	    xfree(c);
+	    continue;
+	}
+	for (j = n; j > i; j--)
+	    codings[j] = codings[j - 1];
+	codings[i] = c;
+	n++;
+    }
+
+    for (i = 0; i < n; i++) {
+	strListAdd(&out, codings[i], ',');
+	xfree(codings[i]);
+    }
+    result = xstrdup(strIsNotNull(out) ? strBuf(out) : "");
+    stringClean(&out);
+    return result;
+}
@@ -1,4 +1,3 @@
-
 #ifndef SQUID_HTTP_GZIP_H
 #define SQUID_HTTP_GZIP_H
 
@@ -10,7 +9,9 @@
 #define GZIP_OK    (0)
 #define GZIP_SYNC  (1)
 
-typedef struct {
+typedef struct _HttpGzipContext HttpGzipContext;
+
+struct _HttpGzipContext {
     z_stream        zstream;
     unsigned char  *gzipBuffer;
     unsigned int    checksum;
@@ -21,8 +22,27 @@ typedef struct {
     unsigned int    lastChunkSize;
 
     int             compression_type;
-    int             flush;  
-} HttpGzipContext;
+    int             flush;
+
+    /*
+     * Hand-off to the compression threads.  While busy a thread owns
+     * the context; owner is cleared if the server side goes away
+     * meanwhile and the context is then freed when the job returns.
+     */
+    HttpStateData  *owner;
+    MemBuf          in;
+    int             busy;
+    int             finish;
+    int             rc;
+    HttpGzipContext *next;
+    iapp_msg        done;
+    struct {
+	int complete;
+	int keep_alive;
+	int buffer_filled;
+	ssize_t len;
+    } resume;
+};
 
 int httpGzipNeed(request_t *request, HttpReply *reply);
 
@@ -40,4 +60,15 @@ int httpGzipStreamOutReset(HttpGzipContext *ctx);
 
 int httpGzipDone(HttpStateData *httpState);
 
+int httpGzipAsync(HttpGzipContext *ctx);
+
+void httpGzipSubmit(HttpGzipContext *ctx, int finish);
+
+int httpGzipCollect(HttpStateData *httpState);
+
+char *httpGzipVaryValue(const String *accept_encoding);
+
+/* in http.c */
+void httpGzipResume(HttpStateData *httpState);
+
 #endif /* SQUID_HTTP_GZIP_H */
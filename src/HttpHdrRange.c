@@ -70,7 +70,7 @@ httpHdrRangeBoundaryStr(clientHttpRequest * http)
     assert(http);
     stringAppend(&b, full_appname_string, strlen(full_appname_string));
     stringAppend(&b, ":", 1);
-    key = storeKeyText(http->entry->hash.key);
+    key = storeKeyText(storeEntryKey(http->entry));
     stringAppend(&b, key, strlen(key));
     return b;
 }
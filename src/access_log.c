@@ -35,6 +35,7 @@
 
 
 #include "squid.h"
+#include "access_log_binary.h"
 
 #if HEADERS_LOG
 static Logfile *headerslog = NULL;
@@ -354,7 +355,10 @@ struct _logformat_token {
     unsigned int space:1;
     unsigned int zero:1;
     int divisor;
-    logformat_token *next;	/* todo: move from linked list to array */
+    size_t len;			/* LFT_STRING: precomputed length */
+    time_t cached_time;		/* LFT_TIME_*: second the cache is for */
+    char *cached;		/* LFT_TIME_*: strftime() result */
+    logformat_token *next;	/* next array element, NULL on the last */
 };
 
 struct logformat_token_table_entry {
@@ -453,6 +457,37 @@ struct logformat_token_table_entry logformat_token_table[] =
     {NULL, LFT_NONE}		/* this must be last */
 };
 
+/*
+ * Integer to decimal without going through the printf machinery.
+ * Returns a pointer into buf.
+ */
+static char *
+accessLogFormatInt(char *buf, size_t size, squid_off_t v)
+{
+    char *p = buf + size;
+    unsigned long long u = v < 0 ? -(unsigned long long) v : (unsigned long long) v;
+
+    *--p = '\0';
+    do {
+	*--p = '0' + (u % 10);
+	u /= 10;
+    } while (u);
+    if (v < 0)
+	*--p = '-';
+    return p;
+}
+
+static void
+accessLogAppendPad(MemBuf * mb, size_t n)
+{
+    static const char spaces[] = "                ";
+    while (n > 0) {
+	size_t c = XMIN(n, sizeof(spaces) - 1);
+	memBufAppend(mb, spaces, c);
+	n -= c;
+    }
+}
+
 static void
 accessLogCustom(AccessLogEntry * al, customlog * log)
 {
@@ -462,6 +497,7 @@ accessLogCustom(AccessLogEntry * al, customlog * log)
     static MemBuf mb = MemBufNULL;
     char tmp[1024];
     String sb = StringNull;
+    size_t l;
 
     memBufReset(&mb);
 
@@ -478,8 +514,9 @@ accessLogCustom(AccessLogEntry * al, customlog * log)
 	    out = "";
 	    break;
 	case LFT_STRING:
-	    out = fmt->data.string;
-	    break;
+	    /* literals never need quoting or padding */
+	    memBufAppend(&mb, fmt->data.string, fmt->len);
+	    continue;
 	case LFT_CLIENT_IP_ADDRESS:
 	    out = inet_ntoa(al->cache.caddr);
 	    break;
@@ -534,7 +571,7 @@ accessLogCustom(AccessLogEntry * al, customlog * log)
 
 	case LFT_TIME_LOCALTIME:
 	case LFT_TIME_GMT:
-	    {
+	    if (fmt->cached_time != squid_curtime || !fmt->cached) {
 		const char *spec;
 		struct tm *t;
 		spec = fmt->data.timespec;
@@ -545,8 +582,11 @@ accessLogCustom(AccessLogEntry * al, customlog * log)
 		else
 		    t = gmtime(&squid_curtime);
 		strftime(tmp, sizeof(tmp), spec, t);
-		out = tmp;
+		safe_free(fmt->cached);
+		fmt->cached = xstrdup(tmp);
+		fmt->cached_time = squid_curtime;
 	    }
+	    out = fmt->cached;
 	    break;
 
 	case LFT_TIME_TO_HANDLE_REQUEST:
@@ -745,8 +785,12 @@ accessLogCustom(AccessLogEntry * al, customlog * log)
 	}
 
 	if (doint) {
-	    snprintf(tmp, sizeof(tmp), "%0*" PRINTF_OFF_T, fmt->zero ? (int) fmt->width : 0, outint);
-	    out = tmp;
+	    if (fmt->zero)
+		snprintf(tmp, sizeof(tmp), "%0*" PRINTF_OFF_T, (int) fmt->width, outint);
+	    else
+		out = accessLogFormatInt(tmp, sizeof(tmp), outint);
+	    if (!out)
+		out = tmp;
 	}
 	if (out && *out) {
 	    if (quote || fmt->quote != LOG_QUOTE_NONE) {
@@ -777,13 +821,12 @@ accessLogCustom(AccessLogEntry * al, customlog * log)
 		    dofree = newfree;
 		}
 	    }
-	    if (fmt->width) {
-		if (fmt->left)
-		    memBufPrintf(&mb, "%-*s", (int) fmt->width, out);
-		else
-		    memBufPrintf(&mb, "%*s", (int) fmt->width, out);
-	    } else
-		memBufAppend(&mb, out, strlen(out));
+	    l = strlen(out);
+	    if (fmt->width > l && !fmt->left)
+		accessLogAppendPad(&mb, fmt->width - l);
+	    memBufAppend(&mb, out, l);
+	    if (fmt->width > l && fmt->left)
+		accessLogAppendPad(&mb, fmt->width - l);
 	} else {
 	    memBufAppend(&mb, "-", 1);
 	}
@@ -793,7 +836,11 @@ accessLogCustom(AccessLogEntry * al, customlog * log)
 	if (dofree)
 	    safe_free(out);
     }
-    logfilePrintf(logfile, "%s\n", mb.buf);
+    /* same limit logfilePrintf() used to impose */
+    if (mb.size > 8191)
+	mb.size = 8191;
+    memBufAppend(&mb, "\n", 1);
+    logfileWrite(logfile, mb.buf, mb.size);
 }
 
 /* parses a single token. Returns the token length in characters,
@@ -947,6 +994,33 @@ accessLogGetNewLogFormatToken(logformat_token * lt, char *def, enum log_quote *q
     return (cur - def);
 }
 
+/*
+ * Second pass over a parsed definition: lay the tokens out in one
+ * array so the formatter walks contiguous memory, and precompute what
+ * does not depend on the request.  The next pointers are kept so the
+ * array can still be walked like the list it came from.
+ */
+static logformat_token *
+accessLogCompileLogFormat(logformat_token * list)
+{
+    logformat_token *t, *next, *prog;
+    int n = 0, i = 0;
+
+    for (t = list; t; t = t->next)
+	n++;
+    prog = xcalloc(n, sizeof(logformat_token));
+    for (t = list; t; t = next) {
+	next = t->next;
+	prog[i] = *t;
+	if (prog[i].type == LFT_STRING)
+	    prog[i].len = strlen(prog[i].data.string);
+	prog[i].next = (i + 1 < n) ? &prog[i + 1] : NULL;
+	i++;
+	xfree(t);
+    }
+    return prog;
+}
+
 int
 accessLogParseLogFormat(logformat_token ** fmt, char *def)
 {
@@ -970,6 +1044,7 @@ accessLogParseLogFormat(logformat_token ** fmt, char *def)
 	last_lt = new_lt;
 	cur += accessLogGetNewLogFormatToken(new_lt, cur, &quote);
     }
+    *fmt = accessLogCompileLogFormat(*fmt);
     return 1;
 }
 
@@ -1066,12 +1141,12 @@ accessLogDumpLogFormat(StoreEntry * entry, const char *name, logformat * definit
 void
 accessLogFreeLogFormat(logformat_token ** tokens)
 {
-    while (*tokens) {
-	logformat_token *token = *tokens;
-	*tokens = token->next;
+    logformat_token *token;
+    for (token = *tokens; token; token = token->next) {
 	safe_free(token->data.string);
-	xfree(token);
+	safe_free(token->cached);
     }
+    safe_free(*tokens);
 }
 
 static void
@@ -1174,6 +1249,65 @@ accessLogCommon(AccessLogEntry * al, Logfile * logfile)
     }
 }
 
+/*
+ * One fixed header plus the raw strings; nothing is escaped or turned
+ * into text here.  See access_log_binary.h for the layout.
+ */
+static void
+accessLogBinary(AccessLogEntry * al, Logfile * logfile)
+{
+    static MemBuf mb = MemBufNULL;
+    access_log_binary_hdr h;
+    const char *str[ALB_NSTR];
+    const char *user;
+    size_t l;
+    int i;
+
+    user = al->cache.authuser;
+    if (!user || !*user)
+	user = al->cache.rfc931;
+#if USE_SSL
+    if (!user || !*user)
+	user = al->cache.ssluser;
+#endif
+    str[ALB_STR_STATUS] = log_tags[al->cache.code];
+    str[ALB_STR_METHOD] = al->private.method_str;
+    str[ALB_STR_URL] = al->url;
+    str[ALB_STR_USER] = user ? user : "";
+    str[ALB_STR_HIERARCHY] = hier_strings[al->hier.code];
+    str[ALB_STR_PEER] = al->hier.host;
+    str[ALB_STR_MIME] = al->http.content_type;
+
+    memset(&h, 0, sizeof(h));
+    h.magic = ALB_MAGIC;
+    h.version = ALB_VERSION;
+    if (al->hier.ping.timedout)
+	h.flags |= ALB_F_TIMEDOUT;
+    h.sec = (unsigned int) current_time.tv_sec;
+    h.usec = (unsigned int) current_time.tv_usec;
+    h.msec = (unsigned int) al->cache.msec;
+    h.caddr = al->cache.caddr.s_addr;
+    h.size = (unsigned long long) al->cache.size;
+    h.rq_size = (unsigned long long) al->cache.rq_size;
+    h.http_code = (unsigned short) al->http.code;
+    h.length = sizeof(h);
+    for (i = 0; i < ALB_NSTR; i++) {
+	l = str[i] ? strlen(str[i]) : 0;
+	if (l > 0xffff)
+	    l = 0xffff;
+	h.len[i] = l;
+	h.length += l;
+    }
+    /* one write per record so it is never split or interleaved */
+    memBufReset(&mb);
+    memBufAppend(&mb, &h, sizeof(h));
+    for (i = 0; i < ALB_NSTR; i++) {
+	if (h.len[i])
+	    memBufAppend(&mb, str[i], h.len[i]);
+    }
+    logfileWrite(logfile, mb.buf, mb.size);
+}
+
 void
 accessLogLog(AccessLogEntry * al, aclCheck_t * checklist)
 {
@@ -1212,6 +1346,9 @@ accessLogLog(AccessLogEntry * al, aclCheck_t * checklist)
 	    case CLF_CUSTOM:
 		accessLogCustom(al, log);
 		break;
+	    case CLF_BINARY:
+		accessLogBinary(al, log->logfile);
+		break;
 	    case CLF_NONE:
 		goto last;
 	    default:
@@ -1290,6 +1427,8 @@ accessLogInit(void)
 	if (log->type == CLF_NONE)
 	    continue;
 	log->logfile = logfileOpen(log->filename, MAX_URL << 2, 1);
+	if (log->type == CLF_BINARY && !log->logfile->flags.binary)
+	    fatalf("access_log %s: the binary format needs a stdio:, udp: or daemon: log with logfile_daemon_ring_size set\n", log->filename);
 	LogfileStatus = LOG_ENABLE;
     }
 #if HEADERS_LOG
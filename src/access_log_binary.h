@@ -0,0 +1,47 @@
+#ifndef __ACCESS_LOG_BINARY_H__
+#define __ACCESS_LOG_BINARY_H__
+
+/*
+ * Record layout of the "binary" access_log format.
+ *
+ * Each record is a fixed header followed by ALB_NSTR strings, each
+ * stored as its length in the header's 'len' array and then the bytes
+ * themselves without any terminator or escaping.  Numbers are stored in
+ * host byte order except the client address which stays in network
+ * order; a decoder on a box of the other endianness sees a swapped
+ * magic.  tools/access_log_decode turns a file of these back into
+ * native squid log lines.
+ */
+
+#define ALB_MAGIC		0x5351	/* "SQ" */
+#define ALB_VERSION		1
+
+#define ALB_F_TIMEDOUT		0x01	/* hierarchy ping timed out */
+
+enum {
+    ALB_STR_STATUS,		/* log tag, e.g. TCP_MISS */
+    ALB_STR_METHOD,
+    ALB_STR_URL,
+    ALB_STR_USER,
+    ALB_STR_HIERARCHY,		/* hierarchy code, e.g. DIRECT */
+    ALB_STR_PEER,		/* hierarchy host */
+    ALB_STR_MIME,
+    ALB_NSTR
+};
+
+typedef struct {
+    unsigned short magic;
+    unsigned char version;
+    unsigned char flags;
+    unsigned int length;	/* whole record including this header */
+    unsigned int sec;
+    unsigned int usec;
+    unsigned int msec;		/* time taken to handle the request */
+    unsigned int caddr;		/* client IPv4 address, network order */
+    unsigned long long size;	/* reply bytes */
+    unsigned long long rq_size;	/* request bytes */
+    unsigned short http_code;
+    unsigned short len[ALB_NSTR];
+} access_log_binary_hdr;
+
+#endif
@@ -219,9 +219,9 @@ authNegotiateInit(authScheme * scheme)
 	 * this patch, the client may fail to authenticate, but squid's
 	 * state will be preserved.
 	 */
-	if (negotiateConfig->authenticate && Config.onoff.pipeline_prefetch != 0) {
+	if (negotiateConfig->authenticate && Config.pipeline_max_prefetch != 0) {
 	    debugs(29, 1, "pipeline prefetching incompatile with Negotiate authentication. Disabling pipeline_prefetch");
-	    Config.onoff.pipeline_prefetch = 0;
+	    Config.pipeline_max_prefetch = 0;
 	}
 	if (!negotiate_user_pool)
 	    negotiate_user_pool = memPoolCreate("Negotiate Scheme User Data", sizeof(negotiate_user_t));
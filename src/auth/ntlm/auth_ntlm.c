@@ -214,9 +214,9 @@ authNTLMInit(authScheme * scheme)
 	 * this patch, the client may fail to authenticate, but squid's
 	 * state will be preserved.
 	 */
-	if (ntlmConfig->authenticate && Config.onoff.pipeline_prefetch != 0) {
+	if (ntlmConfig->authenticate && Config.pipeline_max_prefetch != 0) {
 	    debugs(29, 1, "pipeline prefetching incompatile with NTLM authentication. Disabling pipeline_prefetch");
-	    Config.onoff.pipeline_prefetch = 0;
+	    Config.pipeline_max_prefetch = 0;
 	}
 	if (!ntlm_user_pool)
 	    ntlm_user_pool = memPoolCreate("NTLM Scheme User Data", sizeof(ntlm_user_t));
@@ -65,6 +65,8 @@ static void parse_cachedir_option_minsize(SwapDir * sd, const char *option, cons
 static void dump_cachedir_option_minsize(StoreEntry * e, const char *option, SwapDir * sd);
 static void parse_cachedir_option_maxsize(SwapDir * sd, const char *option, const char *value, int reconfiguring);
 static void dump_cachedir_option_maxsize(StoreEntry * e, const char *option, SwapDir * sd);
+static void parse_cachedir_option_writesize(SwapDir * sd, const char *option, const char *value, int reconfiguring);
+static void dump_cachedir_option_writesize(StoreEntry * e, const char *option, SwapDir * sd);
 static void parse_logformat(logformat ** logformat_definitions);
 static void parse_access_log(customlog ** customlog_definitions);
 static void dump_logformat(StoreEntry * entry, const char *name, logformat * definitions);
@@ -85,6 +87,7 @@ static struct cache_dir_option common_cachedir_options[] =
     {"read-only", parse_cachedir_option_readonly, NULL},
     {"min-size", parse_cachedir_option_minsize, dump_cachedir_option_minsize},
     {"max-size", parse_cachedir_option_maxsize, dump_cachedir_option_maxsize},
+    {"write-size", parse_cachedir_option_writesize, dump_cachedir_option_writesize},
     {NULL, NULL}
 };
 
@@ -140,6 +143,9 @@ static int check_null_https_port_list(const https_port_list *);
 static void parse_rewrite(rewrite ** rewrites);
 static void dump_rewrite(StoreEntry * entry, const char *n, rewrite * reds);
 static void free_rewrite(rewrite ** reds);
+static void parse_rewrite_rules(rewrite_rules ** rules);
+static void dump_rewrite_rules(StoreEntry * entry, const char *n, rewrite_rules * rules);
+static void free_rewrite_rules(rewrite_rules ** rules);
 static void parse_programline(wordlist **);
 static void free_programline(wordlist **);
 static void dump_programline(StoreEntry *, const char *, const wordlist *);
@@ -1156,6 +1162,10 @@ dump_delay_pool_count(StoreEntry * entry, const char *name, delayConfig cfg)
 	    storeAppendPrintf(entry, " %d/%d",
 		cfg.rates[i]->individual.restore_bps,
 		cfg.rates[i]->individual.max_bytes);
+	if (cfg.class[i] >= 4)
+	    storeAppendPrintf(entry, " %d/%d",
+		cfg.rates[i]->connection.restore_bps,
+		cfg.rates[i]->connection.max_bytes);
 	if (cfg.class[i] >= 1)
 	    storeAppendPrintf(entry, "\n");
     }
@@ -1169,6 +1179,10 @@ parse_delay_pool_count(delayConfig * cfg)
 	free_delay_pool_count(cfg);
     }
     parse_ushort(&cfg->pools);
+    if (cfg->pools > DELAY_MAX_POOLS) {
+	debugs(3, 0, "parse_delay_pool_count: limiting delay_pools %d to %d", cfg->pools, DELAY_MAX_POOLS);
+	cfg->pools = DELAY_MAX_POOLS;
+    }
     if (cfg->pools) {
 	delayInitDelayData(cfg->pools);
 	cfg->class = xcalloc(cfg->pools, sizeof(u_char));
@@ -1188,8 +1202,8 @@ parse_delay_pool_class(delayConfig * cfg)
 	return;
     }
     parse_ushort(&class);
-    if (class < 1 || class > 3) {
-	debugs(3, 0, "parse_delay_pool_class: Ignoring pool %d class %d not in 1 .. 3", pool, class);
+    if (class < 1 || class > 4) {
+	debugs(3, 0, "parse_delay_pool_class: Ignoring pool %d class %d not in 1 .. 4", pool, class);
 	return;
     }
     pool--;
@@ -1205,6 +1219,8 @@ parse_delay_pool_class(delayConfig * cfg)
 	cfg->rates[pool]->network.restore_bps = cfg->rates[pool]->network.max_bytes = -1;
     if (cfg->class[pool] >= 2)
 	cfg->rates[pool]->individual.restore_bps = cfg->rates[pool]->individual.max_bytes = -1;
+    if (cfg->class[pool] >= 4)
+	cfg->rates[pool]->connection.restore_bps = cfg->rates[pool]->connection.max_bytes = -1;
     delayCreateDelayPool(pool, class);
 }
 
@@ -1241,8 +1257,8 @@ parse_delay_pool_rates(delayConfig * cfg)
 	ptr++;
     }
     class = cfg->class[pool];
-    /* if class is 3, swap around network and individual */
-    if (class == 3) {
+    /* if class is 3 or 4, swap around network and individual */
+    if (class >= 3) {
 	delaySpec tmp;
 
 	tmp = cfg->rates[pool]->individual;
@@ -1648,6 +1664,7 @@ parse_cachedir(cacheSwap * swap)
     /* defaults in case fs implementation fails to set these */
     sd->min_objsize = 0;
     sd->max_objsize = -1;
+    sd->write_size = STORE_SWAPOUT_WRITE_SZ;
     sd->fs.blksize = 1024;
     /* parse the FS parameters and options */
     storefs_list[fs].parsefunc(sd, swap->n_configured, path_str);
@@ -1720,6 +1737,56 @@ dump_cachedir_option_maxsize(StoreEntry * e, const char *option, SwapDir * sd)
 	storeAppendPrintf(e, " %s=%ld", option, (long int) sd->max_objsize);
 }
 
+static void
+parse_cachedir_option_writesize(SwapDir * sd, const char *option, const char *value, int reconfiguring)
+{
+    squid_off_t size;
+    char *end;
+    double d;
+
+    if (!value)
+	self_destruct();
+
+    d = strtod(value, &end);
+    if (end == value || d <= 0)
+	self_destruct();
+    switch (xtoupper(*end)) {
+    case 'K':
+	d *= 1 << 10;
+	end++;
+	break;
+    case 'M':
+	d *= 1 << 20;
+	end++;
+	break;
+    }
+    if (xtoupper(*end) == 'B')
+	end++;
+    if (*end != '\0')
+	self_destruct();
+    if (d > STORE_SWAPOUT_WRITE_MAX)
+	fatalf("cache_dir %s: write-size %s is larger than %d bytes\n", sd->path, value, STORE_SWAPOUT_WRITE_MAX);
+    size = (squid_off_t) d;
+    if (size != d || size % SM_PAGE_SIZE != 0)
+	fatalf("cache_dir %s: write-size %s is not a multiple of %d bytes\n", sd->path, value, SM_PAGE_SIZE);
+    if (strcmp(sd->type, "coss") == 0) {
+	debugs(3, 0, "WARNING: cache_dir %s: coss writes whole stripes, ignoring write-size", sd->path);
+	return;
+    }
+
+    if (reconfiguring && sd->write_size != (size_t) size)
+	debugs(3, 1, "Cache dir '%s' write size now %ld", sd->path, (long int) size);
+
+    sd->write_size = (size_t) size;
+}
+
+static void
+dump_cachedir_option_writesize(StoreEntry * e, const char *option, SwapDir * sd)
+{
+    if (sd->write_size != STORE_SWAPOUT_WRITE_SZ)
+	storeAppendPrintf(e, " %s=%ld", option, (long int) sd->write_size);
+}
+
 void
 parse_cachedir_options(SwapDir * sd, struct cache_dir_option *options, int reconfiguring)
 {
@@ -2929,6 +2996,52 @@ dump_uri_whitespace(StoreEntry * entry, const char *name, int var)
     storeAppendPrintf(entry, "%s %s\n", name, s);
 }
 
+#define free_pconn_order free_int
+
+static void
+parse_pconn_order(int *var)
+{
+    char *token = strtok(NULL, w_space);
+    if (token == NULL)
+	self_destruct();
+    if (!strcasecmp(token, "lifo"))
+	*var = PCONN_ORDER_LIFO;
+    else if (!strcasecmp(token, "fifo"))
+	*var = PCONN_ORDER_FIFO;
+    else
+	self_destruct();
+}
+
+static void
+dump_pconn_order(StoreEntry * entry, const char *name, int var)
+{
+    storeAppendPrintf(entry, "%s %s\n", name, var == PCONN_ORDER_FIFO ? "fifo" : "lifo");
+}
+
+#define free_pipeline_prefetch free_int
+
+static void
+parse_pipeline_prefetch(int *var)
+{
+    char *token = strtok(NULL, w_space);
+    if (token == NULL)
+	self_destruct();
+    if (!strcasecmp(token, "on"))
+	*var = 1;
+    else if (!strcasecmp(token, "off"))
+	*var = 0;
+    else if (xisdigit(*token))
+	*var = atoi(token);
+    else
+	self_destruct();
+}
+
+static void
+dump_pipeline_prefetch(StoreEntry * entry, const char *name, int var)
+{
+    storeAppendPrintf(entry, "%s %d\n", name, var);
+}
+
 static void
 free_removalpolicy(RemovalPolicySettings ** settings)
 {
@@ -3208,6 +3321,20 @@ parse_http_port_option(http_port_list * s, char *token)
 	s->allow_direct = 1;
     } else if (strcmp(token, "http11") == 0) {
 	s->http11 = 1;
+    } else if (strcmp(token, "worker-queues") == 0) {
+	s->worker_queues = 1;
+    } else if (strcmp(token, "defer-accept") == 0) {
+	s->defer_accept = 30;
+    } else if (strncmp(token, "defer-accept=", 13) == 0) {
+	s->defer_accept = xatoi(token + 13);
+	if (s->defer_accept < 1)
+	    self_destruct();
+    } else if (strcmp(token, "tcp-fastopen") == 0) {
+	s->tcp_fastopen = 100;
+    } else if (strncmp(token, "tcp-fastopen=", 13) == 0) {
+	s->tcp_fastopen = xatoi(token + 13);
+	if (s->tcp_fastopen < 1)
+	    self_destruct();
     } else if (strcmp(token, "tcpkeepalive") == 0) {
 	s->tcp_keepalive.enabled = 1;
     } else if (strncmp(token, "tcpkeepalive=", 13) == 0) {
@@ -3309,6 +3436,12 @@ dump_generic_http_port(StoreEntry * e, const char *n, const http_port_list * s)
 	storeAppendPrintf(e, " tproxy");
     if (s->http11)
 	storeAppendPrintf(e, " http11");
+    if (s->worker_queues)
+	storeAppendPrintf(e, " worker-queues");
+    if (s->defer_accept)
+	storeAppendPrintf(e, " defer-accept=%d", s->defer_accept);
+    if (s->tcp_fastopen)
+	storeAppendPrintf(e, " tcp-fastopen=%d", s->tcp_fastopen);
     if (s->tcp_keepalive.enabled) {
 	if (s->tcp_keepalive.idle || s->tcp_keepalive.interval || s->tcp_keepalive.timeout) {
 	    storeAppendPrintf(e, " tcp_keepalive=%d,%d,%d", s->tcp_keepalive.idle, s->tcp_keepalive.interval, s->tcp_keepalive.timeout);
@@ -3635,6 +3768,8 @@ parse_access_log(customlog ** logs)
 	cl->type = CLF_SQUID;
     } else if (strcmp(logdef_name, "common") == 0) {
 	cl->type = CLF_COMMON;
+    } else if (strcmp(logdef_name, "binary") == 0) {
+	cl->type = CLF_BINARY;
     } else {
 	debugs(3, 0, "Log format '%s' is not defined", logdef_name);
 	self_destruct();
@@ -3673,6 +3808,9 @@ dump_access_log(StoreEntry * entry, const char *name, customlog * logs)
 	case CLF_COMMON:
 	    storeAppendPrintf(entry, "%s squid", log->filename);
 	    break;
+	case CLF_BINARY:
+	    storeAppendPrintf(entry, "%s binary", log->filename);
+	    break;
 	case CLF_AUTO:
 	    if (log->aclList)
 		storeAppendPrintf(entry, "%s auto", log->filename);
@@ -3789,6 +3927,127 @@ free_rewrite(rewrite ** reds)
     }
 }
 
+static void
+parse_rewrite_rules(rewrite_rules ** rules)
+{
+    char *token;
+    char *t;
+    rewrite_rule *rule;
+    rewrite_rules *r;
+    int errcode;
+
+    if ((token = strtok(NULL, w_space)) == NULL)
+	self_destruct();
+    rule = (rewrite_rule *) xcalloc(1, sizeof(*rule));
+    if (!strcmp(token, "host"))
+	rule->type = REWRITE_RULE_HOST;
+    else if (!strcmp(token, "prefix"))
+	rule->type = REWRITE_RULE_PREFIX;
+    else if (!strcmp(token, "regex"))
+	rule->type = REWRITE_RULE_REGEX;
+    else {
+	debugs(3, 0, "parse_rewrite_rules: unknown rule type '%s'", token);
+	self_destruct();
+    }
+    if ((token = strtok(NULL, w_space)) != NULL && !strcmp(token, "-i")) {
+	rule->icase = 1;
+	token = strtok(NULL, w_space);
+    }
+    if (token == NULL)
+	self_destruct();
+    rule->pattern = xstrdup(token);
+    rule->pattern_len = strlen(token);
+    if (rule->type == REWRITE_RULE_HOST) {
+	/* request hosts are always lower case */
+	for (t = rule->pattern; *t; t++)
+	    *t = xtolower(*t);
+    } else if (rule->type == REWRITE_RULE_REGEX) {
+	if ((errcode = regcomp(&rule->regex, rule->pattern,
+		    REG_EXTENDED | (rule->icase ? REG_ICASE : 0))) != 0) {
+	    char errbuf[256];
+	    regerror(errcode, &rule->regex, errbuf, sizeof errbuf);
+	    debugs(3, 0, "parse_rewrite_rules: Invalid regular expression '%s': %s",
+		rule->pattern, errbuf);
+	    self_destruct();
+	}
+    }
+    if ((token = strtok(NULL, w_space)) == NULL)
+	self_destruct();
+    if (strcmp(token, "-")) {
+	if ((rule->tokens = rewriteURLCompile(token)) == NULL) {
+	    debugs(3, 0, "parse_rewrite_rules: Invalid destination URL '%s'", token);
+	    self_destruct();
+	}
+	rule->dsturl = xstrdup(token);
+    }
+    aclParseAclList(&rule->aclList);
+
+    if ((r = *rules) == NULL) {
+	r = *rules = (rewrite_rules *) xcalloc(1, sizeof(*r));
+	r->tail = &r->head;
+	r->match_tail = &r->match;
+    }
+    rule->index = r->count++;
+    *r->tail = rule;
+    r->tail = &rule->next;
+    if (rule->type == REWRITE_RULE_HOST) {
+	rewrite_rule *prev;
+	if (r->hosts == NULL)
+	    r->hosts = hash_create((HASHCMP *) strcmp, 229, hash4);
+	if ((prev = hash_lookup(r->hosts, rule->pattern)) != NULL) {
+	    while (prev->host_next)
+		prev = prev->host_next;
+	    prev->host_next = rule;
+	} else {
+	    rule->hash.key = rule->pattern;
+	    hash_join(r->hosts, &rule->hash);
+	}
+    } else {
+	*r->match_tail = rule;
+	r->match_tail = &rule->match_next;
+    }
+}
+
+static void
+dump_rewrite_rules(StoreEntry * entry, const char *n, rewrite_rules * rules)
+{
+    rewrite_rule *rule;
+
+    if (rules == NULL)
+	return;
+    for (rule = rules->head; rule != NULL; rule = rule->next) {
+	storeAppendPrintf(entry, "%s %s %s%s %s", n, rewriteRuleTypeStr(rule->type),
+	    rule->icase ? "-i " : "", rule->pattern,
+	    rule->dsturl ? rule->dsturl : "-");
+	dump_acl_list(entry, rule->aclList);
+	storeAppendPrintf(entry, "\n");
+    }
+}
+
+static void
+free_rewrite_rules(rewrite_rules ** rules)
+{
+    rewrite_rules *r = *rules;
+
+    if (r == NULL)
+	return;
+    while (r->head) {
+	rewrite_rule *rule = r->head;
+	r->head = rule->next;
+	if (rule->type == REWRITE_RULE_REGEX)
+	    regfree(&rule->regex);
+	safe_free(rule->pattern);
+	safe_free(rule->dsturl);
+	rewriteURLFree(rule->tokens);
+	aclDestroyAclList(&rule->aclList);
+	xfree(rule);
+    }
+    if (r->hosts)
+	hashFreeMemory(r->hosts);
+    xfree(r);
+    *rules = NULL;
+}
+
 static void
 parse_zph_mode(enum zph_mode *mode)
 {
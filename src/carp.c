@@ -42,11 +42,86 @@ static int n_carp_peers = 0;
 static peer **carp_peers = NULL;
 static OBJH carpCachemgr;
 
+/*
+ * Maglev lookup table (carp_maglev).  Each slot holds an index into
+ * carp_peers; a URL hashes straight to a slot.
+ */
+static unsigned short *carp_table = NULL;
+static int carp_table_size = 0;
+static char *carp_tried = NULL;
+
+static const int carp_table_primes[] =
+{
+    251, 509, 1021, 2039, 4093, 8191, 16381, 32749, 65521, 0
+};
+
 static int
 peerSortWeight(const void *a, const void *b)
 {
     const peer *const *p1 = a, *const *p2 = b;
-    return (*p1)->weight - (*p2)->weight;
+    /* tie break on the name so every process builds the same table */
+    if ((*p1)->weight != (*p2)->weight)
+	return (*p1)->weight - (*p2)->weight;
+    return strcmp((*p1)->name, (*p2)->name);
+}
+
+static unsigned int
+carpMix(unsigned int h)
+{
+    h += h * 0x62531965;
+    return ROTATE_LEFT(h, 21);
+}
+
+static void
+carpTableBuild(void)
+{
+    int *pos, *skip, *credit;
+    int filled = 0;
+    int wmax = 0;
+    int k, i;
+
+    safe_free(carp_table);
+    safe_free(carp_tried);
+    carp_table_size = 0;
+    if (!Config.onoff.carp_maglev || n_carp_peers == 0)
+	return;
+    for (i = 0; carp_table_primes[i + 1] && carp_table_primes[i] < 100 * n_carp_peers; i++);
+    carp_table_size = carp_table_primes[i];
+    carp_table = xmalloc(carp_table_size * sizeof(*carp_table));
+    memset(carp_table, 0xff, carp_table_size * sizeof(*carp_table));
+    carp_tried = xcalloc(n_carp_peers, 1);
+    pos = xcalloc(n_carp_peers, sizeof(*pos));
+    skip = xcalloc(n_carp_peers, sizeof(*skip));
+    credit = xcalloc(n_carp_peers, sizeof(*credit));
+    for (k = 0; k < n_carp_peers; k++) {
+	unsigned int h = carp_peers[k]->carp.hash;
+	pos[k] = h % carp_table_size;
+	skip[k] = carpMix(h ^ 0x5bd1e995) % (carp_table_size - 1) + 1;
+	if (carp_peers[k]->weight > wmax)
+	    wmax = carp_peers[k]->weight;
+    }
+    /*
+     * Peers take turns claiming their next free preferred slot.  Each
+     * round a peer earns its weight in credit and claims one slot per
+     * wmax credit, so slot counts follow the weights.
+     */
+    while (filled < carp_table_size) {
+	for (k = 0; k < n_carp_peers && filled < carp_table_size; k++) {
+	    credit[k] += carp_peers[k]->weight;
+	    while (credit[k] >= wmax && filled < carp_table_size) {
+		credit[k] -= wmax;
+		while (carp_table[pos[k]] != 0xffff)
+		    pos[k] = (pos[k] + skip[k]) % carp_table_size;
+		carp_table[pos[k]] = k;
+		pos[k] = (pos[k] + skip[k]) % carp_table_size;
+		filled++;
+	    }
+	}
+    }
+    xfree(pos);
+    xfree(skip);
+    xfree(credit);
+    debugs(39, 2, "carpTableBuild: %d slots for %d parents", carp_table_size, n_carp_peers);
 }
 
 void
@@ -65,6 +140,9 @@ carpInit(void)
     }
     safe_free(carp_peers);
     n_carp_peers = 0;
+    safe_free(carp_table);
+    safe_free(carp_tried);
+    carp_table_size = 0;
     /* find out which peers we have */
     for (p = Config.peers; p; p = p->next) {
 	if (!p->options.carp)
@@ -122,9 +200,63 @@ carpInit(void)
 	X_last = p->carp.load_multiplier;
 	P_last = p->carp.load_factor;
     }
+    carpTableBuild();
     cachemgrRegister("carp", "CARP information", carpCachemgr, NULL, NULL, 0, 1, 0);
 }
 
+/*
+ * carp_bounded_load: is tp carrying more than its share of the
+ * connections currently open to all CARP parents?
+ */
+static int
+carpOverloaded(const peer * tp, int total_conns)
+{
+    double limit;
+    if (Config.carp_bounded_load <= 0)
+	return 0;
+    limit = ceil(Config.carp_bounded_load / 100.0 * (total_conns + 1) * tp->carp.load_factor);
+    return tp->stats.conn_open >= limit;
+}
+
+static int
+carpTotalConns(void)
+{
+    int k;
+    int total = 0;
+    if (Config.carp_bounded_load <= 0)
+	return 0;
+    for (k = 0; k < n_carp_peers; k++)
+	total += carp_peers[k]->stats.conn_open;
+    return total;
+}
+
+static peer *
+carpTableSelect(request_t * request, unsigned int user_hash)
+{
+    int slot = carpMix(user_hash) % carp_table_size;
+    int n_tried = 0;
+    int total_conns = carpTotalConns();
+    int i;
+    peer *fallback = NULL;
+    memset(carp_tried, 0, n_carp_peers);
+    for (i = 0; i < carp_table_size && n_tried < n_carp_peers; i++) {
+	int k = carp_table[(slot + i) % carp_table_size];
+	peer *tp = carp_peers[k];
+	if (carp_tried[k])
+	    continue;
+	carp_tried[k] = 1;
+	n_tried++;
+	if (!peerHTTPOkay(tp, request))
+	    continue;
+	if (!carpOverloaded(tp, total_conns))
+	    return tp;
+	debugs(39, 3, "carpSelectParent: %s overloaded (%d open)", tp->name, tp->stats.conn_open);
+	if (fallback == NULL)
+	    fallback = tp;
+    }
+    return fallback;
+}
+
 peer *
 carpSelectParent(request_t * request)
 {
@@ -132,11 +264,14 @@ carpSelectParent(request_t * request)
     const char *c;
     peer *p = NULL;
     peer *tp;
+    peer *fallback = NULL;
     unsigned int user_hash = 0;
     unsigned int combined_hash;
     double score;
     double high_score = 0;
+    double fallback_score = 0;
     const char *key = NULL;
+    int total_conns;
 
     if (n_carp_peers == 0)
 	return NULL;
@@ -147,6 +282,13 @@ carpSelectParent(request_t * request)
     debugs(39, 2, "carpSelectParent: Calculating hash for %s", key);
     for (c = key; *c != 0; c++)
 	user_hash += ROTATE_LEFT(user_hash, 19) + *c;
+    if (carp_table) {
+	p = carpTableSelect(request, user_hash);
+	if (p)
+	    debugs(39, 2, "carpSelectParent: selected %s", p->name);
+	return p;
+    }
+    total_conns = carpTotalConns();
     /* select peer */
     for (k = 0; k < n_carp_peers; k++) {
 	tp = carp_peers[k];
@@ -157,10 +299,19 @@ carpSelectParent(request_t * request)
 	debugs(39, 3, "carpSelectParent: %s combined_hash %u score %.0f",
 	    tp->name, combined_hash, score);
 	if ((score > high_score) && peerHTTPOkay(tp, request)) {
+	    if (carpOverloaded(tp, total_conns)) {
+		if (score > fallback_score) {
+		    fallback = tp;
+		    fallback_score = score;
+		}
+		continue;
+	    }
 	    p = tp;
 	    high_score = score;
 	}
     }
+    if (p == NULL)
+	p = fallback;
     if (p)
 	debugs(39, 2, "carpSelectParent: selected %s", p->name);
     return p;
@@ -171,19 +322,38 @@ carpCachemgr(StoreEntry * sentry, void* data)
 {
     peer *p;
     int sumfetches = 0;
-    storeAppendPrintf(sentry, "%24s %10s %10s %10s %10s\n",
+    int k, i;
+    int *slots = NULL;
+    if (carp_table) {
+	storeAppendPrintf(sentry, "Maglev table: %d slots\n", carp_table_size);
+	slots = xcalloc(n_carp_peers, sizeof(*slots));
+	for (i = 0; i < carp_table_size; i++)
+	    slots[carp_table[i]]++;
+    }
+    if (Config.carp_bounded_load > 0)
+	storeAppendPrintf(sentry, "Bounded load: %d%%\n", Config.carp_bounded_load);
+    storeAppendPrintf(sentry, "%24s %10s %10s %10s %10s %10s %10s\n",
 	"Hostname",
 	"Hash",
 	"Multiplier",
 	"Factor",
-	"Actual");
+	"Actual",
+	"Slots",
+	"Open");
     for (p = Config.peers; p; p = p->next)
 	sumfetches += p->stats.fetches;
     for (p = Config.peers; p; p = p->next) {
-	storeAppendPrintf(sentry, "%24s %10x %10f %10f %10f\n",
+	int n_slots = 0;
+	for (k = 0; slots && k < n_carp_peers; k++)
+	    if (carp_peers[k] == p)
+		n_slots = slots[k];
+	storeAppendPrintf(sentry, "%24s %10x %10f %10f %10f %10d %10d\n",
 	    p->name, p->carp.hash,
 	    p->carp.load_multiplier,
 	    p->carp.load_factor,
-	    sumfetches ? (double) p->stats.fetches / sumfetches : -1.0);
+	    sumfetches ? (double) p->stats.fetches / sumfetches : -1.0,
+	    n_slots,
+	    p->stats.conn_open);
     }
+    safe_free(slots);
 }
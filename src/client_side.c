@@ -55,6 +55,12 @@
 
 #include "../libmutiprocess/ipcsupport.h"
 
+#if defined(_SQUID_LINUX_)
+#include <sys/sendfile.h>
+#define USE_CLIENT_SENDFILE 1
+/* bytes per sendfile() call, so one big hit can't hog the event loop */
+#define CLIENT_SENDFILE_CHUNK (256 * 1024)
+#endif
 
 #if LINGERING_CLOSE
 #define comm_close comm_lingering_close
@@ -70,6 +76,7 @@ static const char *const crlf = "\r\n";
 static CWCB clientWriteComplete;
 static CWCB clientWriteBodyComplete;
 static PF clientReadRequest;
+static int clientParseRequests(ConnStateData * conn);
 static PF requestTimeout;
 static int clientCheckTransferDone(clientHttpRequest *);
 static int clientGotNotEnough(clientHttpRequest *);
@@ -91,6 +98,10 @@ static void httpsAcceptSSL(ConnStateData * connState, SSL_CTX * sslContext);
 #endif
 static int varyEvaluateMatch(StoreEntry * entry, request_t * request);
 static int clientCheckBeginForwarding(clientHttpRequest * http);
+#if USE_CLIENT_SENDFILE
+static int clientSendfileStart(clientHttpRequest * http);
+static PF clientSendfileWrite;
+#endif
 
 #if USE_IDENT
 static void
@@ -168,7 +179,7 @@ checkNegativeHit(StoreEntry * e)
 {
     if (!EBIT_TEST(e->flags, ENTRY_NEGCACHED))
 	return 0;
-    if (e->expires <= squid_curtime)
+    if (STORE_TIME(e->expires) <= squid_curtime)
 	return 0;
     if (e->store_status != STORE_OK)
 	return 0;
@@ -179,6 +190,7 @@ static void
 clientUpdateCounters(clientHttpRequest * http)
 {
     int svc_time = tvSubMsec(http->start, current_time);
+    int svc_usec = tvSubUsec(http->start, current_time);
     ping_data *i;
     HierarchyLogEntry *H;
     statCounter.client_http.requests++;
@@ -191,6 +203,7 @@ clientUpdateCounters(clientHttpRequest * http)
     if (http->request->err_type != ERR_NONE)
 	statCounter.client_http.errors++;
     statHistCount(&statCounter.client_http.all_svc_time, svc_time);
+    latencyRecord(LATENCY_ALL, svc_usec);
     /*
      * The idea here is not to be complete, but to get service times
      * for only well-defined types.  For example, we don't include
@@ -200,18 +213,22 @@ clientUpdateCounters(clientHttpRequest * http)
     switch (http->log_type) {
     case LOG_TCP_REFRESH_HIT:
 	statHistCount(&statCounter.client_http.nh_svc_time, svc_time);
+	latencyRecord(LATENCY_NEAR_MISS, svc_usec);
 	break;
     case LOG_TCP_IMS_HIT:
 	statHistCount(&statCounter.client_http.nm_svc_time, svc_time);
+	latencyRecord(LATENCY_NEAR_MISS, svc_usec);
 	break;
     case LOG_TCP_HIT:
     case LOG_TCP_MEM_HIT:
     case LOG_TCP_OFFLINE_HIT:
 	statHistCount(&statCounter.client_http.hit_svc_time, svc_time);
+	latencyRecord(LATENCY_HIT, svc_usec);
 	break;
     case LOG_TCP_MISS:
     case LOG_TCP_CLIENT_REFRESH_MISS:
 	statHistCount(&statCounter.client_http.miss_svc_time, svc_time);
+	latencyRecord(LATENCY_MISS, svc_usec);
 	break;
     default:
 	/* make compiler warnings go away */
@@ -458,7 +475,7 @@ clientInterpretRequestHeaders(clientHttpRequest * http)
     }
     if (http->conn->port->no_connection_auth)
 	request->flags.no_connection_auth = 1;
-    if (Config.onoff.pipeline_prefetch)
+    if (Config.pipeline_max_prefetch)
 	request->flags.no_connection_auth = 1;
 
     /* ignore range header in non-GETs */
@@ -723,7 +740,7 @@ clientBuildReplyHeader(clientHttpRequest * http, HttpReply * rep)
 	    if (EBIT_TEST(http->entry->flags, ENTRY_SPECIAL)) {
 		httpHeaderDelById(hdr, HDR_DATE);
 		httpHeaderInsertTime(hdr, 0, HDR_DATE, squid_curtime);
-	    } else if (http->entry->timestamp < 0) {
+	    } else if (STORE_TIME(http->entry->timestamp) < 0) {
 		(void) 0;
 	    } else if (http->conn->port->act_as_origin) {
 		HttpHeaderEntry *h = httpHeaderFindEntry(hdr, HDR_DATE);
@@ -732,18 +749,18 @@ clientBuildReplyHeader(clientHttpRequest * http, HttpReply * rep)
 		httpHeaderDelById(hdr, HDR_DATE);
 		httpHeaderInsertTime(hdr, 0, HDR_DATE, squid_curtime);
 		h = httpHeaderFindEntry(hdr, HDR_EXPIRES);
-		if (h && http->entry->expires >= 0) {
+		if (h && STORE_TIME(http->entry->expires) >= 0) {
 		    httpHeaderPutExt(hdr, "X-Origin-Expires", strBuf2(h->value), strLen2(h->value));
 		    httpHeaderDelById(hdr, HDR_EXPIRES);
-		    httpHeaderInsertTime(hdr, 1, HDR_EXPIRES, squid_curtime + http->entry->expires - http->entry->timestamp);
+		    httpHeaderInsertTime(hdr, 1, HDR_EXPIRES, squid_curtime + STORE_TIME(http->entry->expires) - STORE_TIME(http->entry->timestamp));
 		} {
 		    char age[64];
-		    snprintf(age, sizeof(age), "%ld", (long int) squid_curtime - http->entry->timestamp);
+		    snprintf(age, sizeof(age), "%ld", (long int) squid_curtime - STORE_TIME(http->entry->timestamp));
 		    httpHeaderPutExt(hdr, "X-Cache-Age", age, -1);
 		}
-	    } else if (http->entry->timestamp < squid_curtime) {
+	    } else if (STORE_TIME(http->entry->timestamp) < squid_curtime) {
 		httpHeaderPutInt(hdr, HDR_AGE,
-		    squid_curtime - http->entry->timestamp);
+		    squid_curtime - STORE_TIME(http->entry->timestamp));
 	    }
 	    if (!httpHeaderHas(hdr, HDR_CONTENT_LENGTH) && http->entry->mem_obj && http->entry->store_status == STORE_OK) {
 		rep->content_length = contentLen(http->entry);
@@ -1233,7 +1250,7 @@ clientProcessHit(clientHttpRequest * http)
     StoreEntry *e = http->entry;
 
     if (is_modified == 0) {
-	time_t timestamp = e->timestamp;
+	time_t timestamp = STORE_TIME(e->timestamp);
 	MemBuf mb = httpPacked304Reply(e->mem_obj->reply, http->conn->port->http11);
 	http->log_type = LOG_TCP_IMS_HIT;
 	storeClientUnregister(http->sc, e, http);
@@ -1247,7 +1264,7 @@ clientProcessHit(clientHttpRequest * http)
 	http->entry = e;
 	httpReplyParse(e->mem_obj->reply, mb.buf, mb.size);
 	storeTimestampsSet(e);
-	e->timestamp = timestamp;
+	e->timestamp = storeTimeOffset(timestamp);
 	storeAppend(e, mb.buf, mb.size);
 	memBufClean(&mb);
 	storeComplete(e);
@@ -1676,9 +1693,11 @@ clientCheckHeaderDone(clientHttpRequest * http)
 	/* Only GET requests should have ranges */
 	assert(http->request->method != NULL);
 	assert(http->request->method->code == METHOD_GET);
+	ClientBody b;
+	clientBodyInit(&b, &mb, NULL, 0);
 	/* clientPackMoreRanges() updates http->out.offset */
 	/* force the end of the transfer if we are done */
-	if (!clientPackMoreRanges(http, "", 0, &mb))
+	if (!clientPackMoreRanges(http, "", 0, &b))
 	    http->flags.done_copying = 1;
     }
     /* write headers and initial body */
@@ -1709,6 +1728,9 @@ clientSendMoreData(void *data, mem_node_ref ref, ssize_t size)
     ConnStateData *conn = http->conn;
     int fd = conn->fd;
     MemBuf mb;
+    ClientBody b;
+    struct iovec *iov;
+    int iovcnt;
     debugs(33, 5, "clientSendMoreData: %s, %d bytes", http->uri, (int) size);
     assert(size + ref.offset <= SM_PAGE_SIZE);
     assert(size <= SM_PAGE_SIZE);
@@ -1720,7 +1742,7 @@ clientSendMoreData(void *data, mem_node_ref ref, ssize_t size)
     assert(conn->reqs.head != NULL);
     if (DLINK_HEAD(conn->reqs) != http) {
 	/* there is another object in progress, defer this one */
-	debugs(33, 1, "clientSendMoreData: Deferring %s", storeUrl(entry));
+	debugs(33, 2, "clientSendMoreData: Deferring %s", storeUrl(entry));
 	stmemNodeUnref(&ref);
 	return;
     } else if (size < 0) {
@@ -1761,30 +1783,39 @@ clientSendMoreData(void *data, mem_node_ref ref, ssize_t size)
 	 */
 	http->request->flags.proxy_keepalive = 0;
     }
-    /* init mb; put status line and headers if any */
-    memBufDefInit(&mb);
+    /*
+     * Range parts and chunks are written as segments: generated text
+     * from a small MemBuf, the data straight from the page, which we
+     * hold on to until clientWriteBodyComplete().  body_iov[0] is kept
+     * for the chunk header.
+     */
+    mb = MemBufNull;
+    clientBodyInit(&b, &mb, http->body_iov + 1, COMM_WRITEV_MAX - 1);
     if (http->request->range) {
 	/* Only GET requests should have ranges */
 	assert(http->request->method->code == METHOD_GET);
 	/* clientPackMoreRanges() updates http->out.offset */
 	/* force the end of the transfer if we are done */
-	if (!clientPackMoreRanges(http, buf, size, &mb))
+	if (!clientPackMoreRanges(http, buf, size, &b))
 	    http->flags.done_copying = 1;
     } else {
 	http->out.offset += size;
-	memBufAppend(&mb, buf, size);
+	clientBodyRef(&b, buf, size);
     }
-    /* write body */
-    if (http->request->flags.chunked_response) {
-	char header[32];
-	size_t header_size;
-	header_size = snprintf(header, sizeof(header), "%x\r\n", mb.size);
-	memBufAppend(&mb, "\r\n", 2);
-	comm_write_mbuf_header(fd, mb, header, header_size, clientWriteComplete, http);
-    } else {
-	comm_write_mbuf(fd, mb, clientWriteComplete, http);
+    iov = http->body_iov + 1;
+    if (http->request->flags.chunked_response && clientBodySize(&b) > 0) {
+	iov = http->body_iov;
+	iov->iov_base = http->chunk_hdr;
+	iov->iov_len = snprintf(http->chunk_hdr, sizeof(http->chunk_hdr), "%x\r\n", (int) clientBodySize(&b));
+	clientBodyRef(&b, crlf, 2);
     }
-    stmemNodeUnref(&ref);
+    iovcnt = clientBodyFinish(&b) + (iov == http->body_iov);
+    /* write body */
+    http->nr = ref;
+    if (memBufIsNull(&mb))
+	comm_writev(fd, iov, iovcnt, clientWriteBodyComplete, http, NULL, NULL);
+    else
+	comm_writev(fd, iov, iovcnt, clientWriteBodyComplete, http, mb.buf, memBufFreeFunc(&mb));
 }
 
 /*
@@ -1805,17 +1836,134 @@ clientWriteBodyComplete(int fd, char *buf, size_t size, int errflag, void *data)
     clientWriteComplete(fd, NULL, size, errflag, data);
 }
 
+#if USE_CLIENT_SENDFILE
+/*
+ * The cache file to sendfile() the rest of the body from, or -1 when
+ * this reply has to go through the store client.  The body is sent
+ * untouched, so the object must be complete on disk and the reply
+ * must not be sliced into ranges or chunks.
+ */
+static int
+clientSendfileFd(clientHttpRequest * http)
+{
+    StoreEntry *e = http->entry;
+    store_client *sc = http->sc;
+    if (!Config.onoff.client_sendfile)
+	return -1;
+    if (http->request->range || http->request->flags.chunked_response)
+	return -1;
+    if (http->request->method->code == METHOD_HEAD || http->flags.done_copying)
+	return -1;
+    if (e->store_status != STORE_OK || e->swap_status != SWAPOUT_DONE)
+	return -1;
+    if (EBIT_TEST(e->flags, ENTRY_ABORTED) || e->mem_obj == NULL)
+	return -1;
+    if (e->mem_obj->swap_hdr_sz == 0)
+	return -1;
+    if (objectLen(e) - http->out.offset < Config.sendfileMinSize)
+	return -1;
+    if (sc == NULL || sc->type != STORE_DISK_CLIENT || sc->swapin_sio == NULL)
+	return -1;
+#if DELAY_POOLS
+    if (sc->delay_id)
+	return -1;
+#endif
+#if USE_SSL
+    if (fd_table[http->conn->fd].ssl && !fd_table[http->conn->fd].flags.ktls_send)
+	return -1;
+#endif
+    return storeIOFd(sc->swapin_sio);
+}
+
+/*
+ * Send what is left of a disk hit with sendfile(), a chunk per write
+ * event, instead of copying it through stmem.  Every chunk completes
+ * through clientWriteComplete() like a normal body write, which
+ * brings us back here for the next one.
+ */
+static int
+clientSendfileStart(clientHttpRequest * http)
+{
+    int file_fd = clientSendfileFd(http);
+    if (file_fd < 0)
+	return 0;
+    if (!http->flags.sendfile) {
+	http->flags.sendfile = 1;
+	debugs(33, 3, "clientSendfileStart: FD %d sending %s from file FD %d",
+	    http->conn->fd, http->uri, file_fd);
+#ifdef POSIX_FADV_WILLNEED
+	posix_fadvise(file_fd,
+	    (off_t) (http->entry->mem_obj->swap_hdr_sz + http->out.offset),
+	    (off_t) (objectLen(http->entry) - http->out.offset),
+	    POSIX_FADV_WILLNEED);
+#endif
+    }
+    commSetSelect(http->conn->fd, COMM_SELECT_WRITE, clientSendfileWrite, http, 0);
+    return 1;
+}
+
+static void
+clientSendfileWrite(int fd, void *data)
+{
+    clientHttpRequest *http = data;
+    StoreEntry *entry = http->entry;
+    int file_fd = clientSendfileFd(http);
+    squid_off_t len;
+    off_t off;
+    ssize_t n;
+    if (file_fd < 0) {
+	/* lost the file somehow; carry on through the store client */
+	storeClientRef(http->sc, entry,
+	    http->out.offset,
+	    http->out.offset,
+	    SM_PAGE_SIZE,
+	    clientSendMoreData,
+	    http);
+	return;
+    }
+    off = (off_t) (entry->mem_obj->swap_hdr_sz + http->out.offset);
+    len = objectLen(entry) - http->out.offset;
+    if (len > CLIENT_SENDFILE_CHUNK)
+	len = CLIENT_SENDFILE_CHUNK;
+    n = sendfile(fd, file_fd, &off, (size_t) len);
+    CommStats.syscalls.sock.writes++;
+    if (n < 0) {
+	if (ignoreErrno(errno)) {
+	    commSetSelect(fd, COMM_SELECT_WRITE, clientSendfileWrite, http, 0);
+	    return;
+	}
+	debugs(33, 2, "clientSendfileWrite: FD %d: %s", fd, xstrerror());
+	clientWriteComplete(fd, NULL, 0, COMM_ERROR, http);
+	return;
+    }
+    if (n == 0) {
+	debugs(33, 1, "clientSendfileWrite: swap file for %s is shorter than the object",
+	    http->uri);
+	clientWriteComplete(fd, NULL, 0, COMM_ERROR, http);
+	return;
+    }
+    fd_bytes(fd, n, FD_WRITE);
+    http->out.offset += n;
+    kb_incr(&statCounter.client_http.sendfile_kbytes_out, n);
+    clientWriteComplete(fd, NULL, n, COMM_OK, http);
+}
+#endif
+
 void
 clientKeepaliveNextRequest(clientHttpRequest * http)
 {
     ConnStateData *conn = http->conn;
     StoreEntry *entry;
+    int pipelined = 0;
     debugs(33, 3, "clientKeepaliveNextRequest: FD %d", conn->fd);
+    /* sending the next reply may close the connection under our feet */
+    cbdataLock(conn);
     conn->defer.until = 0;	/* Kick it to read a new request */
     httpRequestFree(http);
     if (conn->pinning.pinned && conn->pinning.fd == -1) {
 	debugs(33, 2, "clientKeepaliveNextRequest: FD %d Connection was pinned but server side gone. Terminating client connection", conn->fd);
 	comm_close(conn->fd);
+	cbdataUnlock(conn);
 	return;
     }
     http = NULL;
@@ -1835,6 +1983,7 @@ clientKeepaliveNextRequest(clientHttpRequest * http)
 	 * Note, the FD may be closed at this point.
 	 */
     } else if ((entry = http->entry) == NULL) {
+	pipelined = 1;
 	/*
 	 * this request is in progress, maybe doing an ACL or a redirect,
 	 * execution will resume after the operation completes.
@@ -1843,6 +1992,7 @@ clientKeepaliveNextRequest(clientHttpRequest * http)
 	if (http->request->method->code == METHOD_CONNECT)
 	    clientCheckFollowXForwardedFor(http);
     } else {
+	pipelined = 1;
 	debugs(33, 2, "clientKeepaliveNextRequest: FD %d Sending next",
 	    conn->fd);
 	assert(entry);
@@ -1854,6 +2004,21 @@ clientKeepaliveNextRequest(clientHttpRequest * http)
 		http);
 	}
     }
+    /*
+     * A slot was freed for pipelined requests already sitting in the
+     * input buffer.  Start them now instead of waiting for a read event
+     * that will not come if the client has sent everything.  Reading
+     * has stopped for good if the read handler is gone (bad request or
+     * CONNECT seen).
+     */
+    if (pipelined && Config.pipeline_max_prefetch && cbdataValid(conn) &&
+	conn->in.offset > 0 && !conn->body.callback &&
+	fd_table[conn->fd].read_handler == clientReadRequest) {
+	/* stop reading after a bad request, as clientReadRequest() does */
+	if (clientParseRequests(conn) == -1 && cbdataValid(conn))
+	    commSetSelect(conn->fd, COMM_SELECT_READ, NULL, NULL, 0);
+    }
+    cbdataUnlock(conn);
 }
 
 static void
@@ -1940,6 +2105,10 @@ clientWriteComplete(int fd, char *bufnotused, size_t size, int errflag, void *da
 	    delaySetStoreClient(http->sc, delayPoolClient(http->delayAssignedPool,
 		    (in_addr_t) http->conn->peer.sin_addr.s_addr));
 	}
+#endif
+#if USE_CLIENT_SENDFILE
+	if (clientSendfileStart(http))
+	    return;
 #endif
 	/* More data will be coming from primary server; register with 
 	 * storage manager. */
@@ -2393,6 +2562,24 @@ clientReadDefer(int fd, void *data)
     }
 }
 
+/*
+ * Parse and start the requests waiting in the connection input buffer,
+ * as many as pipeline_prefetch allows.  The caller must hold a cbdata
+ * lock on conn; it may be closed on return.
+ */
+static int
+clientParseRequests(ConnStateData * conn)
+{
+    int ret = 0;
+    while (cbdataValid(conn) && conn->in.offset > 0 && conn->body.size_left == 0) {
+	/* Ret tells us how many bytes was consumed - 0 == didn't consume request, > 0 == consumed, -1 == error, -2 == CONNECT request stole the connection */
+	ret = clientTryParseRequest(conn);
+	if (ret <= 0)
+	    break;
+    }				/* while offset > 0 && conn->body.size_left == 0 */
+    return ret;
+}
+
 static void
 clientReadRequest(int fd, void *data)
 {
@@ -2474,13 +2661,7 @@ clientReadRequest(int fd, void *data)
 	}
     }
     /* Process next request */
-    ret = 0;
-    while (cbdataValid(conn) && conn->in.offset > 0 && conn->body.size_left == 0) {
-	/* Ret tells us how many bytes was consumed - 0 == didn't consume request, > 0 == consumed, -1 == error, -2 == CONNECT request stole the connection */
-	ret = clientTryParseRequest(conn);
-	if (ret <= 0)
-	    break;
-    }				/* while offset > 0 && conn->body.size_left == 0 */
+    ret = clientParseRequests(conn);
     if (!cbdataValid(conn)) {
 	cbdataUnlock(conn);
 	return;
@@ -2528,18 +2709,63 @@ clientLifetimeTimeout(int fd, void *data)
     comm_close(fd);
 }
 
+/*
+ * Admission control: true while the event loop lags behind by more
+ * than client_admission_lag.
+ */
+static int
+httpAcceptOverloaded(void)
+{
+    return Config.admission.lag > 0 && CommStats.loop_lag * 1000 > Config.admission.lag;
+}
+
 static int
 httpAcceptDefer(int fd, void *dataunused)
 {
     static time_t last_warn = 0;
-    if (fdNFree() >= RESERVED_FD)
-	return 0;
-    if (last_warn + 15 < squid_curtime) {
-	debugs(33, 0, "WARNING! Your cache is running out of filedescriptors");
-	last_warn = squid_curtime;
+    static time_t last_lag_warn = 0;
+    if (fdNFree() < RESERVED_FD) {
+	if (last_warn + 15 < squid_curtime) {
+	    debugs(33, 0, "WARNING! Your cache is running out of filedescriptors");
+	    last_warn = squid_curtime;
+	}
+	commDeferFD(fd);
+	return 1;
     }
-    commDeferFD(fd);
-    return 1;
+    if (httpAcceptOverloaded() && !Config.admission.shed) {
+	if (last_lag_warn + 15 < squid_curtime) {
+	    debugs(33, 1, "WARNING! Event loop lags %.0f msec, holding back new connections",
+		CommStats.loop_lag * 1000);
+	    last_lag_warn = squid_curtime;
+	}
+	commDeferFD(fd);
+	return 1;
+    }
+    return 0;
+}
+
+/*
+ * Start reading a new connection, on the event loop it was handed to.
+ * With defer-accept or fast open the request is normally already
+ * queued on the socket; read it now rather than after another pass
+ * through the event loop.  connState may be gone afterwards.
+ */
+static void
+httpAcceptStart(void *data)
+{
+    ConnStateData *connState = data;
+    int fd = connState->fd;
+
+    if (iapp_nloops > 1) {
+	int valid = cbdataValid(connState);
+	cbdataUnlock(connState);
+	if (!valid)
+	    return;
+    }
+    if (connState->port->defer_accept || connState->port->tcp_fastopen)
+	clientReadRequest(fd, connState);
+    else
+	commSetSelect(fd, COMM_SELECT_READ, clientReadRequest, connState, 0);
 }
 
 /* Handle a new connection on HTTP socket. */
@@ -2577,6 +2803,14 @@ httpAccept(int sock, void *data)
        }
 
 	F = &fd_table[fd];
+	if (httpAcceptOverloaded()) {
+	    debugs(33, 3, "httpAccept: FD %d: overloaded, resetting client %s:%d", fd, F->ipaddrstr, F->remote_port);
+	    statCounter.client_http.accepts_shed++;
+	    comm_reset_close(fd);
+	    sqinet_done(&peer);
+	    sqinet_done(&me);
+	    continue;
+	}
 	debugs(33, 4, "httpAccept: FD %d: accepted port %d client %s:%d", fd, F->local_port, F->ipaddrstr, F->remote_port);
 	fd_note_static(fd, "client http connect");
 	connState = connStateCreate(fd, &peer, &me);
@@ -2592,7 +2826,6 @@ httpAccept(int sock, void *data)
 	if (aclCheckFast(Config.accessList.identLookup, &identChecklist))
 	    identStart4(&connState->me, &connState->peer, clientIdentDone, connState);
 #endif
-	commSetSelect(fd, COMM_SELECT_READ, clientReadRequest, connState, 0);
 	commSetDefer(fd, clientReadDefer, connState);
 	if (Config.client_socksize > -1)
 	    commSetTcpBufferSize(fd, Config.client_socksize);
@@ -2601,8 +2834,14 @@ httpAccept(int sock, void *data)
 	}
 	clientdbEstablished(sqinet_get_v4_inaddr(&peer, SQADDR_ASSERT_IS_V4), 1);
 	incoming_sockets_accepted++;
+	statCounter.client_http.accepts++;
         sqinet_done(&peer);
         sqinet_done(&me);
+	if (iapp_nloops > 1) {
+	    cbdataLock(connState);
+	    iapp_loop_handoff(fd, iapp_loop_next(), &connState->handoff, httpAcceptStart, connState);
+	} else
+	    httpAcceptStart(connState);
     }
 }
 
@@ -2653,6 +2892,12 @@ clientNegotiateSSL(int fd, void *data)
 	/* NOTREACHED */
     }
     fd_table[fd].read_pending = COMM_PENDING_NOW;
+    statCounter.ssl.accepts++;
+    ret = ssl_ktls_check(fd);
+    if (ret & SSL_KTLS_SEND)
+	statCounter.ssl.ktls_send++;
+    if (ret & SSL_KTLS_RECV)
+	statCounter.ssl.ktls_recv++;
     if (SSL_session_reused(ssl)) {
 	debugs(83, 2, "clientNegotiateSSL: Session %p reused on FD %d (%s:%d)", SSL_get_session(ssl), fd, fd_table[fd].ipaddrstr, (int) fd_table[fd].remote_port);
     } else {
@@ -2768,6 +3013,7 @@ httpsAccept(int sock, void *data)
 	    commSetTcpBufferSize(fd, Config.client_socksize);
 	clientdbEstablished(sqinet_get_v4_inaddr(&peer, SQADDR_ASSERT_IS_V4), 1);
 	incoming_sockets_accepted++;
+	statCounter.client_http.accepts++;
 	httpsAcceptSSL(connState, s->sslContext);
         sqinet_done(&peer);
         sqinet_done(&me);
@@ -2931,6 +3177,15 @@ AddOpenedHttpSocket(int fd)
     return found;
 }
 
+static void
+clientHttpListenOptions(int fd, http_port_list * s)
+{
+    if (s->defer_accept)
+	commSetDeferAccept(fd, s->defer_accept);
+    if (s->tcp_fastopen)
+	commSetTcpFastOpen(fd, s->tcp_fastopen);
+}
+
 static void
 clientHttpConnectionsOpened(int fd, void* data)
 {
@@ -2947,6 +3202,7 @@ clientHttpConnectionsOpened(int fd, void* data)
 	}	
 	
 	comm_listen(fd);
+	clientHttpListenOptions(fd, s);
 	commSetSelect(fd, COMM_SELECT_READ, httpAccept, s, 0);
 	/*
 	 * We need to set a defer handler here so that we don't
@@ -2965,6 +3221,33 @@ clientHttpConnectionsOpened(int fd, void* data)
 	assert(AddOpenedHttpSocket(fd));
 }
 
+/*
+ * worker-queues: open this worker's own SO_REUSEPORT listener rather
+ * than asking the coordinator for the shared one.
+ */
+static void
+clientHttpConnectionsReusePortOpen(http_port_list * s, int comm_flags)
+{
+    int fd;
+    int cpu;
+    HttpSockets[NHttpSockets] = -1;	/* set in clientHttpConnectionsOpened */
+    ++NHttpSockets;
+    enter_suid();
+    fd = comm_open(SOCK_STREAM,
+	IPPROTO_TCP,
+	s->s.sin_addr,
+	ntohs(s->s.sin_port),
+	comm_flags | COMM_REUSEPORT,
+	COMM_TOS_DEFAULT,
+	"HTTP Socket");
+    leave_suid();
+    if (fd >= 0 && (cpu = CpuAffinityCore()) >= 0) {
+	debugs(1, 2, "clientHttpConnectionsReusePortOpen: FD %d prefers CPU %d", fd, cpu);
+	commSetIncomingCpu(fd, cpu);
+    }
+    clientHttpConnectionsOpened(fd, s);
+}
+
 static void
 clientHttpConnectionsSMPOpen(void)
 {
@@ -2980,6 +3263,11 @@ clientHttpConnectionsSMPOpen(void)
 		
 		if (s->tproxy)
 		  comm_flags |= COMM_TPROXY_LCL;
+
+		if (s->worker_queues) {
+		    clientHttpConnectionsReusePortOpen(s, comm_flags);
+		    continue;
+		}
 			  
 		StrandStartListenRequest(SOCK_STREAM, IPPROTO_TCP, fdnHttpSocket, comm_flags, NULL, 0, (void*)s, clientHttpConnectionsOpened);
 
@@ -3024,6 +3312,7 @@ clientHttpConnectionsOpen(void)
 		if (fd < 0)
 		    continue;
 		comm_listen(fd);
+		clientHttpListenOptions(fd, s);
 		commSetSelect(fd, COMM_SELECT_READ, httpAccept, s, 0);
 		/*
 		 * We need to set a defer handler here so that we don't
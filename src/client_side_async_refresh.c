@@ -141,8 +141,8 @@ clientAsyncRefresh(clientHttpRequest * http)
     httpHeaderDelById(&request->header, HDR_IF_RANGE);
     httpHeaderDelById(&request->header, HDR_IF_NONE_MATCH);
     httpHeaderDelById(&request->header, HDR_IF_MATCH);
-    if (async->old_entry->lastmod > 0)
-	request->lastmod = async->old_entry->lastmod;
+    if (STORE_TIME(async->old_entry->lastmod) > 0)
+	request->lastmod = STORE_TIME(async->old_entry->lastmod);
     else if (async->old_entry->mem_obj && async->old_entry->mem_obj->reply)
 	request->lastmod = async->old_entry->mem_obj->reply->date;
     else
@@ -11,7 +11,7 @@ modifiedSince(StoreEntry * entry, request_t * request)
 {
     squid_off_t object_length;
     MemObject *mem = entry->mem_obj;
-    time_t mod_time = entry->lastmod;
+    time_t mod_time = STORE_TIME(entry->lastmod);
     debugs(33, 3, "modifiedSince: '%s'", storeLookupUrl(entry));
     debugs(33, 3, "modifiedSince: mod_time = %ld", (long int) mod_time);
     if (mod_time < 0)
@@ -101,12 +101,12 @@ clientProcessExpired(clientHttpRequest * http)
     /* delay_id is already set on original store client */
     delaySetStoreClient(http->sc, delayClient(http));
 #endif
-    if (can_revalidate && http->old_entry->lastmod > 0) {
-	http->request->lastmod = http->old_entry->lastmod;
+    if (can_revalidate && STORE_TIME(http->old_entry->lastmod) > 0) {
+	http->request->lastmod = STORE_TIME(http->old_entry->lastmod);
 	http->request->flags.cache_validation = 1;
     } else
 	http->request->lastmod = -1;
-    debugs(33, 5, "clientProcessExpired: lastmod %ld", (long int) entry->lastmod);
+    debugs(33, 5, "clientProcessExpired: lastmod %ld", (long int) STORE_TIME(entry->lastmod));
     /* NOTE, don't call storeLockObject(), storeCreateEntry() does it */
     http->entry = entry;
     http->out.offset = 0;
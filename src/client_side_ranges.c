@@ -5,6 +5,96 @@
 /* XXX */
 static const char *const crlf = "\r\n";
 
+void
+clientBodyInit(ClientBody * b, MemBuf * mb, struct iovec *iov, int iovmax)
+{
+    b->mb = mb;
+    b->iov = iov;
+    b->iovcnt = 0;
+    b->iovmax = iovmax;
+    b->mark = 0;
+}
+
+/* text segments have a NULL base until clientBodyFinish() */
+static void
+clientBodyAddText(ClientBody * b, size_t size)
+{
+    if (b->iovcnt > 0 && b->iov[b->iovcnt - 1].iov_base == NULL) {
+	b->iov[b->iovcnt - 1].iov_len += size;
+	return;
+    }
+    assert(b->iovcnt < b->iovmax);
+    b->iov[b->iovcnt].iov_base = NULL;
+    b->iov[b->iovcnt].iov_len = size;
+    b->iovcnt++;
+}
+
+/*
+ * Start appending generated text to b; clientBodyTextEnd() records
+ * what was appended since.
+ */
+MemBuf *
+clientBodyTextBegin(ClientBody * b)
+{
+    if (memBufIsNull(b->mb))
+	memBufDefInit(b->mb);
+    b->mark = b->mb->size;
+    return b->mb;
+}
+
+void
+clientBodyTextEnd(ClientBody * b)
+{
+    if (b->iov && b->mb->size > b->mark)
+	clientBodyAddText(b, b->mb->size - b->mark);
+}
+
+/*
+ * Add data by reference.  One slot is always kept for trailing text,
+ * once the others are used up the data is copied after all.
+ */
+void
+clientBodyRef(ClientBody * b, const char *data, size_t size)
+{
+    if (size == 0)
+	return;
+    if (b->iov && b->iovcnt < b->iovmax - 1) {
+	b->iov[b->iovcnt].iov_base = (char *) data;
+	b->iov[b->iovcnt].iov_len = size;
+	b->iovcnt++;
+	return;
+    }
+    memBufAppend(clientBodyTextBegin(b), data, size);
+    clientBodyTextEnd(b);
+}
+
+size_t
+clientBodySize(const ClientBody * b)
+{
+    size_t size = 0;
+    int i;
+    if (!b->iov)
+	return memBufIsNull(b->mb) ? 0 : b->mb->size;
+    for (i = 0; i < b->iovcnt; i++)
+	size += b->iov[i].iov_len;
+    return size;
+}
+
+/* Point the text segments into mb, now that it stopped moving */
+int
+clientBodyFinish(ClientBody * b)
+{
+    char *text = memBufIsNull(b->mb) ? NULL : b->mb->buf;
+    int i;
+    for (i = 0; i < b->iovcnt; i++) {
+	if (b->iov[i].iov_base == NULL) {
+	    b->iov[i].iov_base = text;
+	    text += b->iov[i].iov_len;
+	}
+    }
+    return b->iovcnt;
+}
+
 
 /* put terminating boundary for multiparts */
 void
@@ -43,7 +133,7 @@ clientPackRangeHdr(const HttpReply * rep, const HttpHdrRangeSpec * spec, String
 }
 
 /*
- * extracts a "range" from *buf and appends them to mb, updating
+ * extracts a "range" from *buf and appends them to b, updating
  * all offsets and such.
  */
 void
@@ -51,7 +141,7 @@ clientPackRange(clientHttpRequest * http,
     HttpHdrRangeIter * i,
     const char **buf,
     size_t * size,
-    MemBuf * mb)
+    ClientBody * b)
 {
     const size_t copy_sz = i->debt_size <= *size ? i->debt_size : *size;
     squid_off_t body_off = http->out.offset - i->prefix_size;
@@ -72,14 +162,15 @@ clientPackRange(clientHttpRequest * http,
 	    http->entry->mem_obj->reply,	/* original reply */
 	    i->spec,		/* current range */
 	    i->boundary,	/* boundary, the same for all */
-	    mb
+	    clientBodyTextBegin(b)
 	    );
+	clientBodyTextEnd(b);
     }
     /*
      * append content
      */
     debugs(33, 3, "clientPackRange: appending %ld bytes", (long int) copy_sz);
-    memBufAppend(mb, *buf, copy_sz);
+    clientBodyRef(b, *buf, copy_sz);
     /*
      * update offsets
      */
@@ -110,10 +201,10 @@ clientCanPackMoreRanges(const clientHttpRequest * http, HttpHdrRangeIter * i, si
     return i->spec && size > 0;
 }
 
-/* extracts "ranges" from buf and appends them to mb, updating all offsets and such */
+/* extracts "ranges" from buf and appends them to b, updating all offsets and such */
 /* returns true if we need more data */
 int
-clientPackMoreRanges(clientHttpRequest * http, const char *buf, size_t size, MemBuf * mb)
+clientPackMoreRanges(clientHttpRequest * http, const char *buf, size_t size, ClientBody * b)
 {
     HttpHdrRangeIter *i = &http->range_iter;
     /* offset in range specs does not count the prefix of an http msg */
@@ -146,7 +237,7 @@ clientPackMoreRanges(clientHttpRequest * http, const char *buf, size_t size, Mem
 	/* put next chunk if any */
 	if (size) {
 	    http->out.offset = body_off + i->prefix_size;	/* sync */
-	    clientPackRange(http, i, &buf, &size, mb);
+	    clientPackRange(http, i, &buf, &size, b);
 	    body_off = http->out.offset - i->prefix_size;	/* sync */
 	}
     }
@@ -163,7 +254,8 @@ clientPackMoreRanges(clientHttpRequest * http, const char *buf, size_t size, Mem
 	    assert(body_off == i->spec->offset + i->spec->length - i->debt_size);
     } else if (http->request->range->specs.count > 1) {
 	/* put terminating boundary for multiparts */
-	clientPackTermBound(i->boundary, mb);
+	clientPackTermBound(i->boundary, clientBodyTextBegin(b));
+	clientBodyTextEnd(b);
     }
     http->out.offset = body_off + i->prefix_size;	/* sync */
     return i->debt_size > 0;
@@ -234,7 +326,7 @@ clientIfRangeMatch(clientHttpRequest * http, HttpReply * rep)
     }
     /* got modification time? */
     else if (spec.time >= 0) {
-        return http->entry->lastmod == spec.time;
+        return STORE_TIME(http->entry->lastmod) == spec.time;
     }
     assert(0);                  /* should not happen */
     return 0;
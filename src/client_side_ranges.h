@@ -1,12 +1,34 @@
 #ifndef	__CLIENT_SIDE_RANGES_H__
 #define	__CLIENT_SIDE_RANGES_H__
 
+/*
+ * A body write being put together.  Generated text (part headers,
+ * boundaries) goes into mb; data that stays valid until the write
+ * completes is referenced in place through iov.  Without an iov
+ * everything is copied into mb.
+ */
+struct _ClientBody {
+    MemBuf *mb;
+    struct iovec *iov;
+    int iovcnt;
+    int iovmax;
+    mb_size_t mark;
+};
+typedef struct _ClientBody ClientBody;
+
+extern void clientBodyInit(ClientBody * b, MemBuf * mb, struct iovec *iov, int iovmax);
+extern void clientBodyRef(ClientBody * b, const char *data, size_t size);
+extern MemBuf *clientBodyTextBegin(ClientBody * b);
+extern void clientBodyTextEnd(ClientBody * b);
+extern size_t clientBodySize(const ClientBody * b);
+extern int clientBodyFinish(ClientBody * b);
+
 extern void clientPackTermBound(String boundary, MemBuf * mb);
 extern void clientPackRangeHdr(const HttpReply * rep, const HttpHdrRangeSpec * spec, String boundary, MemBuf * mb);
 extern void clientPackRange(clientHttpRequest * http, HttpHdrRangeIter * i, const char **buf, size_t * size,
-    MemBuf * mb);
+    ClientBody * b);
 extern int clientCanPackMoreRanges(const clientHttpRequest * http, HttpHdrRangeIter * i, size_t size);
-extern int clientPackMoreRanges(clientHttpRequest * http, const char *buf, size_t size, MemBuf * mb);
+extern int clientPackMoreRanges(clientHttpRequest * http, const char *buf, size_t size, ClientBody * b);
 extern void clientBuildRangeHeader(clientHttpRequest * http, HttpReply * rep);
 extern int clientCheckRangeForceMiss(StoreEntry * entry, HttpHdrRange * range);
 
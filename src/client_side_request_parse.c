@@ -456,9 +456,9 @@ clientTryParseRequest(ConnStateData * conn)
     }
 
     HttpMsgBufInit(&msg, conn->in.buf, conn->in.offset);	/* XXX for now there's no deallocation function needed but this may change */
-    /* Limit the number of concurrent requests to 2 */
+    /* Limit the number of concurrent requests to 1 + pipeline_prefetch */
     for (n = conn->reqs.head, nrequests = 0; n; n = n->next, nrequests++);
-    if (nrequests >= (Config.onoff.pipeline_prefetch ? 2 : 1)) {
+    if (nrequests > Config.pipeline_max_prefetch) {
 	debugs(33, 3, "clientTryParseRequest: FD %d max concurrent requests reached", fd);
 	debugs(33, 5, "clientTryParseRequest: FD %d defering new request until one is done", fd);
 	conn->defer.until = squid_curtime + 100;	/* Reset when a request is complete */
@@ -71,7 +71,13 @@ clientRedirectAccessCheckDone(int answer, void *data)
 void
 clientRedirectStart(clientHttpRequest * http)
 {
+    char *rurl;
     debugs(33, 5, "clientRedirectStart: '%s'", http->uri);
+    if (rewriteRulesApply(Config.urlRewriteRules, http, &rurl)) {
+	clientRedirectDone(http, rurl);
+	safe_free(rurl);
+	return;
+    }
     if (Config.Program.url_rewrite.command == NULL) {
 	http->redirect_state = REDIRECT_PENDING;
 	if (Config.rewrites != NULL) {
@@ -54,7 +54,13 @@ clientStoreURLRewriteAccessCheckDone(int answer, void *data)
 void
 clientStoreURLRewriteStart(clientHttpRequest * http)
 {
+    char *result;
     debugs(85, 5, "clientStoreURLRewriteStart: '%s'", http->uri);
+    if (rewriteRulesApply(Config.storeurlRewriteRules, http, &result)) {
+	clientStoreURLRewriteDone(http, result);
+	safe_free(result);
+	return;
+    }
     if (Config.Program.store_rewrite.command == NULL) {
 	clientStoreURLRewriteDone(http, NULL);
 	return;
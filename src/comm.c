@@ -58,6 +58,8 @@ typedef struct {
     int tries;
     int addrcount;
     int connstart;
+    struct timeval dns_start;	/* latency histograms */
+    struct timeval connect_start;
 } ConnectStateData;
 
 static PF commConnectFree;
@@ -94,6 +96,7 @@ commConnectStart(int fd, const char *host, u_short port, CNCB * callback, void *
     }
     cbdataLock(cs->data);
     comm_add_close_handler(fd, commConnectFree, cs);
+    cs->dns_start = current_time;
     ipcache_nbgethostbyname(host, commConnectDnsHandle, cs);
 }
 
@@ -106,6 +109,7 @@ commConnectDnsHandle(const ipcache_addrs * ia, void *data)
 	if (cs->addrcount > 0) {
 	    fd_table[cs->fd].flags.dnsfailed = 1;
 	    cs->connstart = squid_curtime;
+	    cs->connect_start = current_time;
 	    commConnectHandle(cs->fd, cs);
 	} else {
 	    debugs(5, 3, "commConnectDnsHandle: Unknown host: %s", cs->host);
@@ -124,6 +128,10 @@ commConnectDnsHandle(const ipcache_addrs * ia, void *data)
 	ipcacheCycleAddr(cs->host, NULL);
     cs->addrcount = ia->count;
     cs->connstart = squid_curtime;
+    if (cs->tries == 0) {
+	latencyRecord(LATENCY_DNS, tvSubUsec(cs->dns_start, current_time));
+	cs->connect_start = current_time;
+    }
     commConnectHandle(cs->fd, cs);
 }
 
@@ -286,7 +294,9 @@ commConnectHandle(int fd, void *data)
 	commSetSelect(fd, COMM_SELECT_WRITE, commConnectHandle, cs, 0);
 	break;
     case COMM_OK:
+	fd_table[fd].flags.edge = 1;
 	ipcacheMarkGoodAddr(cs->host, cs->S.sin_addr);
+	latencyRecord(LATENCY_CONNECT, tvSubUsec(cs->connect_start, current_time));
 	commConnectCallback(cs, COMM_OK);
 	break;
     default:
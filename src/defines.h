@@ -148,6 +148,18 @@
 #define STORE_HDR_METASIZE (4*sizeof(time_t)+2*sizeof(u_short)+sizeof(squid_file_sz))
 #define STORE_HDR_METASIZE_OLD (4*sizeof(time_t)+2*sizeof(u_short)+sizeof(size_t))
 
+/*
+ * StoreEntry keeps its timestamps as 32 bit offsets from STORE_TIME_BASE
+ * (early 2021), which covers 1953 to 2089.  STORE_TIME_NONE stands for
+ * the -1 "not set" time_t.
+ */
+#define STORE_TIME_BASE ((time_t) 0x60000000)
+#define STORE_TIME_NONE (-0x7fffffff - 1)
+#define STORE_TIME(st) ((st) == STORE_TIME_NONE ? (time_t) -1 : STORE_TIME_BASE + (time_t) (st))
+
+#define storeEntryKey(e) ((e)->hashed ? (const cache_key *) (e)->key : NULL)
+#define storeHashNext(e) storeEntryById((e)->hash_next)
+
 #define STORE_ENTRY_WITH_MEMOBJ		1
 #define STORE_ENTRY_WITHOUT_MEMOBJ	0
 
@@ -184,6 +196,8 @@
 #define PEER_TCP_MAGIC_COUNT 10
 
 #define STORE_CLIENT_BUF_SZ 4096
+#define STORE_SWAPOUT_WRITE_SZ (64 * 1024)	/* default cache_dir write-size */
+#define STORE_SWAPOUT_WRITE_MAX (1024 * 1024)	/* largest cache_dir write-size */
 
 #define URI_WHITESPACE_STRIP 0
 #define URI_WHITESPACE_ALLOW 1
@@ -191,6 +205,15 @@
 #define URI_WHITESPACE_CHOP 3
 #define URI_WHITESPACE_DENY 4
 
+#if DELAY_POOLS
+/* delay_id is (pool + 1) << 24 | slot, see delay_pools.c */
+#define DELAY_MAX_POOLS 255
+#define DELAY_ID_POOL(d) ((d) >> 24)
+#endif
+
+#define PCONN_ORDER_LIFO 0
+#define PCONN_ORDER_FIFO 1
+
 #ifndef _PATH_DEVNULL
 #ifdef _SQUID_MSWIN_
 #define _PATH_DEVNULL "NUL"
@@ -224,6 +247,12 @@
 #define _WIN_SQUID_RUN_MODE_SERVICE		1
 #endif
 
+/* Cache Digest layouts (StoreDigestCBlock.flags) */
+#define CD_FLAG_BLOCKED		0x01	/* bits of one key share a CD_BLOCK_SIZE block */
+#define CD_FLAG_DELTA		0x02	/* body is a list of changed mask words */
+#define CD_BLOCK_SIZE		64	/* bytes, one cache line */
+#define CD_BLOCKED_VERSION	6	/* first digest version reading CD_FLAG_BLOCKED */
+
 #define	LOGFILE_SEQNO(n)	( (n)->sequence_number )
 
 #define	storeSwapTLVFree	tlv_free
@@ -38,120 +38,317 @@
 #if DELAY_POOLS
 #include "squid.h"
 
-struct _class1DelayPool {
-    int class;
-    int aggregate;
-    uint64_t aggregate_bytes;
-};
-
-#define IND_MAP_SZ 256
+/*
+ * Each pool is a hierarchy of token buckets: an aggregate bucket at
+ * the root, then optionally network, individual and per connection
+ * buckets.  A bucket is selected by masking the client address (class
+ * 2 and 3 keep their historic "last octet" keys, class 4 uses a real
+ * network prefix) and refilled lazily from the time elapsed since it
+ * was last looked at, so there is no periodic sweep over all buckets.
+ *
+ * A delay_id names a slot which points at the leaf bucket of the
+ * request; the bytes wanted are the minimum over the leaf and all its
+ * parents.  Slots also remember the registered delay_id location so
+ * they can be zeroed on reconfigure.
+ */
 
-struct _class2DelayPool {
-    int class;
-    int aggregate;
-    uint64_t aggregate_bytes;
-    /* OK: -1 is terminator.  individual[255] is always host 255. */
-    /* 255 entries + 1 terminator byte */
-    unsigned char individual_map[IND_MAP_SZ];
-    unsigned char individual_255_used;
-    /* 256 entries */
-    int individual[IND_MAP_SZ];
-    uint64_t individual_bytes[IND_MAP_SZ];
+#define DELAY_MAX_LEVELS	4
+#define DELAY_SLOT_BITS		24
+#define DELAY_SLOT_MASK		((1 << DELAY_SLOT_BITS) - 1)
+#define DELAY_HASH_MIN		64
+#define DELAY_BUCKET_TTL	60.0	/* forget unused buckets after this */
+#define DELAY_GC_INTERVAL	60.0
+#define DELAY_WAKEUP_MIN	0.01
+#define DELAY_WAKEUP_MAX	1.0
+
+typedef struct _delayBucket delayBucket;
+typedef struct _delayLevel delayLevel;
+typedef struct _delayPoolData delayPoolData;
+typedef struct _delaySlot delaySlot;
+
+struct _delayBucket {
+    delayBucket *next;		/* hash chain */
+    delayBucket *parent;
+    delayLevel *level;
+    unsigned int key;
+    int refs;			/* children and delay_ids using the bucket */
+    double tokens;
+    double updated;		/* current_dtime of the last refill */
+    uint64_t bytes;
+    dlink_node idle;		/* on the pool idle list while refs == 0 */
+    double idle_since;
 };
 
-#define NET_MAP_SZ 256
-#define C3_IND_SZ (NET_MAP_SZ*IND_MAP_SZ)
+struct _delayLevel {
+    const char *name;
+    delaySpec *spec;
+    unsigned int mask;		/* address bits selecting the bucket */
+    int per_connection;
+    delayBucket **buckets;
+    unsigned int nbuckets;
+    int count;
+};
 
-struct _class3DelayPool {
+struct _delayPoolData {
     int class;
-    int aggregate;
-    uint64_t aggregate_bytes;
-    /* OK: -1 is terminator.  network[255] is always host 255. */
-    /* 255 entries + 1 terminator byte */
-    unsigned char network_map[NET_MAP_SZ];
-    unsigned char network_255_used;
-    /* 256 entries */
-    int network[256];
-    uint64_t network_bytes[256];
-    /* 256 sets of (255 entries + 1 terminator byte) */
-    unsigned char individual_map[NET_MAP_SZ][IND_MAP_SZ];
-    /* Pack this into one bit per net */
-    unsigned char individual_255_used[32];
-    /* largest entry = (255<<8)+255 = 65535 */
-    int individual[C3_IND_SZ];
-    uint64_t individual_bytes[C3_IND_SZ];
+    int nlevels;
+    delayLevel level[DELAY_MAX_LEVELS];
+    delayBucket *aggregate;
+    dlink_list idle;
 };
 
-typedef struct _class1DelayPool class1DelayPool;
-typedef struct _class2DelayPool class2DelayPool;
-typedef struct _class3DelayPool class3DelayPool;
-
-union _delayPool {
-    class1DelayPool *class1;
-    class2DelayPool *class2;
-    class3DelayPool *class3;
+struct _delaySlot {
+    delayBucket *bucket;	/* NULL when free */
+    delay_id *loc;		/* registered location */
+    unsigned short pool;
+    int next_free;
 };
 
-typedef union _delayPool delayPool;
-
-static delayPool *delay_data = NULL;
+static delayPoolData *delay_data = NULL;
+static unsigned short delay_npools = 0;
 static char *delay_no_delay;
-static time_t delay_pools_last_update = 0;
-static hash_table *delay_id_ptr_hash = NULL;
+static delaySlot *delay_slots = NULL;
+static int delay_slots_alloc = 0;
+static int delay_slots_free = -1;
+static int delay_slots_used = 0;
+static double delay_wakeup_at = 0.0;
+static MemPool *delay_bucket_pool = NULL;
 static long memory_used = 0;
 
 static OBJH delayPoolStats;
 static OBJH delayPoolStatsNew;
+static EVH delayPoolsWakeup;
+static EVH delayPoolsGC;
 
 static unsigned int
-delayIdPtrHash(const void *key, unsigned int n)
+delayHash(unsigned int key, unsigned int n)
 {
-    /* Hashes actual POINTER VALUE.
-     * Assumes <= 256 hash buckets & even hash size.
-     * Assumes the most variation in pointers to inside
-     * medium size objects occurs in the 2nd and 3rd
-     * least significant bytes.
-     */
-    const char *ptr = (char *) &key;
-#if SIZEOF_VOID_P == 4
-    return (ptr[1] ^ ptr[2]) & (n - 1);
-#elif SIZEOF_VOID_P == 8
-#if WORDS_BIGENDIAN
-    return (ptr[5] ^ ptr[6]) & (n - 1);
-#else
-    return (ptr[1] ^ ptr[2]) & (n - 1);
-#endif
-#else
-#error What kind of a sick architecture are you on anyway?
-#endif
+    key *= 2654435761U;
+    return (key ^ (key >> 16)) & (n - 1);
+}
+
+static void
+delayLevelResize(delayLevel * l, unsigned int size)
+{
+    delayBucket **old = l->buckets;
+    unsigned int oldsize = l->nbuckets;
+    delayBucket *b, *next;
+    unsigned int i;
+    l->buckets = xcalloc(size, sizeof(*l->buckets));
+    l->nbuckets = size;
+    memory_used += (size - oldsize) * sizeof(*l->buckets);
+    for (i = 0; i < oldsize; i++) {
+	for (b = old[i]; b; b = next) {
+	    next = b->next;
+	    b->next = l->buckets[delayHash(b->key, size)];
+	    l->buckets[delayHash(b->key, size)] = b;
+	}
+    }
+    safe_free(old);
 }
 
 static int
-delayIdPtrHashCmp(const void *a, const void *b)
+delayInitialLevel(const delaySpec * spec)
 {
-    /*
-     * Compare POINTER VALUE.
-     * Note, we can't subtract void pointers, but we don't need
-     * to anyway.  All we need is a test for equality.
-     */
-    return a != b;
+    return (int) (((double) spec->max_bytes * Config.Delay.initial) / 100);
 }
 
 static void
-delayPoolsUpdateEvent(void *unused, void* data)
+delayBucketRef(delayPoolData * pd, delayBucket * b)
+{
+    if (b->refs++ == 0 && b != pd->aggregate)
+	dlinkDelete(&b->idle, &pd->idle);
+}
+
+static delayBucket *
+delayBucketCreate(delayPoolData * pd, delayLevel * l, delayBucket * parent, unsigned int key)
 {
-    delayPoolsUpdate(NULL);
-    eventAdd("delayPoolsUpdateEvent", delayPoolsUpdateEvent, NULL, 1.0, 1);
+    delayBucket *b = memPoolAlloc(delay_bucket_pool);
+    memory_used += sizeof(*b);
+    b->level = l;
+    b->key = key;
+    b->tokens = delayInitialLevel(l->spec);
+    b->updated = current_dtime;
+    b->parent = parent;
+    if (parent)
+	delayBucketRef(pd, parent);
+    if (!l->per_connection) {
+	if ((unsigned int) ++l->count > l->nbuckets)
+	    delayLevelResize(l, l->nbuckets << 1);
+	b->next = l->buckets[delayHash(key, l->nbuckets)];
+	l->buckets[delayHash(key, l->nbuckets)] = b;
+    }
+    return b;
+}
+
+static void delayBucketUnref(delayPoolData * pd, delayBucket * b);
+
+static void
+delayBucketFree(delayPoolData * pd, delayBucket * b)
+{
+    delayLevel *l = b->level;
+    delayBucket **bp;
+    assert(b->refs == 0);
+    if (!l->per_connection) {
+	for (bp = &l->buckets[delayHash(b->key, l->nbuckets)]; *bp != b; bp = &(*bp)->next)
+	    assert(*bp != NULL);
+	*bp = b->next;
+	l->count--;
+    }
+    if (b->parent)
+	delayBucketUnref(pd, b->parent);
+    memPoolFree(delay_bucket_pool, b);
+    memory_used -= sizeof(*b);
+}
+
+static void
+delayBucketUnref(delayPoolData * pd, delayBucket * b)
+{
+    assert(b->refs > 0);
+    if (--b->refs > 0)
+	return;
+    if (b->level->per_connection) {
+	delayBucketFree(pd, b);
+	return;
+    }
+    /* keep the level around for a while in case the client returns */
+    b->idle_since = current_dtime;
+    dlinkAddTail(b, &b->idle, &pd->idle);
+}
+
+static delayBucket *
+delayBucketFind(delayLevel * l, unsigned int key)
+{
+    delayBucket *b;
+    for (b = l->buckets[delayHash(key, l->nbuckets)]; b; b = b->next) {
+	if (b->key == key)
+	    return b;
+    }
+    return NULL;
+}
+
+/* bring the bucket up to date and return its level, -1 restore is unlimited */
+static double
+delayBucketRefill(delayBucket * b)
+{
+    const delaySpec *spec = b->level->spec;
+    double elapsed = current_dtime - b->updated;
+    if (elapsed > 0) {
+	b->updated = current_dtime;
+	if (b->tokens < spec->max_bytes) {
+	    b->tokens += elapsed * spec->restore_bps;
+	    if (b->tokens > spec->max_bytes)
+		b->tokens = spec->max_bytes;
+	}
+    }
+    return b->tokens;
+}
+
+static void
+delayPoolsGC(void *unused)
+{
+    unsigned short i;
+    dlink_node *n;
+    delayBucket *b;
+    for (i = 0; i < delay_npools; i++) {
+	n = delay_data[i].idle.head;
+	while (n) {
+	    b = n->data;
+	    n = n->next;
+	    if (b->idle_since + DELAY_BUCKET_TTL > current_dtime)
+		break;		/* list is in idle order */
+	    dlinkDelete(&b->idle, &delay_data[i].idle);
+	    delayBucketFree(&delay_data[i], b);
+	}
+    }
+    eventAdd("delayPoolsGC", delayPoolsGC, NULL, DELAY_GC_INTERVAL, 1);
+}
+
+static void
+delayPoolsWakeup(void *unused)
+{
+    delay_wakeup_at = 0.0;
+    commRecheckDeferred();
+}
+
+/* arrange for deferred readers to be rechecked when the bucket has refilled */
+static void
+delayScheduleWakeup(delayBucket * leaf)
+{
+    delayBucket *b;
+    double wait = 0.0;
+    double w;
+    for (b = leaf; b; b = b->parent) {
+	if (b->level->spec->restore_bps <= 0 || b->tokens >= 1.0)
+	    continue;
+	w = (1.0 - b->tokens) / b->level->spec->restore_bps;
+	if (w > wait)
+	    wait = w;
+    }
+    if (wait < DELAY_WAKEUP_MIN)
+	wait = DELAY_WAKEUP_MIN;
+    if (wait > DELAY_WAKEUP_MAX)
+	return;			/* checkTimeouts() will get there first */
+    if (delay_wakeup_at > 0.0 && delay_wakeup_at <= current_dtime + wait)
+	return;
+    delay_wakeup_at = current_dtime + wait;
+    eventAdd("delayPoolsWakeup", delayPoolsWakeup, NULL, wait, 0);
+}
+
+static delaySlot *
+delaySlotLookup(delay_id d)
+{
+    int slot = d & DELAY_SLOT_MASK;
+    if (d == 0 || slot >= delay_slots_alloc || delay_slots[slot].bucket == NULL)
+	return NULL;
+    return &delay_slots[slot];
+}
+
+static delaySlot *
+delaySlotAlloc(void)
+{
+    delaySlot *s;
+    int n, i;
+    if (delay_slots_free < 0) {
+	n = delay_slots_alloc ? delay_slots_alloc << 1 : 256;
+	if (n > DELAY_SLOT_MASK + 1)
+	    n = DELAY_SLOT_MASK + 1;
+	if (n == delay_slots_alloc)
+	    return NULL;
+	delay_slots = xrealloc(delay_slots, n * sizeof(*delay_slots));
+	memset(delay_slots + delay_slots_alloc, 0, (n - delay_slots_alloc) * sizeof(*delay_slots));
+	memory_used += (n - delay_slots_alloc) * sizeof(*delay_slots);
+	for (i = n - 1; i >= delay_slots_alloc; i--) {
+	    delay_slots[i].next_free = delay_slots_free;
+	    delay_slots_free = i;
+	}
+	delay_slots_alloc = n;
+    }
+    s = &delay_slots[delay_slots_free];
+    delay_slots_free = s->next_free;
+    delay_slots_used++;
+    return s;
+}
+
+static void
+delaySlotRelease(delaySlot * s)
+{
+    delayBucket *leaf = s->bucket;
+    s->bucket = NULL;
+    s->loc = NULL;
+    s->next_free = delay_slots_free;
+    delay_slots_free = s - delay_slots;
+    delay_slots_used--;
+    delayBucketUnref(&delay_data[s->pool], leaf);
 }
 
 void
 delayPoolsInit(void)
 {
-    delay_pools_last_update = getCurrentTime();
     delay_no_delay = xcalloc(1, Squid_MaxFD);
     cachemgrRegister("delay", "Delay Pool Levels", delayPoolStats, NULL, NULL, 0, 1, 0);
     cachemgrRegister("delay2", "Delay Pool Statistics", delayPoolStatsNew, NULL, NULL, 0, 1, 0);
-    eventAdd("delayPoolsUpdateEvent", delayPoolsUpdateEvent, NULL, 1.0, 1, 0);
+    eventAdd("delayPoolsGC", delayPoolsGC, NULL, DELAY_GC_INTERVAL, 1);
 }
 
 void
@@ -159,89 +356,69 @@ delayInitDelayData(unsigned short pools)
 {
     if (!pools)
 	return;
+    /* the configuration is parsed before delayPoolsInit() */
+    if (!delay_bucket_pool)
+	delay_bucket_pool = memPoolCreate("delay_bucket", sizeof(delayBucket));
     delay_data = xcalloc(pools, sizeof(*delay_data));
+    delay_npools = pools;
     memory_used += pools * sizeof(*delay_data);
-    delay_id_ptr_hash = hash_create(delayIdPtrHashCmp, 256, delayIdPtrHash);
-}
-
-static void
-delayIdZero(void *hlink)
-{
-    hash_link *h = hlink;
-    delay_id *id = (delay_id *) h->key;
-    *id = 0;
-    xfree(h);
-    memory_used -= sizeof(*h);
 }
 
 void
 delayFreeDelayData(unsigned short pools)
 {
-    if (!delay_id_ptr_hash)
+    int i;
+    if (!delay_data)
 	return;
+    /* the pools are gone; every registered delay_id becomes "no pool" */
+    for (i = 0; i < delay_slots_alloc; i++) {
+	if (delay_slots[i].loc)
+	    *delay_slots[i].loc = 0;
+    }
+    memory_used -= delay_slots_alloc * sizeof(*delay_slots);
+    safe_free(delay_slots);
+    delay_slots_alloc = 0;
+    delay_slots_free = -1;
+    delay_slots_used = 0;
     safe_free(delay_data);
     memory_used -= pools * sizeof(*delay_data);
-    hashFreeItems(delay_id_ptr_hash, delayIdZero);
-    hashFreeMemory(delay_id_ptr_hash);
-    delay_id_ptr_hash = NULL;
+    delay_npools = 0;
 }
 
 void
 delayRegisterDelayIdPtr(delay_id * loc)
 {
-    hash_link *lnk;
-    if (!delay_id_ptr_hash)
-	return;
+    delaySlot *s;
     if (*loc == 0)
 	return;
-    lnk = xmalloc(sizeof(hash_link));
-    memory_used += sizeof(hash_link);
-    lnk->key = (char *) loc;
-    hash_join(delay_id_ptr_hash, lnk);
+    s = delaySlotLookup(*loc);
+    assert(s);
+    assert(s->loc == NULL);
+    s->loc = loc;
 }
 
 void
 delayUnregisterDelayIdPtr(delay_id * loc)
 {
-    hash_link *lnk;
-    if (!delay_id_ptr_hash)
-	return;
+    delaySlot *s;
     /*
      * If we went through a reconfigure, then all the delay_id's
-     * got set to zero, and they were removed from our hash
-     * table.
+     * got set to zero.
      */
     if (*loc == 0)
 	return;
-    lnk = hash_lookup(delay_id_ptr_hash, loc);
-    assert(lnk);
-    hash_remove_link(delay_id_ptr_hash, lnk);
-    xxfree(lnk);
-    memory_used -= sizeof(*lnk);
+    s = delaySlotLookup(*loc);
+    assert(s);
+    assert(s->loc == loc);
+    delaySlotRelease(s);
 }
 
 void
 delayCreateDelayPool(unsigned short pool, u_char class)
 {
-    switch (class) {
-    case 1:
-	delay_data[pool].class1 = xmalloc(sizeof(class1DelayPool));
-	delay_data[pool].class1->class = 1;
-	memory_used += sizeof(class1DelayPool);
-	break;
-    case 2:
-	delay_data[pool].class2 = xmalloc(sizeof(class2DelayPool));
-	delay_data[pool].class1->class = 2;
-	memory_used += sizeof(class2DelayPool);
-	break;
-    case 3:
-	delay_data[pool].class3 = xmalloc(sizeof(class3DelayPool));
-	delay_data[pool].class1->class = 3;
-	memory_used += sizeof(class3DelayPool);
-	break;
-    default:
-	assert(0);
-    }
+    assert(class >= 1 && class <= DELAY_MAX_LEVELS);
+    memset(&delay_data[pool], 0, sizeof(delay_data[pool]));
+    delay_data[pool].class = class;
 }
 
 void
@@ -250,49 +427,94 @@ delayInitDelayPool(unsigned short pool, u_char class, delaySpecSet * rates)
     /* delaySetSpec may be pointer to partial structure so MUST pass by
      * reference.
      */
+    delayPoolData *pd = &delay_data[pool];
+    delayLevel *l = pd->level;
+    if (pd->aggregate)
+	delayFreeDelayPool(pool);
+    pd->class = class;
+    l->name = "aggregate";
+    l->spec = &rates->aggregate;
+    l++;
     switch (class) {
     case 1:
-	delay_data[pool].class1->aggregate = (int) (((double) rates->aggregate.max_bytes *
-		Config.Delay.initial) / 100);
 	break;
     case 2:
-	delay_data[pool].class2->aggregate = (int) (((double) rates->aggregate.max_bytes *
-		Config.Delay.initial) / 100);
-	delay_data[pool].class2->individual_map[0] = 255;
-	delay_data[pool].class2->individual_255_used = 0;
+	l->name = "individual";
+	l->spec = &rates->individual;
+	l->mask = 0x000000ff;
+	l++;
 	break;
     case 3:
-	delay_data[pool].class3->aggregate = (int) (((double) rates->aggregate.max_bytes *
-		Config.Delay.initial) / 100);
-	delay_data[pool].class3->network_map[0] = 255;
-	delay_data[pool].class3->network_255_used = 0;
-	memset(&delay_data[pool].class3->individual_255_used, '\0',
-	    sizeof(delay_data[pool].class3->individual_255_used));
+	l->name = "network";
+	l->spec = &rates->network;
+	l->mask = 0x0000ff00;
+	l++;
+	l->name = "individual";
+	l->spec = &rates->individual;
+	l->mask = 0x0000ffff;
+	l++;
+	break;
+    case 4:
+	/* network mask is taken from delay_network_prefix when used */
+	l->name = "network";
+	l->spec = &rates->network;
+	l++;
+	l->name = "individual";
+	l->spec = &rates->individual;
+	l->mask = 0xffffffff;
+	l++;
+	l->name = "connection";
+	l->spec = &rates->connection;
+	l->per_connection = 1;
+	l++;
 	break;
     default:
 	assert(0);
     }
+    pd->nlevels = l - pd->level;
+    for (l = pd->level; l < pd->level + pd->nlevels; l++) {
+	if (!l->per_connection)
+	    delayLevelResize(l, DELAY_HASH_MIN);
+    }
+    pd->aggregate = delayBucketCreate(pd, pd->level, NULL, 0);
+    pd->aggregate->refs = 1;	/* owned by the pool */
 }
 
 void
 delayFreeDelayPool(unsigned short pool)
 {
-    /* this is a union - and all free() cares about is the pointer location */
-    switch (delay_data[pool].class1->class) {
-    case 1:
-	memory_used -= sizeof(class1DelayPool);
-	break;
-    case 2:
-	memory_used -= sizeof(class2DelayPool);
-	break;
-    case 3:
-	memory_used -= sizeof(class3DelayPool);
-	break;
-    default:
-	debugs(77, 1, "delayFreeDelayPool: bad class %d",
-	    delay_data[pool].class1->class);
+    delayPoolData *pd = &delay_data[pool];
+    delayBucket *b, *next;
+    delayLevel *l;
+    unsigned int i;
+    if (!pd->aggregate) {
+	memset(pd, 0, sizeof(*pd));
+	return;
     }
-    safe_free(delay_data[pool].class1);
+    for (l = pd->level; l < pd->level + pd->nlevels; l++) {
+	for (i = 0; i < l->nbuckets; i++) {
+	    for (b = l->buckets[i]; b; b = next) {
+		next = b->next;
+		memPoolFree(delay_bucket_pool, b);
+		memory_used -= sizeof(*b);
+	    }
+	}
+	memory_used -= l->nbuckets * sizeof(*l->buckets);
+	safe_free(l->buckets);
+    }
+    /*
+     * Connection buckets are not hashed; they are only reachable
+     * through the slots, which delayFreeDelayData() throws away.
+     */
+    for (i = 0; i < (unsigned int) delay_slots_alloc; i++) {
+	b = delay_slots[i].bucket;
+	if (b && b->level->per_connection && delay_slots[i].pool == pool) {
+	    memPoolFree(delay_bucket_pool, b);
+	    memory_used -= sizeof(*b);
+	    delay_slots[i].bucket = NULL;
+	}
+    }
+    memset(pd, 0, sizeof(*pd));
 }
 
 void
@@ -313,12 +535,6 @@ delayIsNoDelay(int fd)
     return delay_no_delay[fd];
 }
 
-static delay_id
-delayId(unsigned short pool, unsigned short position)
-{
-    return (pool << 16) | position;
-}
-
 delay_id
 delayClient(clientHttpRequest * http)
 {
@@ -333,254 +549,61 @@ delayClient(clientHttpRequest * http)
     ch.request = r;
     if (r->client_addr.s_addr == INADDR_BROADCAST) {
 	debugs(77, 2, "delayClient: WARNING: Called with 'allones' address, ignoring");
-	return delayId(0, 0);
+	return 0;
     }
     for (pool = 0; pool < Config.Delay.pools; pool++) {
 	if (Config.Delay.access[pool] && aclCheckFast(Config.Delay.access[pool], &ch))
 	    break;
     }
     if (pool == Config.Delay.pools)
-	return delayId(0, 0);
+	return 0;
     return delayPoolClient(pool, ch.src_addr.s_addr);
 }
 
 delay_id
 delayPoolClient(unsigned short pool, in_addr_t addr)
 {
-    int i;
-    int j;
-    unsigned int host;
-    unsigned short position;
-    unsigned char class, net;
-    class = Config.Delay.class[pool];
-    debugs(77, 2, "delayPoolClient: pool %u , class %u", pool, class);
-    if (class == 0)
-	return delayId(0, 0);
-    if (class == 1)
-	return delayId(pool + 1, 0);
-    if (class == 2) {
-	host = ntohl(addr) & 0xff;
-	if (host == 255) {
-	    if (!delay_data[pool].class2->individual_255_used) {
-		delay_data[pool].class2->individual_255_used = 1;
-		delay_data[pool].class2->individual[IND_MAP_SZ - 1] =
-		    (int) (((double) Config.Delay.rates[pool]->individual.max_bytes *
-			Config.Delay.initial) / 100);
-	    }
-	    return delayId(pool + 1, 255);
-	}
-	for (i = 0; i < IND_MAP_SZ; i++) {
-	    if (delay_data[pool].class2->individual_map[i] == host)
-		break;
-	    if (delay_data[pool].class2->individual_map[i] == 255) {
-		delay_data[pool].class2->individual_map[i] = host;
-		assert(i < (IND_MAP_SZ - 1));
-		delay_data[pool].class2->individual_map[i + 1] = 255;
-		delay_data[pool].class2->individual[i] =
-		    (int) (((double) Config.Delay.rates[pool]->individual.max_bytes *
-			Config.Delay.initial) / 100);
-		break;
-	    }
-	}
-	return delayId(pool + 1, i);
-    }
-    /* class == 3 */
-    host = ntohl(addr) & 0xffff;
-    net = host >> 8;
-    host &= 0xff;
-    if (net == 255) {
-	i = 255;
-	if (!delay_data[pool].class3->network_255_used) {
-	    delay_data[pool].class3->network_255_used = 1;
-	    delay_data[pool].class3->network[255] =
-		(int) (((double) Config.Delay.rates[pool]->network.max_bytes *
-		    Config.Delay.initial) / 100);
-	    delay_data[pool].class3->individual_map[i][0] = 255;
-	}
-    } else {
-	for (i = 0; i < NET_MAP_SZ; i++) {
-	    if (delay_data[pool].class3->network_map[i] == net)
-		break;
-	    if (delay_data[pool].class3->network_map[i] == 255) {
-		delay_data[pool].class3->network_map[i] = net;
-		delay_data[pool].class3->individual_map[i][0] = 255;
-		assert(i < (NET_MAP_SZ - 1));
-		delay_data[pool].class3->network_map[i + 1] = 255;
-		delay_data[pool].class3->network[i] =
-		    (int) (((double) Config.Delay.rates[pool]->network.max_bytes *
-			Config.Delay.initial) / 100);
-		break;
-	    }
-	}
-    }
-    position = i << 8;
-    if (host == 255) {
-	position |= 255;
-	if (!(delay_data[pool].class3->individual_255_used[i / 8] & (1 << (i % 8)))) {
-	    delay_data[pool].class3->individual_255_used[i / 8] |= (1 << (i % 8));
-	    delay_data[pool].class3->individual[position] =
-		(int) (((double) Config.Delay.rates[pool]->individual.max_bytes *
-		    Config.Delay.initial) / 100);
-	}
-	return delayId(pool + 1, position);
-    }
-    assert(i < NET_MAP_SZ);
-    for (j = 0; j < IND_MAP_SZ; j++) {
-	if (delay_data[pool].class3->individual_map[i][j] == host) {
-	    position |= j;
-	    break;
-	}
-	if (delay_data[pool].class3->individual_map[i][j] == 255) {
-	    delay_data[pool].class3->individual_map[i][j] = host;
-	    assert(j < (IND_MAP_SZ - 1));
-	    delay_data[pool].class3->individual_map[i][j + 1] = 255;
-	    position |= j;
-	    delay_data[pool].class3->individual[position] =
-		(int) (((double) Config.Delay.rates[pool]->individual.max_bytes *
-		    Config.Delay.initial) / 100);
-	    break;
-	}
-    }
-    return delayId(pool + 1, position);
-}
-
-static void
-delayUpdateClass1(class1DelayPool * class1, delaySpecSet * rates, int incr)
-{
-    /* delaySetSpec may be pointer to partial structure so MUST pass by
-     * reference.
-     */
-    if (rates->aggregate.restore_bps != -1 &&
-	(class1->aggregate += rates->aggregate.restore_bps * incr) >
-	rates->aggregate.max_bytes)
-	class1->aggregate = rates->aggregate.max_bytes;
-}
-
-static void
-delayUpdateClass2(class2DelayPool * class2, delaySpecSet * rates, int incr)
-{
-    int restore_bytes;
-    unsigned char i;		/* depends on 255 + 1 = 0 */
-    /* delaySetSpec may be pointer to partial structure so MUST pass by
-     * reference.
-     */
-    if (rates->aggregate.restore_bps != -1 &&
-	(class2->aggregate += rates->aggregate.restore_bps * incr) >
-	rates->aggregate.max_bytes)
-	class2->aggregate = rates->aggregate.max_bytes;
-    if ((restore_bytes = rates->individual.restore_bps) == -1)
-	return;
-    restore_bytes *= incr;
-    /* i < IND_MAP_SZ is enforced by data type (unsigned chars are all < 256).
-     * this loop starts at 0 or 255 and ends at 254 unless terminated earlier
-     * by finding the end of the map.  note as above that 255 + 1 = 0.
-     */
-    for (i = (class2->individual_255_used ? 255 : 0);; i++) {
-	if (i != 255 && class2->individual_map[i] == 255)
-	    return;
-	if (class2->individual[i] != rates->individual.max_bytes &&
-	    (class2->individual[i] += restore_bytes) > rates->individual.max_bytes)
-	    class2->individual[i] = rates->individual.max_bytes;
-	if (i == 254)
-	    return;
-    }
-}
-
-static void
-delayUpdateClass3(class3DelayPool * class3, delaySpecSet * rates, int incr)
-{
-    int individual_restore_bytes, network_restore_bytes;
-    int mpos;
-    unsigned char i, j;		/* depends on 255 + 1 = 0 */
-    /* delaySetSpec may be pointer to partial structure so MUST pass by
-     * reference.
-     */
-    if (rates->aggregate.restore_bps != -1 &&
-	(class3->aggregate += rates->aggregate.restore_bps * incr) >
-	rates->aggregate.max_bytes)
-	class3->aggregate = rates->aggregate.max_bytes;
-    /* the following line deliberately uses &, not &&, in an if statement
-     * to avoid conditional execution
-     */
-    if (((network_restore_bytes = rates->network.restore_bps) == -1) &
-	((individual_restore_bytes = rates->individual.restore_bps) == -1))
-	return;
-    individual_restore_bytes *= incr;
-    network_restore_bytes *= incr;
-    /* i < NET_MAP_SZ is enforced by data type (unsigned chars are all < 256).
-     * this loop starts at 0 or 255 and ends at 254 unless terminated earlier
-     * by finding the end of the map.  note as above that 255 + 1 = 0.
-     */
-    for (i = (class3->network_255_used ? 255 : 0);; ++i) {
-	if (i != 255 && class3->network_map[i] == 255)
-	    return;
-	if (individual_restore_bytes != -incr) {
-	    mpos = i << 8;
-	    /* this is not as simple as the outer loop as mpos doesn't wrap like
-	     * i and j do.  so the net 255 increment is done as a separate special
-	     * case.  the alternative would be overlapping a union of two chars on
-	     * top of a 16-bit unsigned int, but that wouldn't really be worth the
-	     * effort.
-	     */
-	    for (j = 0;; ++j, ++mpos) {
-		if (class3->individual_map[i][j] == 255)
-		    break;
-		assert(mpos < C3_IND_SZ);
-		if (class3->individual[mpos] != rates->individual.max_bytes &&
-		    (class3->individual[mpos] += individual_restore_bytes) >
-		    rates->individual.max_bytes)
-		    class3->individual[mpos] = rates->individual.max_bytes;
-		if (j == 254)
-		    break;
-	    }
-	    if (class3->individual_255_used[i / 8] & (1 << (i % 8))) {
-		mpos |= 255;	/* this will set mpos to network 255 */
-		assert(mpos < C3_IND_SZ);
-		if (class3->individual[mpos] != rates->individual.max_bytes &&
-		    (class3->individual[mpos] += individual_restore_bytes) >
-		    rates->individual.max_bytes)
-		    class3->individual[mpos] = rates->individual.max_bytes;
-	    }
-	}
-	if (network_restore_bytes != -incr &&
-	    class3->network[i] != rates->network.max_bytes &&
-	    (class3->network[i] += network_restore_bytes) >
-	    rates->network.max_bytes)
-	    class3->network[i] = rates->network.max_bytes;
-	if (i == 254)
-	    return;
-    }
-}
-
-void
-delayPoolsUpdate(void *unused)
-{
-    int incr = squid_curtime - delay_pools_last_update;
-    unsigned short i;
-    unsigned char class;
-    if (!Config.Delay.pools)
-	return;
-    if (incr < 1)
-	return;
-    delay_pools_last_update = squid_curtime;
-    for (i = 0; i < Config.Delay.pools; i++) {
-	class = Config.Delay.class[i];
-	if (!class)
+    delayPoolData *pd;
+    delayLevel *l;
+    delayBucket *b;
+    delayBucket *found;
+    delaySlot *s;
+    unsigned int mask;
+    unsigned int key;
+    if (pool >= delay_npools || Config.Delay.class[pool] == 0)
+	return 0;
+    pd = &delay_data[pool];
+    if (!pd->aggregate)
+	return 0;
+    debugs(77, 2, "delayPoolClient: pool %u , class %u", pool, pd->class);
+    if ((s = delaySlotAlloc()) == NULL) {
+	debugs(77, 1, "delayPoolClient: out of delay_id slots, not delaying");
+	return 0;
+    }
+    b = pd->aggregate;
+    for (l = pd->level + 1; l < pd->level + pd->nlevels; l++) {
+	if (l->per_connection) {
+	    b = delayBucketCreate(pd, l, b, 0);
 	    continue;
-	switch (class) {
-	case 1:
-	    delayUpdateClass1(delay_data[i].class1, Config.Delay.rates[i], incr);
-	    break;
-	case 2:
-	    delayUpdateClass2(delay_data[i].class2, Config.Delay.rates[i], incr);
-	    break;
-	case 3:
-	    delayUpdateClass3(delay_data[i].class3, Config.Delay.rates[i], incr);
-	    break;
-	default:
-	    assert(0);
 	}
+	mask = l->mask;
+	if (pd->class == 4 && l == pd->level + 1) {
+	    if (Config.Delay.network_prefix == 0)
+		mask = 0;
+	    else
+		mask = ~0U << (32 - XMIN(Config.Delay.network_prefix, 32));
+	}
+	key = ntohl(addr) & mask;
+	if ((found = delayBucketFind(l, key)) != NULL)
+	    b = found;
+	else
+	    b = delayBucketCreate(pd, l, b, key);
     }
+    s->bucket = b;
+    s->loc = NULL;
+    s->pool = pool;
+    delayBucketRef(pd, b);
+    return ((pool + 1) << DELAY_SLOT_BITS) | (s - delay_slots);
 }
 
 /*
@@ -590,40 +613,22 @@ delayPoolsUpdate(void *unused)
 int
 delayBytesWanted(delay_id d, int min, int max)
 {
-    unsigned short position = d & 0xFFFF;
-    unsigned short pool = (d >> 16) - 1;
-    unsigned char class = (pool == 0xFFFF) ? 0 : Config.Delay.class[pool];
+    delaySlot *s = delaySlotLookup(d);
+    delayBucket *b;
     int nbytes = max;
+    double level;
 
-    switch (class) {
-    case 0:
-	break;
-
-    case 1:
-	if (Config.Delay.rates[pool]->aggregate.restore_bps != -1)
-	    nbytes = XMIN(nbytes, delay_data[pool].class1->aggregate);
-	break;
-
-    case 2:
-	if (Config.Delay.rates[pool]->aggregate.restore_bps != -1)
-	    nbytes = XMIN(nbytes, delay_data[pool].class2->aggregate);
-	if (Config.Delay.rates[pool]->individual.restore_bps != -1)
-	    nbytes = XMIN(nbytes, delay_data[pool].class2->individual[position]);
-	break;
-
-    case 3:
-	if (Config.Delay.rates[pool]->aggregate.restore_bps != -1)
-	    nbytes = XMIN(nbytes, delay_data[pool].class3->aggregate);
-	if (Config.Delay.rates[pool]->individual.restore_bps != -1)
-	    nbytes = XMIN(nbytes, delay_data[pool].class3->individual[position]);
-	if (Config.Delay.rates[pool]->network.restore_bps != -1)
-	    nbytes = XMIN(nbytes, delay_data[pool].class3->network[position >> 8]);
-	break;
-
-    default:
-	fatalf("delayBytesWanted: Invalid class %d\n", class);
-	break;
+    if (s == NULL)
+	return XMAX(min, nbytes);
+    for (b = s->bucket; b; b = b->parent) {
+	if (b->level->spec->restore_bps == -1)
+	    continue;
+	level = delayBucketRefill(b);
+	if (level < nbytes)
+	    nbytes = (int) level;
     }
+    if (nbytes <= 0)
+	delayScheduleWakeup(s->bucket);
     nbytes = XMAX(min, nbytes);
     return nbytes;
 }
@@ -636,39 +641,18 @@ delayBytesWanted(delay_id d, int min, int max)
 void
 delayBytesIn(delay_id d, int qty)
 {
-    unsigned short position = d & 0xFFFF;
-    unsigned short pool = (d >> 16) - 1;
-    unsigned char class;
-
-    if (pool == 0xFFFF)
-	return;
-    class = Config.Delay.class[pool];
-    switch (class) {
-    case 1:
-	delay_data[pool].class1->aggregate -= qty;
-
-	delay_data[pool].class1->aggregate_bytes += qty;
-	return;
-    case 2:
-	delay_data[pool].class2->aggregate -= qty;
-	delay_data[pool].class2->individual[position] -= qty;
-
-	delay_data[pool].class2->aggregate_bytes += qty;
-	delay_data[pool].class2->individual_bytes[position] += qty;
-	return;
-    case 3:
-	delay_data[pool].class3->aggregate -= qty;
-	delay_data[pool].class3->network[position >> 8] -= qty;
-	delay_data[pool].class3->individual[position] -= qty;
-
-	delay_data[pool].class3->aggregate_bytes += qty;
-	delay_data[pool].class3->network_bytes[position >> 8] += qty;
-	delay_data[pool].class3->individual_bytes[position] += qty;
+    delaySlot *s = delaySlotLookup(d);
+    delayBucket *b;
 
+    if (s == NULL)
 	return;
+    for (b = s->bucket; b; b = b->parent) {
+	if (b->level->spec->restore_bps != -1) {
+	    delayBucketRefill(b);
+	    b->tokens -= qty;
+	}
+	b->bytes += qty;
     }
-    fatalf("delayBytesWanted: Invalid class %d\n", class);
-    assert(0);
 }
 
 int
@@ -720,221 +704,96 @@ delaySetStoreClient(store_client * sc, delay_id delay_id)
     delayRegisterDelayIdPtr(&sc->delay_id);
 }
 
-static void
-delayPoolStatsAg(StoreEntry * sentry, int pool, int type, delaySpecSet * rate, int ag, uint64_t bytes)
+static const char *
+delayBucketKeyStr(const delayBucket * b)
 {
-    /* note - always pass delaySpecSet's by reference as may be incomplete */
-    if (rate->aggregate.restore_bps == -1) {
-	if (type == 1)
-	    storeAppendPrintf(sentry, "\tAggregate:\n\t\tDisabled.\n\n");
-	return;
-    }
-    if (type == 1) {
-	storeAppendPrintf(sentry, "\tAggregate:\n");
-	storeAppendPrintf(sentry, "\t\tMax: %d\n", rate->aggregate.max_bytes);
-	storeAppendPrintf(sentry, "\t\tRestore: %d\n", rate->aggregate.restore_bps);
-	storeAppendPrintf(sentry, "\t\tCurrent: %d\n", ag);
-    } else {
-	storeAppendPrintf(sentry, "pools.pool.%d.max=%d\n", pool + 1, rate->aggregate.max_bytes);
-	storeAppendPrintf(sentry, "pools.pool.%d.restore=%d\n", pool + 1, rate->aggregate.restore_bps);
-	storeAppendPrintf(sentry, "pools.pool.%d.current=%d\n", pool + 1, ag);
-	storeAppendPrintf(sentry, "pools.pool.%d.bytes=%" PRIu64 "\n", pool + 1, bytes);
-    }
-}
-
-static void
-delayPoolStats1(StoreEntry * sentry, int type, unsigned short pool)
-{
-    /* must be a reference only - partially malloc()d struct */
-    delaySpecSet *rate = Config.Delay.rates[pool];
-
-    if (type == 1) {
-	storeAppendPrintf(sentry, "Pool: %d\n\tClass: 1\n\n", pool + 1);
-    } else {
-	storeAppendPrintf(sentry, "pools.pool.%d.class=1\n", pool + 1);
-    }
-    delayPoolStatsAg(sentry, pool, type, rate, delay_data[pool].class1->aggregate, delay_data[pool].class1->aggregate_bytes);
-    storeAppendPrintf(sentry, "\n");
-}
-
-static void
-delayPoolStats2Individual(StoreEntry * sentry, int type, unsigned short pool, int i)
-{
-    class2DelayPool *class2 = delay_data[pool].class2;
-
-    if (type == 1) {
-	storeAppendPrintf(sentry, "%d:%d ", class2->individual_map[i],
-	    class2->individual[i]);
-    } else {
-	storeAppendPrintf(sentry, "pools.pool.%d.individuals.%d.rate=%d\n", pool + 1, class2->individual_map[i], class2->individual[i]);
-	storeAppendPrintf(sentry, "pools.pool.%d.individuals.%d.bytes=%" PRIu64 "\n", pool + 1, class2->individual_map[i], class2->individual_bytes[i]);
-    }
+    struct in_addr a;
+    a.s_addr = htonl(b->key);
+    return inet_ntoa(a);
 }
 
 static void
-delayPoolStats2(StoreEntry * sentry, int type, unsigned short pool)
+delayPoolStatsLevel(StoreEntry * sentry, int type, unsigned short pool, delayLevel * l)
 {
-    /* must be a reference only - partially malloc()d struct */
-    delaySpecSet *rate = Config.Delay.rates[pool];
-    class2DelayPool *class2 = delay_data[pool].class2;
-    unsigned char shown = 0;
+    const delaySpec *spec = l->spec;
+    delayBucket *b;
     unsigned int i;
+    int shown = 0;
+    int active = 0;
 
-    if (type == 1)
-	storeAppendPrintf(sentry, "Pool: %d\n\tClass: 2\n\n", pool + 1);
-    else
-	storeAppendPrintf(sentry, "pools.pool.%d.class=2\n", pool + 1);
-
-    delayPoolStatsAg(sentry, pool, type, rate, class2->aggregate, class2->aggregate_bytes);
-    if (rate->individual.restore_bps == -1) {
+    if (spec->restore_bps == -1) {
 	if (type == 1)
-	    storeAppendPrintf(sentry, "\tIndividual:\n\t\tDisabled.\n\n");
+	    storeAppendPrintf(sentry, "\t%c%s:\n\t\tDisabled.\n\n", toupper(*l->name), l->name + 1);
 	return;
     }
     if (type == 1) {
-	storeAppendPrintf(sentry, "\tIndividual:\n");
-	storeAppendPrintf(sentry, "\t\tMax: %d\n", rate->individual.max_bytes);
-	storeAppendPrintf(sentry, "\t\tRate: %d\n", rate->individual.restore_bps);
-	storeAppendPrintf(sentry, "\t\tCurrent: ");
+	storeAppendPrintf(sentry, "\t%c%s:\n", toupper(*l->name), l->name + 1);
+	storeAppendPrintf(sentry, "\t\tMax: %d\n", spec->max_bytes);
+	storeAppendPrintf(sentry, "\t\tRate: %d\n", spec->restore_bps);
     } else {
-	storeAppendPrintf(sentry, "pools.pool.%d.individual.max=%d\n", pool + 1, rate->individual.max_bytes);
-	storeAppendPrintf(sentry, "pools.pool.%d.individual.rate=%d\n", pool + 1, rate->individual.restore_bps);
+	storeAppendPrintf(sentry, "pools.pool.%d.%s.max=%d\n", pool + 1, l->name, spec->max_bytes);
+	storeAppendPrintf(sentry, "pools.pool.%d.%s.rate=%d\n", pool + 1, l->name, spec->restore_bps);
     }
-    for (i = 0; i < IND_MAP_SZ; i++) {
-	if (class2->individual_map[i] == 255)
-	    break;
-	delayPoolStats2Individual(sentry, type, pool, i);
-	shown = 1;
+    if (l->per_connection) {
+	for (i = 0; i < (unsigned int) delay_slots_alloc; i++) {
+	    if (delay_slots[i].bucket && delay_slots[i].bucket->level == l)
+		active++;
+	}
+	if (type == 1)
+	    storeAppendPrintf(sentry, "\t\tActive: %d\n\n", active);
+	else
+	    storeAppendPrintf(sentry, "pools.pool.%d.%s.active=%d\n", pool + 1, l->name, active);
+	return;
     }
-    if (class2->individual_255_used) {
-	delayPoolStats2Individual(sentry, type, pool, 255);
-	shown = 1;
+    if (type == 1)
+	storeAppendPrintf(sentry, "\t\tCurrent: ");
+    for (i = 0; i < l->nbuckets; i++) {
+	for (b = l->buckets[i]; b; b = b->next) {
+	    delayBucketRefill(b);
+	    if (type == 1) {
+		storeAppendPrintf(sentry, "%s:%d ", delayBucketKeyStr(b), (int) b->tokens);
+	    } else {
+		storeAppendPrintf(sentry, "pools.pool.%d.%ss.%s.rate=%d\n", pool + 1, l->name, delayBucketKeyStr(b), (int) b->tokens);
+		storeAppendPrintf(sentry, "pools.pool.%d.%ss.%s.bytes=%" PRIu64 "\n", pool + 1, l->name, delayBucketKeyStr(b), b->bytes);
+	    }
+	    shown = 1;
+	}
     }
     if (type == 1 && !shown)
 	storeAppendPrintf(sentry, "Not used yet.");
-    storeAppendPrintf(sentry, "\n\n");
-}
-
-
-static void
-delayPoolStats3Network(StoreEntry * e, int type, unsigned short pool, int i)
-{
-    class3DelayPool *class3 = delay_data[pool].class3;
-
-    if (type == 1) {
-	storeAppendPrintf(e, "%d:%d ", class3->network_map[i],
-	    class3->network[i]);
-    } else {
-	storeAppendPrintf(e, "pools.pool.%d.networks.%d.rate=%d\n", pool + 1, class3->network_map[i], class3->network[i]);;
-	storeAppendPrintf(e, "pools.pool.%d.networks.%d.bytes=%" PRIu64 "\n", pool + 1, class3->network_map[i], class3->network_bytes[i]);
-    }
-}
-
-static void
-delayPoolStats3Individual(StoreEntry * e, int type, unsigned short pool, int i, int j)
-{
-    class3DelayPool *class3 = delay_data[pool].class3;
-
-    if (type == 1) {
-	storeAppendPrintf(e, "%d:%d ", class3->individual_map[i][j],
-	    class3->individual[(i << 8) | j]);
-    } else {
-	storeAppendPrintf(e, "pools.pool.%d.networks.%d.individuals.%d.rate=%d\n", pool + 1, class3->network_map[i], class3->individual_map[i][j], class3->individual[(i << 8) | j]);
-	storeAppendPrintf(e, "pools.pool.%d.networks.%d.individuals.%d.bytes=%" PRIu64 "\n", pool + 1, class3->network_map[i], class3->individual_map[i][j], class3->individual_bytes[(i << 8) | j]);
-    }
-}
-
-static int
-delayPoolStats3IndNetwork(StoreEntry * sentry, int type, unsigned short pool, int i)
-{
-    int j;
-    int shown = 0;
-    class3DelayPool *class3 = delay_data[pool].class3;
-
-    if (type == 1)
-	storeAppendPrintf(sentry, "\t\tCurrent [Network %d]: ", class3->network_map[i]);
-    shown = 1;
-
-    for (j = 0; j < IND_MAP_SZ; j++) {
-	if (class3->individual_map[i][j] == 255)
-	    break;
-	delayPoolStats3Individual(sentry, type, pool, i, j);
-	shown = 1;
-    }
-    if (class3->individual_255_used[i / 8] & (1 << (i % 8))) {
-	delayPoolStats3Individual(sentry, type, pool, i, 255);
-	shown = 1;
-    }
     if (type == 1)
-	storeAppendPrintf(sentry, "\n");
-    return shown;
+	storeAppendPrintf(sentry, "\n\n");
 }
 
 static void
-delayPoolStats3(StoreEntry * sentry, int type, unsigned short pool)
+delayPoolStatsPool(StoreEntry * sentry, int type, unsigned short pool)
 {
-    /* fully malloc()d struct in this case only */
-    delaySpecSet *rate = Config.Delay.rates[pool];
-    class3DelayPool *class3 = delay_data[pool].class3;
-    unsigned char shown = 0;
-    unsigned int i;
+    delayPoolData *pd = &delay_data[pool];
+    /* must be a reference only - partially malloc()d struct */
+    delaySpec *rate = &Config.Delay.rates[pool]->aggregate;
+    delayBucket *ag = pd->aggregate;
+    int i;
 
     if (type == 1)
-	storeAppendPrintf(sentry, "Pool: %d\n\tClass: 3\n\n", pool + 1);
+	storeAppendPrintf(sentry, "Pool: %d\n\tClass: %d\n\n", pool + 1, pd->class);
     else
-	storeAppendPrintf(sentry, "pools.pool.%d.class=3\n", pool + 1);
-    delayPoolStatsAg(sentry, pool, type, rate, class3->aggregate, class3->aggregate_bytes);
-    if ((type == 1) && rate->network.restore_bps == -1) {
-	storeAppendPrintf(sentry, "\tNetwork:\n\t\tDisabled.");
-    } else {
-	if (type == 1) {
-	    storeAppendPrintf(sentry, "\tNetwork:\n");
-	    storeAppendPrintf(sentry, "\t\tMax: %d\n", rate->network.max_bytes);
-	    storeAppendPrintf(sentry, "\t\tRate: %d\n", rate->network.restore_bps);
-	    storeAppendPrintf(sentry, "\t\tCurrent: ");
-	} else {
-	    storeAppendPrintf(sentry, "pools.pool.%d.network.max=%d\n", pool + 1, rate->network.max_bytes);
-	    storeAppendPrintf(sentry, "pools.pool.%d.network.rate=%d\n", pool + 1, rate->network.restore_bps);
-	}
-	for (i = 0; i < NET_MAP_SZ; i++) {
-	    if (class3->network_map[i] == 255)
-		break;
-	    delayPoolStats3Network(sentry, type, pool, i);
-	    shown = 1;
-	}
-	if (class3->network_255_used) {
-	    delayPoolStats3Network(sentry, type, pool, 255);
-	    shown = 1;
-	}
-	if ((type == 1) && !shown)
-	    storeAppendPrintf(sentry, "Not used yet.");
-    }
-    if (type == 1)
-	storeAppendPrintf(sentry, "\n\n");
-    shown = 0;
-    if (rate->individual.restore_bps == -1) {
+	storeAppendPrintf(sentry, "pools.pool.%d.class=%d\n", pool + 1, pd->class);
+    if (rate->restore_bps == -1) {
 	if (type == 1)
-	    storeAppendPrintf(sentry, "\tIndividual:\n\t\tDisabled.\n\n");
-	return;
-    }
-    if (type == 1) {
-	storeAppendPrintf(sentry, "\tIndividual:\n");
-	storeAppendPrintf(sentry, "\t\tMax: %d\n", rate->individual.max_bytes);
-	storeAppendPrintf(sentry, "\t\tRate: %d\n", rate->individual.restore_bps);
+	    storeAppendPrintf(sentry, "\tAggregate:\n\t\tDisabled.\n\n");
+    } else if (type == 1) {
+	storeAppendPrintf(sentry, "\tAggregate:\n");
+	storeAppendPrintf(sentry, "\t\tMax: %d\n", rate->max_bytes);
+	storeAppendPrintf(sentry, "\t\tRestore: %d\n", rate->restore_bps);
+	storeAppendPrintf(sentry, "\t\tCurrent: %d\n\n", (int) delayBucketRefill(ag));
     } else {
-	storeAppendPrintf(sentry, "pools.pool.%d.individual.max=%d\n", pool + 1, rate->individual.max_bytes);
-	storeAppendPrintf(sentry, "pools.pool.%d.individual.rate=%d\n", pool + 1, rate->individual.restore_bps);
+	storeAppendPrintf(sentry, "pools.pool.%d.max=%d\n", pool + 1, rate->max_bytes);
+	storeAppendPrintf(sentry, "pools.pool.%d.restore=%d\n", pool + 1, rate->restore_bps);
+	storeAppendPrintf(sentry, "pools.pool.%d.current=%d\n", pool + 1, (int) delayBucketRefill(ag));
+	storeAppendPrintf(sentry, "pools.pool.%d.bytes=%" PRIu64 "\n", pool + 1, ag->bytes);
     }
-    for (i = 0; i < NET_MAP_SZ; i++) {
-	if (class3->network_map[i] == 255)
-	    break;
-	shown |= delayPoolStats3IndNetwork(sentry, type, pool, i);
-    }
-    if (class3->network_255_used)
-	shown |= delayPoolStats3IndNetwork(sentry, type, pool, 255);
-
-    if ((type == 1) && !shown)
-	storeAppendPrintf(sentry, "\t\tCurrent [All networks]: Not used yet.\n");
+    for (i = 1; i < pd->nlevels; i++)
+	delayPoolStatsLevel(sentry, type, pool, &pd->level[i]);
     storeAppendPrintf(sentry, "\n");
 }
 
@@ -945,24 +804,14 @@ delayPoolStats(StoreEntry * sentry, void* data)
 
     storeAppendPrintf(sentry, "Delay pools configured: %d\n\n", Config.Delay.pools);
     for (i = 0; i < Config.Delay.pools; i++) {
-	switch (Config.Delay.class[i]) {
-	case 0:
+	if (Config.Delay.class[i] == 0 || !delay_data[i].aggregate) {
 	    storeAppendPrintf(sentry, "Pool: %d\n\tClass: 0\n\n", i + 1);
 	    storeAppendPrintf(sentry, "\tMisconfigured pool.\n\n");
-	    break;
-	case 1:
-	    delayPoolStats1(sentry, 1, i);
-	    break;
-	case 2:
-	    delayPoolStats2(sentry, 1, i);
-	    break;
-	case 3:
-	    delayPoolStats3(sentry, 1, i);
-	    break;
-	default:
-	    assert(0);
+	    continue;
 	}
+	delayPoolStatsPool(sentry, 1, i);
     }
+    storeAppendPrintf(sentry, "Delay ids in use: %d\n", delay_slots_used);
     storeAppendPrintf(sentry, "Memory Used: %d bytes\n", (int) memory_used);
 }
 
@@ -973,22 +822,11 @@ delayPoolStatsNew(StoreEntry * e, void* data)
 
     storeAppendPrintf(e, "pools.npools=%d\n\n", Config.Delay.pools);
     for (i = 0; i < Config.Delay.pools; i++) {
-	switch (Config.Delay.class[i]) {
-	case 0:
+	if (Config.Delay.class[i] == 0 || !delay_data[i].aggregate) {
 	    storeAppendPrintf(e, "pools.pool.%d.class=0\n\n", i + 1);
-	    break;
-	case 1:
-	    delayPoolStats1(e, 2, i);
-	    break;
-	case 2:
-	    delayPoolStats2(e, 2, i);
-	    break;
-	case 3:
-	    delayPoolStats3(e, 2, i);
-	    break;
-	default:
-	    assert(0);
+	    continue;
 	}
+	delayPoolStatsPool(e, 2, i);
     }
 }
 
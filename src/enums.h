@@ -407,9 +407,16 @@ typedef enum {
     RFT_URLHOST,
     RFT_HDRHOST,
     RFT_EXTERNALACL_TAG,
-    RFT_EXTERNALACL_LOGSTR
+    RFT_EXTERNALACL_LOGSTR,
+    RFT_SUBMATCH
 } rewrite_token_type;
 
+typedef enum {
+    REWRITE_RULE_HOST,
+    REWRITE_RULE_PREFIX,
+    REWRITE_RULE_REGEX
+} rewrite_rule_type;
+
 typedef enum {
     FORWARDED_FOR_ON,
     FORWARDED_FOR_OFF,
@@ -418,6 +425,17 @@ typedef enum {
     FORWARDED_FOR_TRUNCATE
 } forwarded_for_mode;
 
+typedef enum {
+    LATENCY_ALL,
+    LATENCY_HIT,
+    LATENCY_NEAR_MISS,
+    LATENCY_MISS,
+    LATENCY_DNS,
+    LATENCY_CONNECT,
+    LATENCY_FIRST_BYTE,
+    LATENCY_MAX
+} latency_phase_t;
+
 #if USE_HTCP
 
 enum htcp_clr_reason {
@@ -49,19 +49,23 @@ eventLocalInit(void)
 static void
 eventDump(StoreEntry * sentry,void* data)
 {
-    struct ev_entry *e = tasks;
+    struct ev_entry *e;
+    int i;
     if (last_event_ran)
 	storeAppendPrintf(sentry, "Last event to run: %s\n\n", last_event_ran);
-    storeAppendPrintf(sentry, "%s\t%s\t%s\t%s\n",
-	"Operation",
-	"Next Execution",
-	"Weight",
-	"Callback Valid?");
-    while (e != NULL) {
-	storeAppendPrintf(sentry, "%s\t%f seconds\t%d\t%s\n",
-	    e->name, e->when - current_dtime, e->weight,
-	    e->arg ? cbdataValid(e->arg) ? "yes" : "no" : "N/A");
-	e = e->next;
+    for (i = 0; i < iapp_nloops; i++) {
+	if (iapp_nloops > 1)
+	    storeAppendPrintf(sentry, "%sEvent loop %d:\n", i ? "\n" : "", i);
+	storeAppendPrintf(sentry, "%s\t%s\t%s\t%s\n",
+	    "Operation",
+	    "Next Execution",
+	    "Weight",
+	    "Callback Valid?");
+	for (e = iapp_loops[i].tasks; e != NULL; e = e->next) {
+	    storeAppendPrintf(sentry, "%s\t%f seconds\t%d\t%s\n",
+		e->name, e->when - current_dtime, e->weight,
+		e->arg ? cbdataValid(e->arg) ? "yes" : "no" : "N/A");
+	}
     }
 }
 
@@ -49,8 +49,18 @@
 #define DEFAULT_EXTERNAL_ACL_CHILDREN 5
 #endif
 
+/* Shared (SMP) result cache geometry */
+#define EXTERNAL_ACL_SHM_SHARDS 32
+#define EXTERNAL_ACL_SHM_PROBE 8
+#define EXTERNAL_ACL_SHM_KEY_SZ 512
+#define EXTERNAL_ACL_SHM_VALUE_SZ 512
+/* How long to wait on a lookup another worker has in progress */
+#define EXTERNAL_ACL_SHM_WAIT 10
+#define EXTERNAL_ACL_SHM_POLL 0.01
+
 typedef struct _external_acl_format external_acl_format;
 typedef struct _external_acl_data external_acl_data;
+typedef struct _externalAclShm externalAclShm;
 
 static char *makeExternalAclKey(aclCheck_t * ch, external_acl_data * acl_data);
 static void external_acl_cache_delete(external_acl * def, external_acl_entry * entry);
@@ -58,6 +68,8 @@ static int external_acl_entry_expired(external_acl * def, external_acl_entry * e
 static int external_acl_grace_expired(external_acl * def, external_acl_entry * entry);
 static void external_acl_cache_touch(external_acl * def, external_acl_entry * entry);
 static int external_acl_is_pending(external_acl * def, const char *key);
+static external_acl_entry *external_acl_cache_add(external_acl * def, const char *key, int result, char *user, char *passwd, char *message, char *log);
+static int externalAclShmLookup(external_acl * def, const char *key, int claim, external_acl_entry ** entry);
 
 /*******************************************************************
  * external_acl cache entry
@@ -99,6 +111,14 @@ struct _external_acl {
 	QUOTE_METHOD_SHELL = 1,
 	QUOTE_METHOD_URL
     } quote;
+    int shared_cache_size;
+    ShmSegment shm;
+    externalAclShm *shared;
+    struct {
+	int hits;
+	int waits;
+	int stores;
+    } shared_stats;
 };
 
 struct _external_acl_format {
@@ -173,6 +193,8 @@ free_external_acl(void *data)
 	external_acl_cache_delete(p, p->lru_list.tail->data);
     if (p->cache)
 	hashFreeMemory(p->cache);
+    shmSegmentClose(&p->shm);
+    p->shared = NULL;
 }
 
 void
@@ -210,6 +232,8 @@ parse_externalAclHelper(external_acl ** list)
 	    a->concurrency = atoi(token + 12);
 	} else if (strncmp(token, "cache=", 6) == 0) {
 	    a->cache_size = atoi(token + 6);
+	} else if (strncmp(token, "shared_cache=", 13) == 0) {
+	    a->shared_cache_size = atoi(token + 13);
 	} else if (strcmp(token, "protocol=2.5") == 0) {
 	    a->quote = QUOTE_METHOD_SHELL;
 	} else if (strcmp(token, "protocol=3.0") == 0) {
@@ -364,6 +388,8 @@ dump_externalAclHelper(StoreEntry * sentry, const char *name, const external_acl
 	    storeAppendPrintf(sentry, " concurrency=%d", node->concurrency);
 	if (node->cache_size)
 	    storeAppendPrintf(sentry, " cache=%d", node->cache_size);
+	if (node->shared_cache_size)
+	    storeAppendPrintf(sentry, " shared_cache=%d", node->shared_cache_size);
 	for (format = node->format; format; format = format->next) {
 	    switch (format->type) {
 	    case EXT_ACL_HEADER:
@@ -544,6 +570,8 @@ aclMatchExternal(void *data, aclCheck_t * ch)
     if (!entry) {
 	int lookup_needed = 1;
 	entry = hash_lookup(acl->def->cache, key);
+	if ((!entry || external_acl_entry_expired(acl->def, entry)) && acl->def->shared)
+	    externalAclShmLookup(acl->def, key, 0, &entry);
 	if (entry && !external_acl_entry_expired(acl->def, entry)) {
 	    lookup_needed = external_acl_grace_expired(acl->def, entry);
 	    /* Don't make graceful lookups if already pending */
@@ -894,6 +922,224 @@ external_acl_cache_delete(external_acl * def, external_acl_entry * entry)
     cbdataFree(entry);
 }
 
+/******************************************************************
+ * external_acl shared cache
+ *
+ * Each SMP worker keeps its own cache above.  With shared_cache=n the
+ * results are also published in a shared memory table so a result
+ * learnt by one worker is used by all of them.  A slot can also be
+ * marked as pending while one worker asks the helper; other workers
+ * then wait for that answer instead of asking the same question.
+ *
+ * The table is split in shards, each with its own lock.  A key is
+ * looked for in a small probe window inside its shard; when the window
+ * is full, empty, expired, stale pending, negative and finally the
+ * oldest slots are replaced, in that order.
+ */
+
+enum {
+    EXTACL_SLOT_EMPTY,
+    EXTACL_SLOT_PENDING,
+    EXTACL_SLOT_RESULT
+};
+
+enum {
+    EXTACL_SHM_MISS,
+    EXTACL_SHM_HIT,
+    EXTACL_SHM_PENDING
+};
+
+typedef struct _externalAclShmSlot externalAclShmSlot;
+struct _externalAclShmSlot {
+    unsigned int hash;
+    int state;
+    int owner;			/* KidIdentifier of the pending lookup */
+    int result;
+    time_t date;
+    char key[EXTERNAL_ACL_SHM_KEY_SZ];
+    char value[EXTERNAL_ACL_SHM_VALUE_SZ];	/* user\0passwd\0message\0log\0 */
+};
+
+struct _externalAclShm {
+    ShmLock lock[EXTERNAL_ACL_SHM_SHARDS];
+    externalAclShmSlot slots[1];
+};
+
+static int
+externalAclShmSlots(external_acl * def)
+{
+    int n = def->shared_cache_size;
+    return ((n + EXTERNAL_ACL_SHM_SHARDS - 1) / EXTERNAL_ACL_SHM_SHARDS) * EXTERNAL_ACL_SHM_SHARDS;
+}
+
+static void
+externalAclShmOpen(external_acl * def)
+{
+    char tag[SHM_NAME_LEN];
+    size_t size = offsetof(externalAclShm, slots) + externalAclShmSlots(def) * sizeof(externalAclShmSlot);
+    snprintf(tag, sizeof(tag), "extacl-%s", def->name);
+    def->shared = shmSegmentOpen(&def->shm, tag, size);
+    if (!def->shared)
+	debugs(82, 1, "WARNING: external_acl_type %s: shared cache unavailable, using per-process cache only", def->name);
+}
+
+static int
+external_acl_shm_slot_expired(external_acl * def, externalAclShmSlot * slot)
+{
+    return slot->date + (slot->result == 1 ? def->ttl : def->negative_ttl) < squid_curtime;
+}
+
+/*
+ * Lock the shard key hashes to.  If the last holder died with the lock
+ * taken its slots may be half written, so the shard starts over empty.
+ */
+static ShmLock *
+externalAclShmLock(external_acl * def, unsigned int hash)
+{
+    int per_shard = externalAclShmSlots(def) / EXTERNAL_ACL_SHM_SHARDS;
+    int shard = hash % EXTERNAL_ACL_SHM_SHARDS;
+    ShmLock *lock = &def->shared->lock[shard];
+    if (shmLockAcquire(lock))
+	memset(&def->shared->slots[shard * per_shard], 0, per_shard * sizeof(externalAclShmSlot));
+    return lock;
+}
+
+/*
+ * Find the slot for key in its probe window.  With create set, a
+ * slot is recycled for the key if it isn't there.  The shard lock
+ * must be held.
+ */
+static externalAclShmSlot *
+externalAclShmFind(external_acl * def, const char *key, unsigned int hash, int create)
+{
+    int per_shard = externalAclShmSlots(def) / EXTERNAL_ACL_SHM_SHARDS;
+    int probe = XMIN(per_shard, EXTERNAL_ACL_SHM_PROBE);
+    externalAclShmSlot *base = &def->shared->slots[(hash % EXTERNAL_ACL_SHM_SHARDS) * per_shard];
+    externalAclShmSlot *victim = NULL;
+    int victim_rank = -1;
+    int start = (hash / EXTERNAL_ACL_SHM_SHARDS) % per_shard;
+    int i;
+    for (i = 0; i < probe; i++) {
+	externalAclShmSlot *slot = &base[(start + i) % per_shard];
+	int rank;
+	if (slot->state != EXTACL_SLOT_EMPTY && slot->hash == hash && strcmp(slot->key, key) == 0)
+	    return slot;
+	if (!create)
+	    continue;
+	if (slot->state == EXTACL_SLOT_EMPTY)
+	    rank = 4;
+	else if (slot->state == EXTACL_SLOT_RESULT && external_acl_shm_slot_expired(def, slot))
+	    rank = 3;
+	else if (slot->state == EXTACL_SLOT_PENDING && slot->date + EXTERNAL_ACL_SHM_WAIT < squid_curtime)
+	    rank = 2;
+	else if (slot->state == EXTACL_SLOT_RESULT && slot->result != 1)
+	    rank = 1;
+	else
+	    rank = 0;
+	if (rank > victim_rank || (rank == victim_rank && slot->date < victim->date)) {
+	    victim = slot;
+	    victim_rank = rank;
+	}
+    }
+    if (victim) {
+	victim->state = EXTACL_SLOT_EMPTY;
+	victim->hash = hash;
+	xstrncpy(victim->key, key, sizeof(victim->key));
+    }
+    return victim;
+}
+
+/*
+ * Look key up in the shared cache.  On a hit the result is copied
+ * into the local cache and returned in *entry.  With claim set, a
+ * miss marks the key as pending for this worker, unless another
+ * worker already has a lookup of it in progress.
+ */
+static int
+externalAclShmLookup(external_acl * def, const char *key, int claim, external_acl_entry ** entry)
+{
+    char value[EXTERNAL_ACL_SHM_VALUE_SZ];
+    char *user, *passwd, *message, *log;
+    externalAclShmSlot *slot;
+    unsigned int hash;
+    ShmLock *lock;
+    time_t date;
+    int result;
+    if (strlen(key) >= EXTERNAL_ACL_SHM_KEY_SZ)
+	return EXTACL_SHM_MISS;
+    hash = hash4(key, 0xffffffffU);
+    lock = externalAclShmLock(def, hash);
+    slot = externalAclShmFind(def, key, hash, claim);
+    if (!slot) {
+	shmLockRelease(lock);
+	return EXTACL_SHM_MISS;
+    }
+    if (slot->state == EXTACL_SLOT_RESULT && !external_acl_shm_slot_expired(def, slot)) {
+	result = slot->result;
+	date = slot->date;
+	memcpy(value, slot->value, sizeof(value));
+	shmLockRelease(lock);
+	user = value;
+	passwd = user + strlen(user) + 1;
+	message = passwd + strlen(passwd) + 1;
+	log = message + strlen(message) + 1;
+	*entry = external_acl_cache_add(def, key, result, *user ? user : NULL,
+	    *passwd ? passwd : NULL, *message ? message : NULL, *log ? log : NULL);
+	/* keep the age of the original lookup, not the time we copied it */
+	(*entry)->date = date;
+	def->shared_stats.hits++;
+	return EXTACL_SHM_HIT;
+    }
+    if (!claim) {
+	shmLockRelease(lock);
+	return EXTACL_SHM_MISS;
+    }
+    if (slot->state == EXTACL_SLOT_PENDING && slot->owner != KidIdentifier &&
+	slot->date + EXTERNAL_ACL_SHM_WAIT >= squid_curtime) {
+	shmLockRelease(lock);
+	return EXTACL_SHM_PENDING;
+    }
+    slot->state = EXTACL_SLOT_PENDING;
+    slot->owner = KidIdentifier;
+    slot->date = squid_curtime;
+    shmLockRelease(lock);
+    return EXTACL_SHM_MISS;
+}
+
+/* Publish a helper result, or just drop our pending mark if result < 0 */
+static void
+externalAclShmStore(external_acl * def, const char *key, int result, const char *user, const char *passwd, const char *message, const char *log)
+{
+    char value[EXTERNAL_ACL_SHM_VALUE_SZ];
+    externalAclShmSlot *slot;
+    unsigned int hash;
+    ShmLock *lock;
+    int len = 0;
+    if (strlen(key) >= EXTERNAL_ACL_SHM_KEY_SZ)
+	return;
+    if (result >= 0) {
+	len = snprintf(value, sizeof(value), "%s%c%s%c%s%c%s",
+	    user ? user : "", '\0', passwd ? passwd : "", '\0',
+	    message ? message : "", '\0', log ? log : "");
+	/* too large to share; just release the slot */
+	if (len >= (int) sizeof(value))
+	    result = -1;
+    }
+    hash = hash4(key, 0xffffffffU);
+    lock = externalAclShmLock(def, hash);
+    slot = externalAclShmFind(def, key, hash, result >= 0);
+    if (slot && result >= 0) {
+	memcpy(slot->value, value, len + 1);
+	slot->result = result;
+	slot->date = squid_curtime;
+	slot->state = EXTACL_SLOT_RESULT;
+	def->shared_stats.stores++;
+    } else if (slot && slot->state == EXTACL_SLOT_PENDING && slot->owner == KidIdentifier) {
+	slot->state = EXTACL_SLOT_EMPTY;
+    }
+    shmLockRelease(lock);
+}
+
 /******************************************************************
  * external_acl helpers
  */
@@ -939,11 +1185,36 @@ free_externalAclState(void *data)
  * any " characters)
  */
 
+/* Hand the lookup result to everyone waiting on this state */
+static void
+externalAclDeliver(externalAclState * state, external_acl_entry * entry)
+{
+    externalAclState *next;
+    dlinkDelete(&state->list, &state->def->queue);
+    do {
+	cbdataUnlock(state->def);
+	state->def = NULL;
+
+	if (entry)
+	    external_acl_message = entry->message;
+	else
+	    external_acl_message = NULL;
+
+	if (state->callback && cbdataValid(state->callback_data))
+	    state->callback(state->callback_data, entry);
+	cbdataUnlock(state->callback_data);
+	state->callback_data = NULL;
+
+	next = state->queue;
+	cbdataFree(state);
+	state = next;
+    } while (state);
+}
+
 static void
 externalAclHandleReply(void *data, char *reply)
 {
     externalAclState *state = data;
-    externalAclState *next;
     int result = 0;
     char *status;
     char *token;
@@ -985,7 +1256,6 @@ externalAclHandleReply(void *data, char *reply)
 	    }
 	}
     }
-    dlinkDelete(&state->list, &state->def->queue);
     if (cbdataValid(state->def)) {
 	if (reply)
 	    entry = external_acl_cache_add(state->def, state->key, result, user, passwd, message, log);
@@ -994,25 +1264,41 @@ externalAclHandleReply(void *data, char *reply)
 	    if (oldentry)
 		external_acl_cache_delete(state->def, oldentry);
 	}
+	if (state->def->shared)
+	    externalAclShmStore(state->def, state->key, reply ? result : -1, user, passwd, message, log);
     }
-    do {
-	cbdataUnlock(state->def);
-	state->def = NULL;
-
-	if (entry)
-	    external_acl_message = entry->message;
-	else
-	    external_acl_message = NULL;
-
-	if (state->callback && cbdataValid(state->callback_data))
-	    state->callback(state->callback_data, entry);
-	cbdataUnlock(state->callback_data);
-	state->callback_data = NULL;
+    externalAclDeliver(state, entry);
+}
 
-	next = state->queue;
-	cbdataFree(state);
-	state = next;
-    } while (state);
+/*
+ * Wait for a lookup another worker has in progress to show up in the
+ * shared cache.  If that worker gives up we ask the helper ourselves.
+ */
+static void
+externalAclShmPoll(void *data)
+{
+    externalAclState *state = data;
+    external_acl *def = state->def;
+    external_acl_entry *entry = NULL;
+    MemBuf buf;
+    if (!cbdataValid(def)) {
+	externalAclDeliver(state, NULL);
+	return;
+    }
+    switch (externalAclShmLookup(def, state->key, 1, &entry)) {
+    case EXTACL_SHM_HIT:
+	externalAclDeliver(state, entry);
+	break;
+    case EXTACL_SHM_PENDING:
+	eventAdd("externalAclShmPoll", externalAclShmPoll, state, EXTERNAL_ACL_SHM_POLL, 0);
+	break;
+    default:
+	memBufDefInit(&buf);
+	memBufPrintf(&buf, "%s\n", state->key);
+	helperSubmit(def->helper, buf.buf, externalAclHandleReply, state);
+	memBufClean(&buf);
+	break;
+    }
 }
 
 const char *
@@ -1109,6 +1395,21 @@ externalAclLookup(aclCheck_t * ch, void *acl_data, EAH * callback, void *callbac
 	    callback(callback_data, entry);
 	    return;
 	}
+	/* Check if another worker knows or is already asking */
+	if (def->shared && !graceful) {
+	    switch (externalAclShmLookup(def, state->key, 1, &entry)) {
+	    case EXTACL_SHM_HIT:
+		cbdataFree(state);
+		callback(callback_data, entry);
+		return;
+	    case EXTACL_SHM_PENDING:
+		def->shared_stats.waits++;
+		dlinkAdd(state, &state->list, &def->queue);
+		eventAdd("externalAclShmPoll", externalAclShmPoll, state, EXTERNAL_ACL_SHM_POLL, 0);
+		ch->state[ACL_EXTERNAL] = ACL_LOOKUP_PENDING;
+		return;
+	    }
+	}
 	/* Send it off to the helper */
 	memBufDefInit(&buf);
 	memBufPrintf(&buf, "%s\n", key);
@@ -1140,6 +1441,12 @@ externalAclStats(StoreEntry * sentry, void* data)
     for (p = Config.externalAclHelperList; p; p = p->next) {
 	storeAppendPrintf(sentry, "External ACL Statistics: %s\n", p->name);
 	storeAppendPrintf(sentry, "Cache size: %d\n", p->cache->count);
+	if (p->shared) {
+	    storeAppendPrintf(sentry, "Shared cache slots: %d\n", externalAclShmSlots(p));
+	    storeAppendPrintf(sentry, "Shared cache hits: %d\n", p->shared_stats.hits);
+	    storeAppendPrintf(sentry, "Shared cache waits: %d\n", p->shared_stats.waits);
+	    storeAppendPrintf(sentry, "Shared cache stores: %d\n", p->shared_stats.stores);
+	}
 	helperStats(sentry, p->helper);
 	storeAppendPrintf(sentry, "\n");
     }
@@ -1163,6 +1470,8 @@ externalAclInit(void)
     for (p = Config.externalAclHelperList; p; p = p->next) {
 	if (!p->cache)
 	    p->cache = hash_create((HASHCMP *) strcmp, hashPrime(1024), hash4);
+	if (p->shared_cache_size > 0 && UsingSmp() && !p->shared)
+	    externalAclShmOpen(p);
 	if (!p->helper)
 	    p->helper = helperCreate(p->name);
 	p->helper->cmdline = p->cmdline;
@@ -1186,5 +1495,7 @@ externalAclShutdown(void)
     external_acl *p;
     for (p = Config.externalAclHelperList; p; p = p->next) {
 	helperShutdown(p->helper);
+	if (shutting_down && IamCoordinatorProcess())
+	    shmSegmentUnlink(&p->shm);
     }
 }
@@ -219,6 +219,19 @@ fwdServerClosed(int fd, void *data)
 }
 
 #if USE_SSL
+/* outgoing SSL sessions are cached per server, "host:port" */
+static const char *
+fwdSslSessionKey(FwdState * fwdState)
+{
+    static char key[SQUIDHOSTNAMELEN + 8];
+    peer *p = fwdState->servers->peer;
+    if (p)
+	snprintf(key, sizeof(key), "%s:%d", p->host, (int) p->http_port);
+    else
+	snprintf(key, sizeof(key), "%s:%d", fwdState->request->host, (int) fwdState->request->port);
+    return key;
+}
+
 static void
 fwdNegotiateSSL(int fd, void *data)
 {
@@ -257,10 +270,19 @@ fwdNegotiateSSL(int fd, void *data)
 	    return;
 	}
     }
-    if (fs->peer && !SSL_session_reused(ssl)) {
-	if (fs->peer->sslSession)
-	    SSL_SESSION_free(fs->peer->sslSession);
-	fs->peer->sslSession = SSL_get1_session(ssl);
+    statCounter.ssl.connects++;
+    ret = ssl_ktls_check(fd);
+    if (ret & SSL_KTLS_SEND)
+	statCounter.ssl.ktls_send++;
+    if (ret & SSL_KTLS_RECV)
+	statCounter.ssl.ktls_recv++;
+    if (!SSL_session_reused(ssl)) {
+	if (fs->peer) {
+	    if (fs->peer->sslSession)
+		SSL_SESSION_free(fs->peer->sslSession);
+	    fs->peer->sslSession = SSL_get1_session(ssl);
+	}
+	sslSessionCacheStore(fwdSslSessionKey(fwdState), SSL_get_session(ssl));
     }
 #if NOT_YET
     if (verify_domain) {
@@ -289,6 +311,7 @@ fwdInitiateSSL(FwdState * fwdState)
     int fd = fwdState->server_fd;
     SSL *ssl;
     SSL_CTX *sslContext = NULL;
+    SSL_SESSION *session;
     peer *peer = fs->peer;
     if (peer) {
 	assert(peer->use_ssl);
@@ -308,9 +331,11 @@ fwdInitiateSSL(FwdState * fwdState)
 	return;
     }
     SSL_set_fd(ssl, fd);
-    if (peer) {
-	if (peer->sslSession)
-	    SSL_set_session(ssl, peer->sslSession);
+    if ((session = sslSessionCacheGet(fwdSslSessionKey(fwdState))) != NULL) {
+	SSL_set_session(ssl, session);
+	SSL_SESSION_free(session);
+    } else if (peer && peer->sslSession) {
+	SSL_set_session(ssl, peer->sslSession);
     }
     fd_table[fd].ssl = ssl;
     fd_table[fd].read_method = &ssl_read_method;
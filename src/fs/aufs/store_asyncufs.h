@@ -82,5 +82,6 @@ extern STOBJREAD storeAufsRead;
 extern STOBJWRITE storeAufsWrite;
 extern STOBJUNLINK storeAufsUnlink;
 extern STOBJRECYCLE storeAufsRecycle;
+extern STOBJFD storeAufsFd;
 
 #endif
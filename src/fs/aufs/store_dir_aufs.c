@@ -784,6 +784,7 @@ storeAufsDirParse(SwapDir * sd, int index, char *path)
     sd->obj.write = storeAufsWrite;
     sd->obj.unlink = storeAufsUnlink;
     sd->obj.recycle = storeAufsRecycle;
+    sd->obj.fd = storeAufsFd;
     sd->log.open = storeAufsDirOpenSwapLog;
     sd->log.close = storeAufsDirCloseSwapLog;
     sd->log.write = storeAufsDirSwapLog;
@@ -219,6 +219,20 @@ storeAufsRead(SwapDir * SD, storeIOState * sio, char *buf, size_t size, squid_of
 #endif
 }
 
+/* The open file, when no aio operation is using it */
+int
+storeAufsFd(SwapDir * SD, storeIOState * sio)
+{
+    squidaiostate_t *aiostate = (squidaiostate_t *) sio->fsstate;
+    if (aiostate->flags.close_request || aiostate->flags.opening)
+	return -1;
+    if (aiostate->flags.reading || aiostate->flags.writing)
+	return -1;
+    if (!DLINK_ISEMPTY(aiostate->pending_reads) || !DLINK_ISEMPTY(aiostate->pending_writes))
+	return -1;
+    return aiostate->fd;
+}
+
 
 /* Write */
 void
@@ -301,14 +301,14 @@ storeAufsDirWriteCleanEntry(SwapDir * sd, const StoreEntry * e)
     memset(&s, '\0', ss);
     s.op = (char) SWAP_LOG_ADD;
     s.swap_filen = e->swap_filen;
-    s.timestamp = e->timestamp;
-    s.lastref = e->lastref;
-    s.expires = e->expires;
-    s.lastmod = e->lastmod;
+    s.timestamp = STORE_TIME(e->timestamp);
+    s.lastref = STORE_TIME(e->lastref);
+    s.expires = STORE_TIME(e->expires);
+    s.lastmod = STORE_TIME(e->lastmod);
     s.swap_file_sz = e->swap_file_sz;
     s.refcount = e->refcount;
     s.flags = e->flags;
-    xmemcpy(&s.key, e->hash.key, SQUID_MD5_DIGEST_LENGTH);
+    xmemcpy(&s.key, storeEntryKey(e), SQUID_MD5_DIGEST_LENGTH);
     xmemcpy(state->outbuf + state->outbuf_offset, &s, ss);
     state->outbuf_offset += ss;
     /* buffered write */
@@ -416,14 +416,14 @@ storeAufsDirSwapLog(const SwapDir * sd, const StoreEntry * e, int op)
     storeSwapLogData *s = memPoolAlloc(pool_swap_log_data);
     s->op = (char) op;
     s->swap_filen = e->swap_filen;
-    s->timestamp = e->timestamp;
-    s->lastref = e->lastref;
-    s->expires = e->expires;
-    s->lastmod = e->lastmod;
+    s->timestamp = STORE_TIME(e->timestamp);
+    s->lastref = STORE_TIME(e->lastref);
+    s->expires = STORE_TIME(e->expires);
+    s->lastmod = STORE_TIME(e->lastmod);
     s->swap_file_sz = e->swap_file_sz;
     s->refcount = e->refcount;
     s->flags = e->flags;
-    xmemcpy(s->key, e->hash.key, SQUID_MD5_DIGEST_LENGTH);
+    xmemcpy(s->key, storeEntryKey(e), SQUID_MD5_DIGEST_LENGTH);
     file_write(aioinfo->swaplog_fd,
 	-1,
 	s,
@@ -110,10 +110,10 @@ storeAufsDirAddDiskRestore(SwapDir * SD, const cache_key * key,
     e->swap_dirn = SD->index;
     e->swap_file_sz = swap_file_sz;
     e->lock_count = 0;
-    e->lastref = lastref;
-    e->timestamp = timestamp;
-    e->expires = expires;
-    e->lastmod = lastmod;
+    e->lastref = storeTimeOffset(lastref);
+    e->timestamp = storeTimeOffset(timestamp);
+    e->expires = storeTimeOffset(expires);
+    e->lastmod = storeTimeOffset(lastmod);
     e->refcount = refcount;
     e->flags = flags;
     EBIT_SET(e->flags, ENTRY_CACHABLE);
@@ -153,7 +153,7 @@ storeAufsDirRebuildFromSwapLogObject(RebuildState *rb, storeSwapLogData s)
 	    (void) 0;
 	} else if (s.op == SWAP_LOG_DEL) {
 	    /* Delete unless we already have a newer copy */
-	    if ((e = storeGet(s.key)) != NULL && s.lastref >= e->lastref) {
+	    if ((e = storeGet(s.key)) != NULL && s.lastref >= STORE_TIME(e->lastref)) {
 		/*
 		 * Make sure we don't unlink the file, it might be
 		 * in use by a subsequent entry.  Also note that
@@ -186,7 +186,7 @@ storeAufsDirRebuildFromSwapLogObject(RebuildState *rb, storeSwapLogData s)
 	/* If this URL already exists in the cache, does the swap log
 	 * appear to have a newer entry?  Compare 'lastref' from the
 	 * swap log to e->lastref. */
-	disk_entry_newer = e ? (s.lastref > e->lastref ? 1 : 0) : 0;
+	disk_entry_newer = e ? (s.lastref > STORE_TIME(e->lastref) ? 1 : 0) : 0;
 	if (used && !disk_entry_newer) {
 	    /* log entry is old, ignore it */
 	    rb->counts.clashcount++;
@@ -194,10 +194,10 @@ storeAufsDirRebuildFromSwapLogObject(RebuildState *rb, storeSwapLogData s)
 	} else if (used && e && e->swap_filen == s.swap_filen && e->swap_dirn == SD->index) {
 	    /* swapfile taken, same URL, newer, update meta */
 	    if (e->store_status == STORE_OK) {
-		e->lastref = s.timestamp;
-		e->timestamp = s.timestamp;
-		e->expires = s.expires;
-		e->lastmod = s.lastmod;
+		e->lastref = storeTimeOffset(s.timestamp);
+		e->timestamp = storeTimeOffset(s.timestamp);
+		e->expires = storeTimeOffset(s.expires);
+		e->lastmod = storeTimeOffset(s.lastmod);
 		e->flags = s.flags;
 		e->refcount += s.refcount;
 		storeAufsDirUnrefObj(SD, e);
@@ -90,10 +90,10 @@ storeCoss_AddStoreEntry(RebuildState * rb, const cache_key * key, storeSwapLogDa
     ne->swap_dirn = SD->index;
     ne->swap_file_sz = d->swap_file_sz;
     ne->lock_count = 0;
-    ne->lastref = d->lastref;
-    ne->timestamp = d->timestamp;
-    ne->expires = d->expires;
-    ne->lastmod = d->lastmod;
+    ne->lastref = storeTimeOffset(d->lastref);
+    ne->timestamp = storeTimeOffset(d->timestamp);
+    ne->expires = storeTimeOffset(d->expires);
+    ne->lastmod = storeTimeOffset(d->lastmod);
     ne->refcount = d->refcount;
     ne->flags = d->flags;
     EBIT_SET(ne->flags, ENTRY_CACHABLE);
@@ -157,8 +157,8 @@ storeCoss_ConsiderStoreEntry(RebuildState * rb, const cache_key * key, storeSwap
     /* Dang, its a clash. See if its fresher */
 
     /* Fresher? Its a new object: deallocate the old one, reallocate the new one */
-    if (d->lastref > oe->lastref) {
-	debugs(47, 3, "COSS: fresher object for filen %d found (%ld -> %ld)", oe->swap_filen, (long int) oe->timestamp, (long int) d->timestamp);
+    if (d->lastref > STORE_TIME(oe->lastref)) {
+	debugs(47, 3, "COSS: fresher object for filen %d found (%ld -> %ld)", oe->swap_filen, (long int) STORE_TIME(oe->timestamp), (long int) d->timestamp);
 	rb->cosscounts.fresher++;
 	storeCoss_DeleteStoreEntry(rb, key, oe);
 	oe = NULL;
@@ -170,7 +170,7 @@ storeCoss_ConsiderStoreEntry(RebuildState * rb, const cache_key * key, storeSwap
      * Not fresher? Its the same object then we /should/ probably relocate it; I'm
      * not sure what should be done here.
      */
-    if (oe->timestamp == d->timestamp && oe->expires == d->expires) {
+    if (STORE_TIME(oe->timestamp) == d->timestamp && STORE_TIME(oe->expires) == d->expires) {
 	debugs(47, 3, "COSS: filen %d -> %d (since they're the same!)", oe->swap_filen, d->swap_filen);
 	rb->cosscounts.reloc++;
 	storeCoss_DeleteStoreEntry(rb, key, oe);
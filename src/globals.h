@@ -96,15 +96,16 @@ extern const char *icp_opcode_str[];
 extern const char *lookup_t_str[];
 extern double request_failure_ratio;	/* 0.0 */
 extern int store_hash_buckets;	/* 0 */
-extern hash_table *store_table;	/* NULL */
 extern dlink_list ClientActiveRequests;
 extern int hot_obj_count;	/* 0 */
+extern unsigned long store_swapin_mem_size;	/* 0 */
 extern const int CacheDigestHashFuncCount;	/* 4 */
 extern CacheDigest *store_digest;	/* NULL */
 extern const char *StoreDigestFileName;		/* "store_digest" */
+extern const char *StoreDigestDeltaFileName;	/* "store_digest.delta" */
 extern const char *StoreDigestMimeStr;	/* "application/cache-digest" */
 #if USE_CACHE_DIGESTS
-extern const Version CacheDigestVer;	/* { 5, 3 } */
+extern const Version CacheDigestVer;	/* { 6, 3 } */
 #endif
 extern const char *MultipartMsgBoundaryStr;	/* "Unique-Squid-Separator" */
 extern icpUdpData *IcpQueueHead;	/* NULL */
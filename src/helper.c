@@ -49,6 +49,8 @@ helperStats(StoreEntry * sentry, helper * hlp)
 	hlp->stats.replies);
     storeAppendPrintf(sentry, "queue length: %d\n",
 	hlp->stats.queue_size);
+    storeAppendPrintf(sentry, "writes: %d\n",
+	hlp->stats.writes);
     storeAppendPrintf(sentry, "avg service time: %.2f msec\n",
 	(double) hlp->stats.avg_svc_time / 1000.0);
     storeAppendPrintf(sentry, "\n");
@@ -83,6 +85,10 @@ helperStats(StoreEntry * sentry, helper * hlp)
     storeAppendPrintf(sentry, "   B = BUSY\n");
     storeAppendPrintf(sentry, "   C = CLOSING\n");
     storeAppendPrintf(sentry, "   S = SHUTDOWN\n");
+    storeAppendPrintf(sentry, "\nQueue time histogram (msec):\n");
+    statHistDump(&hlp->stats.queue_time, sentry, NULL);
+    storeAppendPrintf(sentry, "\nService time histogram (msec):\n");
+    statHistDump(&hlp->stats.svc_time, sentry, NULL);
 }
 
 void
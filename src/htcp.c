@@ -690,17 +690,17 @@ htcpTstReply(htcpDataHeader * dhdr, StoreEntry * e, htcpSpecifier * spec, struct
 	stuff.S.version = spec->version;
 	stuff.S.req_hdrs = spec->req_hdrs;
 	httpHeaderPutInt(&hdr, HDR_AGE,
-	    e->timestamp <= squid_curtime ?
-	    squid_curtime - e->timestamp : 0);
+	    STORE_TIME(e->timestamp) <= squid_curtime ?
+	    squid_curtime - STORE_TIME(e->timestamp) : 0);
 	httpHeaderPackInto(&hdr, &p);
 	stuff.D.resp_hdrs = xstrdup(mb.buf);
 	debugs(31, 3, "htcpTstReply: resp_hdrs = {%s}", stuff.D.resp_hdrs);
 	memBufReset(&mb);
 	httpHeaderReset(&hdr);
-	if (e->expires > -1)
-	    httpHeaderPutTime(&hdr, HDR_EXPIRES, e->expires);
-	if (e->lastmod > -1)
-	    httpHeaderPutTime(&hdr, HDR_LAST_MODIFIED, e->lastmod);
+	if (STORE_TIME(e->expires) > -1)
+	    httpHeaderPutTime(&hdr, HDR_EXPIRES, STORE_TIME(e->expires));
+	if (STORE_TIME(e->lastmod) > -1)
+	    httpHeaderPutTime(&hdr, HDR_LAST_MODIFIED, STORE_TIME(e->lastmod));
 	httpHeaderPackInto(&hdr, &p);
 	stuff.D.entity_hdrs = xstrdup(mb.buf);
 	debugs(31, 3, "htcpTstReply: entity_hdrs = {%s}", stuff.D.entity_hdrs);
@@ -1314,7 +1314,7 @@ htcpQuery(StoreEntry * e, request_t * req, peer * p)
     htcpSend(pkt, (int) pktlen, &p->in_addr);
     queried_id[stuff.msg_id % N_QUERIED_KEYS] = stuff.msg_id;
     save_key = queried_keys[stuff.msg_id % N_QUERIED_KEYS];
-    storeKeyCopy(save_key, e->hash.key);
+    storeKeyCopy(save_key, storeEntryKey(e));
     queried_addr[stuff.msg_id % N_QUERIED_KEYS] = p->in_addr;
     debugs(31, 3, "htcpQuery: key (%p) %s", save_key, storeKeyText(save_key));
 }
@@ -49,10 +49,14 @@
 
 static const char *const crlf = "\r\n";
 
+/* room for a read_sz of body: the tail page's free space plus new pages */
+#define HTTP_READ_IOV	(8192 / SM_PAGE_SIZE + 2)
+
 static CWCB httpSendComplete;
 static CWCB httpSendRequestEntry;
 
 static PF httpReadReply;
+static int httpReadBodyDirect(HttpStateData *);
 static void httpSendRequest(HttpStateData *);
 static PF httpStateFree;
 static PF httpTimeout;
@@ -62,6 +66,7 @@ static void httpMakePublic(StoreEntry *);
 static int httpCachableReply(HttpStateData *);
 static void httpMaybeRemovePublic(StoreEntry *, HttpReply *);
 static int peer_supports_connection_pinning(HttpStateData * httpState);
+static void httpAppendBodyDone(HttpStateData *, int complete, int keep_alive, ssize_t len, int buffer_filled);
 
 static int http_num_conns = 0;
 
@@ -166,7 +171,7 @@ httpCacheNegatively(StoreEntry * entry)
     storeNegativeCache(entry);
     if (EBIT_TEST(entry->flags, ENTRY_CACHABLE))
 	storeSetPublicKey(entry);
-    if (entry->expires <= squid_curtime)
+    if (STORE_TIME(entry->expires) <= squid_curtime)
 	storeRelease(entry);
 }
 
@@ -452,7 +457,14 @@ httpMakeVaryMark(request_t * request, HttpReply * reply)
 	hdr = httpHeaderGetByName(&request->header, name);
 	safe_free(name);
 	if (strIsNotNull(hdr)) {
-	    const char *str = stringDupToC(&hdr);
+	    const char *str;
+#if HTTP_GZIP
+	    /* one key per set of codings, see httpGzipVaryValue() */
+	    if (Config.http_gzip.enable && ilen == 15 && strncasecmp(item, "accept-encoding", 15) == 0)
+		str = httpGzipVaryValue(&hdr);
+	    else
+#endif
+		str = stringDupToC(&hdr);
 	    value = rfc1738_escape_part(str);
 	    stringAppend(&vstr, "=\"", 2);
 	    stringAppend(&vstr, value, strlen(value));
@@ -551,9 +563,9 @@ httpReplySetupStuff(HttpStateData *httpState)
 #if HTTP_GZIP
     if (Config.http_gzip.enable && httpState->context == NULL) {
 	httpGzipStart(httpState);
-	debugs(11, 2, "httpGzipStart: http_gzip: %d, types: %s, min_length: %d, "
+	debugs(11, 2, "httpGzipStart: http_gzip: %d, min_length: %d, "
 		"level: %d, window: %d, hash: %d, context: %p, type: %d\n",
-		Config.http_gzip.enable, Config.http_gzip.types, Config.http_gzip.min_length,
+		Config.http_gzip.enable, Config.http_gzip.min_length,
 		Config.http_gzip.level, Config.http_gzip.wbits, Config.http_gzip.memlevel,
 		httpState->context, entry->compression_type);
     }
@@ -651,7 +663,7 @@ httpProcessReplyHeader(HttpStateData * httpState, int s)
 
     Ctx ctx = ctx_enter(entry->mem_obj->url);
     debugs(11, 3, "httpProcessReplyHeader: key '%s'",
-	storeKeyText(entry->hash.key));
+	storeKeyText(storeEntryKey(entry)));
     assert(httpState->reply_hdr_state == 0);
 
     /* Handle non-parsable responses as HTTP/0.9 responses - ie, no headers, just verbatim body */
@@ -804,10 +816,6 @@ static void
 httpAppendBody(HttpStateData * httpState, const char *buf, ssize_t len, int buffer_filled)
 {
     StoreEntry *entry = httpState->entry;
-    const request_t *request = httpState->request;
-    const request_t *orig_request = httpState->orig_request;
-    struct in_addr *client_addr = NULL;
-    u_short client_port = 0;
     int fd = httpState->fd;
     int complete = httpState->eof;
     int keep_alive = !httpState->eof;
@@ -831,7 +839,9 @@ httpAppendBody(HttpStateData * httpState, const char *buf, ssize_t len, int buff
 	    httpState->chunk_size -= size;
 #if HTTP_GZIP
 	    ctx = httpState->context;
-	    if (ctx) {
+	    if (ctx && httpGzipAsync(ctx)) {
+		memBufAppend(&ctx->in, buf, size);
+	    } else if (ctx) {
 		rc = httpGzipCompress(httpState, buf, size);
 		if ( rc < 0) {
 		    debugs(11, 1, "httpGzipCompress error.");
@@ -860,7 +870,9 @@ httpAppendBody(HttpStateData * httpState, const char *buf, ssize_t len, int buff
 	    /* non-chunked without content-length */
 #if HTTP_GZIP
 	    ctx =  httpState->context;
-	    if (ctx) {
+	    if (ctx && httpGzipAsync(ctx)) {
+		memBufAppend(&ctx->in, buf, len);
+	    } else if (ctx) {
 		rc = httpGzipCompress(httpState, buf, len);
 		if ( rc < 0) {
 		    debugs(11, 1, "httpGzipCompress error.");
@@ -952,12 +964,70 @@ httpAppendBody(HttpStateData * httpState, const char *buf, ssize_t len, int buff
 	}
     }
 #if HTTP_GZIP
-    if (httpState->context == NULL || sync) {
+    ctx = httpState->context;
+    if (ctx && httpGzipAsync(ctx)) {
+	/* hand the body to the compression threads, httpGzipResume() continues */
+	if (!httpState->chunk_size && !httpState->flags.chunked)
+	    complete = 1;
+	if (ctx->in.size > 0 || (complete && len == 0)) {
+	    ctx->resume.complete = complete;
+	    ctx->resume.keep_alive = keep_alive;
+	    ctx->resume.buffer_filled = buffer_filled;
+	    ctx->resume.len = len;
+	    httpGzipSubmit(ctx, complete && len == 0);
+	    return;
+	}
+	storeBufferFlush(entry);
+    } else if (httpState->context == NULL || sync) {
 	storeBufferFlush(entry);
     }
 #else
     storeBufferFlush(entry);
 #endif
+    httpAppendBodyDone(httpState, complete, keep_alive, len, buffer_filled);
+}
+
+#if HTTP_GZIP
+void
+httpGzipResume(HttpStateData * httpState)
+{
+    StoreEntry *entry = httpState->entry;
+    HttpGzipContext *ctx = httpState->context;
+    int complete = ctx->resume.complete;
+    int keep_alive = ctx->resume.keep_alive;
+    int buffer_filled = ctx->resume.buffer_filled;
+    ssize_t len = ctx->resume.len;
+
+    if (httpGzipCollect(httpState) < 0) {
+	debugs(11, 1, "httpGzipCompress error.");
+	fwdFail(httpState->fwd, errorCon(ERR_INVALID_RESP,
+		HTTP_INTERNAL_SERVER_ERROR, httpState->fwd->request));
+	comm_close(httpState->fd);
+	return;
+    }
+    if (EBIT_TEST(entry->flags, ENTRY_ABORTED)) {
+	/* as in httpAppendBody() the server FD should already be closed */
+	return;
+    }
+    storeBufferFlush(entry);
+    httpAppendBodyDone(httpState, complete, keep_alive, len, buffer_filled);
+}
+#endif
+
+/* The rest of httpAppendBody(), once the body read so far is stored */
+static void
+httpAppendBodyDone(HttpStateData * httpState, int complete, int keep_alive, ssize_t len, int buffer_filled)
+{
+    StoreEntry *entry = httpState->entry;
+    const request_t *request = httpState->request;
+    const request_t *orig_request = httpState->orig_request;
+    struct in_addr *client_addr = NULL;
+    u_short client_port = 0;
+    int fd = httpState->fd;
+#if HTTP_GZIP
+    int rc;
+#endif
+
     if (EBIT_TEST(entry->flags, ENTRY_ABORTED)) {
 	/*
 	 * the above storeBufferFlush() call could ABORT this entry,
@@ -1118,6 +1188,25 @@ httpAppendBody(HttpStateData * httpState, const char *buf, ssize_t len, int buff
 /* This will be called when data is ready to be read from fd.  Read until
  * error or connection closed. */
 
+/*
+ * Can the next read go straight into the store?  Only for body data
+ * that is stored as it arrives: after the reply headers, with nothing
+ * left over from the previous read, and not chunked or compressed.
+ */
+static int
+httpReadBodyDirect(HttpStateData * httpState)
+{
+    if (httpState->reply_hdr_state < 2 || httpState->read_buf)
+	return 0;
+    if (httpState->flags.chunked || httpState->chunk_size == 0)
+	return 0;
+#if HTTP_GZIP
+    if (httpState->context)
+	return 0;
+#endif
+    return 1;
+}
+
 /* THIS IS THE NEW ONE - completely untested, not used by default -adrian */
 static void
 httpReadReply(int fd, void *data)
@@ -1135,6 +1224,8 @@ httpReadReply(int fd, void *data)
     delay_id delay_id;
 #endif
     int buffer_filled;
+    struct iovec iov[HTTP_READ_IOV];
+    int niov;
 
     if (EBIT_TEST(entry->flags, ENTRY_ABORTED)) {
 	comm_close(fd);
@@ -1158,11 +1249,28 @@ httpReadReply(int fd, void *data)
      * and growing the buffer only if its part of the reply status + headers
      * (as strings atm need to be contiguous) ..
      */
-    if (! httpState->read_buf)
-        httpState->read_buf = buf_create_size(32768);
+    if (httpReadBodyDirect(httpState)) {
+	/*
+	 * Plain body after the headers: read it straight into the
+	 * store pages.  read_buf stays NULL, which the code below
+	 * takes to mean the data is already stored.
+	 */
+	if (httpState->chunk_size > 0 && read_sz > httpState->chunk_size)
+	    read_sz = httpState->chunk_size;
+	niov = storeAppendReserve(entry, iov, HTTP_READ_IOV, read_sz);
+	len = fd_readv(fd, iov, niov);
+	if (len > 0)
+	    storeBuffer(entry);	/* httpAppendBody() flushes */
+	storeAppendCommit(entry, iov, niov, len > 0 ? len : 0);
+	if (len > 0 && httpState->chunk_size > 0)
+	    httpState->chunk_size -= len;
+    } else {
+	if (! httpState->read_buf)
+	    httpState->read_buf = buf_create_size(32768);
 
-    /* XXX buffer_filled is all busted right now, unfortunately! */
-    len = buf_read(httpState->read_buf, fd, read_sz);
+	/* XXX buffer_filled is all busted right now, unfortunately! */
+	len = buf_read(httpState->read_buf, fd, read_sz);
+    }
     buffer_filled = (len == read_sz);
     debugs(11, 5, "httpReadReply: FD %d: len %d.", fd, (int) len);
 
@@ -1178,6 +1286,10 @@ httpReadReply(int fd, void *data)
 	for (clen = len - 1, bin = 0; clen; bin++)
 	    clen >>= 1;
 	IOStats.Http.read_hist[bin]++;
+	if (httpState->request_sent.tv_sec) {
+	    latencyRecord(LATENCY_FIRST_BYTE, tvSubUsec(httpState->request_sent, current_time));
+	    httpState->request_sent.tv_sec = 0;
+	}
     }
 
     /* Read size is 0 (EOF); we've not seen any data from the object; its a zero sized reply */
@@ -1221,7 +1333,7 @@ httpReadReply(int fd, void *data)
 
     /* This will be replaced with some logic to only append and parse a data + offset */
     /* Trim whitespace from the incoming buffer */
-    if (buf_len(httpState->read_buf) == 0 && len > 0 && fd_table[fd].uses > 1) {
+    if (httpState->read_buf && buf_len(httpState->read_buf) == 0 && len > 0 && fd_table[fd].uses > 1) {
 	/* Skip whitespace */
 	/* XXX dirty direct buffer access, but its what the existing code basically did! */
 	while (po < buf_len(httpState->read_buf) && xisspace(buf_buf(httpState->read_buf)[po])) {
@@ -1374,6 +1486,9 @@ httpReadReply(int fd, void *data)
           buf_len(httpState->read_buf) - po - done, buffer_filled);
         if (cbdataValid(httpState))
             httpState->read_buf = buf_deref(httpState->read_buf);
+    } else {
+	/* read straight into the store, only the bookkeeping is left */
+	httpAppendBody(httpState, NULL, 0, buffer_filled);
     }
     cbdataUnlock(httpState);
     /* httpState may be cleared here */
@@ -1814,6 +1929,7 @@ httpSendRequest(HttpStateData * httpState)
     int fd = httpState->fd;
 
     debugs(11, 5, "httpSendRequest: FD %d: httpState %p.", fd, httpState);
+    httpState->request_sent = current_time;
 
     /* Schedule read reply. (but no timeout set until request fully sent) */
     commSetTimeout(fd, Config.Timeout.lifetime, httpTimeout, httpState);
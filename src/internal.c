@@ -48,7 +48,8 @@ internalStart(request_t * request, StoreEntry * entry)
 	inet_ntoa(request->client_addr), strLen2(request->urlpath), strBuf2(request->urlpath));
     if (strCmp(request->urlpath, "/squid-internal-dynamic/netdb") == 0) {
 	netdbBinaryExchange(entry);
-    } else if (strCmp(request->urlpath, "/squid-internal-periodic/store_digest") == 0) {
+    } else if (strCmp(request->urlpath, "/squid-internal-periodic/store_digest") == 0 ||
+	strCmp(request->urlpath, "/squid-internal-periodic/store_digest.delta") == 0) {
 #if USE_CACHE_DIGESTS
 	const char *msgbuf = "This cache is currently building its digest.\n";
 #else
@@ -0,0 +1,213 @@
+
+/*
+ * DEBUG: section 18    Cache Manager Statistics
+ *
+ * SQUID Web Proxy Cache          http://www.squid-cache.org/
+ * ----------------------------------------------------------
+ *
+ *  Squid is the result of efforts by numerous individuals from
+ *  the Internet community; see the CONTRIBUTORS file for full
+ *  details.   Many organizations have provided support for Squid's
+ *  development; see the SPONSORS file for full details.  Squid is
+ *  Copyrighted (C) 2001 by the Regents of the University of
+ *  California; see the COPYRIGHT file for full details.  Squid
+ *  incorporates software developed and/or copyrighted by other
+ *  sources; see the CREDITS file for full details.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111, USA.
+ *
+ */
+
+/*
+ * Per phase service time histograms, in microseconds.
+ *
+ * Every process records into its own block.  With SMP the blocks sit
+ * side by side in one shared segment indexed by KidIdentifier, so the
+ * process answering a cachemgr request can merge them all without the
+ * histograms having to travel through the (4 KB) IPC messages.  The
+ * aggregated action data only counts the kids that answered.
+ */
+
+#include "squid.h"
+
+typedef struct {
+    HdrHist hist[LATENCY_MAX];
+} LatencyBlock;
+
+typedef struct {
+    int kids;
+} LatencyActionData;
+
+static const char *const latency_phase_str[LATENCY_MAX] =
+{
+    "all",
+    "hit",
+    "near_miss",
+    "miss",
+    "dns",
+    "connect",
+    "first_byte"
+};
+
+static ShmSegment latency_shm;
+static LatencyBlock *latency_blocks = NULL;
+static int latency_nblocks = 0;
+static LatencyBlock *latency_mine = NULL;
+
+static OBJH latencyStats;
+static OBJH latencyHistograms;
+static COL latencyCollect;
+static ADD latencyAdd;
+
+void
+latencyRecord(latency_phase_t phase, int usec)
+{
+    if (!latency_mine)
+	return;
+    if (usec < 0)
+	usec = 0;
+    hdrHistRecord(&latency_mine->hist[phase], (unsigned long long) usec);
+}
+
+const char *
+latencyPhaseName(latency_phase_t phase)
+{
+    return latency_phase_str[phase];
+}
+
+/* this process' own histogram, or NULL before latencyInit() */
+const HdrHist *
+latencyHist(latency_phase_t phase)
+{
+    return latency_mine ? &latency_mine->hist[phase] : NULL;
+}
+
+static void
+latencyMerged(HdrHist * out)
+{
+    int i, p;
+    for (p = 0; p < LATENCY_MAX; p++)
+	hdrHistReset(&out[p]);
+    for (i = 0; i < latency_nblocks; i++)
+	for (p = 0; p < LATENCY_MAX; p++)
+	    hdrHistMerge(&out[p], &latency_blocks[i].hist[p]);
+}
+
+static void
+latencyDumpRow(StoreEntry * e, const char *name, const HdrHist * H)
+{
+    if (H->count == 0) {
+	storeAppendPrintf(e, "%-12s %10d\n", name, 0);
+	return;
+    }
+    storeAppendPrintf(e, "%-12s %10" PRIu64 " %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+	name,
+	(uint64_t) H->count,
+	(double) H->sum / H->count / 1000.0,
+	H->min / 1000.0,
+	hdrHistPercentile(H, 50.0) / 1000.0,
+	hdrHistPercentile(H, 90.0) / 1000.0,
+	hdrHistPercentile(H, 99.0) / 1000.0,
+	hdrHistPercentile(H, 99.9) / 1000.0,
+	H->max / 1000.0);
+}
+
+static void
+latencyStats(StoreEntry * e, void *data)
+{
+    LatencyActionData *stats = data;
+    HdrHist *merged = xcalloc(LATENCY_MAX, sizeof(HdrHist));
+    int i, p;
+
+    latencyMerged(merged);
+    storeAppendPrintf(e, "Service times in milliseconds");
+    if (stats)
+	storeAppendPrintf(e, ", %d kids reporting", stats->kids);
+    storeAppendPrintf(e, "\n\n%-12s %10s %10s %10s %10s %10s %10s %10s %10s\n",
+	"phase", "count", "mean", "min", "p50", "p90", "p99", "p99.9", "max");
+    for (p = 0; p < LATENCY_MAX; p++)
+	latencyDumpRow(e, latency_phase_str[p], &merged[p]);
+    if (latency_nblocks > 1) {
+	for (i = 0; i < latency_nblocks; i++) {
+	    if (latency_blocks[i].hist[LATENCY_ALL].count == 0 && latency_blocks[i].hist[LATENCY_DNS].count == 0)
+		continue;
+	    storeAppendPrintf(e, "\nkid%d:\n", i);
+	    for (p = 0; p < LATENCY_MAX; p++)
+		latencyDumpRow(e, latency_phase_str[p], &latency_blocks[i].hist[p]);
+	}
+    }
+    xfree(merged);
+}
+
+static void
+latencyHistograms(StoreEntry * e, void *data)
+{
+    HdrHist *merged = xcalloc(LATENCY_MAX, sizeof(HdrHist));
+    int b, p;
+
+    latencyMerged(merged);
+    for (p = 0; p < LATENCY_MAX; p++) {
+	storeAppendPrintf(e, "%s histogram (usec):\n", latency_phase_str[p]);
+	for (b = 0; b < HDRHIST_BINS; b++) {
+	    if (merged[p].bins[b] == 0)
+		continue;
+	    storeAppendPrintf(e, "\t%" PRIu64 "-%" PRIu64 "\t%u\n",
+		(uint64_t) hdrHistBinLow(b), (uint64_t) hdrHistBinHigh(b), merged[p].bins[b]);
+	}
+    }
+    xfree(merged);
+}
+
+static void *
+latencyCollect(void)
+{
+    LatencyActionData *stats = xcalloc(1, sizeof(LatencyActionData));
+    stats->kids = 1;
+    return stats;
+}
+
+static int
+latencyAdd(void *A, void *B)
+{
+    if (A && B)
+	((LatencyActionData *) A)->kids += ((LatencyActionData *) B)->kids;
+    return sizeof(LatencyActionData);
+}
+
+void
+latencyInit(void)
+{
+    if (latency_blocks)
+	return;
+    if (UsingSmp()) {
+	latency_nblocks = NumberOfKids() + 1;
+	latency_blocks = shmSegmentOpen(&latency_shm, "latency", latency_nblocks * sizeof(LatencyBlock));
+	if (!latency_blocks)
+	    debugs(18, 1, "WARNING: latency histograms are not shared, showing this kid only");
+	else if (KidIdentifier < latency_nblocks)
+	    latency_mine = &latency_blocks[KidIdentifier];
+    }
+    if (!latency_blocks) {
+	latency_nblocks = 1;
+	latency_blocks = xcalloc(1, sizeof(LatencyBlock));
+	latency_mine = latency_blocks;
+    }
+    cachemgrRegister("latency",
+	"Service Time Percentiles",
+	latencyStats, latencyAdd, latencyCollect, 0, 1, 1);
+    cachemgrRegister("latency_histograms",
+	"Service Time Histograms",
+	latencyHistograms, latencyAdd, latencyCollect, 0, 1, 1);
+}
@@ -33,8 +33,10 @@
 #if HAVE_PATHS_H
 #include <paths.h>
 #endif
+#include <sys/mman.h>
 
 #include "defines.h"
+#include "logfile_ring.h"
 
 #define SQUID_MAXPATHLEN 256
 #ifndef MAXPATHLEN
@@ -78,6 +80,96 @@ rotate(const char *path, int rotate_count)
     }
 }
 
+static logfile_ring_hdr *ring = NULL;
+
+/*
+ * squid writes into the ring from now on, so carrying on without it
+ * would silently drop every line.  Say why in the log itself (stderr
+ * is /dev/null) and exit; squid treats a dead log daemon as fatal.
+ */
+static void
+ring_fail(FILE * fp, const char *name, const char *reason)
+{
+    fprintf(fp, "logfile-daemon: cannot attach log ring %s: %s\n", name, reason);
+    fflush(fp);
+    exit(1);
+}
+
+/*
+ * Attach to the ring squid created.  The name is unlinked straight
+ * away; both processes keep their mappings.
+ */
+static void
+ring_attach(FILE * fp, const char *name)
+{
+    struct stat sb;
+    void *mem;
+    int fd;
+
+    if (ring)
+	return;
+    fd = shm_open(name, O_RDWR, 0600);
+    if (fd < 0)
+	ring_fail(fp, name, strerror(errno));
+    if (fstat(fd, &sb) < 0 || sb.st_size < (off_t) sizeof(logfile_ring_hdr)) {
+	close(fd);
+	ring_fail(fp, name, "segment too small");
+    }
+    mem = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    shm_unlink(name);
+    if (mem == MAP_FAILED)
+	ring_fail(fp, name, strerror(errno));
+    ring = mem;
+    if (ring->magic != LOGFILE_RING_MAGIC || sizeof(logfile_ring_hdr) + ring->size > (size_t) sb.st_size)
+	ring_fail(fp, name, "bad ring header");
+}
+
+/* Write out everything squid has published so far */
+static void
+ring_drain(FILE * fp)
+{
+    char *data = LOGFILE_RING_DATA(ring);
+    unsigned long long head, tail;
+    unsigned int pos, len;
+
+    for (;;) {
+	head = ring->head;
+	tail = ring->tail;
+	if (head == tail)
+	    return;
+	__sync_synchronize();
+	while (tail != head) {
+	    pos = tail & (ring->size - 1);
+	    len = *(unsigned int *) (data + pos);
+	    if (len == LOGFILE_RING_SKIP) {
+		tail += ring->size - pos;
+		continue;
+	    }
+	    fwrite(data + pos + 4, 1, len, fp);
+	    tail += LOGFILE_RING_RECSZ(len);
+	}
+	__sync_synchronize();
+	ring->tail = tail;
+    }
+}
+
+/*
+ * Drain, then tell squid we are about to block on the pipe.  The
+ * re-check closes the race with squid publishing a line just before
+ * it saw 'waiting' still clear.
+ */
+static void
+ring_idle(FILE * fp, int do_buffer)
+{
+    ring_drain(fp);
+    ring->waiting = 1;
+    __sync_synchronize();
+    ring_drain(fp);
+    if (!do_buffer)
+	fflush(fp);
+}
+
 /*
  * The commands:
  *
@@ -88,6 +180,12 @@ rotate(const char *path, int rotate_count)
  * F\n - flush file
  * r<n>\n - set rotate count to <n>
  * b<n>\n - 1 = buffer output, 0 = don't buffer output
+ * M<name>\n - attach to the shared memory ring <name>
+ * D\n - drain the ring
+ *
+ * With a ring attached the log lines arrive through it and the ring is
+ * drained before every command, so a rotate still splits the log at
+ * the point squid asked for it.
  */
 int
 main(int argc, char *argv[])
@@ -119,6 +217,8 @@ main(int argc, char *argv[])
     dup2(t, 2);
 
     while (fgets(buf, LOGFILE_BUF_LEN, stdin)) {
+	if (ring)
+	    ring_drain(fp);
 	/* First byte indicates what we're logging! */
 	switch (buf[0]) {
 	case 'L':
@@ -155,12 +255,22 @@ main(int argc, char *argv[])
 	case 'F':
 	    fflush(fp);
 	    break;
+	case 'M':
+	    buf[strcspn(buf, "\n")] = '\0';
+	    ring_attach(fp, buf + 1);
+	    break;
+	case 'D':
+	    break;
 	default:
 	    /* Just in case .. */
 	    fprintf(fp, "%s", buf);
 	    break;
 	}
+	if (ring)
+	    ring_idle(fp, do_buffer);
     }
+    if (ring)
+	ring_drain(fp);
     fclose(fp);
     fp = NULL;
     exit(0);
@@ -34,6 +34,7 @@
 
 #include "squid.h"
 #include "logfile_mod_daemon.h"
+#include "logfile_ring.h"
 
 /* How many buffers to keep before we say we've buffered too much */
 #define	LOGFILE_MAXBUFS		128
@@ -64,6 +65,10 @@ struct _l_daemon {
     dlink_list bufs;
     int nbufs;
     int last_warned;
+    ShmSegment ring_seg;
+    logfile_ring_hdr *ring;	/* shared ring for log lines, if any */
+    MemBuf line;		/* line being assembled for the ring */
+    int ring_drops;
 };
 
 typedef struct _l_daemon l_daemon_t;
@@ -200,6 +205,92 @@ logfile_mod_daemon_append(Logfile * lf, const char *buf, int len)
     }
 }
 
+/*
+ * Map a shared memory ring for the log lines.  The daemon is told the
+ * segment name through the control pipe and unlinks it once attached;
+ * if anything fails here the lines simply keep going down the pipe.
+ */
+static void
+logfileRingOpen(Logfile * lf)
+{
+    l_daemon_t *ll = (l_daemon_t *) lf->data;
+    static int ring_seq = 0;
+    char tag[32];
+    size_t size = LOGFILE_RING_MIN;
+
+    while (size < Config.Log.daemon_ring_size && size < (1U << 30))
+	size <<= 1;
+    snprintf(tag, sizeof(tag), "log-%d-%d", (int) getpid(), ++ring_seq);
+    ll->ring = shmSegmentOpen(&ll->ring_seg, tag, sizeof(logfile_ring_hdr) + size);
+    if (ll->ring == NULL) {
+	debugs(50, 1, "Logfile Daemon: %s: no shared memory ring, using the pipe", lf->path);
+	return;
+    }
+    memset(ll->ring, 0, sizeof(logfile_ring_hdr));
+    ll->ring->size = size;
+    ll->ring->magic = LOGFILE_RING_MAGIC;
+    memBufDefInit(&ll->line);
+    lf->flags.binary = 1;
+    debugs(50, 2, "Logfile Daemon: %s: %d byte ring %s", lf->path, (int) size, ll->ring_seg.name);
+}
+
+/*
+ * Wake the daemon up if it went idle.  Only one 'D' is queued per idle
+ * period because the daemon has to set 'waiting' again first.
+ */
+static void
+logfileRingNudge(Logfile * lf)
+{
+    l_daemon_t *ll = (l_daemon_t *) lf->data;
+    if (!__sync_lock_test_and_set(&ll->ring->waiting, 0))
+	return;
+    logfile_mod_daemon_append(lf, "D\n", 2);
+    logfileQueueWrite(lf);
+}
+
+/*
+ * Copy the assembled line into the ring.  When the daemon has fallen
+ * so far behind that the ring is full the line is dropped, just like
+ * the pipe path does when too many buffers are queued.
+ */
+static void
+logfileRingCommit(Logfile * lf)
+{
+    l_daemon_t *ll = (l_daemon_t *) lf->data;
+    logfile_ring_hdr *r = ll->ring;
+    char *data = LOGFILE_RING_DATA(r);
+    unsigned long long head = r->head;
+    unsigned int len = ll->line.size;
+    unsigned int need = LOGFILE_RING_RECSZ(len);
+    unsigned int pos = head & (r->size - 1);
+    unsigned int skip = 0;
+
+    if (pos + need > r->size)
+	skip = r->size - pos;
+    if ((unsigned long long) need + skip > r->size - (head - r->tail)) {
+	ll->ring_drops++;
+	if (ll->last_warned < squid_curtime - LOGFILE_WARN_TIME) {
+	    ll->last_warned = squid_curtime;
+	    debugs(50, 1, "logfileRingCommit: %s: ring is full; %d log messages have been lost.", lf->path, ll->ring_drops);
+	}
+	logfileRingNudge(lf);
+	return;
+    }
+    if (skip) {
+	*(unsigned int *) (data + pos) = LOGFILE_RING_SKIP;
+	head += skip;
+	pos = 0;
+    }
+    *(unsigned int *) (data + pos) = len;
+    xmemcpy(data + pos + 4, ll->line.buf, len);
+    __sync_synchronize();
+    r->head = head + need;
+    __sync_synchronize();
+    /* let lines pile up a bit; the flush event picks up the rest */
+    if (r->waiting && r->head - r->tail >= r->size / 8)
+	logfileRingNudge(lf);
+}
+
 /*
  * only schedule a flush (write) if one isn't scheduled.
  */
@@ -212,6 +303,9 @@ logfileFlushEvent(void *data)
      * This might work better if we keep track of when we wrote last and only
      * schedule a write if we haven't done so in the last second or two.
      */
+    l_daemon_t *ll = (l_daemon_t *) lf->data;
+    if (ll->ring && ll->ring->head != ll->ring->tail)
+	logfileRingNudge(lf);
     logfileQueueWrite(lf);
     eventAdd("logfileFlush", logfileFlushEvent, lf, 1.0, 1);
 }
@@ -247,10 +341,14 @@ logfile_mod_daemon_open(Logfile * lf, const char *path, size_t bufsz, int fatal_
 	    fatal("Couldn't start logfile helper");
     }
     ll->nbufs = 0;
+    if (Config.Log.daemon_ring_size > 0)
+	logfileRingOpen(lf);
 
     /* Queue the initial control data */
     tmpbuf = (char *) xmalloc(BUFSIZ);
     snprintf(tmpbuf, BUFSIZ, "r%d\nb%d\n", Config.Log.rotateNumber, Config.onoff.buffered_logs);
+    if (ll->ring)
+	snprintf(tmpbuf + strlen(tmpbuf), BUFSIZ - strlen(tmpbuf), "M%s\n", ll->ring_seg.name);
     logfile_mod_daemon_append(lf, tmpbuf, strlen(tmpbuf));
     xfree(tmpbuf);
 
@@ -274,6 +372,11 @@ logfile_mod_daemon_close(Logfile * lf)
     }
     kill(ll->pid, SIGTERM);
     eventDelete(logfileFlushEvent, lf);
+    if (ll->ring) {
+	shmSegmentClose(&ll->ring_seg);
+	shmSegmentUnlink(&ll->ring_seg);
+	memBufClean(&ll->line);
+    }
     xfree(ll);
     lf->data = NULL;
     cbdataUnlock(lf);
@@ -300,6 +403,10 @@ static void
 logfile_mod_daemon_writeline(Logfile * lf, const char *buf, size_t len)
 {
     l_daemon_t *ll = (l_daemon_t *) lf->data;
+    if (ll->ring) {
+	memBufAppend(&ll->line, buf, len);
+	return;
+    }
     /* Make sure the logfile buffer isn't too large */
     if (ll->nbufs > LOGFILE_MAXBUFS) {
 	if (ll->last_warned < squid_curtime - LOGFILE_WARN_TIME) {
@@ -320,6 +427,10 @@ logfile_mod_daemon_linestart(Logfile * lf)
     char tb[2];
     assert(ll->eol == 1);
     ll->eol = 0;
+    if (ll->ring) {
+	memBufReset(&ll->line);
+	return;
+    }
     tb[0] = 'L';
     tb[1] = '\0';
     logfile_mod_daemon_append(lf, tb, 1);
@@ -332,6 +443,11 @@ logfile_mod_daemon_lineend(Logfile * lf)
     logfile_buffer_t *b;
     assert(ll->eol == 0);
     ll->eol = 1;
+    if (ll->ring) {
+	if (ll->line.size > 0)
+	    logfileRingCommit(lf);
+	return;
+    }
     /* Kick a write off if the head buffer is -full- */
     if (ll->bufs.head != NULL) {
 	b = ll->bufs.head->data;
@@ -344,6 +460,11 @@ static void
 logfile_mod_daemon_flush(Logfile * lf)
 {
     l_daemon_t *ll = (l_daemon_t *) lf->data;
+    if (ll->ring && ll->ring->head != ll->ring->tail) {
+	/* the daemon drains the ring before it looks at any command */
+	ll->ring->waiting = 0;
+	logfile_mod_daemon_append(lf, "D\n", 2);
+    }
     if (commUnsetNonBlocking(ll->wfd)) {
 	debugs(50, 1, "Logfile Daemon: Couldn't set the pipe blocking for flush! You're now missing some log entries.");
 	return;
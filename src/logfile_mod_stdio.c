@@ -194,6 +194,7 @@ logfile_mod_stdio_open(Logfile * lf, const char *path, size_t bufsz, int fatal_f
     lf->f_lineend = logfile_mod_stdio_lineend;
     lf->f_flush = logfile_mod_stdio_flush;
     lf->f_rotate = logfile_mod_stdio_rotate;
+    lf->flags.binary = 1;
 
     ll = xcalloc(1, sizeof(*ll));
     lf->data = ll;
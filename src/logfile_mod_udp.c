@@ -159,6 +159,7 @@ logfile_mod_udp_open(Logfile * lf, const char *path, size_t bufsz, int fatal_fla
     lf->f_lineend = logfile_mod_udp_lineend;
     lf->f_flush = logfile_mod_udp_flush;
     lf->f_rotate = logfile_mod_udp_rotate;
+    lf->flags.binary = 1;
 
     ll = xcalloc(1, sizeof(*ll));
     lf->data = ll;
@@ -0,0 +1,41 @@
+#ifndef __LOGFILE_RING_H__
+#define __LOGFILE_RING_H__
+
+/*
+ * Shared memory ring between squid and logfile-daemon.
+ *
+ * squid is the only producer and the daemon the only consumer, so the
+ * ring needs no locks: squid advances head after copying a record in,
+ * the daemon advances tail after writing it out.  Both counters only
+ * grow; (counter & (size - 1)) is the offset into the data area.
+ *
+ * Every record is a 32 bit length followed by the data, padded to
+ * LOGFILE_RING_ALIGN.  A record never wraps; when it does not fit at
+ * the end of the data area squid writes a LOGFILE_RING_SKIP marker and
+ * starts again at offset 0.
+ *
+ * The daemon sets 'waiting' before it goes back to its control pipe
+ * and squid only sends a 'D' (drain) command when it finds it set, so
+ * a busy daemon is never woken once per line.
+ */
+
+#define LOGFILE_RING_MAGIC	0x53514c52	/* "SQLR" */
+#define LOGFILE_RING_ALIGN	8
+#define LOGFILE_RING_SKIP	0xffffffffU
+#define LOGFILE_RING_MIN	(64 * 1024)
+
+typedef struct {
+    unsigned int magic;
+    unsigned int size;		/* bytes in the data area, a power of two */
+    char pad0[56];
+    volatile unsigned long long head;	/* written by squid */
+    char pad1[56];
+    volatile unsigned long long tail;	/* written by the daemon */
+    volatile int waiting;	/* daemon is idle, squid must nudge it */
+    char pad2[52];
+} logfile_ring_hdr;
+
+#define LOGFILE_RING_DATA(h)	((char *) (h) + sizeof(logfile_ring_hdr))
+#define LOGFILE_RING_RECSZ(len)	(((len) + 4 + LOGFILE_RING_ALIGN - 1) & ~(LOGFILE_RING_ALIGN - 1))
+
+#endif
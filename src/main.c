@@ -569,6 +569,7 @@ mainReconfigureFinish(void *data)
     iapp_tcpRcvBufSz = Config.tcpRcvBufsz;
     iapp_useAcceptFilter = Config.accept_filter;
     iapp_incomingRate = Config.incoming_rate;
+    iapp_epollEdgeTriggered = Config.onoff.epoll_edge_triggered;
     httpConfig_relaxed_parser = Config.onoff.relaxed_header_parser;
     cfg_range_offset_limit = Config.rangeOffsetLimit;
 #if USE_SSL
@@ -634,6 +635,9 @@ if (IamPrimaryProcess())
 
 #if DELAY_POOLS
     clientReassignDelaypools();
+#endif
+#if USE_SSL
+    sslSessionCacheConfigure();
 #endif
     serverConnectionsOpen();
     neighbors_init();
@@ -835,6 +839,8 @@ mainInitialize(void)
 	urlInitialize();
 	cachemgrInit();
 	statInit();
+	latencyInit();
+	metricsInit();
 	storeInit();
 	mainSetCwd();
 	/* after this point we want to see the mallinfo() output */
@@ -858,6 +864,9 @@ mainInitialize(void)
 #endif
 	}
 
+#if USE_SSL
+    sslSessionCacheConfigure();
+#endif
     serverConnectionsOpen();
 	
     neighbors_init();
@@ -999,6 +1008,7 @@ main(int argc, char **argv)
         iapp_tcpRcvBufSz = Config.tcpRcvBufsz;
         iapp_useAcceptFilter = Config.accept_filter;
         iapp_incomingRate = Config.incoming_rate;
+        iapp_epollEdgeTriggered = Config.onoff.epoll_edge_triggered;
         httpConfig_relaxed_parser = Config.onoff.relaxed_header_parser;
         cfg_range_offset_limit = Config.rangeOffsetLimit;
 #if USE_SSL
@@ -1103,6 +1113,9 @@ main(int argc, char **argv)
 	 else if (UsingSmp() && (IamWorkerProcess() || IamDiskProcess()))
 		 StartIpcStrandInstance();
 
+    if (Config.event_loops > 1)
+	iapp_loops_start(Config.event_loops);
+
     /* main loop */
     for (;;) {
 	if (do_reconfigure) {
@@ -0,0 +1,511 @@
+
+/*
+ * DEBUG: section 18    Cache Manager Statistics
+ *
+ * SQUID Web Proxy Cache          http://www.squid-cache.org/
+ * ----------------------------------------------------------
+ *
+ *  Squid is the result of efforts by numerous individuals from
+ *  the Internet community; see the CONTRIBUTORS file for full
+ *  details.   Many organizations have provided support for Squid's
+ *  development; see the SPONSORS file for full details.  Squid is
+ *  Copyrighted (C) 2001 by the Regents of the University of
+ *  California; see the COPYRIGHT file for full details.  Squid
+ *  incorporates software developed and/or copyrighted by other
+ *  sources; see the CREDITS file for full details.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111, USA.
+ *
+ */
+
+/*
+ * The "metrics" cachemgr action: counters, gauges and service time
+ * summaries in the Prometheus text exposition format.
+ *
+ * Every metrics_update_period each worker renders its own samples into
+ * a slot, grouped by metric family, so answering a scrape is only a
+ * matter of copying the slots out family by family behind one HELP and
+ * TYPE line each.  With SMP the slots sit in one shared segment indexed
+ * by KidIdentifier and every sample carries a kid="N" label; sum() them
+ * on the collector side for instance wide figures.  A slot is guarded
+ * by a sequence number which is odd while its worker rewrites it.
+ */
+
+#include "squid.h"
+
+#define METRICS_SLOT_DATA	(256 * 1024)
+
+typedef struct _MetricFamily MetricFamily;
+typedef void METRICS_RENDER(MemBuf * mb, const MetricFamily * f, const char *kid);
+
+struct _MetricFamily {
+    const char *name;
+    const char *type;
+    const char *help;
+    METRICS_RENDER *render;
+    size_t off;			/* field offset or gauge id, see render */
+};
+
+enum {
+    METRICS_GAUGE_CLIENTS,
+    METRICS_GAUGE_FD_MAX,
+    METRICS_GAUGE_FD_OPEN,
+    METRICS_GAUGE_DISK_FD_OPEN,
+    METRICS_GAUGE_STORE_ENTRIES,
+    METRICS_GAUGE_MEM_OBJECTS,
+    METRICS_GAUGE_HOT_OBJECTS,
+    METRICS_GAUGE_DISK_OBJECTS,
+    METRICS_GAUGE_SWAP_SIZE,
+    METRICS_GAUGE_MEM_INUSE,
+    METRICS_GAUGE_MEM_ALLOC,
+    METRICS_GAUGE_START_TIME,
+    METRICS_GAUGE_CPU_TIME,
+    METRICS_GAUGE_PAGE_FAULTS
+};
+
+static METRICS_RENDER metricsInt;
+static METRICS_RENDER metricsKb;
+static METRICS_RENDER metricsServerInt;
+static METRICS_RENDER metricsServerKb;
+static METRICS_RENDER metricsGauge;
+static METRICS_RENDER metricsPoolObjects;
+static METRICS_RENDER metricsPoolBytes;
+static METRICS_RENDER metricsCacheDir;
+static METRICS_RENDER metricsServiceTime;
+
+#define SC(field)	offsetof(StatCounters, field)
+#define SS(field)	offsetof(struct _metrics_server, field)
+
+/* one of the server.{all,http,ftp,other} members of StatCounters */
+struct _metrics_server {
+    int requests;
+    int errors;
+    kb_t kbytes_in;
+    kb_t kbytes_out;
+};
+
+static const MetricFamily metric_families[] =
+{
+    {"squid_client_http_requests_total", "counter", "Client HTTP requests", metricsInt, SC(client_http.requests)},
+    {"squid_client_http_hits_total", "counter", "Client HTTP requests served from the cache", metricsInt, SC(client_http.hits)},
+    {"squid_client_http_mem_hits_total", "counter", "Client HTTP hits served from memory", metricsInt, SC(client_http.mem_hits)},
+    {"squid_client_http_disk_hits_total", "counter", "Client HTTP hits served from disk", metricsInt, SC(client_http.disk_hits)},
+    {"squid_client_http_errors_total", "counter", "Client HTTP requests answered with an error", metricsInt, SC(client_http.errors)},
+    {"squid_client_http_received_bytes_total", "counter", "Bytes received from clients", metricsKb, SC(client_http.kbytes_in)},
+    {"squid_client_http_sent_bytes_total", "counter", "Bytes sent to clients", metricsKb, SC(client_http.kbytes_out)},
+    {"squid_client_http_hit_sent_bytes_total", "counter", "Bytes sent to clients from cache hits", metricsKb, SC(client_http.hit_kbytes_out)},
+    {"squid_client_http_sendfile_sent_bytes_total", "counter", "Bytes of cache hits sent with sendfile()", metricsKb, SC(client_http.sendfile_kbytes_out)},
+    {"squid_server_requests_total", "counter", "Requests forwarded to servers", metricsServerInt, SS(requests)},
+    {"squid_server_errors_total", "counter", "Failed server requests", metricsServerInt, SS(errors)},
+    {"squid_server_received_bytes_total", "counter", "Bytes received from servers", metricsServerKb, SS(kbytes_in)},
+    {"squid_server_sent_bytes_total", "counter", "Bytes sent to servers", metricsServerKb, SS(kbytes_out)},
+    {"squid_icp_packets_sent_total", "counter", "ICP packets sent", metricsInt, SC(icp.pkts_sent)},
+    {"squid_icp_packets_received_total", "counter", "ICP packets received", metricsInt, SC(icp.pkts_recv)},
+    {"squid_icp_queries_sent_total", "counter", "ICP queries sent", metricsInt, SC(icp.queries_sent)},
+    {"squid_icp_replies_sent_total", "counter", "ICP replies sent", metricsInt, SC(icp.replies_sent)},
+    {"squid_icp_queries_received_total", "counter", "ICP queries received", metricsInt, SC(icp.queries_recv)},
+    {"squid_icp_replies_received_total", "counter", "ICP replies received", metricsInt, SC(icp.replies_recv)},
+    {"squid_icp_query_timeouts_total", "counter", "ICP queries which timed out", metricsInt, SC(icp.query_timeouts)},
+    {"squid_icp_replies_queued_total", "counter", "ICP replies which had to be queued", metricsInt, SC(icp.replies_queued)},
+    {"squid_icp_sent_bytes_total", "counter", "ICP bytes sent", metricsKb, SC(icp.kbytes_sent)},
+    {"squid_icp_received_bytes_total", "counter", "ICP bytes received", metricsKb, SC(icp.kbytes_recv)},
+    {"squid_htcp_packets_sent_total", "counter", "HTCP packets sent", metricsInt, SC(htcp.pkts_sent)},
+    {"squid_htcp_packets_received_total", "counter", "HTCP packets received", metricsInt, SC(htcp.pkts_recv)},
+    {"squid_cache_digest_messages_sent_total", "counter", "Cache digest messages sent", metricsInt, SC(cd.msgs_sent)},
+    {"squid_cache_digest_messages_received_total", "counter", "Cache digest messages received", metricsInt, SC(cd.msgs_recv)},
+    {"squid_cache_digest_sent_bytes_total", "counter", "Cache digest bytes sent", metricsKb, SC(cd.kbytes_sent)},
+    {"squid_cache_digest_received_bytes_total", "counter", "Cache digest bytes received", metricsKb, SC(cd.kbytes_recv)},
+    {"squid_unlink_requests_total", "counter", "Requests to unlink cache files", metricsInt, SC(unlink.requests)},
+    {"squid_swap_outs_total", "counter", "Objects written to cache_dirs", metricsInt, SC(swap.outs)},
+    {"squid_swap_ins_total", "counter", "Objects read from cache_dirs", metricsInt, SC(swap.ins)},
+    {"squid_swap_files_cleaned_total", "counter", "Orphaned cache files removed", metricsInt, SC(swap.files_cleaned)},
+    {"squid_aborted_requests_total", "counter", "Requests aborted by the client", metricsInt, SC(aborted_requests)},
+    {"squid_ssl_accepts_total", "counter", "SSL handshakes completed with clients", metricsInt, SC(ssl.accepts)},
+    {"squid_ssl_connects_total", "counter", "SSL handshakes completed with servers", metricsInt, SC(ssl.connects)},
+    {"squid_ssl_ktls_send_total", "counter", "SSL connections with kernel TLS transmit", metricsInt, SC(ssl.ktls_send)},
+    {"squid_ssl_ktls_recv_total", "counter", "SSL connections with kernel TLS receive", metricsInt, SC(ssl.ktls_recv)},
+    {"squid_cpu_seconds_total", "counter", "CPU time used", metricsGauge, METRICS_GAUGE_CPU_TIME},
+    {"squid_page_faults_total", "counter", "Major page faults", metricsGauge, METRICS_GAUGE_PAGE_FAULTS},
+    {"squid_start_time_seconds", "gauge", "Process start time since the epoch", metricsGauge, METRICS_GAUGE_START_TIME},
+    {"squid_clients", "gauge", "Clients in the client database", metricsGauge, METRICS_GAUGE_CLIENTS},
+    {"squid_fd_max", "gauge", "Maximum number of file descriptors", metricsGauge, METRICS_GAUGE_FD_MAX},
+    {"squid_fd_open", "gauge", "File descriptors in use", metricsGauge, METRICS_GAUGE_FD_OPEN},
+    {"squid_disk_fd_open", "gauge", "Cache files open", metricsGauge, METRICS_GAUGE_DISK_FD_OPEN},
+    {"squid_store_entries", "gauge", "StoreEntries", metricsGauge, METRICS_GAUGE_STORE_ENTRIES},
+    {"squid_store_mem_objects", "gauge", "StoreEntries with a MemObject", metricsGauge, METRICS_GAUGE_MEM_OBJECTS},
+    {"squid_store_hot_objects", "gauge", "Hot objects held in memory", metricsGauge, METRICS_GAUGE_HOT_OBJECTS},
+    {"squid_store_disk_objects", "gauge", "Objects on disk", metricsGauge, METRICS_GAUGE_DISK_OBJECTS},
+    {"squid_store_swap_size_bytes", "gauge", "Bytes used by objects on disk", metricsGauge, METRICS_GAUGE_SWAP_SIZE},
+    {"squid_mem_inuse_bytes", "gauge", "Bytes in use in memory pools", metricsGauge, METRICS_GAUGE_MEM_INUSE},
+    {"squid_mem_alloc_bytes", "gauge", "Bytes allocated by memory pools", metricsGauge, METRICS_GAUGE_MEM_ALLOC},
+    {"squid_mempool_alloc_objects", "gauge", "Objects allocated per memory pool", metricsPoolObjects, offsetof(MemPoolMeter, alloc)},
+    {"squid_mempool_inuse_objects", "gauge", "Objects in use per memory pool", metricsPoolObjects, offsetof(MemPoolMeter, inuse)},
+    {"squid_mempool_alloc_bytes", "gauge", "Bytes allocated per memory pool", metricsPoolBytes, offsetof(MemPoolMeter, alloc)},
+    {"squid_mempool_inuse_bytes", "gauge", "Bytes in use per memory pool", metricsPoolBytes, offsetof(MemPoolMeter, inuse)},
+    {"squid_cache_dir_max_bytes", "gauge", "Configured cache_dir size", metricsCacheDir, offsetof(SwapDir, max_size)},
+    {"squid_cache_dir_used_bytes", "gauge", "Bytes used in a cache_dir", metricsCacheDir, offsetof(SwapDir, cur_size)},
+    {"squid_service_time_seconds", "summary", "Service times by phase", metricsServiceTime, 0},
+};
+
+#define METRICS_NFAMILIES	(sizeof(metric_families) / sizeof(metric_families[0]))
+
+typedef struct {
+    volatile unsigned int seq;	/* odd while being rewritten, 0 until first written */
+    unsigned int off[METRICS_NFAMILIES];
+    unsigned int len[METRICS_NFAMILIES];
+    char data[METRICS_SLOT_DATA];
+} MetricsSlot;
+
+typedef struct {
+    int kids;
+} MetricsActionData;
+
+static ShmSegment metrics_shm;
+static MetricsSlot *metrics_slots = NULL;
+static int metrics_nslots = 0;
+static MetricsSlot *metrics_mine = NULL;
+static int metrics_truncated = 0;
+
+static OBJH metricsStats;
+static COL metricsCollect;
+static ADD metricsAdd;
+static EVH metricsUpdate;
+
+static void
+metricsSample(MemBuf * mb, const char *name, const char *suffix, const char *kid, const char *labels, double v)
+{
+    const char *sep = (*kid && *labels) ? "," : "";
+    if (*kid || *labels)
+	memBufPrintf(mb, "%s%s{%s%s%s} %.15g\n", name, suffix, kid, sep, labels, v);
+    else
+	memBufPrintf(mb, "%s%s %.15g\n", name, suffix, v);
+}
+
+/* label values must have backslash, double quote and newline escaped */
+static const char *
+metricsLabelValue(const char *s)
+{
+    static char buf[256];
+    char *d = buf;
+    for (; *s && d < buf + sizeof(buf) - 3; s++) {
+	if (*s == '\\' || *s == '"') {
+	    *d++ = '\\';
+	    *d++ = *s;
+	} else if (*s == '\n') {
+	    *d++ = '\\';
+	    *d++ = 'n';
+	} else
+	    *d++ = *s;
+    }
+    *d = '\0';
+    return buf;
+}
+
+static double
+metricsKbValue(const kb_t * k)
+{
+    return (double) k->kb * 1024.0 + (double) k->bytes;
+}
+
+static void
+metricsInt(MemBuf * mb, const MetricFamily * f, const char *kid)
+{
+    metricsSample(mb, f->name, "", kid, "", *(const int *) ((const char *) &statCounter + f->off));
+}
+
+static void
+metricsKb(MemBuf * mb, const MetricFamily * f, const char *kid)
+{
+    metricsSample(mb, f->name, "", kid, "", metricsKbValue((const kb_t *) ((const char *) &statCounter + f->off)));
+}
+
+static void
+metricsServer(MemBuf * mb, const MetricFamily * f, const char *kid, int is_kb)
+{
+    static const char *const proto[] =
+    {"http", "ftp", "other"};
+    const char *base[3];
+    char labels[32];
+    int i;
+    base[0] = (const char *) &statCounter.server.http;
+    base[1] = (const char *) &statCounter.server.ftp;
+    base[2] = (const char *) &statCounter.server.other;
+    for (i = 0; i < 3; i++) {
+	snprintf(labels, sizeof(labels), "proto=\"%s\"", proto[i]);
+	if (is_kb)
+	    metricsSample(mb, f->name, "", kid, labels, metricsKbValue((const kb_t *) (base[i] + f->off)));
+	else
+	    metricsSample(mb, f->name, "", kid, labels, *(const int *) (base[i] + f->off));
+    }
+}
+
+static void
+metricsServerInt(MemBuf * mb, const MetricFamily * f, const char *kid)
+{
+    metricsServer(mb, f, kid, 0);
+}
+
+static void
+metricsServerKb(MemBuf * mb, const MetricFamily * f, const char *kid)
+{
+    metricsServer(mb, f, kid, 1);
+}
+
+static void
+metricsGauge(MemBuf * mb, const MetricFamily * f, const char *kid)
+{
+    struct rusage rusage;
+    double v = 0.0;
+    switch (f->off) {
+    case METRICS_GAUGE_CLIENTS:
+	v = statCounter.client_http.clients;
+	break;
+    case METRICS_GAUGE_FD_MAX:
+	v = Squid_MaxFD;
+	break;
+    case METRICS_GAUGE_FD_OPEN:
+	v = Number_FD;
+	break;
+    case METRICS_GAUGE_DISK_FD_OPEN:
+	v = store_open_disk_fd;
+	break;
+    case METRICS_GAUGE_STORE_ENTRIES:
+	v = storeEntryCount();
+	break;
+    case METRICS_GAUGE_MEM_OBJECTS:
+	v = memPoolInUseCount(pool_memobject);
+	break;
+    case METRICS_GAUGE_HOT_OBJECTS:
+	v = hot_obj_count;
+	break;
+    case METRICS_GAUGE_DISK_OBJECTS:
+	v = n_disk_objects;
+	break;
+    case METRICS_GAUGE_SWAP_SIZE:
+	v = (double) store_swap_size * 1024.0;
+	break;
+    case METRICS_GAUGE_MEM_INUSE:
+	v = TheMeter.inuse.level;
+	break;
+    case METRICS_GAUGE_MEM_ALLOC:
+	v = TheMeter.alloc.level;
+	break;
+    case METRICS_GAUGE_START_TIME:
+	v = squid_start.tv_sec + squid_start.tv_usec / 1000000.0;
+	break;
+    case METRICS_GAUGE_CPU_TIME:
+	squid_getrusage(&rusage);
+	v = rusage_cputime(&rusage);
+	break;
+    case METRICS_GAUGE_PAGE_FAULTS:
+	squid_getrusage(&rusage);
+	v = rusage_pagefaults(&rusage);
+	break;
+    }
+    metricsSample(mb, f->name, "", kid, "", v);
+}
+
+static void
+metricsPool(MemBuf * mb, const MetricFamily * f, const char *kid, int bytes)
+{
+    char labels[300];
+    int i;
+    for (i = 0; i < Pools.count; i++) {
+	const MemPool *pool = Pools.items[i];
+	const MemMeter *m = (const MemMeter *) ((const char *) &pool->meter + f->off);
+	if (!memPoolWasUsed(pool))
+	    continue;
+	snprintf(labels, sizeof(labels), "pool=\"%s\"", metricsLabelValue(pool->label));
+	metricsSample(mb, f->name, "", kid, labels, bytes ? (double) m->level * pool->obj_size : (double) m->level);
+    }
+}
+
+static void
+metricsPoolObjects(MemBuf * mb, const MetricFamily * f, const char *kid)
+{
+    metricsPool(mb, f, kid, 0);
+}
+
+static void
+metricsPoolBytes(MemBuf * mb, const MetricFamily * f, const char *kid)
+{
+    metricsPool(mb, f, kid, 1);
+}
+
+static void
+metricsCacheDir(MemBuf * mb, const MetricFamily * f, const char *kid)
+{
+    char labels[300];
+    int i;
+    for (i = 0; i < Config.cacheSwap.n_configured; i++) {
+	const SwapDir *sd = &Config.cacheSwap.swapDirs[i];
+	snprintf(labels, sizeof(labels), "dir=\"%s\",type=\"%s\"", metricsLabelValue(sd->path), sd->type);
+	metricsSample(mb, f->name, "", kid, labels, *(const int *) ((const char *) sd + f->off) * 1024.0);
+    }
+}
+
+static void
+metricsServiceTime(MemBuf * mb, const MetricFamily * f, const char *kid)
+{
+    static const double quantile[] =
+    {0.5, 0.9, 0.99, 0.999};
+    char labels[64];
+    int p, q;
+    for (p = 0; p < LATENCY_MAX; p++) {
+	const HdrHist *H = latencyHist(p);
+	if (!H)
+	    return;
+	for (q = 0; q < sizeof(quantile) / sizeof(quantile[0]); q++) {
+	    snprintf(labels, sizeof(labels), "phase=\"%s\",quantile=\"%g\"", latencyPhaseName(p), quantile[q]);
+	    metricsSample(mb, f->name, "", kid, labels, H->count ? hdrHistPercentile(H, quantile[q] * 100.0) / 1000000.0 : 0.0);
+	}
+	snprintf(labels, sizeof(labels), "phase=\"%s\"", latencyPhaseName(p));
+	metricsSample(mb, f->name, "_sum", kid, labels, H->sum / 1000000.0);
+	metricsSample(mb, f->name, "_count", kid, labels, H->count);
+    }
+}
+
+static void
+metricsUpdate(void *unused)
+{
+    unsigned int off[METRICS_NFAMILIES];
+    unsigned int len[METRICS_NFAMILIES];
+    char kid[32];
+    MemBuf mb;
+    int i;
+
+    if (UsingSmp())
+	snprintf(kid, sizeof(kid), "kid=\"%d\"", KidIdentifier);
+    else
+	kid[0] = '\0';
+    memBufInit(&mb, 64 * 1024, METRICS_SLOT_DATA * 2);
+    for (i = 0; i < METRICS_NFAMILIES; i++) {
+	off[i] = mb.size;
+	metric_families[i].render(&mb, &metric_families[i], kid);
+	len[i] = mb.size - off[i];
+	if (mb.size > METRICS_SLOT_DATA) {
+	    /* drop the family which did not fit and everything after it */
+	    for (; i < METRICS_NFAMILIES; i++)
+		off[i] = len[i] = 0;
+	    if (!metrics_truncated++)
+		debugs(18, 1, "WARNING: metrics do not fit in %d bytes, some are left out", METRICS_SLOT_DATA);
+	    break;
+	}
+    }
+
+    metrics_mine->seq++;
+    __sync_synchronize();
+    memcpy(metrics_mine->off, off, sizeof(off));
+    memcpy(metrics_mine->len, len, sizeof(len));
+    for (i = 0; i < METRICS_NFAMILIES; i++)
+	memcpy(metrics_mine->data + off[i], mb.buf + off[i], len[i]);
+    __sync_synchronize();
+    metrics_mine->seq++;
+    memBufClean(&mb);
+
+    eventAdd("metricsUpdate", metricsUpdate, NULL, (double) XMAX(Config.metrics_update_period, 1), 1);
+}
+
+/* take a consistent copy of a slot; 0 when it was never written or kept changing */
+static int
+metricsCopySlot(MetricsSlot * copy, const MetricsSlot * slot)
+{
+    unsigned int seq;
+    int tries, i;
+    for (tries = 0; tries < 100; tries++) {
+	seq = slot->seq;
+	if (seq == 0)
+	    return 0;
+	if (seq & 1)
+	    continue;
+	__sync_synchronize();
+	memcpy(copy->off, slot->off, sizeof(copy->off));
+	memcpy(copy->len, slot->len, sizeof(copy->len));
+	for (i = 0; i < METRICS_NFAMILIES; i++) {
+	    if (copy->off[i] + copy->len[i] > METRICS_SLOT_DATA)
+		break;
+	    memcpy(copy->data + copy->off[i], slot->data + copy->off[i], copy->len[i]);
+	}
+	__sync_synchronize();
+	if (slot->seq == seq && i == METRICS_NFAMILIES) {
+	    copy->seq = seq;
+	    return 1;
+	}
+    }
+    debugs(18, 2, "metricsCopySlot: slot %d kept changing, skipped", (int) (slot - metrics_slots));
+    return 0;
+}
+
+static void
+metricsStats(StoreEntry * e, void *data)
+{
+    MetricsSlot *copy = xmalloc(metrics_nslots * sizeof(MetricsSlot));
+    char *have = xcalloc(metrics_nslots, 1);
+    int f, i;
+
+    for (i = 0; i < metrics_nslots; i++)
+	have[i] = metricsCopySlot(&copy[i], &metrics_slots[i]);
+    for (f = 0; f < METRICS_NFAMILIES; f++) {
+	storeAppendPrintf(e, "# HELP %s %s\n# TYPE %s %s\n",
+	    metric_families[f].name, metric_families[f].help,
+	    metric_families[f].name, metric_families[f].type);
+	for (i = 0; i < metrics_nslots; i++)
+	    if (have[i] && copy[i].len[f])
+		storeAppend(e, copy[i].data + copy[i].off[f], copy[i].len[f]);
+    }
+    xfree(have);
+    xfree(copy);
+}
+
+static void *
+metricsCollect(void)
+{
+    MetricsActionData *stats = xcalloc(1, sizeof(MetricsActionData));
+    stats->kids = 1;
+    return stats;
+}
+
+static int
+metricsAdd(void *A, void *B)
+{
+    if (A && B)
+	((MetricsActionData *) A)->kids += ((MetricsActionData *) B)->kids;
+    return sizeof(MetricsActionData);
+}
+
+void
+metricsInit(void)
+{
+    if (metrics_slots)
+	return;
+    if (UsingSmp()) {
+	metrics_nslots = NumberOfKids() + 1;
+	metrics_slots = shmSegmentOpen(&metrics_shm, "metrics", metrics_nslots * sizeof(MetricsSlot));
+	if (!metrics_slots)
+	    debugs(18, 1, "WARNING: metrics are not shared, showing this kid only");
+	else if (KidIdentifier < metrics_nslots)
+	    metrics_mine = &metrics_slots[KidIdentifier];
+    }
+    if (!metrics_slots) {
+	metrics_nslots = 1;
+	metrics_slots = xcalloc(1, sizeof(MetricsSlot));
+	metrics_mine = metrics_slots;
+    }
+    cachemgrRegister("metrics",
+	"Metrics in Prometheus text format",
+	metricsStats, metricsAdd, metricsCollect, 0, 1, 1);
+    if (metrics_mine && IamWorkerProcess())
+	eventAdd("metricsUpdate", metricsUpdate, NULL, 0.0, 1);
+}
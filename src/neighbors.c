@@ -456,7 +456,7 @@ neighborsUdpPing(request_t * request,
     mem->start_ping = current_time;
     mem->ping_reply_callback = callback;
     mem->ircb_data = callback_data;
-    reqnum = icpSetCacheKey(entry->hash.key);
+    reqnum = icpSetCacheKey(storeEntryKey(entry));
     for (i = 0, p = first_ping; i++ < Config.npeers; p = p->next) {
 	if (p == NULL)
 	    p = Config.peers;
@@ -468,7 +468,7 @@ neighborsUdpPing(request_t * request,
 	    p->name, url);
 	if (p->type == PEER_MULTICAST)
 	    mcastSetTtl(theOutIcpConnection, p->mcast.ttl);
-	debugs(15, 3, "neighborsUdpPing: key = '%s'", storeKeyText(entry->hash.key));
+	debugs(15, 3, "neighborsUdpPing: key = '%s'", storeKeyText(storeEntryKey(entry)));
 	debugs(15, 3, "neighborsUdpPing: reqnum = %d", reqnum);
 
 #if USE_HTCP
@@ -1223,7 +1223,7 @@ peerCountMcastPeersStart(void *data)
     mem->ircb_data = psstate;
     mcastSetTtl(theOutIcpConnection, p->mcast.ttl);
     p->mcast.id = mem->id;
-    reqnum = icpSetCacheKey(fake->hash.key);
+    reqnum = icpSetCacheKey(storeEntryKey(fake));
     query = icpCreateMessage(ICP_QUERY, 0, url, reqnum, 0);
     icpUdpSend(theOutIcpConnection,
 	&p->in_addr,
@@ -36,93 +36,235 @@
 #include "squid.h"
 #include "pconn.h"
 
+/*
+ * Idle server connections are pooled per destination.  A destination
+ * is identified by a binary key (host, port, domain, and the client
+ * address/port for spoofed outgoing connections) so no key string
+ * has to be formatted on every push and pop.  Each pool keeps its idle
+ * connections on an intrusive list, newest first, and the idle entry
+ * is the comm callback data so a timeout or close removes it in O(1).
+ *
+ * Pools outlive their last idle connection for a while so the per
+ * destination reuse statistics mean something; pconnCleanup() drops
+ * pools which have been unused for PCONN_POOL_TTL seconds.
+ */
+
+struct _pconn_key {
+    const char *host;
+    const char *domain;
+    struct in_addr client_addr;
+    u_short port;
+    u_short client_port;
+    int has_client;
+};
+
 struct _pconn {
-    hash_link hash;		/* must be first */
-    int *fds;
-    int nfds_alloc;
-    int nfds;
+    struct _pconn *next;	/* hash chain */
+    unsigned int hval;
+    char *host;
+    char *domain;
+    struct in_addr client_addr;
+    u_short port;
+    u_short client_port;
+    int has_client;
+    dlink_list idle;		/* struct _pconn_idle, newest first */
+    int nidle;
+    time_t last_used;
+    dlink_node link;		/* on the pools list */
+    struct {
+	int pushes;
+	int reuses;
+	int misses;
+	int timeouts;
+	int closes;
+	int overflows;
+    } stats;
+};
+
+struct _pconn_idle {
+    dlink_node node;
+    struct _pconn *pool;
+    int fd;
+    time_t since;
 };
 
-#define PCONN_FDS_SZ	8	/* pconn set size, increase for better memcache hit rate */
+#define PCONN_HASH_MIN	256	/* initial bucket count, must be a power of 2 */
+#define PCONN_POOL_TTL	600	/* drop empty pools unused for this long */
+#define PCONN_CLEANUP_INTERVAL	60
 
 static PF pconnRead;
 static PF pconnTimeout;
-static hash_link *pconnLookup(const char *peer, u_short port, const char *domain, struct in_addr *client_address, u_short client_port);
-static int pconnKey(char *buf, const char *host, u_short port, const char *domain, struct in_addr *client_address, u_short client_port);
-static hash_table *table = NULL;
-static struct _pconn *pconnNew(const char *key);
+static EVH pconnCleanup;
+static struct _pconn *pconnLookup(const struct _pconn_key *key, unsigned int hval);
+static unsigned int pconnHash(const struct _pconn_key *key);
+static void pconnKeyInit(struct _pconn_key *key, const char *host, u_short port, const char *domain, struct in_addr *client_address, u_short client_port);
+static struct _pconn *pconnNew(const struct _pconn_key *key, unsigned int hval);
 static void pconnDelete(struct _pconn *p);
-static void pconnRemoveFD(struct _pconn *p, int fd);
+static void pconnRemoveIdle(struct _pconn_idle *idle);
+static const char *pconnDescribe(const struct _pconn *p);
 static OBJH pconnHistDump;
+static struct _pconn **buckets = NULL;
+static unsigned int nbuckets = 0;
+static int npools = 0;
+static dlink_list pools;
 static MemPool *pconn_data_pool = NULL;
-static MemPool *pconn_fds_pool = NULL;
+static MemPool *pconn_idle_pool = NULL;
 
-#define	PCONN_KEYLEN	(SQUIDHOSTNAMELEN + 30)
+static void
+pconnKeyInit(struct _pconn_key *key, const char *host, u_short port, const char *domain,
+    struct in_addr *client_address, u_short client_port)
+{
+    key->host = host;
+    key->port = port;
+    key->domain = domain;
+    key->has_client = client_address != NULL;
+    if (client_address) {
+	key->client_addr = *client_address;
+	key->client_port = client_port;
+    } else {
+	key->client_addr.s_addr = 0;
+	key->client_port = 0;
+    }
+}
+
+/* FNV-1a over the key fields */
+static unsigned int
+pconnHash(const struct _pconn_key *key)
+{
+    unsigned int h = 2166136261U;
+    const unsigned char *s;
+    for (s = (const unsigned char *) key->host; *s; s++)
+	h = (h ^ *s) * 16777619U;
+    h = (h ^ 0xff) * 16777619U;
+    if (key->domain)
+	for (s = (const unsigned char *) key->domain; *s; s++)
+	    h = (h ^ *s) * 16777619U;
+    h = (h ^ key->port) * 16777619U;
+    if (key->has_client) {
+	h = (h ^ key->client_addr.s_addr) * 16777619U;
+	h = (h ^ key->client_port) * 16777619U;
+    }
+    return h;
+}
 
 static int
-pconnKey(char *buf, const char *host, u_short port, const char *domain,
-    struct in_addr *client_address, u_short client_port)
+pconnMatch(const struct _pconn *p, const struct _pconn_key *key, unsigned int hval)
 {
-    if (domain && client_address)
-	return snprintf(buf, PCONN_KEYLEN, "%s.%d:%s.%d/%s", host, (int) port,
-	    inet_ntoa(*client_address), (int) client_port, domain);
-    else if (domain && (!client_address))
-	return snprintf(buf, PCONN_KEYLEN, "%s.%d/%s", host, (int) port, domain);
-    else if ((!domain) && client_address)
-	return snprintf(buf, PCONN_KEYLEN, "%s.%d:%s.%d", host, (int) port,
-	    inet_ntoa(*client_address), (int) client_port);
-    else
-	return snprintf(buf, PCONN_KEYLEN, "%s:%d", host, (int) port);
+    if (p->hval != hval || p->port != key->port || p->has_client != key->has_client)
+	return 0;
+    if (p->has_client && (p->client_addr.s_addr != key->client_addr.s_addr || p->client_port != key->client_port))
+	return 0;
+    if ((p->domain == NULL) != (key->domain == NULL))
+	return 0;
+    if (p->domain && strcmp(p->domain, key->domain) != 0)
+	return 0;
+    return strcmp(p->host, key->host) == 0;
+}
+
+static struct _pconn *
+pconnLookup(const struct _pconn_key *key, unsigned int hval)
+{
+    struct _pconn *p;
+    assert(buckets != NULL);
+    for (p = buckets[hval & (nbuckets - 1)]; p; p = p->next) {
+	if (pconnMatch(p, key, hval))
+	    return p;
+    }
+    return NULL;
+}
+
+static void
+pconnResize(unsigned int size)
+{
+    struct _pconn **old = buckets;
+    unsigned int oldsize = nbuckets;
+    unsigned int i;
+    struct _pconn *p, *next;
+    debugs(48, 2, "pconnResize: %u -> %u buckets, %d pools", oldsize, size, npools);
+    buckets = xcalloc(size, sizeof(*buckets));
+    nbuckets = size;
+    for (i = 0; i < oldsize; i++) {
+	for (p = old[i]; p; p = next) {
+	    next = p->next;
+	    p->next = buckets[p->hval & (size - 1)];
+	    buckets[p->hval & (size - 1)] = p;
+	}
+    }
+    safe_free(old);
 }
 
 static struct _pconn *
-pconnNew(const char *key)
+pconnNew(const struct _pconn_key *key, unsigned int hval)
 {
     struct _pconn *p = memPoolAlloc(pconn_data_pool);
-    p->hash.key = xstrdup(key);
-    p->nfds_alloc = PCONN_FDS_SZ;
-    p->fds = memPoolAlloc(pconn_fds_pool);
-    debugs(48, 3, "pconnNew: adding %s", hashKeyStr(&p->hash));
-    hash_join(table, &p->hash);
+    unsigned int b;
+    p->hval = hval;
+    p->host = xstrdup(key->host);
+    p->domain = key->domain ? xstrdup(key->domain) : NULL;
+    p->port = key->port;
+    p->has_client = key->has_client;
+    p->client_addr = key->client_addr;
+    p->client_port = key->client_port;
+    p->last_used = squid_curtime;
+    if ((unsigned int) ++npools > nbuckets)
+	pconnResize(nbuckets << 1);
+    b = hval & (nbuckets - 1);
+    p->next = buckets[b];
+    buckets[b] = p;
+    dlinkAddTail(p, &p->link, &pools);
+    debugs(48, 3, "pconnNew: adding %s", pconnDescribe(p));
     return p;
 }
 
 static void
 pconnDelete(struct _pconn *p)
 {
-    debugs(48, 3, "pconnDelete: deleting %s", hashKeyStr(&p->hash));
-    hash_remove_link(table, (hash_link *) p);
-    if (p->nfds_alloc == PCONN_FDS_SZ)
-	memPoolFree(pconn_fds_pool, p->fds);
-    else
-	xfree(p->fds);
-    xfree(p->hash.key);
+    struct _pconn **pp;
+    debugs(48, 3, "pconnDelete: deleting %s", pconnDescribe(p));
+    assert(p->nidle == 0);
+    for (pp = &buckets[p->hval & (nbuckets - 1)]; *pp != p; pp = &(*pp)->next)
+	assert(*pp != NULL);
+    *pp = p->next;
+    dlinkDelete(&p->link, &pools);
+    npools--;
+    safe_free(p->host);
+    safe_free(p->domain);
     memPoolFree(pconn_data_pool, p);
 }
 
+static const char *
+pconnDescribe(const struct _pconn *p)
+{
+    LOCAL_ARRAY(char, buf, SQUIDHOSTNAMELEN + 64);
+    if (p->has_client)
+	snprintf(buf, SQUIDHOSTNAMELEN + 64, "%s:%d via %s:%d%s%s", p->host, (int) p->port,
+	    inet_ntoa(p->client_addr), (int) p->client_port,
+	    p->domain ? "/" : "", p->domain ? p->domain : "");
+    else
+	snprintf(buf, SQUIDHOSTNAMELEN + 64, "%s:%d%s%s", p->host, (int) p->port,
+	    p->domain ? "/" : "", p->domain ? p->domain : "");
+    return buf;
+}
+
 static void
-pconnRemoveFD(struct _pconn *p, int fd)
+pconnRemoveIdle(struct _pconn_idle *idle)
 {
-    int i;
-    for (i = p->nfds - 1; i >= 0; i--) {
-	if (p->fds[i] == fd)
-	    break;
-    }
-    assert(i >= 0);
-    debugs(48, 3, "pconnRemoveFD: found FD %d at index %d", fd, i);
-    for (; i < p->nfds - 1; i++)
-	p->fds[i] = p->fds[i + 1];
-    if (--p->nfds == 0)
-	pconnDelete(p);
+    struct _pconn *p = idle->pool;
+    debugs(48, 3, "pconnRemoveIdle: FD %d from %s, idle %d seconds", idle->fd,
+	pconnDescribe(p), (int) (squid_curtime - idle->since));
+    dlinkDelete(&idle->node, &p->idle);
+    p->nidle--;
+    p->last_used = squid_curtime;
+    memPoolFree(pconn_idle_pool, idle);
 }
 
 static void
 pconnTimeout(int fd, void *data)
 {
-    struct _pconn *p = data;
-    assert(table != NULL);
-    debugs(48, 3, "pconnTimeout: FD %d %s", fd, hashKeyStr(&p->hash));
-    pconnRemoveFD(p, fd);
+    struct _pconn_idle *idle = data;
+    assert(idle->fd == fd);
+    idle->pool->stats.timeouts++;
+    pconnRemoveIdle(idle);
     comm_close(fd);
 }
 
@@ -130,21 +272,38 @@ static void
 pconnRead(int fd, void *data)
 {
     LOCAL_ARRAY(char, buf, 256);
-    struct _pconn *p = data;
+    struct _pconn_idle *idle = data;
     int n;
-    assert(table != NULL);
+    assert(idle->fd == fd);
     CommStats.syscalls.sock.reads++;
     n = FD_READ_METHOD(fd, buf, 256);
     debugs(48, 3, "pconnRead: %d bytes from FD %d, %s", n, fd,
-	hashKeyStr(&p->hash));
-    pconnRemoveFD(p, fd);
+	pconnDescribe(idle->pool));
+    idle->pool->stats.closes++;
+    pconnRemoveIdle(idle);
     comm_close(fd);
 }
 
+static void
+pconnCleanup(void *unused)
+{
+    dlink_node *n = pools.head;
+    struct _pconn *p;
+    while (n) {
+	p = n->data;
+	n = n->next;
+	if (p->nidle == 0 && p->last_used + PCONN_POOL_TTL < squid_curtime)
+	    pconnDelete(p);
+    }
+    eventAdd("pconnCleanup", pconnCleanup, NULL, PCONN_CLEANUP_INTERVAL, 1);
+}
+
 static void
 pconnHistDump(StoreEntry * e, void* data)
 {
     int i;
+    dlink_node *n;
+    struct _pconn *p;
     storeAppendPrintf(e,
 	"Client-side persistent connection counts:\n"
 	"\n"
@@ -168,6 +327,20 @@ pconnHistDump(StoreEntry * e, void* data)
 	    continue;
 	storeAppendPrintf(e, "\t%4d  %9d\n", i, server_pconn_hist[i]);
     }
+    storeAppendPrintf(e,
+	"\n"
+	"Server-side idle connection pools: %d pools, %u buckets\n"
+	"\n"
+	"\t idle   pushed   reused   missed timedout   closed overflow  reuse%%  destination\n",
+	npools, nbuckets);
+    for (n = pools.head; n; n = n->next) {
+	p = n->data;
+	storeAppendPrintf(e, "\t%5d %8d %8d %8d %8d %8d %8d %6.1f%%  %s\n",
+	    p->nidle, p->stats.pushes, p->stats.reuses, p->stats.misses,
+	    p->stats.timeouts, p->stats.closes, p->stats.overflows,
+	    dpercent(p->stats.reuses, p->stats.reuses + p->stats.misses),
+	    pconnDescribe(p));
+    }
 }
 
 /* ========== PUBLIC FUNCTIONS ============================================ */
@@ -177,18 +350,19 @@ void
 pconnInit(void)
 {
     int i;
-    assert(table == NULL);
-    table = hash_create((HASHCMP *) strcmp, 229, hash_string);
+    assert(buckets == NULL);
+    pconnResize(PCONN_HASH_MIN);
     for (i = 0; i < PCONN_HIST_SZ; i++) {
 	client_pconn_hist[i] = 0;
 	server_pconn_hist[i] = 0;
     }
     pconn_data_pool = memPoolCreate("pconn_data", sizeof(struct _pconn));
-    pconn_fds_pool = memPoolCreate("pconn_fds", PCONN_FDS_SZ * sizeof(int));
+    pconn_idle_pool = memPoolCreate("pconn_idle", sizeof(struct _pconn_idle));
 
     cachemgrRegister("pconn",
 	"Persistent Connection Utilization Histograms",
 	pconnHistDump, NULL, NULL, 0, 1, 0);
+    eventAdd("pconnCleanup", pconnCleanup, NULL, PCONN_CLEANUP_INTERVAL, 1);
     debugs(48, 3, "persistent connection module initialized");
 }
 
@@ -196,9 +370,11 @@ void
 pconnPush(int fd, const char *host, u_short port, const char *domain, struct in_addr *client_address, u_short client_port)
 {
     struct _pconn *p;
-    int *old;
+    struct _pconn_idle *idle;
+    struct _pconn_key key;
+    unsigned int hval;
+    int oldfd;
     LOCAL_ARRAY(char, desc, FD_DESC_SZ);
-    LOCAL_ARRAY(char, key, PCONN_KEYLEN);
     if (fdUsageHigh()) {
 	debugs(48, 3, "pconnPush: Not many unused FDs");
 	comm_close(fd);
@@ -207,57 +383,60 @@ pconnPush(int fd, const char *host, u_short port, const char *domain, struct in_
 	comm_close(fd);
 	return;
     }
-    assert(table != NULL);
-    pconnKey(key, host, port, domain, client_address, client_port);
-    p = (struct _pconn *) hash_lookup(table, key);
+    pconnKeyInit(&key, host, port, domain, client_address, client_port);
+    hval = pconnHash(&key);
+    p = pconnLookup(&key, hval);
     if (p == NULL)
-	p = pconnNew(key);
-    if (p->nfds == p->nfds_alloc) {
-	debugs(48, 3, "pconnPush: growing FD array");
-	p->nfds_alloc <<= 1;
-	old = p->fds;
-	p->fds = xmalloc(p->nfds_alloc * sizeof(int));
-	xmemcpy(p->fds, old, p->nfds * sizeof(int));
-	if (p->nfds == PCONN_FDS_SZ)
-	    memPoolFree(pconn_fds_pool, old);
-	else
-	    xfree(old);
+	p = pconnNew(&key, hval);
+    if (Config.pconn.max_idle_per_dest > 0 && p->nidle >= Config.pconn.max_idle_per_dest) {
+	/* make room by closing the connection which has been idle longest */
+	idle = p->idle.tail->data;
+	debugs(48, 3, "pconnPush: %s is full, closing FD %d", pconnDescribe(p), idle->fd);
+	p->stats.overflows++;
+	oldfd = idle->fd;
+	pconnRemoveIdle(idle);
+	comm_close(oldfd);
     }
-    p->fds[p->nfds++] = fd;
-    commSetSelect(fd, COMM_SELECT_READ, pconnRead, p, 0);
-    commSetTimeout(fd, Config.Timeout.pconn, pconnTimeout, p);
+    idle = memPoolAlloc(pconn_idle_pool);
+    idle->pool = p;
+    idle->fd = fd;
+    idle->since = squid_curtime;
+    dlinkAdd(idle, &idle->node, &p->idle);
+    p->nidle++;
+    p->stats.pushes++;
+    p->last_used = squid_curtime;
+    commSetSelect(fd, COMM_SELECT_READ, pconnRead, idle, 0);
+    commSetTimeout(fd, Config.Timeout.pconn, pconnTimeout, idle);
     snprintf(desc, FD_DESC_SZ, "%s idle connection", host);
     fd_note(fd, desc);
-    debugs(48, 3, "pconnPush: pushed FD %d for %s", fd, key);
+    debugs(48, 3, "pconnPush: pushed FD %d for %s", fd, pconnDescribe(p));
 }
 
 int
 pconnPop(const char *host, u_short port, const char *domain, struct in_addr *client_address, u_short client_port, int *idle)
 {
     struct _pconn *p;
-    hash_link *hptr;
-    int fd = -1;
-    assert(table != NULL);
-    hptr = pconnLookup(host, port, domain, client_address, client_port);
-    if (hptr != NULL) {
-	p = (struct _pconn *) hptr;
-	assert(p->nfds > 0);
-	fd = p->fds[p->nfds - 1];
-	if (idle)
-	    *idle = p->nfds - 1;
-	pconnRemoveFD(p, fd);
-	commSetSelect(fd, COMM_SELECT_READ, NULL, NULL, 0);
-	commSetTimeout(fd, -1, NULL, NULL);
+    struct _pconn_idle *e;
+    struct _pconn_key key;
+    int fd;
+    pconnKeyInit(&key, host, port, domain, client_address, client_port);
+    p = pconnLookup(&key, pconnHash(&key));
+    if (p == NULL)
+	return -1;
+    if (p->nidle == 0) {
+	p->stats.misses++;
+	return -1;
     }
+    if (Config.pconn.order == PCONN_ORDER_FIFO)
+	e = p->idle.tail->data;
+    else
+	e = p->idle.head->data;
+    fd = e->fd;
+    pconnRemoveIdle(e);
+    p->stats.reuses++;
+    if (idle)
+	*idle = p->nidle;
+    commSetSelect(fd, COMM_SELECT_READ, NULL, NULL, 0);
+    commSetTimeout(fd, -1, NULL, NULL);
     return fd;
 }
-
-static hash_link *
-pconnLookup(const char *peer, u_short port, const char *domain, struct in_addr *client_address, u_short client_port)
-{
-    LOCAL_ARRAY(char, key, PCONN_KEYLEN);
-    assert(table != NULL);
-    pconnKey(key, peer, port, domain, client_address, client_port);
-    return hash_lookup(table, key);
-}
-
@@ -50,6 +50,8 @@ static STNCB peerDigestFetchReply;
 static STNCB peerDigestSwapInHeaders;
 static STNCB peerDigestSwapInCBlock;
 static STNCB peerDigestSwapInMask;
+static STNCB peerDigestSwapInDelta;
+static int peerDigestApplyDelta(DigestFetchState * fetch);
 static int peerDigestFetchedEnough(DigestFetchState * fetch, ssize_t size, const char *step_name);
 static void peerDigestFetchStop(DigestFetchState * fetch, const char *reason);
 static void peerDigestFetchAbort(DigestFetchState * fetch, const char *reason);
@@ -57,7 +59,7 @@ static void peerDigestReqFinish(DigestFetchState * fetch, int, int, int, const c
 static void peerDigestPDFinish(DigestFetchState * fetch, int pcb_valid, int err);
 static void peerDigestFetchFinish(DigestFetchState * fetch, int err);
 static void peerDigestFetchSetStats(DigestFetchState * fetch);
-static int peerDigestSetCBlock(PeerDigest * pd, const char *buf);
+static int peerDigestSetCBlock(DigestFetchState * fetch, const char *buf);
 static int peerDigestUseful(const PeerDigest * pd);
 
 MemPool * pool_cache_digest = NULL;
@@ -70,6 +72,8 @@ MemPool * pool_cache_digest = NULL;
 static const time_t PeerDigestReqMinGap = 5 * 60;	/* seconds */
 /* min interval for requesting digests (cumulative request stream) */
 static const time_t GlobDigestReqMinGap = 1 * 60;	/* seconds */
+/* stop asking a peer for deltas after this many failed in a row */
+static const int PeerDigestMaxDeltaFailures = 3;
 
 /* local vars */
 
@@ -187,8 +191,8 @@ static time_t
 peerDigestNewDelay(const StoreEntry * e)
 {
     assert(e);
-    if (e->expires > 0)
-	return e->expires + PeerDigestReqMinGap - squid_curtime;
+    if (STORE_TIME(e->expires) > 0)
+	return STORE_TIME(e->expires) + PeerDigestReqMinGap - squid_curtime;
     return PeerDigestReqMinGap;
 }
 
@@ -281,12 +285,18 @@ peerDigestRequest(PeerDigest * pd)
     pd->req_result = NULL;
     pd->flags.requested = 1;
 
+    /* ask for the changes only if we hold a complete, known generation */
+    pd->flags.delta = Config.digest.delta && pd->cd && pd->generation &&
+	!pd->flags.no_delta && !pd->flags.need_full && !p->digest_url;
+    pd->flags.need_full = 0;
+
     /* compute future request components */
     if (p->digest_url)
 	url = xstrdup(p->digest_url);
     else
 	url = internalRemoteUri(p->host, p->http_port,
-	    "/squid-internal-periodic/", StoreDigestFileName);
+	    "/squid-internal-periodic/",
+	    pd->flags.delta ? StoreDigestDeltaFileName : StoreDigestFileName);
 
     req = urlParse(urlMethodGetKnownByCode(METHOD_GET), url);
     assert(req);
@@ -453,7 +463,7 @@ peerDigestSwapInCBlock(void *data, mem_node_ref nr, ssize_t size)
 	HttpReply *rep = fetch->entry->mem_obj->reply;
 
 	assert(pd && rep);
-	if (peerDigestSetCBlock(pd, fetch->buf)) {
+	if (peerDigestSetCBlock(fetch, fetch->buf)) {
 	    /* XXX: soon we will have variable header size */
 	    fetch->offset -= fetch->buf_used - StoreDigestCBlockSize;
 	    /* switch to CD buffer and fetch digest guts */
@@ -461,11 +471,19 @@ peerDigestSwapInCBlock(void *data, mem_node_ref nr, ssize_t size)
 	    fetch->buf = NULL;
 	    fetch->buf_used = 0;
 	    assert(pd->cd->mask);
-	    storeClientRef(fetch->sc, fetch->entry,
-		fetch->offset,
-		fetch->offset,
-		pd->cd->mask_size,
-		peerDigestSwapInMask, fetch);
+	    if (pd->flags.delta) {
+		fetch->delta = xmalloc(fetch->cblock.delta_size + 1);
+		storeClientRef(fetch->sc, fetch->entry,
+		    fetch->offset,
+		    fetch->offset,
+		    SM_PAGE_SIZE,
+		    peerDigestSwapInDelta, fetch);
+	    } else
+		storeClientRef(fetch->sc, fetch->entry,
+		    fetch->offset,
+		    fetch->offset,
+		    pd->cd->mask_size,
+		    peerDigestSwapInMask, fetch);
 	} else {
 	    peerDigestFetchAbort(fetch, "invalid digest cblock");
 	}
@@ -524,6 +542,63 @@ peerDigestSwapInMask(void *data, mem_node_ref nr, ssize_t size)
     }
 }
 
+/* collect the change records of a delta; they are applied once complete */
+static void
+peerDigestSwapInDelta(void *data, mem_node_ref nr, ssize_t size)
+{
+    DigestFetchState *fetch = data;
+    const int want = fetch->cblock.delta_size - fetch->delta_used;
+
+    if (peerDigestFetchedEnough(fetch, size, "peerDigestSwapInDelta")) {
+	stmemNodeUnref(&nr);
+	return;
+    }
+    assert(size <= nr.node->len - nr.offset);
+    if (size > want)
+	size = want;
+    if (size > 0)
+	memcpy(fetch->delta + fetch->delta_used, nr.node->data + nr.offset, size);
+    stmemNodeUnref(&nr);
+
+    fetch->offset += size;
+    fetch->delta_used += size;
+    if (fetch->delta_used >= fetch->cblock.delta_size)
+	assert(peerDigestFetchedEnough(fetch, 0, "peerDigestSwapInDelta"));
+    else
+	storeClientRef(fetch->sc, fetch->entry,
+	    fetch->offset,
+	    fetch->offset,
+	    XMIN(SM_PAGE_SIZE, fetch->cblock.delta_size - fetch->delta_used),
+	    peerDigestSwapInDelta, fetch);
+}
+
+/*
+ * xor the received change records into the digest mask.  All offsets
+ * are checked before anything is applied so a bad delta leaves the
+ * mask untouched.
+ */
+static int
+peerDigestApplyDelta(DigestFetchState * fetch)
+{
+    CacheDigest *cd = fetch->pd->cd;
+    u_int32_t off;
+    int i, j;
+    if (fetch->cblock.delta_size % 8)
+	return 0;
+    for (i = 0; i < fetch->cblock.delta_size; i += 8) {
+	xmemcpy(&off, fetch->delta + i, sizeof(off));
+	if (ntohl(off) >= cd->mask_size)
+	    return 0;
+    }
+    for (i = 0; i < fetch->cblock.delta_size; i += 8) {
+	xmemcpy(&off, fetch->delta + i, sizeof(off));
+	off = ntohl(off);
+	for (j = 0; j < 4 && off + j < cd->mask_size; j++)
+	    cd->mask[off + j] ^= fetch->delta[i + 4 + j];
+    }
+    return 1;
+}
+
 static int
 peerDigestFetchedEnough(DigestFetchState * fetch, ssize_t size, const char *step_name)
 {
@@ -570,12 +645,20 @@ peerDigestFetchedEnough(DigestFetchState * fetch, ssize_t size, const char *step
 	    reason = "null digest?!";
 	else if (fetch->buf)
 	    reason = "premature end of digest header?!";
-	else if (fetch->mask_offset != pd->cd->mask_size)
+	else if (pd->flags.delta && fetch->delta_used != fetch->cblock.delta_size)
+	    reason = "premature end of digest delta?!";
+	else if (!pd->flags.delta && fetch->mask_offset != pd->cd->mask_size)
 	    reason = "premature end of digest mask?!";
+	else if (pd->flags.delta && !peerDigestApplyDelta(fetch))
+	    reason = "corrupted digest delta";
 	else if (!peerDigestUseful(pd))
 	    reason = "useless digest";
-	else
+	else {
 	    reason = no_bug = "success";
+	    pd->cd->count = fetch->cblock.count;
+	    pd->cd->del_count = fetch->cblock.del_count;
+	    pd->generation = fetch->cblock.generation;
+	}
     }
     /* finish if we have a reason */
     if (reason) {
@@ -628,7 +711,10 @@ peerDigestReqFinish(DigestFetchState * fetch,
     /* schedule next check if peer is still out there */
     if (pcb_valid) {
 	PeerDigest *pd = fetch->pd;
-	if (err) {
+	if (err && pd->flags.delta && pd->cd) {
+	    /* fall back to the full digest without a retry penalty */
+	    peerDigestSetCheck(pd, 0);
+	} else if (err) {
 	    pd->times.retry_delay = peerDigestIncDelay(pd);
 	    peerDigestSetCheck(pd, pd->times.retry_delay);
 	} else {
@@ -652,15 +738,37 @@ static void
 peerDigestPDFinish(DigestFetchState * fetch, int pcb_valid, int err)
 {
     PeerDigest *pd = fetch->pd;
+    const int delta = pd->flags.delta;
 
-    pd->times.received = squid_curtime;
+    pd->flags.delta = 0;
+    if (!(err && delta && pcb_valid))
+	pd->times.received = squid_curtime;
     pd->times.req_delay = fetch->resp_time;
     kb_incr(&pd->stats.sent.kbytes, (size_t) fetch->sent.bytes);
     kb_incr(&pd->stats.recv.kbytes, (size_t) fetch->recv.bytes);
     pd->stats.sent.msgs += fetch->sent.msg;
     pd->stats.recv.msgs += fetch->recv.msg;
+    if (delta) {
+	pd->stats.delta.msgs++;
+	kb_incr(&pd->stats.delta.kbytes, (size_t) fetch->recv.bytes);
+    }
 
-    if (err) {
+    if (err && delta && pcb_valid && pd->cd) {
+	/*
+	 * The delta did not apply (the peer has none, or it is based on
+	 * a generation we do not hold).  The mask is only touched once a
+	 * delta is complete, so keep using it until the full digest
+	 * arrives.
+	 */
+	pd->flags.need_full = 1;
+	if (++pd->delta_failures >= PeerDigestMaxDeltaFailures && !pd->flags.no_delta) {
+	    debugs(72, 1, "peer %.*s does not provide digest deltas (%s), fetching full digests",
+		strLen2(pd->host), strBuf2(pd->host), pd->req_result);
+	    pd->flags.no_delta = 1;
+	}
+	debugs(72, 2, "delta from %.*s not applied (%s), will fetch the full digest",
+	    strLen2(pd->host), strBuf2(pd->host), pd->req_result);
+    } else if (err) {
 	debugs(72, 1, "%sdisabling (%s) digest from %.*s",
 	    pcb_valid ? "temporary " : "",
 	    pd->req_result, strLen2(pd->host), strBuf2(pd->host));
@@ -677,6 +785,8 @@ peerDigestPDFinish(DigestFetchState * fetch, int pcb_valid, int err)
 	assert(pcb_valid);
 
 	pd->flags.usable = 1;
+	if (delta)
+	    pd->delta_failures = 0;
 
 	/* XXX: ugly condition, but how? */
 	if (fetch->entry->store_status == STORE_OK)
@@ -719,6 +829,7 @@ peerDigestFetchFinish(DigestFetchState * fetch, int err)
 	memFree(fetch->buf, MEM_4K_BUF);
 	fetch->buf = NULL;
     }
+    safe_free(fetch->delta);
     cbdataFree(fetch);
 }
 
@@ -738,21 +849,23 @@ peerDigestFetchSetStats(DigestFetchState * fetch)
     fetch->recv.bytes = fetch->entry->store_status == STORE_PENDING ?
 	mem->inmem_hi : mem->object_sz;
     fetch->sent.msg = fetch->recv.msg = 1;
-    fetch->expires = fetch->entry->expires;
+    fetch->expires = STORE_TIME(fetch->entry->expires);
     fetch->resp_time = squid_curtime - fetch->start_time;
 
     debugs(72, 3, "peerDigestFetchSetStats: recv %d bytes in %d secs",
 	fetch->recv.bytes, (int) fetch->resp_time);
     debugs(72, 3, "peerDigestFetchSetStats: expires: %ld (%+d), lmt: %ld (%+d)",
 	(long int) fetch->expires, (int) (fetch->expires - squid_curtime),
-	(long int) fetch->entry->lastmod, (int) (fetch->entry->lastmod - squid_curtime));
+	(long int) STORE_TIME(fetch->entry->lastmod), (int) (STORE_TIME(fetch->entry->lastmod) - squid_curtime));
 }
 
 
 static int
-peerDigestSetCBlock(PeerDigest * pd, const char *buf)
+peerDigestSetCBlock(DigestFetchState * fetch, const char *buf)
 {
+    PeerDigest *pd = fetch->pd;
     StoreDigestCBlock cblock;
+    int blocked;
     int freed_size = 0;
     int rval = 0;
     const char *host;
@@ -767,6 +880,10 @@ peerDigestSetCBlock(PeerDigest * pd, const char *buf)
     cblock.count = ntohl(cblock.count);
     cblock.del_count = ntohl(cblock.del_count);
     cblock.mask_size = ntohl(cblock.mask_size);
+    cblock.generation = ntohl(cblock.generation);
+    cblock.base_generation = ntohl(cblock.base_generation);
+    cblock.delta_size = ntohl(cblock.delta_size);
+    blocked = (cblock.flags & CD_FLAG_BLOCKED) != 0;
     debugs(72, 2, "got digest cblock from %s; ver: %d (req: %d)",
 	host, (int) cblock.ver.current, (int) cblock.ver.required);
     debugs(72, 2, "\t size: %d bytes, e-cnt: %d, e-util: %d%%",
@@ -794,12 +911,30 @@ peerDigestSetCBlock(PeerDigest * pd, const char *buf)
 	goto finish;
     }
     /* check consistency further */
-    if (cblock.mask_size != cacheDigestCalcMaskSize(cblock.capacity, cblock.bits_per_entry)) {
+    if (cblock.mask_size != cacheDigestCalcMaskSizeBlocked(cblock.capacity, cblock.bits_per_entry, blocked)) {
 	debugs(72, 0, "%s digest cblock is corrupted (mask size mismatch: %d ? %d).",
-	    host, cblock.mask_size, (int) cacheDigestCalcMaskSize(cblock.capacity, cblock.bits_per_entry));
+	    host, cblock.mask_size, (int) cacheDigestCalcMaskSizeBlocked(cblock.capacity, cblock.bits_per_entry, blocked));
 	rval = 0;
 	goto finish;
     }
+    if (((cblock.flags & CD_FLAG_DELTA) != 0) != pd->flags.delta) {
+	debugs(72, 0, "%s digest cblock is corrupted (unexpected delta flag).", host);
+	rval = 0;
+	goto finish;
+    }
+    fetch->cblock = cblock;
+    if (pd->flags.delta) {
+	/* a delta must apply to exactly the mask we hold */
+	if (cblock.base_generation != pd->generation || cblock.mask_size != pd->cd->mask_size ||
+	    blocked != pd->cd->blocked || cblock.delta_size < 0 || cblock.delta_size > cblock.mask_size) {
+	    debugs(72, 2, "%s digest delta %d -> %d does not apply to generation %d",
+		host, cblock.base_generation, cblock.generation, pd->generation);
+	    rval = 0;
+	    goto finish;
+	}
+	rval = 1;
+	goto finish;
+    }
     /* there are some things we cannot do yet */
     if (cblock.hash_func_count != CacheDigestHashFuncCount) {
 	debugs(72, 0, "%s digest: unsupported #hash functions: %d ? %d.",
@@ -811,7 +946,7 @@ peerDigestSetCBlock(PeerDigest * pd, const char *buf)
      * no cblock bugs below this point
      */
     /* check size changes */
-    if (pd->cd && cblock.mask_size != pd->cd->mask_size) {
+    if (pd->cd && (cblock.mask_size != pd->cd->mask_size || blocked != pd->cd->blocked)) {
 	debugs(72, 2, "%s digest changed size: %d -> %d",
 	    host, cblock.mask_size, pd->cd->mask_size);
 	freed_size = pd->cd->mask_size;
@@ -821,7 +956,7 @@ peerDigestSetCBlock(PeerDigest * pd, const char *buf)
     if (!pd->cd) {
 	debugs(72, 2, "creating %s digest; size: %d (%+d) bytes",
 	    host, cblock.mask_size, (int) (cblock.mask_size - freed_size));
-	pd->cd = cacheDigestCreate(cblock.capacity, cblock.bits_per_entry);
+	pd->cd = cacheDigestCreateBlocked(cblock.capacity, cblock.bits_per_entry, blocked);
 	if (cblock.mask_size >= freed_size)
 	    kb_incr(&statCounter.cd.memory, cblock.mask_size - freed_size);
     }
@@ -829,6 +964,7 @@ peerDigestSetCBlock(PeerDigest * pd, const char *buf)
     /* these assignments leave us in an inconsistent state until we finish reading the digest */
     pd->cd->count = cblock.count;
     pd->cd->del_count = cblock.del_count;
+    pd->generation = 0;
     rval = 1;
 finish:
     safe_free(host);
@@ -895,6 +1031,10 @@ peerDigestStatsReport(const PeerDigest * pd, StoreEntry * e)
 	pd->stats.sent.msgs, (int) pd->stats.sent.kbytes.kb);
     storeAppendPrintf(e, "\treplies recv:  %d, volume: %d KB\n",
 	pd->stats.recv.msgs, (int) pd->stats.recv.kbytes.kb);
+    storeAppendPrintf(e, "\tdeltas recv:   %d, volume: %d KB%s\n",
+	pd->stats.delta.msgs, (int) pd->stats.delta.kbytes.kb,
+	pd->flags.no_delta ? " (peer has no deltas)" : "");
+    storeAppendPrintf(e, "\tgeneration: %d\n", pd->generation);
 
     storeAppendPrintf(e, "\npeer digest structure:\n");
     if (pd->cd)
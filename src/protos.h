@@ -515,6 +515,22 @@ extern void sslStart(clientHttpRequest *, squid_off_t *, int *);
 
 extern void statInit(void);
 extern void statFreeMemory(void);
+
+/* latency.c */
+extern void latencyInit(void);
+extern void latencyRecord(latency_phase_t phase, int usec);
+extern const char *latencyPhaseName(latency_phase_t phase);
+extern const HdrHist *latencyHist(latency_phase_t phase);
+
+/* metrics.c */
+extern void metricsInit(void);
+
+#if USE_SSL
+/* ssl_session_cache.c */
+extern void sslSessionCacheConfigure(void);
+extern SSL_SESSION *sslSessionCacheGet(const char *key);
+extern void sslSessionCacheStore(const char *key, SSL_SESSION * session);
+#endif
 extern double median_svc_get(int, int);
 extern int stat5minClientRequests(void);
 extern double stat5minCPUUsage(void);
@@ -552,6 +568,10 @@ extern void memReport(StoreEntry * e);
 extern StoreEntry *new_StoreEntry(int, const char *);
 extern void storeEntrySetStoreUrl(StoreEntry * e, const char *store_url);
 extern StoreEntry *storeGet(const cache_key *);
+extern StoreEntry *storeEntryById(sentryno);
+extern sentryno storeEntryId(const StoreEntry *);
+extern StoreEntry *storeHashBucket(int bucket);
+extern int storeEntryCount(void);
 extern StoreEntry *storeGetPublic(const char *uri, const method_t * method);
 extern StoreEntry *storeGetPublicByCode(const char *uri, const method_code_t code);
 extern StoreEntry *storeGetPublicByRequest(request_t * request);
@@ -566,6 +586,8 @@ extern void storeRequestFailed(StoreEntry *, ErrorState * err);
 extern void storeInit(void);
 extern void storeAbort(StoreEntry *);
 extern void storeAppend(StoreEntry *, const char *, int);
+extern int storeAppendReserve(StoreEntry *, struct iovec *, int, int);
+extern void storeAppendCommit(StoreEntry *, struct iovec *, int, int);
 extern void storeLockObjectDebug(StoreEntry *, const char *file, const int line);
 extern void storeRelease(StoreEntry *);
 extern void storePurgeEntriesByUrl(request_t * req, const char *url);
@@ -582,6 +604,7 @@ extern void storeFreeMemory(void);
 extern int expiresMoreThan(time_t, time_t);
 extern int storeEntryValidToSend(StoreEntry *);
 extern void storeTimestampsSet(StoreEntry *);
+extern store_time_t storeTimeOffset(time_t);
 extern void storeRegisterAbort(StoreEntry * e, STABH * cb, void *);
 extern void storeUnregisterAbort(StoreEntry * e);
 extern void storeMemObjectDump(MemObject * mem);
@@ -592,6 +615,7 @@ extern void storeCopyNotModifiedReplyHeaders(MemObject * O, MemObject * N);
 extern void storeBuffer(StoreEntry *);
 extern void storeBufferFlush(StoreEntry *);
 extern void storeHashInsert(StoreEntry * e, const cache_key *);
+extern size_t storeIndexBytes(void);
 extern void storeSetMemStatus(StoreEntry * e, int);
 #if STDC_HEADERS
 extern void
@@ -632,6 +656,7 @@ extern storeIOState *storeCreate(StoreEntry *, STFNCB *, STIOCB *, void *);
 extern storeIOState *storeOpen(StoreEntry *, STFNCB *, STIOCB *, void *);
 extern void storeClose(storeIOState *);
 extern void storeRead(storeIOState *, char *, size_t, squid_off_t, STRCB *, void *);
+extern int storeIOFd(storeIOState *);
 extern void storeWrite(storeIOState *, char *, size_t, FREE *);
 extern void storeUnlink(StoreEntry *);
 extern void storeRecycle(StoreEntry *);
@@ -740,6 +765,7 @@ extern void storeClientRef(store_client *, StoreEntry *, squid_off_t, squid_off_
 extern void storeClientCopyHeaders(store_client *, StoreEntry *, STHCB *, void *);
 extern int storeClientCopyPending(store_client *, StoreEntry * e, void *data);
 extern int storeClientUnregister(store_client * sc, StoreEntry * e, void *data);
+extern void storeClientSwapinFree(MemObject * mem);
 extern squid_off_t storeLowestMemReaderOffset(const StoreEntry * entry);
 extern void InvokeHandlers(StoreEntry * e);
 extern int storePendingNClients(const StoreEntry * e);
@@ -852,6 +878,8 @@ extern void htcpSocketClose(void);
 
 /* CacheDigest */
 extern CacheDigest *cacheDigestCreate(int capacity, int bpe);
+extern CacheDigest *cacheDigestCreateBlocked(int capacity, int bpe, int blocked);
+extern void cacheDigestEnableCounting(CacheDigest * cd);
 extern void cacheDigestDestroy(CacheDigest * cd);
 extern CacheDigest *cacheDigestClone(const CacheDigest * cd);
 extern void cacheDigestClear(CacheDigest * cd);
@@ -860,6 +888,7 @@ extern int cacheDigestTest(const CacheDigest * cd, const cache_key * key);
 extern void cacheDigestAdd(CacheDigest * cd, const cache_key * key);
 extern void cacheDigestDel(CacheDigest * cd, const cache_key * key);
 extern size_t cacheDigestCalcMaskSize(int cap, int bpe);
+extern size_t cacheDigestCalcMaskSizeBlocked(int cap, int bpe, int blocked);
 extern int cacheDigestBitUtil(const CacheDigest * cd);
 extern void cacheDigestGuessStatsUpdate(cd_guess_stats * stats, int real_hit, int guess_hit);
 extern void cacheDigestGuessStatsReport(const cd_guess_stats * stats, StoreEntry * sentry, const char *label);
@@ -895,7 +924,6 @@ extern void delayClearNoDelay(int fd);
 extern int delayIsNoDelay(int fd);
 extern delay_id delayClient(clientHttpRequest *);
 extern delay_id delayPoolClient(unsigned short pool, in_addr_t client);
-extern EVH delayPoolsUpdate;
 extern int delayBytesWanted(delay_id d, int min, int max);
 extern void delayBytesIn(delay_id, int qty);
 extern int delayMostBytesWanted(const MemObject * mem, int max);
@@ -1019,7 +1047,10 @@ extern void errorMapInit(void);
 extern int errorMapStart(const errormap * map, request_t * req, HttpReply * reply, const char *aclname, ERRMAPCB * callback, void *data);
 
 rewritetoken *rewriteURLCompile(const char *urlfmt);
+void rewriteURLFree(rewritetoken * head);
 char *internalRedirectProcessURL(clientHttpRequest * req, rewritetoken * head);
+extern int rewriteRulesApply(rewrite_rules * rules, clientHttpRequest * http, char **result);
+extern const char *rewriteRuleTypeStr(rewrite_rule_type type);
 
 /* New HTTP message parsing support */
 extern void HttpMsgBufInit(HttpMsgBuf * hmsg, const char *buf, size_t size);
@@ -46,6 +46,7 @@ typedef struct {
 
 static HLPCB redirectHandleReply;
 static void redirectStateFree(redirectStateData * r);
+static OBJH rewriteRulesStats;
 static helper *redirectors = NULL;
 static OBJH redirectStats;
 static int n_bypassed = 0;
@@ -152,6 +153,13 @@ void
 redirectInit(void)
 {
     static int init = 0;
+    static int rules_init = 0;
+    if (!rules_init) {
+	cachemgrRegister("url_rewrite_rules",
+	    "URL Rewrite Rule Stats",
+	    rewriteRulesStats, NULL, NULL, 0, 1, 0);
+	rules_init = 1;
+    }
     if (!Config.Program.url_rewrite.command)
 	return;
     if (redirectors == NULL)
@@ -234,7 +242,8 @@ static const char *const tokenNames[] =
     "RFT_URLHOST",
     "RFT_HDRHOST",
     "RFT_EXTERNALACL_TAG",
-    "RFT_EXTERNALACL_LOGSTR"
+    "RFT_EXTERNALACL_LOGSTR",
+    "RFT_SUBMATCH"
 };
 
 static const tokendesc *
@@ -315,7 +324,14 @@ rewriteURLCompile(const char *urlfmt)
 	    continue;
 	    break;
 	}
-	_new = newRedirectToken(&urlfmt, urlEncode);
+	if (xisdigit(*urlfmt)) {
+	    /* %0 .. %9: match group of an url_rewrite_rule */
+	    _new = newRedirectTokenStr(RFT_SUBMATCH, NULL, 0, urlEncode);
+	    _new->submatch = *urlfmt++ - '0';
+	} else if ((_new = newRedirectToken(&urlfmt, urlEncode)) == NULL) {
+	    rewriteURLFree(head);
+	    return NULL;
+	}
 	*tail = _new;
 	tail = &_new->next;
 	stt = urlfmt;
@@ -323,6 +339,18 @@ rewriteURLCompile(const char *urlfmt)
     return head;
 }
 
+void
+rewriteURLFree(rewritetoken * head)
+{
+    while (head) {
+	rewritetoken *t = head;
+	head = t->next;
+	if (t->type == RFT_STRING)
+	    safe_free(t->str);
+	xfree(t);
+    }
+}
+
 static char *
 xreacat(char *str, size_t * len,
     const char *append, size_t applen)
@@ -351,8 +379,14 @@ xreacatUL(char *str, size_t * len, unsigned long x)
 }
 #endif
 
-char *
-internalRedirectProcessURL(clientHttpRequest * req, rewritetoken * head)
+/*
+ * Expand a compiled template.  subject and m describe the regex (or
+ * prefix / host) match of an url_rewrite_rule and are only used by
+ * %0 .. %9 tokens.
+ */
+static char *
+rewriteExpand(clientHttpRequest * req, rewritetoken * head,
+    const char *subject, const regmatch_t * m, int nmatch)
 {
     char *dev = NULL;
     size_t len = 0;
@@ -445,6 +479,20 @@ internalRedirectProcessURL(clientHttpRequest * req, rewritetoken * head)
 	    str = stringDupToC(&req->request->extacl_log);
 	    do_free = 1;
 	    break;
+	case RFT_SUBMATCH:
+	    /* an empty or unset group expands to nothing, not "-" */
+	    if (subject && head->submatch < nmatch && m[head->submatch].rm_so >= 0) {
+		str = subject + m[head->submatch].rm_so;
+		str_len = m[head->submatch].rm_eo - m[head->submatch].rm_so;
+		if (str_len > 0 && head->urlEncode) {
+		    char *t = xstrndup(str, str_len + 1);
+		    str = rfc1738_escape_part(t);
+		    dev = xreacat(dev, &len, str, strlen(str));
+		    xfree(t);
+		} else if (str_len > 0)
+		    dev = xreacat(dev, &len, str, str_len);
+	    }
+	    continue;
 	default:
 	    assert(0 && "Invalid rewrite token type");
 	    break;
@@ -476,3 +524,147 @@ internalRedirectProcessURL(clientHttpRequest * req, rewritetoken * head)
     debugs(85, 5, "internalRedirectProcessURL: done: %s", dev);
     return dev;
 }
+
+char *
+internalRedirectProcessURL(clientHttpRequest * req, rewritetoken * head)
+{
+    return rewriteExpand(req, head, NULL, NULL, 0);
+}
+
+/*
+ * In-process rewrite rules (url_rewrite_rule, storeurl_rewrite_rule)
+ *
+ * Rules are compiled when the configuration is parsed.  Host rules live
+ * in a hash keyed by the request host, prefix and regex rules in an
+ * ordered list; a lookup merges the two by configuration index so the
+ * first matching rule wins just as if all rules were scanned in order.
+ */
+#define REWRITE_NMATCH 10
+
+static const char *const RewriteRuleTypeStr[] =
+{
+    "host",
+    "prefix",
+    "regex"
+};
+
+const char *
+rewriteRuleTypeStr(rewrite_rule_type type)
+{
+    return RewriteRuleTypeStr[type];
+}
+
+static int
+rewriteRuleMatch(rewrite_rule * rule, clientHttpRequest * http, aclCheck_t ** ch, regmatch_t * m)
+{
+    const char *uri = http->uri;
+    const char *p;
+    int i;
+    switch (rule->type) {
+    case REWRITE_RULE_HOST:
+	/* the host has already been matched; %1 is everything after it */
+	m[0].rm_so = 0;
+	m[0].rm_eo = strlen(uri);
+	if ((p = strstr(uri, "://")) != NULL && (p = strchr(p + 3, '/')) != NULL)
+	    m[1].rm_so = p - uri;
+	else
+	    m[1].rm_so = m[0].rm_eo;
+	m[1].rm_eo = m[0].rm_eo;
+	for (i = 2; i < REWRITE_NMATCH; i++)
+	    m[i].rm_so = m[i].rm_eo = -1;
+	break;
+    case REWRITE_RULE_PREFIX:
+	if (rule->icase ? strncasecmp(uri, rule->pattern, rule->pattern_len) :
+	    strncmp(uri, rule->pattern, rule->pattern_len))
+	    return 0;
+	m[0].rm_so = 0;
+	m[0].rm_eo = strlen(uri);
+	m[1].rm_so = rule->pattern_len;
+	m[1].rm_eo = m[0].rm_eo;
+	for (i = 2; i < REWRITE_NMATCH; i++)
+	    m[i].rm_so = m[i].rm_eo = -1;
+	break;
+    case REWRITE_RULE_REGEX:
+	if (regexec(&rule->regex, uri, REWRITE_NMATCH, m, 0) != 0)
+	    return 0;
+	break;
+    }
+    if (rule->aclList) {
+	if (*ch == NULL)
+	    *ch = clientAclChecklistCreate(NULL, http);
+	if (!aclMatchAclList(rule->aclList, *ch))
+	    return 0;
+    }
+    return 1;
+}
+
+/*
+ * Find the first rule matching http and expand its template into
+ * *result (xmalloc()ed, NULL for a "-" rule).  Returns 0 when no rule
+ * matched and the request should go on to the helper, if any.
+ */
+int
+rewriteRulesApply(rewrite_rules * rules, clientHttpRequest * http, char **result)
+{
+    rewrite_rule *hrule = NULL;
+    rewrite_rule *rule;
+    rewrite_rule *found = NULL;
+    regmatch_t m[REWRITE_NMATCH];
+    aclCheck_t *ch = NULL;
+
+    *result = NULL;
+    if (rules == NULL)
+	return 0;
+    rules->lookups++;
+    if (rules->hosts && *http->request->host)
+	hrule = hash_lookup(rules->hosts, http->request->host);
+    rule = rules->match;
+    while (found == NULL && (hrule || rule)) {
+	rewrite_rule *r;
+	if (hrule && (rule == NULL || hrule->index < rule->index)) {
+	    r = hrule;
+	    hrule = hrule->host_next;
+	} else {
+	    r = rule;
+	    rule = rule->match_next;
+	}
+	if (rewriteRuleMatch(r, http, &ch, m))
+	    found = r;
+    }
+    if (ch)
+	aclChecklistFree(ch);
+    if (found == NULL) {
+	rules->misses++;
+	return 0;
+    }
+    found->hits++;
+    if (found->tokens)
+	*result = rewriteExpand(http, found->tokens, http->uri, m, REWRITE_NMATCH);
+    debugs(85, 3, "rewriteRulesApply: '%s' matched %s %s => %s", http->uri,
+	RewriteRuleTypeStr[found->type], found->pattern, *result ? *result : "-");
+    return 1;
+}
+
+static void
+rewriteRulesDump(StoreEntry * sentry, const char *name, rewrite_rules * rules)
+{
+    rewrite_rule *rule;
+    if (rules == NULL)
+	return;
+    storeAppendPrintf(sentry, "\n%s: %d rules, %d lookups, %d misses\n",
+	name, rules->count, rules->lookups, rules->misses);
+    storeAppendPrintf(sentry, "%4s %-6s %10s %s\n", "#", "type", "hits", "rule");
+    for (rule = rules->head; rule; rule = rule->next)
+	storeAppendPrintf(sentry, "%4d %-6s %10d %s%s %s\n",
+	    rule->index, RewriteRuleTypeStr[rule->type], rule->hits,
+	    rule->icase ? "-i " : "", rule->pattern,
+	    rule->dsturl ? rule->dsturl : "-");
+}
+
+static void
+rewriteRulesStats(StoreEntry * sentry, void *data)
+{
+    storeAppendPrintf(sentry, "Internal URL Rewrite Rules:\n");
+    rewriteRulesDump(sentry, "url_rewrite_rule", Config.urlRewriteRules);
+    rewriteRulesDump(sentry, "storeurl_rewrite_rule", Config.storeurlRewriteRules);
+}
@@ -174,16 +174,16 @@ refreshStaleness(const StoreEntry * entry, time_t check_time, time_t age, const
     /*
      * Check for an explicit expiration time.
      */
-    if (entry->expires > -1) {
+    if (STORE_TIME(entry->expires) > -1) {
 	sf->expires = 1;
-	if (entry->expires > check_time) {
+	if (STORE_TIME(entry->expires) > check_time) {
 	    debugs(22, 3, "FRESH: expires %d >= check_time %d ",
-		(int) entry->expires, (int) check_time);
+		(int) STORE_TIME(entry->expires), (int) check_time);
 	    return -1;
 	} else {
 	    debugs(22, 3, "STALE: expires %d < check_time %d ",
-		(int) entry->expires, (int) check_time);
-	    return (check_time - entry->expires);
+		(int) STORE_TIME(entry->expires), (int) check_time);
+	    return (check_time - STORE_TIME(entry->expires));
 	}
     }
     assert(age >= 0);
@@ -196,22 +196,22 @@ refreshStaleness(const StoreEntry * entry, time_t check_time, time_t age, const
 	sf->max = 1;
 	return (age - R->max);
     }
-    if (check_time < entry->timestamp) {
+    if (check_time < STORE_TIME(entry->timestamp)) {
 	debugs(22, 1, "STALE: Entry's timestamp greater than check time. Clock going backwards?");
 	debugs(22, 1, "\tcheck_time:\t%s", mkrfc1123(check_time));
-	debugs(22, 1, "\tentry->timestamp:\t%s", mkrfc1123(entry->timestamp));
-	debugs(22, 1, "\tstaleness:\t%ld", (long int) entry->timestamp - check_time);
-	return (entry->timestamp - check_time);
+	debugs(22, 1, "\tentry->timestamp:\t%s", mkrfc1123(STORE_TIME(entry->timestamp)));
+	debugs(22, 1, "\tstaleness:\t%ld", (long int) STORE_TIME(entry->timestamp) - check_time);
+	return (STORE_TIME(entry->timestamp) - check_time);
     }
     /*
      * Try the last-modified factor algorithm.
      */
-    if (entry->lastmod > -1 && entry->timestamp > entry->lastmod) {
+    if (STORE_TIME(entry->lastmod) > -1 && STORE_TIME(entry->timestamp) > STORE_TIME(entry->lastmod)) {
 	/*
 	 * stale_age is the Age of the response when it became/becomes
 	 * stale according to the last-modified factor algorithm.
 	 */
-	time_t stale_age = (entry->timestamp - entry->lastmod) * R->pct;
+	time_t stale_age = (STORE_TIME(entry->timestamp) - STORE_TIME(entry->lastmod)) * R->pct;
 	sf->lmfactor = 1;
 	if (age >= stale_age) {
 	    debugs(22, 3, "STALE: age %d > stale_age %d",
@@ -259,8 +259,8 @@ refreshCheck(const StoreEntry * entry, request_t * request, time_t delta)
 
     if (delta > 0)
 	check_time += delta;
-    if (check_time > entry->timestamp)
-	age = check_time - entry->timestamp;
+    if (check_time > STORE_TIME(entry->timestamp))
+	age = check_time - STORE_TIME(entry->timestamp);
     R = uri ? refreshLimits(uri) : refreshUncompiledPattern(".");
     if (NULL == R)
 	R = &DefaultRefresh;
@@ -272,7 +272,7 @@ refreshCheck(const StoreEntry * entry, request_t * request, time_t delta)
 	R->pattern, (int) R->min, (int) (100.0 * R->pct), (int) R->max);
     debugs(22, 3, "refreshCheck: age = %d", (int) age);
     debugs(22, 3, "\tcheck_time:\t%s", mkrfc1123(check_time));
-    debugs(22, 3, "\tentry->timestamp:\t%s", mkrfc1123(entry->timestamp));
+    debugs(22, 3, "\tentry->timestamp:\t%s", mkrfc1123(STORE_TIME(entry->timestamp)));
 
     if (EBIT_TEST(entry->flags, ENTRY_REVALIDATE) && staleness > -1
 #if HTTP_VIOLATIONS
@@ -396,7 +396,7 @@ refreshIsCachable(const StoreEntry * entry)
     if (reason < 200)
 	/* Does not need refresh. This is certainly cachable */
 	return 1;
-    if (entry->lastmod > 0)
+    if (STORE_TIME(entry->lastmod) > 0)
 	can_revalidate = 1;
     if (entry->mem_obj && entry->mem_obj->reply) {
 	if (httpHeaderHas(&entry->mem_obj->reply->header, HDR_ETAG))
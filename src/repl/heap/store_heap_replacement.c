@@ -71,15 +71,15 @@ HeapKeyGen_StoreEntry_LFUDA(void *entry, double age)
     StoreEntry *e = entry;
     heap_key key;
     double tie;
-    if (e->lastref <= 0)
+    if (STORE_TIME(e->lastref) <= 0)
 	tie = 0.0;
-    else if (squid_curtime <= e->lastref)
+    else if (squid_curtime <= STORE_TIME(e->lastref))
 	tie = 0.0;
     else
-	tie = 1.0 - exp((double) (e->lastref - squid_curtime) / 86400.0);
+	tie = 1.0 - exp((double) (STORE_TIME(e->lastref) - squid_curtime) / 86400.0);
     key = age + (double) e->refcount - tie;
     debugs(81, 3, "HeapKeyGen_StoreEntry_LFUDA: %s refcnt=%d lastref=%ld age=%f tie=%f -> %f",
-	storeKeyText(e->hash.key), (int) e->refcount, (long int) e->lastref, age, tie, key);
+	storeKeyText(storeEntryKey(e)), (int) e->refcount, (long int) STORE_TIME(e->lastref), age, tie, key);
     if (e->mem_obj && e->mem_obj->url)
 	debugs(81, 3, "HeapKeyGen_StoreEntry_LFUDA: url=%s",
 	    e->mem_obj->url);
@@ -112,10 +112,10 @@ HeapKeyGen_StoreEntry_GDSF(void *entry, double age)
     StoreEntry *e = entry;
     heap_key key;
     double size = e->swap_file_sz ? (double) e->swap_file_sz : 1.0;
-    double tie = (e->lastref > 1) ? (1.0 / e->lastref) : 1.0;
+    double tie = (STORE_TIME(e->lastref) > 1) ? (1.0 / STORE_TIME(e->lastref)) : 1.0;
     key = age + ((double) e->refcount / size) - tie;
     debugs(81, 3, "HeapKeyGen_StoreEntry_GDSF: %s size=%f refcnt=%d lastref=%ld age=%f tie=%f -> %f",
-	storeKeyText(e->hash.key), size, (int) e->refcount, (long int) e->lastref, age, tie, key);
+	storeKeyText(storeEntryKey(e)), size, (int) e->refcount, (long int) STORE_TIME(e->lastref), age, tie, key);
     if (e->mem_obj && e->mem_obj->url)
 	debugs(81, 3, "HeapKeyGen_StoreEntry_GDSF: url=%s",
 	    e->mem_obj->url);
@@ -134,9 +134,9 @@ HeapKeyGen_StoreEntry_LRU(void *entry, double age)
 {
     StoreEntry *e = entry;
     debugs(81, 3, "HeapKeyGen_StoreEntry_LRU: %s age=%f lastref=%f",
-	storeKeyText(e->hash.key), age, (double) e->lastref);
+	storeKeyText(storeEntryKey(e)), age, (double) STORE_TIME(e->lastref));
     if (e->mem_obj && e->mem_obj->url)
 	debugs(81, 3, "HeapKeyGen_StoreEntry_LRU: url=%s",
 	    e->mem_obj->url);
-    return (heap_key) e->lastref;
+    return (heap_key) STORE_TIME(e->lastref);
 }
@@ -248,6 +248,13 @@ heap_purgeInit(RemovalPolicy * policy, int max_scan)
     return walker;
 }
 
+static size_t
+heap_memoryUsed(RemovalPolicy * policy)
+{
+    HeapPolicyData *heap = policy->_data;
+    return heap->count * sizeof(heap_node) + heap->heap->size * sizeof(heap_node *);
+}
+
 static void
 heap_free(RemovalPolicy * policy)
 {
@@ -306,6 +313,7 @@ createRemovalPolicy_heap(wordlist * args)
     policy->Dereferenced = heap_referenced;
     policy->WalkInit = heap_walkInit;
     policy->PurgeInit = heap_purgeInit;
+    policy->MemoryUsed = heap_memoryUsed;
     /* Increase policy usage count */
     nr_heap_policies += 0;
     return policy;
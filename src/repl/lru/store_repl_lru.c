@@ -40,7 +40,8 @@ REMOVALPOLICYCREATE createRemovalPolicy_lru;
 typedef struct _LruPolicyData LruPolicyData;
 struct _LruPolicyData {
     RemovalPolicy *policy;
-    dlink_list list;
+    sentryno head;
+    sentryno tail;
     int count;
     int nwalkers;
     enum heap_entry_type {
@@ -61,55 +62,76 @@ repl_guessType(StoreEntry * entry, RemovalPolicyNode * node)
     fatal("Heap Replacement: Unknown StoreEntry node type");
     return TYPE_UNKNOWN;
 }
-#define SET_POLICY_NODE(entry,value) \
-    switch(lru->type) { \
-    case TYPE_STORE_ENTRY: entry->repl.data = value; break ; \
-    case TYPE_STORE_MEM: entry->mem_obj->repl.data = value ; break ; \
-    default: break; \
-    }
 
-typedef struct _LruNode LruNode;
-struct _LruNode {
-    /* Note: the dlink_node MUST be the first member of the LruNode
-     * structure. This member is later pointer typecasted to LruNode *.
-     */
-    dlink_node node;
-};
+/*
+ * The list is threaded through the entries themselves: each
+ * RemovalPolicyNode holds the sentryno of its neighbours, so there is
+ * nothing to allocate per entry.
+ */
+static RemovalPolicyNode *
+lru_node(LruPolicyData * lru, const StoreEntry * entry)
+{
+    if (lru->type == TYPE_STORE_MEM)
+	return &entry->mem_obj->repl;
+    return (RemovalPolicyNode *) & entry->repl;
+}
+
+static int
+lru_linked(LruPolicyData * lru, sentryno id, RemovalPolicyNode * node)
+{
+    return node->link.prev != 0 || lru->head == id;
+}
+
+static void
+lru_link(LruPolicyData * lru, sentryno id, RemovalPolicyNode * node)
+{
+    node->link.prev = lru->tail;
+    node->link.next = 0;
+    if (lru->tail)
+	lru_node(lru, storeEntryById(lru->tail))->link.next = id;
+    else
+	lru->head = id;
+    lru->tail = id;
+}
+
+static void
+lru_unlink(LruPolicyData * lru, RemovalPolicyNode * node)
+{
+    if (node->link.prev)
+	lru_node(lru, storeEntryById(node->link.prev))->link.next = node->link.next;
+    else
+	lru->head = node->link.next;
+    if (node->link.next)
+	lru_node(lru, storeEntryById(node->link.next))->link.prev = node->link.prev;
+    else
+	lru->tail = node->link.prev;
+    node->link.prev = node->link.next = 0;
+}
 
-static MemPool *lru_node_pool = NULL;
 static int nr_lru_policies = 0;
 
 static void
 lru_add(RemovalPolicy * policy, StoreEntry * entry, RemovalPolicyNode * node)
 {
     LruPolicyData *lru = policy->_data;
-    LruNode *lru_node;
-    assert(!node->data);
-    node->data = lru_node = memPoolAlloc(lru_node_pool);
-    dlinkAddTail(entry, &lru_node->node, &lru->list);
-    lru->count += 1;
     if (!lru->type)
 	lru->type = repl_guessType(entry, node);
+    assert(!lru_linked(lru, storeEntryId(entry), node));
+    lru_link(lru, storeEntryId(entry), node);
+    lru->count += 1;
 }
 
 static void
 lru_remove(RemovalPolicy * policy, StoreEntry * entry, RemovalPolicyNode * node)
 {
     LruPolicyData *lru = policy->_data;
-    LruNode *lru_node = node->data;
-    if (!lru_node)
-	return;
     /*
      * It seems to be possible for an entry to exist in the hash
-     * but not be in the LRU list, so check for that case rather
-     * than suffer a NULL pointer access.
+     * but not be in the LRU list, so check for that case.
      */
-    if (NULL == lru_node->node.data)
+    if (!lru->type || !lru_linked(lru, storeEntryId(entry), node))
 	return;
-    assert(lru_node->node.data == entry);
-    node->data = NULL;
-    dlinkDelete(&lru_node->node, &lru->list);
-    memPoolFree(lru_node_pool, lru_node);
+    lru_unlink(lru, node);
     lru->count -= 1;
 }
 
@@ -118,29 +140,30 @@ lru_referenced(RemovalPolicy * policy, const StoreEntry * entry,
     RemovalPolicyNode * node)
 {
     LruPolicyData *lru = policy->_data;
-    LruNode *lru_node = node->data;
-    if (!lru_node)
+    sentryno id = storeEntryId(entry);
+    if (!lru->type || !lru_linked(lru, id, node))
 	return;
-    dlinkDelete(&lru_node->node, &lru->list);
-    dlinkAddTail((void *) entry, &lru_node->node, &lru->list);
+    lru_unlink(lru, node);
+    lru_link(lru, id, node);
 }
 
 /** RemovalPolicyWalker **/
 
 typedef struct _LruWalkData LruWalkData;
 struct _LruWalkData {
-    LruNode *current;
+    sentryno current;
 };
 
 static const StoreEntry *
 lru_walkNext(RemovalPolicyWalker * walker)
 {
     LruWalkData *lru_walk = walker->_data;
-    LruNode *lru_node = lru_walk->current;
-    if (!lru_node)
+    LruPolicyData *lru = walker->_policy->_data;
+    StoreEntry *entry = storeEntryById(lru_walk->current);
+    if (!entry)
 	return NULL;
-    lru_walk->current = (LruNode *) lru_node->node.next;
-    return (StoreEntry *) lru_node->node.data;
+    lru_walk->current = lru_node(lru, entry)->link.next;
+    return entry;
 }
 
 static void
@@ -169,7 +192,7 @@ lru_walkInit(RemovalPolicy * policy)
     walker->_data = lru_walk;
     walker->Next = lru_walkNext;
     walker->Done = lru_walkDone;
-    lru_walk->current = (LruNode *) lru->list.head;
+    lru_walk->current = lru->head;
     return walker;
 }
 
@@ -177,8 +200,8 @@ lru_walkInit(RemovalPolicy * policy)
 
 typedef struct _LruPurgeData LruPurgeData;
 struct _LruPurgeData {
-    LruNode *current;
-    LruNode *start;
+    sentryno current;
+    sentryno start;
 };
 
 static StoreEntry *
@@ -187,29 +210,29 @@ lru_purgeNext(RemovalPurgeWalker * walker)
     LruPurgeData *lru_walker = walker->_data;
     RemovalPolicy *policy = walker->_policy;
     LruPolicyData *lru = policy->_data;
-    LruNode *lru_node;
+    RemovalPolicyNode *node;
     StoreEntry *entry;
+    sentryno id;
   try_again:
-    lru_node = lru_walker->current;
-    if (!lru_node || walker->scanned >= walker->max_scan)
+    id = lru_walker->current;
+    if (!id || walker->scanned >= walker->max_scan)
 	return NULL;
     walker->scanned += 1;
-    lru_walker->current = (LruNode *) lru_node->node.next;
+    entry = storeEntryById(id);
+    node = lru_node(lru, entry);
+    lru_walker->current = node->link.next;
     if (lru_walker->current == lru_walker->start) {
 	/* Last node found */
-	lru_walker->current = NULL;
+	lru_walker->current = 0;
     }
-    entry = (StoreEntry *) lru_node->node.data;
-    dlinkDelete(&lru_node->node, &lru->list);
+    lru_unlink(lru, node);
     if (storeEntryLocked(entry)) {
 	/* Shit, it is locked. we can't return this one */
 	walker->locked++;
-	dlinkAddTail(entry, &lru_node->node, &lru->list);
+	lru_link(lru, id, node);
 	goto try_again;
     }
-    memPoolFree(lru_node_pool, lru_node);
     lru->count -= 1;
-    SET_POLICY_NODE(entry, NULL);
     return entry;
 }
 
@@ -240,7 +263,7 @@ lru_purgeInit(RemovalPolicy * policy, int max_scan)
     walker->max_scan = max_scan;
     walker->Next = lru_purgeNext;
     walker->Done = lru_purgeDone;
-    lru_walk->start = lru_walk->current = (LruNode *) lru->list.head;
+    lru_walk->start = lru_walk->current = lru->head;
     return walker;
 }
 
@@ -248,17 +271,19 @@ static void
 lru_stats(RemovalPolicy * policy, StoreEntry * sentry)
 {
     LruPolicyData *lru = policy->_data;
-    LruNode *lru_node = (LruNode *) lru->list.head;
+    StoreEntry *entry = storeEntryById(lru->head);
 
-  again:
-    if (lru_node) {
-	StoreEntry *entry = (StoreEntry *) lru_node->node.data;
-	if (storeEntryLocked(entry)) {
-	    lru_node = (LruNode *) lru_node->node.next;
-	    goto again;
-	}
-	storeAppendPrintf(sentry, "LRU reference age: %.2f days\n", (double) (squid_curtime - entry->lastref) / (double) (24 * 60 * 60));
-    }
+    while (entry && storeEntryLocked(entry))
+	entry = storeEntryById(lru_node(lru, entry)->link.next);
+    if (entry)
+	storeAppendPrintf(sentry, "LRU reference age: %.2f days\n", (double) (squid_curtime - STORE_TIME(entry->lastref)) / (double) (24 * 60 * 60));
+}
+
+static size_t
+lru_memoryUsed(RemovalPolicy * policy)
+{
+    /* the list links live in the entries */
+    return 0;
 }
 
 static void
@@ -282,9 +307,6 @@ createRemovalPolicy_lru(wordlist * args)
     LruPolicyData *lru_data;
     /* no arguments expected or understood */
     assert(!args);
-    /* Initialize */
-    if (!lru_node_pool)
-	lru_node_pool = memPoolCreate("LRU policy node", sizeof(LruNode));
     /* Allocate the needed structures */
     lru_data = xcalloc(1, sizeof(*lru_data));
     CBDATA_INIT_TYPE(RemovalPolicy);
@@ -302,6 +324,7 @@ createRemovalPolicy_lru(wordlist * args)
     policy->WalkInit = lru_walkInit;
     policy->PurgeInit = lru_purgeInit;
     policy->Stats = lru_stats;
+    policy->MemoryUsed = lru_memoryUsed;
     /* Increase policy usage count */
     nr_lru_policies += 0;
     return policy;
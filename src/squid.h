@@ -179,6 +179,9 @@
 #if HAVE_SYS_SOCKET_H
 #include <sys/socket.h>
 #endif
+#ifndef _SQUID_MSWIN_
+#include <sys/uio.h>
+#endif
 #if HAVE_NETINET_IN_H
 #include <netinet/in.h>
 #endif
@@ -384,6 +387,7 @@ struct rusage {
 #include "../libcb/cbdata.h"
 
 #include "../libstat/StatHist.h"
+#include "../libstat/HdrHist.h"
 
 #include "../libsqinet/inet_legacy.h"
 #include "../libsqinet/sqinet.h"
@@ -456,6 +460,7 @@ struct rusage {
 #include "../libsqurl/proto.h"
 
 #include "../libmutiprocess/multiprocess.h"
+#include "../libmutiprocess/shm.h"
 
 #include "defines.h"
 #include "enums.h"
@@ -545,7 +550,6 @@ extern MemPool * pool_http_hdr_range_spec;
 extern MemPool * pool_http_hdr_range;
 extern MemPool * pool_http_hdr_cont_range;
 extern MemPool * pool_mem_node;
-extern MemPool * pool_storeentry;
 extern MemPool * pool_memobject;
 extern MemPool * pool_swap_tlv;
 extern MemPool * pool_swap_log_data;
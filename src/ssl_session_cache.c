@@ -0,0 +1,469 @@
+
+/*
+ * DEBUG: section 83    SSL accelerator support
+ *
+ * SQUID Web Proxy Cache          http://www.squid-cache.org/
+ * ----------------------------------------------------------
+ *
+ *  Squid is the result of efforts by numerous individuals from
+ *  the Internet community; see the CONTRIBUTORS file for full
+ *  details.   Many organizations have provided support for Squid's
+ *  development; see the SPONSORS file for full details.  Squid is
+ *  Copyrighted (C) 2001 by the Regents of the University of
+ *  California; see the COPYRIGHT file for full details.  Squid
+ *  incorporates software developed and/or copyrighted by other
+ *  sources; see the CREDITS file for full details.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111, USA.
+ *
+ */
+
+/*
+ * SSL session cache shared by all workers.
+ *
+ * Sessions are kept DER encoded in fixed size slots, grouped in sets
+ * of SSL_SESSION_WAYS with a spinlock each; a key hashes to one set
+ * and replaces the oldest entry there when the set is full.  With SMP
+ * the store is a shared segment so a client resuming on another worker
+ * still skips the full handshake; without it the store is private.
+ *
+ * https_port contexts use it as their external OpenSSL session cache.
+ * Outgoing connections to peers and origin servers look sessions up by
+ * "host:port", so anything which has a key for a connection (bumped
+ * connections included) can resume through sslSessionCacheGet().
+ *
+ * Session ticket keys live in the same segment.  The coordinator (or
+ * the only process) rotates them every ssl_ticket_key_rotate_period and
+ * keeps the previous key around so tickets issued just before a
+ * rotation are still accepted, and renewed.
+ */
+
+#include "squid.h"
+
+#if USE_SSL
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#define SSL_SESSION_WAYS	4
+#define SSL_SESSION_SLOT	2048
+
+typedef struct {
+    unsigned int hash;
+    unsigned short key_len;	/* 0 when the slot is free */
+    unsigned short der_len;
+    time_t expires;
+    unsigned char data[SSL_SESSION_SLOT - 16];	/* key, then DER session */
+} SslSessionSlot;
+
+typedef struct {
+    ShmLock lock;
+    SslSessionSlot slot[SSL_SESSION_WAYS];
+} SslSessionSet;
+
+typedef struct {
+    unsigned char name[16];
+    unsigned char aes_key[16];
+    unsigned char hmac_key[16];
+    time_t created;
+} SslTicketKey;
+
+typedef struct {
+    ShmLock ticket_lock;	/* a torn key is still random, no repair needed */
+    SslTicketKey ticket[2];	/* current, previous */
+    int nsets;
+} SslSessionStoreHdr;
+
+#define SSL_SESSION_SETS(h)	((SslSessionSet *) ((h) + 1))
+
+static ShmSegment ssl_session_shm;
+static SslSessionStoreHdr *ssl_session_store = NULL;
+
+typedef struct {
+    int lookups;
+    int hits;
+    int stores;
+    int too_big;
+} SslSessionCounters;
+
+/* cache manager action data, summed over the kids */
+typedef struct {
+    SslSessionCounters total;
+    SslSessionCounters kid[MAX_KID_SUPPORT + 1];	/* indexed by KidIdentifier */
+} SslSessionActionData;
+
+static SslSessionCounters ssl_session_stats;
+
+static OBJH sslSessionCacheStats;
+static COL sslSessionCacheCollect;
+static ADD sslSessionCacheAdd;
+
+static unsigned int
+sslSessionHash(const unsigned char *key, int len)
+{
+    unsigned int h = 2166136261U;
+    while (len-- > 0)
+	h = (h ^ *key++) * 16777619U;
+    return h;
+}
+
+/* a set left locked by a dead kid may be half written; drop its sessions */
+static void
+sslSessionSetLock(SslSessionSet * set)
+{
+    if (shmLockAcquire(&set->lock))
+	memset(set->slot, 0, sizeof(set->slot));
+}
+
+static SslSessionSlot *
+sslSessionFind(SslSessionSet * set, unsigned int hash, const unsigned char *key, int len)
+{
+    int i;
+    for (i = 0; i < SSL_SESSION_WAYS; i++) {
+	SslSessionSlot *s = &set->slot[i];
+	if (s->key_len == len && s->hash == hash && memcmp(s->data, key, len) == 0)
+	    return s;
+    }
+    return NULL;
+}
+
+static void
+sslSessionPut(const unsigned char *key, int len, SSL_SESSION * session)
+{
+    unsigned int hash = sslSessionHash(key, len);
+    SslSessionSet *set = &SSL_SESSION_SETS(ssl_session_store)[hash % ssl_session_store->nsets];
+    SslSessionSlot *s;
+    unsigned char *p;
+    int der_len = i2d_SSL_SESSION(session, NULL);
+    int i;
+
+    if (der_len <= 0 || len + der_len > sizeof(s->data)) {
+	ssl_session_stats.too_big++;
+	return;
+    }
+    sslSessionSetLock(set);
+    s = sslSessionFind(set, hash, key, len);
+    for (i = 0; !s && i < SSL_SESSION_WAYS; i++) {
+	if (set->slot[i].key_len == 0 || set->slot[i].expires <= squid_curtime)
+	    s = &set->slot[i];
+    }
+    if (!s) {
+	s = &set->slot[0];
+	for (i = 1; i < SSL_SESSION_WAYS; i++)
+	    if (set->slot[i].expires < s->expires)
+		s = &set->slot[i];
+    }
+    s->hash = hash;
+    s->key_len = len;
+    s->der_len = der_len;
+    s->expires = SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session);
+    memcpy(s->data, key, len);
+    p = s->data + len;
+    i2d_SSL_SESSION(session, &p);
+    shmLockRelease(&set->lock);
+    ssl_session_stats.stores++;
+}
+
+static SSL_SESSION *
+sslSessionLookup(const unsigned char *key, int len)
+{
+    unsigned char der[SSL_SESSION_SLOT];
+    const unsigned char *p = der;
+    unsigned int hash = sslSessionHash(key, len);
+    SslSessionSet *set = &SSL_SESSION_SETS(ssl_session_store)[hash % ssl_session_store->nsets];
+    SslSessionSlot *s;
+    SSL_SESSION *session;
+    int der_len = 0;
+
+    ssl_session_stats.lookups++;
+    sslSessionSetLock(set);
+    s = sslSessionFind(set, hash, key, len);
+    if (s && s->expires > squid_curtime) {
+	der_len = s->der_len;
+	memcpy(der, s->data + s->key_len, der_len);
+    }
+    shmLockRelease(&set->lock);
+    if (der_len == 0)
+	return NULL;
+    if ((session = d2i_SSL_SESSION(NULL, &p, der_len)) != NULL)
+	ssl_session_stats.hits++;
+    return session;
+}
+
+static void
+sslSessionDelete(const unsigned char *key, int len)
+{
+    unsigned int hash = sslSessionHash(key, len);
+    SslSessionSet *set = &SSL_SESSION_SETS(ssl_session_store)[hash % ssl_session_store->nsets];
+    SslSessionSlot *s;
+
+    sslSessionSetLock(set);
+    if ((s = sslSessionFind(set, hash, key, len)) != NULL)
+	s->key_len = 0;
+    shmLockRelease(&set->lock);
+}
+
+/* server side keys are the session id, prefixed so they never clash with host:port keys */
+static int
+sslSessionServerKey(unsigned char *key, const unsigned char *id, unsigned int id_len)
+{
+    if (id_len > SSL_MAX_SSL_SESSION_ID_LENGTH)
+	id_len = SSL_MAX_SSL_SESSION_ID_LENGTH;
+    key[0] = '\0';
+    memcpy(key + 1, id, id_len);
+    return id_len + 1;
+}
+
+static int
+sslSessionNewCb(SSL * ssl, SSL_SESSION * session)
+{
+    unsigned char key[SSL_MAX_SSL_SESSION_ID_LENGTH + 1];
+    unsigned int id_len;
+    const unsigned char *id = SSL_SESSION_get_id(session, &id_len);
+    sslSessionPut(key, sslSessionServerKey(key, id, id_len), session);
+    return 0;			/* we did not keep a reference */
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+static SSL_SESSION *
+sslSessionGetCb(SSL * ssl, const unsigned char *id, int id_len, int *copy)
+#else
+static SSL_SESSION *
+sslSessionGetCb(SSL * ssl, unsigned char *id, int id_len, int *copy)
+#endif
+{
+    unsigned char key[SSL_MAX_SSL_SESSION_ID_LENGTH + 1];
+    *copy = 0;
+    return sslSessionLookup(key, sslSessionServerKey(key, id, id_len));
+}
+
+static void
+sslSessionRemoveCb(SSL_CTX * ctx, SSL_SESSION * session)
+{
+    unsigned char key[SSL_MAX_SSL_SESSION_ID_LENGTH + 1];
+    unsigned int id_len;
+    const unsigned char *id = SSL_SESSION_get_id(session, &id_len);
+    sslSessionDelete(key, sslSessionServerKey(key, id, id_len));
+}
+
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+static void
+sslTicketKeyNew(void)
+{
+    SslTicketKey key;
+    if (RAND_bytes(key.name, sizeof(key.name)) <= 0 ||
+	RAND_bytes(key.aes_key, sizeof(key.aes_key)) <= 0 ||
+	RAND_bytes(key.hmac_key, sizeof(key.hmac_key)) <= 0) {
+	debugs(83, 1, "sslTicketKeyNew: RAND_bytes failed, keeping the current key: %s",
+	    ERR_error_string(ERR_get_error(), NULL));
+    } else {
+	key.created = squid_curtime;
+	shmLockAcquire(&ssl_session_store->ticket_lock);
+	ssl_session_store->ticket[1] = ssl_session_store->ticket[0];
+	ssl_session_store->ticket[0] = key;
+	shmLockRelease(&ssl_session_store->ticket_lock);
+	debugs(83, 2, "sslTicketKeyNew: new session ticket key");
+    }
+}
+
+static void
+sslTicketKeyRotate(void *unused)
+{
+    sslTicketKeyNew();
+    eventAdd("sslTicketKeyRotate", sslTicketKeyRotate, NULL, (double) XMAX(Config.SSL.ticket_key_rotate, 60), 1);
+}
+
+static int
+sslTicketKeyCb(SSL * ssl, unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX * ectx, HMAC_CTX * hctx, int enc)
+{
+    SslTicketKey ticket[2];
+    int i;
+
+    shmLockAcquire(&ssl_session_store->ticket_lock);
+    memcpy(ticket, ssl_session_store->ticket, sizeof(ticket));
+    shmLockRelease(&ssl_session_store->ticket_lock);
+
+    if (enc) {
+	if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_128_cbc())) <= 0)
+	    return -1;
+	memcpy(name, ticket[0].name, sizeof(ticket[0].name));
+	EVP_EncryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, ticket[0].aes_key, iv);
+	HMAC_Init_ex(hctx, ticket[0].hmac_key, sizeof(ticket[0].hmac_key), EVP_sha256(), NULL);
+	return 1;
+    }
+    for (i = 0; i < 2; i++) {
+	if (ticket[i].created && memcmp(name, ticket[i].name, sizeof(ticket[i].name)) == 0) {
+	    HMAC_Init_ex(hctx, ticket[i].hmac_key, sizeof(ticket[i].hmac_key), EVP_sha256(), NULL);
+	    EVP_DecryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, ticket[i].aes_key, iv);
+	    return i == 0 ? 1 : 2;	/* 2: issue a ticket under the current key */
+	}
+    }
+    return 0;
+}
+#endif
+
+static void
+sslSessionCacheInit(void)
+{
+    size_t size;
+    int nsets = Config.SSL.session_cache_size / sizeof(SslSessionSet);
+    int i;
+
+    if (nsets < 1)
+	return;
+    size = sizeof(SslSessionStoreHdr) + nsets * sizeof(SslSessionSet);
+    if (UsingSmp()) {
+	ssl_session_store = shmSegmentOpen(&ssl_session_shm, "ssl-sessions", size);
+	if (!ssl_session_store)
+	    debugs(83, 1, "WARNING: SSL sessions are not shared between workers");
+    }
+    if (!ssl_session_store)
+	ssl_session_store = xcalloc(1, size);
+    ssl_session_store->nsets = nsets;
+
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+    /* whoever comes first creates the initial key, rotation is the coordinator's */
+    shmLockAcquire(&ssl_session_store->ticket_lock);
+    i = ssl_session_store->ticket[0].created == 0;
+    shmLockRelease(&ssl_session_store->ticket_lock);
+    if (i)
+	sslTicketKeyNew();
+    if (!UsingSmp() || IamCoordinatorProcess())
+	eventAdd("sslTicketKeyRotate", sslTicketKeyRotate, NULL, (double) XMAX(Config.SSL.ticket_key_rotate, 60), 1);
+#endif
+
+    cachemgrRegister("ssl_session_cache",
+	"SSL Session Cache",
+	sslSessionCacheStats, sslSessionCacheAdd, sslSessionCacheCollect, 0, 1, 1);
+    debugs(83, 1, "SSL session cache: %d sessions in %d KB", nsets * SSL_SESSION_WAYS, (int) (size >> 10));
+}
+
+static void
+sslSessionCacheServerContext(SSL_CTX * ctx)
+{
+    if (SSL_CTX_get_session_cache_mode(ctx) == SSL_SESS_CACHE_OFF)
+	return;			/* NO_SESSION_REUSE */
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+    SSL_CTX_sess_set_new_cb(ctx, sslSessionNewCb);
+    SSL_CTX_sess_set_get_cb(ctx, sslSessionGetCb);
+    SSL_CTX_sess_set_remove_cb(ctx, sslSessionRemoveCb);
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+    SSL_CTX_set_tlsext_ticket_key_cb(ctx, sslTicketKeyCb);
+#endif
+}
+
+/*
+ * Called after every (re)configure, once the https_port contexts are
+ * created.  The cache is sized the first time only.
+ */
+void
+sslSessionCacheConfigure(void)
+{
+    https_port_list *s;
+
+    if (!ssl_session_store)
+	sslSessionCacheInit();
+    if (!ssl_session_store)
+	return;
+    for (s = Config.Sockaddr.https; s; s = (https_port_list *) s->http.next) {
+	if (s->sslContext)
+	    sslSessionCacheServerContext(s->sslContext);
+    }
+}
+
+/* a session for an outgoing connection, or NULL; the caller frees it */
+SSL_SESSION *
+sslSessionCacheGet(const char *key)
+{
+    if (!ssl_session_store)
+	return NULL;
+    return sslSessionLookup((const unsigned char *) key, strlen(key));
+}
+
+void
+sslSessionCacheStore(const char *key, SSL_SESSION * session)
+{
+    if (!ssl_session_store || !session)
+	return;
+    sslSessionPut((const unsigned char *) key, strlen(key), session);
+}
+
+static void *
+sslSessionCacheCollect(void)
+{
+    SslSessionActionData *stats = xcalloc(1, sizeof(SslSessionActionData));
+    stats->total = ssl_session_stats;
+    if (KidIdentifier >= 0 && KidIdentifier <= MAX_KID_SUPPORT)
+	stats->kid[KidIdentifier] = ssl_session_stats;
+    return stats;
+}
+
+static void
+sslSessionCountersAdd(SslSessionCounters * a, const SslSessionCounters * b)
+{
+    a->lookups += b->lookups;
+    a->hits += b->hits;
+    a->stores += b->stores;
+    a->too_big += b->too_big;
+}
+
+static int
+sslSessionCacheAdd(void *A, void *B)
+{
+    SslSessionActionData *stats = A;
+    SslSessionActionData *statsB = B;
+    int i;
+
+    if (stats && statsB) {
+	sslSessionCountersAdd(&stats->total, &statsB->total);
+	for (i = 0; i <= MAX_KID_SUPPORT; i++)
+	    sslSessionCountersAdd(&stats->kid[i], &statsB->kid[i]);
+    }
+    return sizeof(SslSessionActionData);
+}
+
+static void
+sslSessionCacheStats(StoreEntry * e, void *data)
+{
+    SslSessionActionData *stats = data;
+    const SslSessionCounters *c = stats ? &stats->total : &ssl_session_stats;
+    SslSessionSet *sets = SSL_SESSION_SETS(ssl_session_store);
+    int used = 0;
+    int i, j;
+
+    for (i = 0; i < ssl_session_store->nsets; i++)
+	for (j = 0; j < SSL_SESSION_WAYS; j++)
+	    if (sets[i].slot[j].key_len && sets[i].slot[j].expires > squid_curtime)
+		used++;
+    storeAppendPrintf(e, "Capacity: %d sessions\n", ssl_session_store->nsets * SSL_SESSION_WAYS);
+    storeAppendPrintf(e, "In use: %d sessions\n", used);
+    storeAppendPrintf(e, "Lookups: %d\n", c->lookups);
+    storeAppendPrintf(e, "Hits: %d\n", c->hits);
+    storeAppendPrintf(e, "Stores: %d\n", c->stores);
+    storeAppendPrintf(e, "Too big to store: %d\n", c->too_big);
+    if (stats) {
+	for (i = 1; i <= MAX_KID_SUPPORT; i++) {
+	    c = &stats->kid[i];
+	    if (c->lookups > 0 || c->stores > 0)
+		storeAppendPrintf(e, "\tkid%d: %d lookups, %d hits, %d stores\n", i, c->lookups, c->hits, c->stores);
+	}
+    }
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+    storeAppendPrintf(e, "Ticket key age: %d seconds\n", (int) (squid_curtime - ssl_session_store->ticket[0].created));
+#endif
+}
+
+#endif /* USE_SSL */
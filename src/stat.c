@@ -366,10 +366,10 @@ describeTimestamps(const StoreEntry * entry)
 {
     LOCAL_ARRAY(char, buf, 256);
     snprintf(buf, 256, "LV:%-9d LU:%-9d LM:%-9d EX:%-9d",
-	(int) entry->timestamp,
-	(int) entry->lastref,
-	(int) entry->lastmod,
-	(int) entry->expires);
+	(int) STORE_TIME(entry->timestamp),
+	(int) STORE_TIME(entry->lastref),
+	(int) STORE_TIME(entry->lastmod),
+	(int) STORE_TIME(entry->expires));
     return buf;
 }
 
@@ -380,7 +380,7 @@ statStoreEntry(MemBuf * mb, StoreEntry * e)
     int i;
     struct _store_client *sc;
     dlink_node *node;
-    memBufPrintf(mb, "KEY %s\n", storeKeyText(e->hash.key));
+    memBufPrintf(mb, "KEY %s\n", storeKeyText(storeEntryKey(e)));
     /* XXX should this url be escaped? */
     if (mem)
 	memBufPrintf(mb, "\t%s %s\n", urlMethodGetConstStr(mem->method), mem->url);
@@ -431,8 +431,7 @@ statObjects(void *data)
 {
     StatObjectsState *state = data;
     StoreEntry *e;
-    hash_link *link_ptr = NULL;
-    hash_link *link_next = NULL;
+    StoreEntry *next;
     if (state->bucket >= store_hash_buckets) {
 	storeComplete(state->sentry);
 	storeUnlockObject(state->sentry);
@@ -447,13 +446,12 @@ statObjects(void *data)
 	return;
     }
     debugs(49, 3, "statObjects: Bucket #%d", state->bucket);
-    link_next = hash_get_bucket(store_table, state->bucket);
-    if (link_next) {
+    next = storeHashBucket(state->bucket);
+    if (next) {
 	MemBuf mb;
 	memBufDefInit(&mb);
-	while (NULL != (link_ptr = link_next)) {
-	    link_next = link_ptr->next;
-	    e = (StoreEntry *) link_ptr;
+	while (NULL != (e = next)) {
+	    next = storeHashNext(e);
 	    if (state->filter && 0 == state->filter(e))
 		continue;
 	    statStoreEntry(&mb, e);
@@ -624,6 +622,7 @@ int add_info(void* A, void* B)
 	
 	InfoActionData* stats = (InfoActionData*)A;
 	InfoActionData* statsB = (InfoActionData*)B;
+	int i;
 	
     if (!timerisset(&squid_start) || timercmp(&squid_start, &statsB->squid_start, >))
         stats->squid_start = statsB->squid_start;
@@ -631,6 +630,10 @@ int add_info(void* A, void* B)
         stats->current_time = statsB->current_time;
 	
 	stats->client_http_clients	+= statsB->client_http_clients;
+	stats->client_http_accepts	+= statsB->client_http_accepts;
+	for (i = 0; i <= MAX_KID_SUPPORT; i++)
+	    stats->kid_accepts[i] += statsB->kid_accepts[i];
+	stats->client_http_accepts_shed += statsB->client_http_accepts_shed;
 	stats->client_http_requests  += statsB->client_http_requests;
 	stats->icp_pkts_recv  += statsB->icp_pkts_recv;
 	stats->icp_pkts_sent  += statsB->icp_pkts_sent;
@@ -698,10 +701,11 @@ int add_info(void* A, void* B)
 	stats->reserved_fd	+= statsB->reserved_fd;
 	stats->open_disk_fd  += statsB->open_disk_fd;
 
-	stats->store_entry_count  +=	stats->store_entry_count;
-	stats->store_mem_object_count  +=	stats->store_mem_object_count;
-	stats->store_mem_count	+=	stats->store_mem_count;
-	stats->store_swap_count   +=	stats->store_swap_count;
+	stats->store_entry_count  +=	statsB->store_entry_count;
+	stats->store_mem_object_count  +=	statsB->store_mem_object_count;
+	stats->store_mem_count	+=	statsB->store_mem_count;
+	stats->store_swap_count   +=	statsB->store_swap_count;
+	stats->store_index_bytes += statsB->store_index_bytes;
 
 	++stats->count;
 
@@ -729,6 +733,11 @@ void* get_info()
 
     stats->client_http_clients = statCounter.client_http.clients;
 
+    stats->client_http_accepts = statCounter.client_http.accepts;
+    if (KidIdentifier >= 0 && KidIdentifier <= MAX_KID_SUPPORT)
+	stats->kid_accepts[KidIdentifier] = statCounter.client_http.accepts;
+    stats->client_http_accepts_shed = statCounter.client_http.accepts_shed;
+
     stats->client_http_requests = statCounter.client_http.requests;
 
     stats->icp_pkts_recv = statCounter.icp.pkts_recv;
@@ -823,10 +832,11 @@ void* get_info()
 
     stats->open_disk_fd = store_open_disk_fd;
 	
-	stats->store_entry_count = memPoolInUseCount(pool_storeentry);
+	stats->store_entry_count = storeEntryCount();
 	stats->store_mem_object_count = memPoolInUseCount(pool_memobject);
 	stats->store_mem_count = hot_obj_count;
 	stats->store_swap_count  = n_disk_objects;
+	stats->store_index_bytes = storeIndexBytes();
 
 	stats->count = 1;
 	
@@ -838,6 +848,7 @@ static void
 DumpInfo(StoreEntry * sentry, void* data)
 {
 	InfoActionData* stats = (InfoActionData*)data;
+	int i;
 	
 	storeAppendPrintf(sentry, "Squid Object Cache: Version %s\n",
 					  version_string);
@@ -863,6 +874,17 @@ DumpInfo(StoreEntry * sentry, void* data)
 	else
 		storeAppendPrintf(sentry,"%s","\tNumber of clients accessing cache:\t(client_db off)\n");
 
+	storeAppendPrintf(sentry, "\tNumber of HTTP connections accepted:\t%.0f\n",
+					  stats->client_http_accepts);
+
+	for (i = 1; i <= MAX_KID_SUPPORT; i++) {
+		if (stats->kid_accepts[i] > 0)
+			storeAppendPrintf(sentry, "\t\tby kid%d:\t%.0f\n", i, stats->kid_accepts[i]);
+	}
+	if (stats->client_http_accepts_shed > 0)
+		storeAppendPrintf(sentry, "\tNumber of HTTP connections shed:\t%.0f\n",
+						  stats->client_http_accepts_shed);
+
 	storeAppendPrintf(sentry, "\tNumber of HTTP requests received:\t%.0f\n",
 					  stats->client_http_requests);
 
@@ -1024,6 +1046,9 @@ DumpInfo(StoreEntry * sentry, void* data)
 					  stats->store_mem_count);
 	storeAppendPrintf(sentry, "\t%6.0f on-disk objects\n",
 					  stats->store_swap_count);
+	if (stats->store_entry_count > 0)
+		storeAppendPrintf(sentry, "\t%6.1f bytes per StoreEntry in the store index (%d byte StoreEntry)\n",
+						  stats->store_index_bytes / stats->store_entry_count, (int) sizeof(StoreEntry));
 
 }
 
@@ -1061,6 +1086,8 @@ info_get(StoreEntry * sentry, void* data)
 	appname);
     storeAppendPrintf(sentry, "\tNumber of clients accessing cache:\t%u\n",
 	statCounter.client_http.clients);
+    storeAppendPrintf(sentry, "\tNumber of HTTP connections accepted:\t%u\n",
+	statCounter.client_http.accepts);
     storeAppendPrintf(sentry, "\tNumber of HTTP requests received:\t%u\n",
 	statCounter.client_http.requests);
     storeAppendPrintf(sentry, "\tNumber of ICP messages received:\t%u\n",
@@ -1105,6 +1132,8 @@ info_get(StoreEntry * sentry, void* data)
 	store_swap_size);
     storeAppendPrintf(sentry, "\tStorage Mem size:\t%d KB\n",
 	(int) (store_mem_size >> 10));
+    storeAppendPrintf(sentry, "\tSwap-in read-ahead size:\t%d KB\n",
+	(int) (store_swapin_mem_size >> 10));
     storeAppendPrintf(sentry, "\tMean Object Size:\t%0.2f KB\n",
 	n_disk_objects ? (double) store_swap_size / n_disk_objects : 0.0);
     storeAppendPrintf(sentry, "\tRequests given to unlinkd:\t%d\n",
@@ -1224,16 +1253,22 @@ info_get(StoreEntry * sentry, void* data)
     storeAppendPrintf(sentry, "\tStore Disk files open:                %4d\n",
 	store_open_disk_fd);
     storeAppendPrintf(sentry, "\tIO loop method:                     %s\n", comm_select_status());
+    if (CommStats.syscalls.pollctls && statCounter.client_http.requests)
+	storeAppendPrintf(sentry, "\tIO loop interest updates per request: %.2f\n",
+	    (double) CommStats.syscalls.pollctls / statCounter.client_http.requests);
 
     storeAppendPrintf(sentry, "Internal Data Structures:\n");
     storeAppendPrintf(sentry, "\t%6d StoreEntries\n",
-	memPoolInUseCount(pool_storeentry));
+	storeEntryCount());
     storeAppendPrintf(sentry, "\t%6d StoreEntries with MemObjects\n",
 	memPoolInUseCount(pool_memobject));
     storeAppendPrintf(sentry, "\t%6d Hot Object Cache Items\n",
 	hot_obj_count);
     storeAppendPrintf(sentry, "\t%6d on-disk objects\n",
 	n_disk_objects);
+    if (storeEntryCount() > 0)
+	storeAppendPrintf(sentry, "\t%6.1f bytes per StoreEntry in the store index (%d byte StoreEntry)\n",
+	    (double) storeIndexBytes() / storeEntryCount(), (int) sizeof(StoreEntry));
 
 #if XMALLOC_STATISTICS
     xm_deltat = current_dtime - xm_time;
@@ -2093,6 +2128,7 @@ int AddCountersStats(void* A, void* B)
 	stats->client_http_kbytes_in = statsB->client_http_kbytes_in;
 	stats->client_http_kbytes_out = statsB->client_http_kbytes_out;
 	stats->client_http_hit_kbytes_out = statsB->client_http_hit_kbytes_out;
+	stats->client_http_sendfile_kbytes_out  +=	statsB->client_http_sendfile_kbytes_out;
 
 	stats->server_all_requests	+=	statsB->server_all_requests;
 	stats->server_all_errors  +=	statsB->server_all_errors;
@@ -2143,6 +2179,10 @@ int AddCountersStats(void* A, void* B)
 	stats->swap_ins  += 	statsB->swap_ins;
 	stats->swap_files_cleaned  +=	statsB->swap_files_cleaned;
 	stats->aborted_requests  += 	statsB->aborted_requests;
+	stats->ssl_accepts  +=	statsB->ssl_accepts;
+	stats->ssl_connects  +=	statsB->ssl_connects;
+	stats->ssl_ktls_send  +=	statsB->ssl_ktls_send;
+	stats->ssl_ktls_recv  +=	statsB->ssl_ktls_recv;
 
 	return sizeof(CountersActionData);
 }
@@ -2165,6 +2205,7 @@ void* GetCountersStats()
     stats->client_http_kbytes_in = f->client_http.kbytes_in.kb;
     stats->client_http_kbytes_out = f->client_http.kbytes_out.kb;
     stats->client_http_hit_kbytes_out = f->client_http.hit_kbytes_out.kb;
+    stats->client_http_sendfile_kbytes_out = f->client_http.sendfile_kbytes_out.kb;
 
     stats->server_all_requests = f->server.all.requests;
     stats->server_all_errors = f->server.all.errors;
@@ -2221,6 +2262,10 @@ void* GetCountersStats()
     stats->swap_ins = f->swap.ins;
     stats->swap_files_cleaned = f->swap.files_cleaned;
     stats->aborted_requests = f->aborted_requests;
+    stats->ssl_accepts = f->ssl.accepts;
+    stats->ssl_connects = f->ssl.connects;
+    stats->ssl_ktls_send = f->ssl.ktls_send;
+    stats->ssl_ktls_recv = f->ssl.ktls_recv;
 	return (void*)stats;
 }
 
@@ -2246,6 +2291,8 @@ DumpCountersStats(StoreEntry* sentry, void* data)
                       stats->client_http_kbytes_out);
     storeAppendPrintf(sentry, "client_http.hit_kbytes_out = %.0f\n",
                       stats->client_http_hit_kbytes_out);
+    storeAppendPrintf(sentry, "client_http.sendfile_kbytes_out = %.0f\n",
+                      stats->client_http_sendfile_kbytes_out);
 
     storeAppendPrintf(sentry, "server.all.requests = %.0f\n",
                       stats->server_all_requests);
@@ -2352,6 +2399,16 @@ DumpCountersStats(StoreEntry* sentry, void* data)
                       stats->swap_files_cleaned);
     storeAppendPrintf(sentry, "aborted_requests = %.0f\n",
                       stats->aborted_requests);
+#if USE_SSL
+    storeAppendPrintf(sentry, "ssl.accepts = %.0f\n",
+                      stats->ssl_accepts);
+    storeAppendPrintf(sentry, "ssl.connects = %.0f\n",
+                      stats->ssl_connects);
+    storeAppendPrintf(sentry, "ssl.ktls_send = %.0f\n",
+                      stats->ssl_ktls_send);
+    storeAppendPrintf(sentry, "ssl.ktls_recv = %.0f\n",
+                      stats->ssl_ktls_recv);
+#endif
 }
 
 static void
@@ -2379,6 +2436,8 @@ statCountersDump(StoreEntry * sentry, void* data)
 	(int) f->client_http.kbytes_out.kb);
     storeAppendPrintf(sentry, "client_http.hit_kbytes_out = %d\n",
 	(int) f->client_http.hit_kbytes_out.kb);
+    storeAppendPrintf(sentry, "client_http.sendfile_kbytes_out = %d\n",
+	(int) f->client_http.sendfile_kbytes_out.kb);
 
     storeAppendPrintf(sentry, "server.all.requests = %d\n",
 	(int) f->server.all.requests);
@@ -2484,6 +2543,16 @@ statCountersDump(StoreEntry * sentry, void* data)
 	f->swap.files_cleaned);
     storeAppendPrintf(sentry, "aborted_requests = %d\n",
 	f->aborted_requests);
+#if USE_SSL
+    storeAppendPrintf(sentry, "ssl.accepts = %d\n",
+	f->ssl.accepts);
+    storeAppendPrintf(sentry, "ssl.connects = %d\n",
+	f->ssl.connects);
+    storeAppendPrintf(sentry, "ssl.ktls_send = %d\n",
+	f->ssl.ktls_send);
+    storeAppendPrintf(sentry, "ssl.ktls_recv = %d\n",
+	f->ssl.ktls_recv);
+#endif
 }
 
 static void
@@ -2816,9 +2885,9 @@ statClientRequests(StoreEntry * s, void* data)
 	    (long int) http->out.offset, (unsigned long int) http->out.size);
 	storeAppendPrintf(s, "req_sz %ld\n", (long int) http->req_sz);
 	e = http->entry;
-	storeAppendPrintf(s, "entry %p/%s\n", e, e ? storeKeyText(e->hash.key) : "N/A");
+	storeAppendPrintf(s, "entry %p/%s\n", e, e ? storeKeyText(storeEntryKey(e)) : "N/A");
 	e = http->old_entry;
-	storeAppendPrintf(s, "old_entry %p/%s\n", e, e ? storeKeyText(e->hash.key) : "N/A");
+	storeAppendPrintf(s, "old_entry %p/%s\n", e, e ? storeKeyText(storeEntryKey(e)) : "N/A");
 	storeAppendPrintf(s, "start %ld.%06d (%f seconds ago)\n",
 	    (long int) http->start.tv_sec,
 	    (int) http->start.tv_usec,
@@ -2839,7 +2908,7 @@ statClientRequests(StoreEntry * s, void* data)
 	storeAppendPrintf(s, "username %s\n", p);
 #if DELAY_POOLS
 	if (http->sc) {
-	    int pool = (http->sc->delay_id >> 16);
+	    int pool = DELAY_ID_POOL(http->sc->delay_id);
 	    storeAppendPrintf(s, "active delay_pool %d\n", pool);
 	    if (http->delayMaxBodySize > 0)
 		storeAppendPrintf(s, "delayed delay_pool %d; transfer threshold %" PRINTF_OFF_T " bytes\n",
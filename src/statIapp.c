@@ -17,6 +17,7 @@ statIappStats(StoreEntry *sentry, void* data)
         storeAppendPrintf(sentry, "libiapp.commstats.syscalls.sock.sendtos = %d\n", CommStats.syscalls.sock.sendtos);
 
         storeAppendPrintf(sentry, "libiapp.commstats.syscalls.polls = %d\n", CommStats.syscalls.polls);
+        storeAppendPrintf(sentry, "libiapp.commstats.syscalls.pollctls = %d\n", CommStats.syscalls.pollctls);
         storeAppendPrintf(sentry, "libiapp.commstats.syscalls.selects = %d\n", CommStats.syscalls.selects);
 
         storeAppendPrintf(sentry, "libiapp.commstats.syscalls.disk.opens = %d\n", CommStats.syscalls.disk.opens);
@@ -29,5 +30,8 @@ statIappStats(StoreEntry *sentry, void* data)
         storeAppendPrintf(sentry, "libiapp.commstats.select_fds = %d\n", CommStats.select_fds);
         storeAppendPrintf(sentry, "libiapp.commstats.select_loops = %d\n", CommStats.select_loops);
         storeAppendPrintf(sentry, "libiapp.commstats.select_time = %d\n", CommStats.select_time);
+        storeAppendPrintf(sentry, "libiapp.commstats.loop_lag = %.6f\n", CommStats.loop_lag);
+        storeAppendPrintf(sentry, "libiapp.commstats.msgs = %d\n", CommStats.msgs);
+        storeAppendPrintf(sentry, "libiapp.commstats.msg_wakeups = %d\n", CommStats.msg_wakeups);
 }
 
@@ -91,7 +91,22 @@ static EVH storeLateRelease;
  */
 static Stack LateReleaseStack;
 MemPool * pool_memobject = NULL;
-MemPool * pool_storeentry = NULL;
+
+/*
+ * StoreEntries are carved from STORE_ENTRY_CHUNK sized chunks aligned
+ * to their size, so a 32 bit sentryno can stand in for a pointer in the
+ * hash chains and the LRU lists.  Slot 0 of each chunk holds the chunk
+ * number; an entry finds its own sentryno from its address.  Free
+ * entries are chained through hash_next.
+ */
+#define STORE_ENTRY_CHUNK (256 * 1024)
+#define STORE_ENTRY_SLOTS ((int) (STORE_ENTRY_CHUNK / sizeof(StoreEntry)) - 1)
+
+static StoreEntry **store_chunks = NULL;
+static int store_nchunks = 0;
+static sentryno store_free_entries = 0;
+static int store_entry_count = 0;
+static sentryno *store_buckets = NULL;
 
 #if URL_CHECKSUM_DEBUG
 unsigned int
@@ -136,15 +151,61 @@ memHaveHeaders(const MemObject * mem)
 }
 
 
+StoreEntry *
+storeEntryById(sentryno id)
+{
+    if (id == 0)
+	return NULL;
+    id--;
+    return store_chunks[id / STORE_ENTRY_SLOTS] + 1 + id % STORE_ENTRY_SLOTS;
+}
+
+sentryno
+storeEntryId(const StoreEntry * e)
+{
+    const StoreEntry *base = (const StoreEntry *) ((unsigned long) e & ~((unsigned long) STORE_ENTRY_CHUNK - 1));
+    return *(const int *) base * STORE_ENTRY_SLOTS + (e - base);
+}
+
+int
+storeEntryCount(void)
+{
+    return store_entry_count;
+}
+
+static void
+storeEntryChunkAdd(void)
+{
+    StoreEntry *chunk;
+    void *p;
+    int i;
+    if (posix_memalign(&p, STORE_ENTRY_CHUNK, STORE_ENTRY_CHUNK) != 0)
+	fatal("storeEntryChunkAdd: out of memory for StoreEntries");
+    chunk = p;
+    memset(chunk, '\0', STORE_ENTRY_CHUNK);
+    *(int *) chunk = store_nchunks;
+    store_chunks = xrealloc(store_chunks, (store_nchunks + 1) * sizeof(*store_chunks));
+    store_chunks[store_nchunks++] = chunk;
+    for (i = STORE_ENTRY_SLOTS; i > 0; i--) {
+	chunk[i].hash_next = store_free_entries;
+	store_free_entries = storeEntryId(&chunk[i]);
+    }
+}
+
 StoreEntry *
 new_StoreEntry(int mem_obj_flag, const char *url)
 {
     StoreEntry *e = NULL;
-    e = memPoolAlloc(pool_storeentry);
+    if (!store_free_entries)
+	storeEntryChunkAdd();
+    e = storeEntryById(store_free_entries);
+    store_free_entries = e->hash_next;
+    memset(e, '\0', sizeof(*e));
+    store_entry_count++;
     if (mem_obj_flag)
 	e->mem_obj = new_MemObject(url);
     debugs(20, 3, "new_StoreEntry: returning %p", e);
-    e->expires = e->lastmod = e->lastref = e->timestamp = -1;
+    e->expires = e->lastmod = e->lastref = e->timestamp = STORE_TIME_NONE;
     e->swap_filen = -1;
     e->swap_dirn = -1;
     return e;
@@ -174,6 +235,7 @@ destroy_MemObject(StoreEntry * e)
     if (!shutting_down)
 	assert(mem->swapout.sio == NULL);
     stmemFree(&mem->data_hdr);
+    storeClientSwapinFree(mem);
     mem->inmem_hi = 0;
 #if 0
     /*
@@ -210,8 +272,10 @@ destroy_StoreEntry(void *data)
     if (e->mem_obj)
 	destroy_MemObject(e);
     storeHashDelete(e);
-    assert(e->hash.key == NULL);
-    memPoolFree(pool_storeentry, e);
+    assert(!e->hashed);
+    e->hash_next = store_free_entries;
+    store_free_entries = storeEntryId(e);
+    store_entry_count--;
 }
 
 /* ----- INTERFACE BETWEEN STORAGE MANAGER AND HASH TABLE FUNCTIONS --------- */
@@ -221,16 +285,57 @@ storeHashInsert(StoreEntry * e, const cache_key * key)
 {
     debugs(20, 3, "storeHashInsert: Inserting Entry %p key '%s'",
 	e, storeKeyText(key));
-    e->hash.key = storeKeyDup(key);
-    hash_join(store_table, &e->hash);
+    sentryno *b = &store_buckets[storeKeyHashHash(key, store_hash_buckets)];
+    assert(!e->hashed);
+    storeKeyCopy(e->key, key);
+    e->hashed = 1;
+    e->hash_next = *b;
+    *b = storeEntryId(e);
 }
 
 static void
 storeHashDelete(StoreEntry * e)
 {
-    hash_remove_link(store_table, &e->hash);
-    storeKeyFree(e->hash.key);
-    e->hash.key = NULL;
+    sentryno id;
+    sentryno *b;
+    if (!e->hashed)
+	return;
+    if (!EBIT_TEST(e->flags, KEY_PRIVATE))
+	storeVaryIndexRelease(e->key);
+    id = storeEntryId(e);
+    for (b = &store_buckets[storeKeyHashHash(e->key, store_hash_buckets)]; *b != id; b = &storeEntryById(*b)->hash_next)
+	assert(*b);
+    *b = e->hash_next;
+    e->hash_next = 0;
+    e->hashed = 0;
+}
+
+/* first entry in a store hash bucket; follow the chain with storeHashNext() */
+StoreEntry *
+storeHashBucket(int bucket)
+{
+    return storeEntryById(store_buckets[bucket]);
+}
+
+/*
+ * Memory held by the store index: the StoreEntry chunks, the hash
+ * buckets and whatever the cache_dir and memory replacement policies
+ * keep per entry.
+ */
+size_t
+storeIndexBytes(void)
+{
+    size_t n = (size_t) store_nchunks * STORE_ENTRY_CHUNK;
+    int i;
+    n += store_hash_buckets * sizeof(*store_buckets);
+    for (i = 0; i < Config.cacheSwap.n_configured; i++) {
+	RemovalPolicy *repl = Config.cacheSwap.swapDirs[i].repl;
+	if (repl && repl->MemoryUsed)
+	    n += repl->MemoryUsed(repl);
+    }
+    if (mem_policy && mem_policy->MemoryUsed)
+	n += mem_policy->MemoryUsed(mem_policy);
+    return n;
 }
 
 /* -------------------------------------------------------------------------- */
@@ -244,7 +349,7 @@ storePurgeMem(StoreEntry * e)
     if (e->mem_obj == NULL)
 	return;
     debugs(20, 3, "storePurgeMem: Freeing memory-copy of %s",
-	storeKeyText(e->hash.key));
+	storeKeyText(storeEntryKey(e)));
     storeSetMemStatus(e, NOT_IN_MEMORY);
     destroy_MemObject(e);
     if (e->swap_status != SWAPOUT_DONE)
@@ -292,8 +397,8 @@ storeLockObjectDebug(StoreEntry * e, const char *file, const int line)
 {
     e->lock_count++;
     debugs(20, 3, "storeLockObject: (%s:%d): key '%s' count=%d", file, line,
-	storeKeyText(e->hash.key), (int) e->lock_count);
-    e->lastref = squid_curtime;
+	storeKeyText(storeEntryKey(e)), (int) e->lock_count);
+    e->lastref = storeTimeOffset(squid_curtime);
     storeEntryReferenced(e);
 }
 
@@ -302,7 +407,7 @@ storeReleaseRequest(StoreEntry * e)
 {
     if (EBIT_TEST(e->flags, RELEASE_REQUEST))
 	return;
-    debugs(20, 3, "storeReleaseRequest: '%s'", storeKeyText(e->hash.key));
+    debugs(20, 3, "storeReleaseRequest: '%s'", storeKeyText(storeEntryKey(e)));
     EBIT_SET(e->flags, RELEASE_REQUEST);
     /*
      * Clear cachable flag here because we might get called before
@@ -320,7 +425,7 @@ storeUnlockObjectDebug(StoreEntry * e, const char *file, const int line)
 {
     e->lock_count--;
     debugs(20, 3, "storeUnlockObject: (%s:%d): key '%s' count=%d", file, line,
-	storeKeyText(e->hash.key), e->lock_count);
+	storeKeyText(storeEntryKey(e)), e->lock_count);
     if (e->lock_count)
 	return (int) e->lock_count;
     if (e->store_status == STORE_PENDING)
@@ -347,7 +452,9 @@ storeUnlockObjectDebug(StoreEntry * e, const char *file, const int line)
 StoreEntry *
 storeGet(const cache_key * key)
 {
-    StoreEntry *e = (StoreEntry *) hash_lookup(store_table, key);
+    StoreEntry *e = storeHashBucket(storeKeyHashHash(key, store_hash_buckets));
+    while (e && memcmp(e->key, key, SQUID_MD5_DIGEST_LENGTH) != 0)
+	e = storeHashNext(e);
     debugs(20, 3, "storeGet: %s -> %p", storeKeyText(key), e);
     return e;
 }
@@ -465,9 +572,9 @@ storeSetPrivateKey(StoreEntry * e)
 {
     const cache_key *newkey;
     MemObject *mem = e->mem_obj;
-    if (e->hash.key && EBIT_TEST(e->flags, KEY_PRIVATE))
+    if (storeEntryKey(e) && EBIT_TEST(e->flags, KEY_PRIVATE))
 	return;			/* is already private */
-    if (e->hash.key) {
+    if (storeEntryKey(e)) {
 	if (e->swap_filen > -1)
 	    storeDirSwapLog(e, SWAP_LOG_DEL);
 	storeHashDelete(e);
@@ -478,7 +585,7 @@ storeSetPrivateKey(StoreEntry * e)
     } else {
 	newkey = storeKeyPrivate("JUNK", urlMethodGetKnown("NONE", 4), getKeyCounter());
     }
-    assert(hash_lookup(store_table, newkey) == NULL);
+    assert(storeGet(newkey) == NULL);
     EBIT_SET(e->flags, KEY_PRIVATE);
     storeHashInsert(e, newkey);
 }
@@ -490,7 +597,7 @@ storeSetPublicKey(StoreEntry * e)
     const cache_key *newkey;
     MemObject *mem = e->mem_obj;
     const char *str = NULL;
-    if (e->hash.key && !EBIT_TEST(e->flags, KEY_PRIVATE)) {
+    if (storeEntryKey(e) && !EBIT_TEST(e->flags, KEY_PRIVATE)) {
 	if (EBIT_TEST(e->flags, KEY_EARLY_PUBLIC)) {
 	    EBIT_CLR(e->flags, KEY_EARLY_PUBLIC);
 	    storeSetPrivateKey(e);	/* wasn't really public yet, reset the key */
@@ -512,7 +619,7 @@ storeSetPublicKey(StoreEntry * e)
 #if MORE_DEBUG_OUTPUT
     if (EBIT_TEST(e->flags, RELEASE_REQUEST))
 	debugs(20, 1, "assertion failed: RELEASE key %s, url %s",
-	    e->hash.key, mem->url);
+	    storeKeyText(storeEntryKey(e)), mem->url);
 #endif
     assert(!EBIT_TEST(e->flags, RELEASE_REQUEST));
     if (mem->request) {
@@ -563,7 +670,7 @@ storeSetPublicKey(StoreEntry * e)
     } else {
 	newkey = storeKeyPublic(storeLookupUrl(e), mem->method);
     }
-    if ((e2 = (StoreEntry *) hash_lookup(store_table, newkey))) {
+    if ((e2 = storeGet(newkey))) {
 	debugs(20, 3, "storeSetPublicKey: Making old '%s' private.", mem->url);
 	storeSetPrivateKey(e2);
 	storeRelease(e2);
@@ -572,7 +679,7 @@ storeSetPublicKey(StoreEntry * e)
 	else
 	    newkey = storeKeyPublic(storeLookupUrl(e), mem->method);
     }
-    if (e->hash.key)
+    if (storeEntryKey(e))
 	storeHashDelete(e);
     EBIT_CLR(e->flags, KEY_PRIVATE);
     storeHashInsert(e, newkey);
@@ -608,8 +715,8 @@ storeCreateEntry(const char *url, request_flags flags, method_t * method)
     e->swap_filen = -1;
     e->swap_dirn = -1;
     e->refcount = 0;
-    e->lastref = squid_curtime;
-    e->timestamp = -1;		/* set in storeTimestampsSet() */
+    e->lastref = storeTimeOffset(squid_curtime);
+    e->timestamp = STORE_TIME_NONE;		/* set in storeTimestampsSet() */
     e->ping_status = PING_NONE;
     EBIT_SET(e->flags, ENTRY_VALIDATED);
     return e;
@@ -619,8 +726,8 @@ storeCreateEntry(const char *url, request_flags flags, method_t * method)
 void
 storeExpireNow(StoreEntry * e)
 {
-    debugs(20, 3, "storeExpireNow: '%s'", storeKeyText(e->hash.key));
-    e->expires = squid_curtime;
+    debugs(20, 3, "storeExpireNow: '%s'", storeKeyText(storeEntryKey(e)));
+    e->expires = storeTimeOffset(squid_curtime);
 }
 
 /* Append incoming data from a primary server to an entry. */
@@ -635,7 +742,7 @@ storeAppend(StoreEntry * e, const char *buf, int len)
     if (len) {
 	debugs(20, 5, "storeAppend: appending %d bytes for '%s'",
 	    len,
-	    storeKeyText(e->hash.key));
+	    storeKeyText(storeEntryKey(e)));
 	storeGetMemSpace(len);
 	stmemAppend(&mem->data_hdr, buf, len);
 	mem->inmem_hi += len;
@@ -646,6 +753,41 @@ storeAppend(StoreEntry * e, const char *buf, int len)
     storeSwapOut(e);
 }
 
+/*
+ * storeAppend() without the copy: storeAppendReserve() describes
+ * room in the entry's memory pages for the caller to read into and
+ * storeAppendCommit() accounts for what landed there.  Nothing else
+ * may be appended to the entry in between.
+ */
+int
+storeAppendReserve(StoreEntry * e, struct iovec *iov, int iovcnt, int len)
+{
+    MemObject *mem = e->mem_obj;
+    assert(mem != NULL);
+    assert(e->store_status == STORE_PENDING);
+    storeGetMemSpace(len);
+    return stmemAppendReserve(&mem->data_hdr, iov, iovcnt, len);
+}
+
+void
+storeAppendCommit(StoreEntry * e, struct iovec *iov, int iovcnt, int len)
+{
+    MemObject *mem = e->mem_obj;
+    assert(len >= 0);
+    stmemAppendCommit(&mem->data_hdr, iov, iovcnt, len);
+    if (len == 0)
+	return;
+    debugs(20, 5, "storeAppendCommit: appended %d bytes for '%s'",
+	len,
+	storeKeyText(storeEntryKey(e)));
+    mem->refresh_timestamp = squid_curtime;
+    mem->inmem_hi += len;
+    if (EBIT_TEST(e->flags, DELAY_SENDING))
+	return;
+    InvokeHandlers(e);
+    storeSwapOut(e);
+}
+
 void
 #if STDC_HEADERS
 storeAppendPrintf(StoreEntry * e, const char *fmt,...)
@@ -812,7 +954,7 @@ storeCheckCachableStats(StoreEntry * sentry, void* data)
 void
 storeComplete(StoreEntry * e)
 {
-    debugs(20, 3, "storeComplete: '%s'", storeKeyText(e->hash.key));
+    debugs(20, 3, "storeComplete: '%s'", storeKeyText(storeEntryKey(e)));
     if (e->store_status != STORE_PENDING) {
 	/*
 	 * if we're not STORE_PENDING, then probably we got aborted
@@ -856,7 +998,7 @@ storeRequestFailed(StoreEntry * e, ErrorState * err)
     MemObject *mem = e->mem_obj;
     assert(e->store_status == STORE_PENDING);
     assert(mem != NULL);
-    debugs(20, 6, "storeAbort: %s", storeKeyText(e->hash.key));
+    debugs(20, 6, "storeAbort: %s", storeKeyText(storeEntryKey(e)));
     storeLockObject(e);		/* lock while aborting */
     storeExpireNow(e);
     storeReleaseRequest(e);
@@ -891,7 +1033,7 @@ storeAbort(StoreEntry * e)
     MemObject *mem = e->mem_obj;
     assert(e->store_status == STORE_PENDING);
     assert(mem != NULL);
-    debugs(20, 6, "storeAbort: %s", storeKeyText(e->hash.key));
+    debugs(20, 6, "storeAbort: %s", storeKeyText(storeEntryKey(e)));
     storeLockObject(e);		/* lock while aborting */
     storeExpireNow(e);
     storeReleaseRequest(e);
@@ -997,7 +1139,7 @@ storeMaintainSwapSpace(void *datanotused)
 void
 storeRelease(StoreEntry * e)
 {
-    debugs(20, 3, "storeRelease: Releasing: '%s'", storeKeyText(e->hash.key));
+    debugs(20, 3, "storeRelease: Releasing: '%s'", storeKeyText(storeEntryKey(e)));
     /* If, for any reason we can't discard this object because of an
      * outstanding request, mark it for pending release */
     if (storeEntryLocked(e)) {
@@ -1092,7 +1234,7 @@ storeEntryValidLength(const StoreEntry * e)
     const HttpReply *reply;
     assert(e->mem_obj != NULL);
     reply = e->mem_obj->reply;
-    debugs(20, 3, "storeEntryValidLength: Checking '%s'", storeKeyText(e->hash.key));
+    debugs(20, 3, "storeEntryValidLength: Checking '%s'", storeKeyText(storeEntryKey(e)));
     debugs(20, 5, "storeEntryValidLength:     object_len = %" PRINTF_OFF_T "",
 	objectLen(e));
     debugs(20, 5, "storeEntryValidLength:         hdr_sz = %d",
@@ -1102,7 +1244,7 @@ storeEntryValidLength(const StoreEntry * e)
 	clen);
     if (clen < 0) {
 	debugs(20, 5, "storeEntryValidLength: Unspecified content length: %s",
-	    storeKeyText(e->hash.key));
+	    storeKeyText(storeEntryKey(e)));
 	return 1;
     }
     diff = reply->hdr_sz + clen - objectLen(e);
@@ -1111,7 +1253,7 @@ storeEntryValidLength(const StoreEntry * e)
     debugs(20, 2, "storeEntryValidLength: %" PRINTF_OFF_T " bytes too %s; '%s'",
 	diff < 0 ? -diff : diff,
 	diff < 0 ? "big" : "small",
-	storeKeyText(e->hash.key));
+	storeKeyText(storeEntryKey(e)));
     return 0;
 }
 
@@ -1136,7 +1278,6 @@ storeInitHashValues(void)
 void
 storeInitMem(void)
 {
-    pool_storeentry = memPoolCreate("StoreEntry", sizeof(StoreEntry));
     pool_memobject = memPoolCreate("MemObject", sizeof(MemObject));
 }
 
@@ -1145,7 +1286,7 @@ storeInit(void)
 {
     storeKeyInit();
     storeInitHashValues();
-    store_table = hash_create(storeKeyHashCmp, store_hash_buckets, storeKeyHashHash);
+    store_buckets = xcalloc(store_hash_buckets, sizeof(*store_buckets));
     mem_policy = createRemovalPolicy(Config.memPolicy);
     storeDigestInit();
     storeLogOpen();
@@ -1185,11 +1326,26 @@ storeKeepInMemory(const StoreEntry * e)
     return mem->inmem_lo == 0;
 }
 
+/* convert a time_t to the offset kept in StoreEntry; see STORE_TIME() */
+store_time_t
+storeTimeOffset(time_t t)
+{
+    time_t off;
+    if (t < 0)
+	return STORE_TIME_NONE;
+    off = t - STORE_TIME_BASE;
+    if (off > 0x7fffffff)
+	return 0x7fffffff;
+    if (off < -0x7fffffff)
+	return -0x7fffffff;
+    return (store_time_t) off;
+}
+
 void
 storeNegativeCache(StoreEntry * e)
 {
     StoreEntry *oe = e->mem_obj->old_entry;
-    time_t expires = e->expires;
+    time_t expires = STORE_TIME(e->expires);
     http_status status = e->mem_obj->reply->sline.status;
     refresh_cc cc = refreshCC(e, e->mem_obj->request);
     if (expires == -1)
@@ -1202,7 +1358,7 @@ storeNegativeCache(StoreEntry * e)
 	if (cc.max_stale >= 0) {
 	    time_t max_expires;
 	    storeTimestampsSet(oe);
-	    max_expires = oe->expires + cc.max_stale;
+	    max_expires = STORE_TIME(oe->expires) + cc.max_stale;
 	    /* Bail out if beyond the stale-if-error staleness limit */
 	    if (max_expires <= squid_curtime)
 		goto cache_error_response;
@@ -1213,23 +1369,26 @@ storeNegativeCache(StoreEntry * e)
 	/* Block the new error from getting cached */
 	EBIT_CLR(e->flags, ENTRY_CACHABLE);
 	/* And negatively cache the old one */
-	if (oe->expires < expires)
-	    oe->expires = expires;
+	if (STORE_TIME(oe->expires) < expires)
+	    oe->expires = storeTimeOffset(expires);
 	EBIT_SET(oe->flags, REFRESH_FAILURE);
 	return;
     }
   cache_error_response:
-    if (e->expires < expires)
-	e->expires = expires;
+    if (STORE_TIME(e->expires) < expires)
+	e->expires = storeTimeOffset(expires);
     EBIT_SET(e->flags, ENTRY_NEGCACHED);
 }
 
 void
 storeFreeMemory(void)
 {
-    hashFreeItems(store_table, destroy_StoreEntry);
-    hashFreeMemory(store_table);
-    store_table = NULL;
+    StoreEntry *e;
+    int i;
+    for (i = 0; i < store_hash_buckets; i++)
+	while ((e = storeHashBucket(i)) != NULL)
+	    destroy_StoreEntry(e);
+    safe_free(store_buckets);
 #if USE_CACHE_DIGESTS
     if (store_digest)
 	cacheDigestDestroy(store_digest);
@@ -1251,7 +1410,7 @@ storeEntryValidToSend(StoreEntry * e)
     if (EBIT_TEST(e->flags, RELEASE_REQUEST))
 	return 0;
     if (EBIT_TEST(e->flags, ENTRY_NEGCACHED))
-	if (e->expires <= squid_curtime)
+	if (STORE_TIME(e->expires) <= squid_curtime)
 	    return 0;
     if (EBIT_TEST(e->flags, ENTRY_ABORTED))
 	return 0;
@@ -1292,11 +1451,11 @@ storeTimestampsSet(StoreEntry * entry)
 	if (squid_curtime > age)
 	    served_date = squid_curtime - age;
     if (reply->expires > 0 && reply->date > -1)
-	entry->expires = served_date + (reply->expires - reply->date);
+	entry->expires = storeTimeOffset(served_date + (reply->expires - reply->date));
     else
-	entry->expires = reply->expires;
-    entry->lastmod = reply->last_modified;
-    entry->timestamp = served_date;
+	entry->expires = storeTimeOffset(reply->expires);
+    entry->lastmod = storeTimeOffset(reply->last_modified);
+    entry->timestamp = storeTimeOffset(served_date);
 }
 
 void
@@ -1347,13 +1506,13 @@ storeMemObjectDump(MemObject * mem)
 void
 storeEntryDump(const StoreEntry * e, int l)
 {
-    debugs(20, l, "StoreEntry->key: %s", storeKeyText(e->hash.key));
-    debugs(20, l, "StoreEntry->next: %p", e->hash.next);
+    debugs(20, l, "StoreEntry->key: %s", storeKeyText(storeEntryKey(e)));
+    debugs(20, l, "StoreEntry->hash_next: %u", e->hash_next);
     debugs(20, l, "StoreEntry->mem_obj: %p", e->mem_obj);
-    debugs(20, l, "StoreEntry->timestamp: %ld", (long int) e->timestamp);
-    debugs(20, l, "StoreEntry->lastref: %ld", (long int) e->lastref);
-    debugs(20, l, "StoreEntry->expires: %ld", (long int) e->expires);
-    debugs(20, l, "StoreEntry->lastmod: %ld", (long int) e->lastmod);
+    debugs(20, l, "StoreEntry->timestamp: %ld", (long int) STORE_TIME(e->timestamp));
+    debugs(20, l, "StoreEntry->lastref: %ld", (long int) STORE_TIME(e->lastref));
+    debugs(20, l, "StoreEntry->expires: %ld", (long int) STORE_TIME(e->expires));
+    debugs(20, l, "StoreEntry->lastmod: %ld", (long int) STORE_TIME(e->lastmod));
     debugs(20, l, "StoreEntry->swap_file_sz: %" PRINTF_OFF_T "", (squid_off_t) e->swap_file_sz);
     debugs(20, l, "StoreEntry->refcount: %d", e->refcount);
     debugs(20, l, "StoreEntry->flags: %s", storeEntryFlags(e));
@@ -1496,7 +1655,7 @@ storeEntryReset(StoreEntry * e)
     mem->inmem_hi = mem->inmem_lo = 0;
     httpReplyDestroy(mem->reply);
     mem->reply = httpReplyCreate();
-    e->expires = e->lastmod = e->timestamp = -1;
+    e->expires = e->lastmod = e->timestamp = STORE_TIME_NONE;
 }
 
 /*
@@ -108,9 +108,13 @@
  */
 static STRCB storeClientReadBody;
 static STRCB storeClientReadHeader;
+static STRCB storeClientReadAheadDone;
 static void storeClientCopy2(StoreEntry * e, store_client * sc);
 static void storeClientCopy3(StoreEntry * e, store_client * sc);
 static void storeClientFileRead(store_client * sc);
+static void storeClientReadAhead(store_client * sc);
+static void storeClientReadAheadTrim(MemObject * mem);
+static int storeClientParseHeader(store_client * sc, const char *b, int l);
 static EVH storeClientCopyEvent;
 static store_client_t storeClientType(StoreEntry *);
 static int CheckQuickAbort2(StoreEntry * entry);
@@ -337,7 +341,7 @@ storeClientRef(store_client * sc,
     void *data)
 {
     debugs(20, 3, "storeClientRef: %s, seen %" PRINTF_OFF_T ", want %" PRINTF_OFF_T ", size %d, cb %p, cbdata %p",
-	storeKeyText(e->hash.key),
+	storeKeyText(storeEntryKey(e)),
 	seen_offset,
 	copy_offset,
 	(int) size,
@@ -427,7 +431,7 @@ storeClientCopy2(StoreEntry * e, store_client * sc)
     }
     cbdataLock(sc);		/* ick, prevent sc from getting freed */
     sc->flags.store_copying = 1;
-    debugs(20, 3, "storeClientCopy2: %s", storeKeyText(e->hash.key));
+    debugs(20, 3, "storeClientCopy2: %s", storeKeyText(storeEntryKey(e)));
     assert(sc->new_callback);
     /*
      * We used to check for ENTRY_ABORTED here.  But there were some
@@ -527,9 +531,19 @@ storeClientCopy3(StoreEntry * e, store_client * sc)
     /* What the client wants is not in memory. Schedule a disk read */
     assert(STORE_DISK_CLIENT == sc->type);
     assert(!sc->flags.disk_io_pending);
-    debugs(20, 3, "storeClientCopy3: reading from STORE");
     /* Just in case there's a node here; free it */
     stmemNodeUnref(&sc->node_ref);
+    if (mem->swapin.data.head && sc->copy_offset >= mem->swapin.data.origin_offset &&
+	sc->copy_offset < mem->swapin.hi) {
+	/* It has already been read ahead from disk */
+	debugs(20, 3, "storeClientCopy3: Copying from read-ahead");
+	sz = stmemRef(&mem->swapin.data, sc->copy_offset, &sc->node_ref);
+	if (sz > 0)
+	    (void) storeClientParseHeader(sc, sc->node_ref.node->data + sc->node_ref.offset, sz);
+	storeClientCallback(sc, sz);
+	return;
+    }
+    debugs(20, 3, "storeClientCopy3: reading from STORE");
     storeClientFileRead(sc);
 }
 
@@ -539,6 +553,22 @@ storeClientFileRead(store_client * sc)
     MemObject *mem = sc->entry->mem_obj;
     assert(sc->new_callback);
     assert(!sc->flags.disk_io_pending);
+    if (mem->swap_hdr_sz != 0) {
+	/*
+	 * Body reads go through the object's read-ahead block.  If
+	 * another client is already reading the block we want, wait
+	 * for it; InvokeHandlers() wakes us up when it lands.
+	 */
+	if (mem->swapin.reader == NULL) {
+	    storeClientReadAhead(sc);
+	    return;
+	}
+	if (sc->copy_offset >= mem->swapin.read_offset &&
+	    sc->copy_offset < mem->swapin.read_offset + (squid_off_t) mem->swapin.read_size) {
+	    debugs(20, 3, "storeClientFileRead: waiting for the read-ahead in progress");
+	    return;
+	}
+    }
     sc->flags.disk_io_pending = 1;
     assert(sc->node_ref.node == NULL);	/* We should never, ever have a node here; or we'd leak! */
     stmemNodeRefCreate(&sc->node_ref);	/* Creates an entry with reference count == 1 */
@@ -561,6 +591,167 @@ storeClientFileRead(store_client * sc)
     }
 }
 
+/*
+ * Read-ahead pages are a transient disk buffer, not hot objects, so
+ * they are moved out of store_mem_size (cache_mem) into
+ * store_swapin_mem_size whenever the window changes.
+ */
+static int
+storeClientSwapinPages(const MemObject * mem)
+{
+    const mem_node *p;
+    int n = 0;
+    for (p = mem->swapin.data.head; p; p = p->next)
+	n++;
+    return n;
+}
+
+static void
+storeClientSwapinAccount(const MemObject * mem, int before)
+{
+    long delta = (long) (storeClientSwapinPages(mem) - before) * SM_PAGE_SIZE;
+    store_mem_size -= delta;
+    store_swapin_mem_size += delta;
+}
+
+void
+storeClientSwapinFree(MemObject * mem)
+{
+    int before = storeClientSwapinPages(mem);
+    stmemFree(&mem->swapin.data);
+    storeClientSwapinAccount(mem, before);
+}
+
+/*
+ * Free the read-ahead data every disk client has gone past, or all of
+ * it once there are no disk clients left.  A client lagging too far
+ * behind doesn't pin the rest; it reads its own block again later.
+ */
+static void
+storeClientReadAheadTrim(MemObject * mem)
+{
+    squid_off_t lowest = -1;
+    squid_off_t keep_from;
+    store_client *sc;
+    dlink_node *node;
+
+    if (mem->swapin.data.head == NULL)
+	return;
+    for (node = mem->clients.head; node; node = node->next) {
+	sc = node->data;
+	if (sc->type != STORE_DISK_CLIENT)
+	    continue;
+	if (lowest < 0 || sc->copy_offset < lowest)
+	    lowest = sc->copy_offset;
+    }
+    if (lowest < 0) {
+	storeClientSwapinFree(mem);
+	mem->swapin.hi = 0;
+	return;
+    }
+    keep_from = mem->swapin.hi - 2 * Config.swapinReadAhead.max;
+    if (lowest < keep_from)
+	lowest = keep_from;
+    if (lowest > mem->swapin.hi)
+	lowest = mem->swapin.hi;
+    if (lowest > mem->swapin.data.origin_offset) {
+	int before = storeClientSwapinPages(mem);
+	stmemFreeDataUpto(&mem->swapin.data, lowest);
+	storeClientSwapinAccount(mem, before);
+    }
+}
+
+/*
+ * Read the next block of the object body from disk into the
+ * MemObject, where all disk clients of the object can use it.
+ *
+ * The block size adapts to how fast the clients use the data up: it
+ * doubles while a block is drained quicker than the disk took to read
+ * it, and halves when draining a block took more than a second.
+ */
+static void
+storeClientReadAhead(store_client * sc)
+{
+    StoreEntry *e = sc->entry;
+    MemObject *mem = e->mem_obj;
+    size_t min = XMAX(Config.swapinReadAhead.min, SM_PAGE_SIZE);
+    size_t max = XMAX(Config.swapinReadAhead.max, min);
+    squid_off_t avail = -1;
+    size_t size;
+
+    storeClientReadAheadTrim(mem);
+    if (mem->swapin.size < min || mem->swapin.size > max)
+	mem->swapin.size = min;
+    if (mem->swapin.data.head == NULL || sc->copy_offset != mem->swapin.hi) {
+	/* Not a continuation of what we have; start over from here */
+	storeClientSwapinFree(mem);
+	mem->swapin.data.origin_offset = sc->copy_offset;
+	mem->swapin.hi = sc->copy_offset;
+    } else if (mem->swapin.done > 0) {
+	double read_time = mem->swapin.done - mem->swapin.started;
+	double drain_time = current_dtime - mem->swapin.done;
+	if (drain_time < read_time && mem->swapin.size < max)
+	    mem->swapin.size = XMIN(mem->swapin.size * 2, max);
+	else if (drain_time > 1.0 && mem->swapin.size > min)
+	    mem->swapin.size = XMAX(mem->swapin.size / 2, min);
+    }
+    size = mem->swapin.size;
+    if (e->swap_status == SWAPOUT_WRITING) {
+	avail = storeSwapOutObjectBytesOnDisk(mem) - sc->copy_offset;
+	assert(avail > 0);
+    } else if (mem->object_sz >= 0) {
+	avail = mem->object_sz - sc->copy_offset;
+    }
+    if (avail > 0 && avail < (squid_off_t) size)
+	size = (size_t) avail;
+    debugs(20, 3, "storeClientReadAhead: %s: %d bytes at %" PRINTF_OFF_T,
+	storeKeyText(storeEntryKey(e)), (int) size, sc->copy_offset);
+    sc->swapin_buf = memAllocBuf(size, &sc->swapin_buf_sz);
+    mem->swapin.reader = sc;
+    mem->swapin.read_offset = sc->copy_offset;
+    mem->swapin.read_size = size;
+    mem->swapin.started = current_dtime;
+    sc->flags.disk_io_pending = 1;
+    storeRead(sc->swapin_sio,
+	sc->swapin_buf,
+	size,
+	sc->copy_offset + mem->swap_hdr_sz,
+	storeClientReadAheadDone,
+	sc);
+}
+
+static void
+storeClientReadAheadDone(void *data, const char *buf_unused, ssize_t len)
+{
+    store_client *sc = data;
+    StoreEntry *e = sc->entry;
+    MemObject *mem = e->mem_obj;
+    assert(sc->flags.disk_io_pending);
+    sc->flags.disk_io_pending = 0;
+    assert(mem->swapin.reader == sc);
+    mem->swapin.reader = NULL;
+    mem->swapin.done = current_dtime;
+    debugs(20, 3, "storeClientReadAheadDone: len %d", (int) len);
+    if (len > 0) {
+	int before = storeClientSwapinPages(mem);
+	stmemAppend(&mem->swapin.data, sc->swapin_buf, len);
+	storeClientSwapinAccount(mem, before);
+	mem->swapin.hi += len;
+    }
+    memFreeBuf(sc->swapin_buf_sz, sc->swapin_buf);
+    sc->swapin_buf = NULL;
+    sc->swapin_buf_sz = 0;
+    /*
+     * The data is handed out by storeClientCopy3(), to this client
+     * and to any others waiting for the same block.
+     */
+    storeLockObject(e);
+    if (len <= 0)
+	storeClientCallback(sc, len);
+    InvokeHandlers(e);
+    storeUnlockObject(e);
+}
+
 /*
  * Try to parse the header.
  * return -1 on error, 0 on more required, +1 on completed.
@@ -642,10 +833,10 @@ storeClientReadHeader(void *data, const char *buf_unused, ssize_t len)
 	case STORE_META_KEY:
 	    assert(t->length == SQUID_MD5_DIGEST_LENGTH);
 	    if (!EBIT_TEST(e->flags, KEY_PRIVATE) &&
-		memcmp(t->value, e->hash.key, SQUID_MD5_DIGEST_LENGTH)) {
+		memcmp(t->value, storeEntryKey(e), SQUID_MD5_DIGEST_LENGTH)) {
 		debugs(20, 2, "storeClientReadHeader: swapin MD5 mismatch");
 		debugs(20, 2, "\t%s", storeKeyText(t->value));
-		debugs(20, 2, "\t%s", storeKeyText(e->hash.key));
+		debugs(20, 2, "\t%s", storeKeyText(storeEntryKey(e)));
 		if (isPowTen(++md5_mismatches))
 		    debugs(20, 1, "WARNING: %d swapin MD5 mismatches",
 			md5_mismatches);
@@ -674,6 +865,9 @@ storeClientReadHeader(void *data, const char *buf_unused, ssize_t len)
 	    else if (strcmp("deflate", t->value) == 0) {
 		e->compression_type = SQUID_CACHE_DEFLATE;
 	    }
+	    else if (strcmp("identity", t->value) == 0) {
+		e->compression_type = SQUID_CACHE_IDENTITY;
+	    }
 
 	    break;
 #endif
@@ -813,9 +1007,10 @@ int
 storeClientUnregister(store_client * sc, StoreEntry * e, void *owner)
 {
     MemObject *mem = e->mem_obj;
+    int kick_readers = 0;
     if (sc == NULL)
 	return 0;
-    debugs(20, 3, "storeClientUnregister: called for '%s'", storeKeyText(e->hash.key));
+    debugs(20, 3, "storeClientUnregister: called for '%s'", storeKeyText(storeEntryKey(e)));
 #if STORE_CLIENT_LIST_DEBUG
     assert(sc == storeClientListSearch(e->mem_obj, owner));
 #endif
@@ -832,6 +1027,16 @@ storeClientUnregister(store_client * sc, StoreEntry * e, void *owner)
 	sc->swapin_sio = NULL;
 	statCounter.swap.ins++;
     }
+    if (sc->swapin_buf) {
+	memFreeBuf(sc->swapin_buf_sz, sc->swapin_buf);
+	sc->swapin_buf = NULL;
+    }
+    if (mem->swapin.reader == sc) {
+	/* Its read won't complete; let the waiting clients read instead */
+	mem->swapin.reader = NULL;
+	kick_readers = 1;
+    }
+    storeClientReadAheadTrim(mem);
     if (NULL != sc->new_callback) {
 	/* callback with ssize = -1 to indicate unexpected termination */
 	debugs(20, 3, "storeClientUnregister: store_client for %s has a callback",
@@ -845,6 +1050,8 @@ storeClientUnregister(store_client * sc, StoreEntry * e, void *owner)
     storeSwapOutMaintainMemObject(e);
     if (mem->nclients == 0)
 	CheckQuickAbort(e);
+    if (kick_readers)
+	InvokeHandlers(e);
     storeUnlockObject(sc->entry);
     sc->entry = NULL;
     cbdataFree(sc);
@@ -886,7 +1093,7 @@ InvokeHandlers(StoreEntry * e)
     dlink_node *nx = NULL;
     dlink_node *node;
 
-    debugs(20, 3, "InvokeHandlers: %s", storeKeyText(e->hash.key));
+    debugs(20, 3, "InvokeHandlers: %s", storeKeyText(storeEntryKey(e)));
     /* walk the entire list looking for valid callbacks */
     for (node = mem->clients.head; node; node = nx) {
 	sc = node->data;
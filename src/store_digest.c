@@ -56,6 +56,11 @@ typedef struct {
     int rewrite_offset;
     int rebuild_count;
     int rewrite_count;
+    int generation;		/* generation of the mask being written */
+    char *snapshot;		/* copy of the last written mask (digest_delta) */
+    int snapshot_size;
+    int snapshot_generation;
+    int delta_size;		/* bytes of change records in the last delta */
 } StoreDigestState;
 
 typedef struct {
@@ -81,6 +86,8 @@ static void storeDigestRewriteResume(void);
 static void storeDigestRewriteFinish(StoreEntry * e);
 static EVH storeDigestSwapOutStep;
 static void storeDigestCBlockSwapOut(StoreEntry * e);
+static void storeDigestCBlockFill(StoreDigestCBlock * cblock);
+static void storeDigestDeltaWrite(void);
 static int storeDigestCalcCap(void);
 static int storeDigestResize(void);
 static void storeDigestAdd(const StoreEntry *);
@@ -102,7 +109,9 @@ storeDigestInit(void)
 	debugs(71, 3, "Local cache digest generation disabled");
 	return;
     }
-    store_digest = cacheDigestCreate(cap, Config.digest.bits_per_entry);
+    store_digest = cacheDigestCreateBlocked(cap, Config.digest.bits_per_entry, Config.digest.blocked);
+    if (Config.digest.counting)
+	cacheDigestEnableCounting(store_digest);
     debugs(71, 1, "Local cache digest enabled; rebuild/rewrite every %d/%d sec",
 	(int) Config.digest.rebuild_period, (int) Config.digest.rewrite_period);
     memset(&sd_state, 0, sizeof(sd_state));
@@ -135,17 +144,17 @@ storeDigestDel(const StoreEntry * entry)
     }
     assert(entry && store_digest);
     debugs(71, 6, "storeDigestDel: checking entry, key: %s",
-	storeKeyText(entry->hash.key));
+	storeKeyText(storeEntryKey(entry)));
     if (!EBIT_TEST(entry->flags, KEY_PRIVATE)) {
-	if (!cacheDigestTest(store_digest, entry->hash.key)) {
+	if (!cacheDigestTest(store_digest, storeEntryKey(entry))) {
 	    sd_stats.del_lost_count++;
 	    debugs(71, 6, "storeDigestDel: lost entry, key: %s url: %s",
-		storeKeyText(entry->hash.key), storeUrl(entry));
+		storeKeyText(storeEntryKey(entry)), storeUrl(entry));
 	} else {
 	    sd_stats.del_count++;
-	    cacheDigestDel(store_digest, entry->hash.key);
+	    cacheDigestDel(store_digest, storeEntryKey(entry));
 	    debugs(71, 6, "storeDigestDel: deled entry, key: %s",
-		storeKeyText(entry->hash.key));
+		storeKeyText(storeEntryKey(entry)));
 	}
     }
 #endif
@@ -168,6 +177,10 @@ storeDigestReport(StoreEntry * e, void* data)
 	storeAppendPrintf(e, "\t collisions: on add: %.2f %% on rej: %.2f %%\n",
 	    xpercent(sd_stats.add_coll_count, sd_stats.add_count),
 	    xpercent(sd_stats.rej_coll_count, sd_stats.rej_count));
+	storeAppendPrintf(e, "\t generation: %d", sd_state.generation);
+	if (Config.digest.delta)
+	    storeAppendPrintf(e, " last delta: %d bytes", sd_state.delta_size);
+	storeAppendPrintf(e, "\n");
     } else {
 	storeAppendPrintf(e, "store digest: disabled.\n");
     }
@@ -187,7 +200,7 @@ storeDigestAddable(const StoreEntry * e)
     /* add some stats! XXX */
 
     debugs(71, 6, "storeDigestAddable: checking entry, key: %s",
-	storeKeyText(e->hash.key));
+	storeKeyText(storeEntryKey(e)));
 
     /* check various entry flags (mimics storeCheckCachable XXX) */
     if (!EBIT_TEST(e->flags, ENTRY_CACHABLE)) {
@@ -232,7 +245,7 @@ storeDigestAddable(const StoreEntry * e)
      * update.
      */
 #if OLD_UNUSED_CODE		/* This code isn't applicable anymore, we can't fix it atm either :( */
-    if ((squid_curtime + Config.digest.rebuild_period) - e->lastref > storeExpiredReferenceAge())
+    if ((squid_curtime + Config.digest.rebuild_period) - STORE_TIME(e->lastref) > storeExpiredReferenceAge())
 	return 0;
 #endif
     return 1;
@@ -245,14 +258,14 @@ storeDigestAdd(const StoreEntry * entry)
 
     if (storeDigestAddable(entry)) {
 	sd_stats.add_count++;
-	if (cacheDigestTest(store_digest, entry->hash.key))
+	if (cacheDigestTest(store_digest, storeEntryKey(entry)))
 	    sd_stats.add_coll_count++;
-	cacheDigestAdd(store_digest, entry->hash.key);
+	cacheDigestAdd(store_digest, storeEntryKey(entry));
 	debugs(71, 6, "storeDigestAdd: added entry, key: %s",
-	    storeKeyText(entry->hash.key));
+	    storeKeyText(storeEntryKey(entry)));
     } else {
 	sd_stats.rej_count++;
-	if (cacheDigestTest(store_digest, entry->hash.key))
+	if (cacheDigestTest(store_digest, storeEntryKey(entry)))
 	    sd_stats.rej_coll_count++;
     }
 }
@@ -317,10 +330,9 @@ storeDigestRebuildStep(void *datanotused)
     debugs(71, 3, "storeDigestRebuildStep: buckets: %d offset: %d chunk: %d buckets",
 	store_hash_buckets, sd_state.rebuild_offset, bcount);
     while (bcount--) {
-	hash_link *link_ptr = hash_get_bucket(store_table, sd_state.rebuild_offset);
-	for (; link_ptr; link_ptr = link_ptr->next) {
-	    storeDigestAdd((StoreEntry *) link_ptr);
-	}
+	StoreEntry *e;
+	for (e = storeHashBucket(sd_state.rebuild_offset); e; e = storeHashNext(e))
+	    storeDigestAdd(e);
 	sd_state.rebuild_offset++;
     }
     /* are we done ? */
@@ -357,7 +369,7 @@ storeDigestRewriteStart(void *datanotused)
     CBDATA_INIT_TYPE(generic_cbdata);
     sd_state.rewrite_lock = cbdataAlloc(generic_cbdata);
     sd_state.rewrite_lock->data = e;
-    debugs(71, 3, "storeDigestRewriteStart: url: %s key: %s", url, storeKeyText(e->hash.key));
+    debugs(71, 3, "storeDigestRewriteStart: url: %s key: %s", url, storeKeyText(storeEntryKey(e)));
     e->mem_obj->request = requestLink(urlParse(method_get, url));
     /* wait for rebuild (if any) to finish */
     if (sd_state.rebuild_lock) {
@@ -376,6 +388,23 @@ storeDigestRewriteResume(void)
     assert(!sd_state.rebuild_lock);
     e = sd_state.rewrite_lock->data;
     sd_state.rewrite_offset = 0;
+    sd_state.generation = squid_curtime;
+    if (sd_state.generation <= sd_state.snapshot_generation)
+	sd_state.generation = sd_state.snapshot_generation + 1;
+    if (Config.digest.delta) {
+	storeDigestDeltaWrite();
+	/* swap out from the snapshot so the body matches the generation */
+	if (sd_state.snapshot_size != store_digest->mask_size) {
+	    safe_free(sd_state.snapshot);
+	    sd_state.snapshot = xmalloc(store_digest->mask_size);
+	    sd_state.snapshot_size = store_digest->mask_size;
+	}
+	xmemcpy(sd_state.snapshot, store_digest->mask, store_digest->mask_size);
+	sd_state.snapshot_generation = sd_state.generation;
+    } else if (sd_state.snapshot) {
+	safe_free(sd_state.snapshot);
+	sd_state.snapshot_size = 0;
+    }
     EBIT_SET(e->flags, ENTRY_SPECIAL);
     /* setting public key will purge old digest entry if any */
     storeSetPublicKey(e);
@@ -400,7 +429,7 @@ storeDigestRewriteFinish(StoreEntry * e)
     storeComplete(e);
     storeTimestampsSet(e);
     debugs(71, 2, "storeDigestRewriteFinish: digest expires at %ld (%+d)",
-	(long int) e->expires, (int) (e->expires - squid_curtime));
+	(long int) STORE_TIME(e->expires), (int) (STORE_TIME(e->expires) - squid_curtime));
     /* is this the write order? @?@ */
     requestUnlink(e->mem_obj->request);
     e->mem_obj->request = NULL;
@@ -428,7 +457,7 @@ storeDigestSwapOutStep(void *data)
     /* _add_ check that nothing bad happened while we were waiting @?@ @?@ */
     if (sd_state.rewrite_offset + chunk_size > store_digest->mask_size)
 	chunk_size = store_digest->mask_size - sd_state.rewrite_offset;
-    storeAppend(e, store_digest->mask + sd_state.rewrite_offset, chunk_size);
+    storeAppend(e, (sd_state.snapshot ? sd_state.snapshot : store_digest->mask) + sd_state.rewrite_offset, chunk_size);
     debugs(71, 3, "storeDigestSwapOutStep: size: %d offset: %d chunk: %d bytes",
 	store_digest->mask_size, sd_state.rewrite_offset, chunk_size);
     sd_state.rewrite_offset += chunk_size;
@@ -439,22 +468,110 @@ storeDigestSwapOutStep(void *data)
 	eventAdd("storeDigestSwapOutStep", storeDigestSwapOutStep, data, 0.0, 1);
 }
 
+static void
+storeDigestCBlockFill(StoreDigestCBlock * cblock)
+{
+    memset(cblock, 0, sizeof(*cblock));
+    cblock->ver.current = htons(CacheDigestVer.current);
+    /* peers which do not know the blocked layout must not use it */
+    cblock->ver.required = htons(store_digest->blocked ?
+	CD_BLOCKED_VERSION : CacheDigestVer.required);
+    cblock->capacity = htonl(store_digest->capacity);
+    cblock->count = htonl(store_digest->count);
+    cblock->del_count = htonl(store_digest->del_count);
+    cblock->mask_size = htonl(store_digest->mask_size);
+    cblock->bits_per_entry = (unsigned char) store_digest->bits_per_entry;
+    cblock->hash_func_count = (unsigned char) CacheDigestHashFuncCount;
+    if (store_digest->blocked)
+	cblock->flags |= CD_FLAG_BLOCKED;
+    cblock->generation = htonl(sd_state.generation);
+}
+
 static void
 storeDigestCBlockSwapOut(StoreEntry * e)
 {
-    memset(&sd_state.cblock, 0, sizeof(sd_state.cblock));
-    sd_state.cblock.ver.current = htons(CacheDigestVer.current);
-    sd_state.cblock.ver.required = htons(CacheDigestVer.required);
-    sd_state.cblock.capacity = htonl(store_digest->capacity);
-    sd_state.cblock.count = htonl(store_digest->count);
-    sd_state.cblock.del_count = htonl(store_digest->del_count);
-    sd_state.cblock.mask_size = htonl(store_digest->mask_size);
-    sd_state.cblock.bits_per_entry = (unsigned char)
-	Config.digest.bits_per_entry;
-    sd_state.cblock.hash_func_count = (unsigned char) CacheDigestHashFuncCount;
+    storeDigestCBlockFill(&sd_state.cblock);
     storeAppend(e, (char *) &sd_state.cblock, sizeof(sd_state.cblock));
 }
 
+/*
+ * Publish the changes between the previously written mask and the
+ * current one as store_digest.delta: a control block followed by
+ * (offset, xor) records for every changed 32 bit word.  Peers holding
+ * the previous generation fetch this instead of the whole mask.  When
+ * there is no usable previous mask, or the delta would not be much
+ * smaller than the mask, any old delta is released and peers fall back
+ * to the full digest.
+ */
+static void
+storeDigestDeltaWrite(void)
+{
+    char *url = internalStoreUri("/squid-internal-periodic/", StoreDigestDeltaFileName);
+    method_t *method_get = urlMethodGetKnownByCode(METHOD_GET);
+    StoreDigestCBlock cblock;
+    request_flags flags;
+    StoreEntry *e;
+    MemBuf mb;
+    int off;
+
+    if ((e = storeGetPublic(url, method_get)) != NULL)
+	storeRelease(e);
+    sd_state.delta_size = -1;
+    if (!sd_state.snapshot || sd_state.snapshot_size != store_digest->mask_size)
+	return;
+    memBufDefInit(&mb);
+    for (off = 0; off < store_digest->mask_size; off += 4) {
+	const int n = XMIN(4, store_digest->mask_size - off);
+	unsigned char cur[4], old[4];
+	int i;
+	u_int32_t noff;
+	memset(cur, 0, sizeof(cur));
+	memset(old, 0, sizeof(old));
+	xmemcpy(cur, store_digest->mask + off, n);
+	xmemcpy(old, sd_state.snapshot + off, n);
+	if (!memcmp(cur, old, sizeof(cur)))
+	    continue;
+	for (i = 0; i < 4; i++)
+	    cur[i] ^= old[i];
+	noff = htonl(off);
+	memBufAppend(&mb, &noff, sizeof(noff));
+	memBufAppend(&mb, cur, sizeof(cur));
+	if (mb.size > store_digest->mask_size / 2) {
+	    debugs(71, 2, "storeDigestDeltaWrite: too many changes, not writing a delta");
+	    memBufClean(&mb);
+	    return;
+	}
+    }
+    flags = null_request_flags;
+    flags.cachable = 1;
+    e = storeCreateEntry(url, flags, method_get);
+    e->mem_obj->request = requestLink(urlParse(method_get, url));
+    EBIT_SET(e->flags, ENTRY_SPECIAL);
+    storeSetPublicKey(e);
+    httpReplyReset(e->mem_obj->reply);
+    httpReplySetHeaders(e->mem_obj->reply, 200, "Cache Digest OK", StoreDigestMimeStr, sizeof(cblock) + mb.size, squid_curtime, squid_curtime + Config.digest.rewrite_period);
+    storeBuffer(e);
+    httpReplySwapOut(e->mem_obj->reply, e);
+    e->mem_obj->reply->hdr_sz = e->mem_obj->inmem_hi;
+    storeDigestCBlockFill(&cblock);
+    cblock.flags |= CD_FLAG_DELTA;
+    cblock.base_generation = htonl(sd_state.snapshot_generation);
+    cblock.delta_size = htonl(mb.size);
+    storeAppend(e, (char *) &cblock, sizeof(cblock));
+    if (mb.size)
+	storeAppend(e, mb.buf, mb.size);
+    storeBufferFlush(e);
+    storeComplete(e);
+    storeTimestampsSet(e);
+    requestUnlink(e->mem_obj->request);
+    e->mem_obj->request = NULL;
+    storeUnlockObject(e);
+    sd_state.delta_size = mb.size;
+    debugs(71, 2, "storeDigestDeltaWrite: generation %d -> %d: %d bytes of changes",
+	sd_state.snapshot_generation, sd_state.generation, mb.size);
+    memBufClean(&mb);
+}
+
 /* calculates digest capacity */
 static int
 storeDigestCalcCap(void)
@@ -466,7 +583,7 @@ storeDigestCalcCap(void)
      */
     const int hi_cap = Config.Swap.maxSize / Config.Store.avgObjectSize;
     const int lo_cap = 1 + store_swap_size / Config.Store.avgObjectSize;
-    const int e_count = memPoolInUseCount(pool_storeentry);
+    const int e_count = storeEntryCount();
     int cap = e_count ? e_count : hi_cap;
     debugs(71, 2, "storeDigestCalcCap: have: %d, want %d entries; limits: [%d, %d]",
 	e_count, cap, lo_cap, hi_cap);
@@ -308,7 +308,7 @@ storeDirSwapLog(const StoreEntry * e, int op)
     assert(op > SWAP_LOG_NOP && op < SWAP_LOG_MAX);
     debugs(20, 3, "storeDirSwapLog: %s %s %d %08X",
 	swap_log_op_str[op],
-	storeKeyText(e->hash.key),
+	storeKeyText(storeEntryKey(e)),
 	e->swap_dirn,
 	e->swap_filen);
     (sd->log.write) (sd, e, op);
@@ -335,7 +335,7 @@ storeDirStats(StoreEntry * sentry, void* data)
 
     storeAppendPrintf(sentry, "Store Directory Statistics:\n");
     storeAppendPrintf(sentry, "Store Entries          : %d\n",
-	memPoolInUseCount(pool_storeentry));
+	storeEntryCount());
     storeAppendPrintf(sentry, "Maximum Swap Size      : %8ld KB\n",
 	(long int) Config.Swap.maxSize);
     storeAppendPrintf(sentry, "Current Store Swap Size: %8d KB\n",
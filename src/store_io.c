@@ -126,6 +126,20 @@ storeRead(storeIOState * sio, char *buf, size_t size, squid_off_t offset, STRCB
     (SD->obj.read) (SD, sio, buf, size, offset, callback, callback_data);
 }
 
+/*
+ * The OS file descriptor of an open, idle sio, for callers that want
+ * to hand the file to the kernel (sendfile).  -1 when the fs does not
+ * keep one, or the file is still being opened, written or closed.
+ */
+int
+storeIOFd(storeIOState * sio)
+{
+    SwapDir *SD = &Config.cacheSwap.swapDirs[sio->swap_dirn];
+    if (sio->flags.closing || SD->obj.fd == NULL)
+	return -1;
+    return (SD->obj.fd) (SD, sio);
+}
+
 void
 storeWrite(storeIOState * sio, char *buf, size_t size, FREE * free_func)
 {
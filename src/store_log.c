@@ -71,7 +71,7 @@ storeLog(int tag, const StoreEntry * e)
 	    storeLogTags[tag],
 	    e->swap_dirn,
 	    e->swap_filen,
-	    storeKeyText(e->hash.key),
+	    storeKeyText(storeEntryKey(e)),
 	    reply->sline.status,
 	    (long int) reply->date,
 	    (long int) reply->last_modified,
@@ -92,7 +92,7 @@ storeLog(int tag, const StoreEntry * e)
 	    storeLogTags[tag],
 	    e->swap_dirn,
 	    e->swap_filen,
-	    storeKeyText(e->hash.key));
+	    storeKeyText(storeEntryKey(e)));
 	logfileLineEnd(storelog);
     }
 }
@@ -65,8 +65,7 @@ storeCleanup(void *datanotused)
     static int store_errors = 0;
     int validnum_start;
     StoreEntry *e;
-    hash_link *link_ptr = NULL;
-    hash_link *link_next = NULL;
+    StoreEntry *next;
     int limit = opt_foreground_rebuild ? 1 << 30 : 500;
     validnum_start = validnum;
 
@@ -83,10 +82,9 @@ storeCleanup(void *datanotused)
 		storeDigestNoteStoreReady();
 	    return;
 	}
-	link_next = hash_get_bucket(store_table, bucketnum);
-	while (NULL != (link_ptr = link_next)) {
-	    link_next = link_ptr->next;
-	    e = (StoreEntry *) link_ptr;
+	next = storeHashBucket(bucketnum);
+	while (NULL != (e = next)) {
+	    next = storeHashNext(e);
 	    if (EBIT_TEST(e->flags, ENTRY_VALIDATED))
 		continue;
 	    /*
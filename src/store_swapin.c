@@ -48,7 +48,7 @@ storeSwapInStart(store_client * sc)
 	return;
     }
     debugs(20, 3, "storeSwapInStart: called for %d %08X %s ",
-	e->swap_dirn, e->swap_filen, storeKeyText(e->hash.key));
+	e->swap_dirn, e->swap_filen, storeKeyText(storeEntryKey(e)));
     if (e->swap_status != SWAPOUT_WRITING && e->swap_status != SWAPOUT_DONE) {
 	debugs(20, 1, "storeSwapInStart: bad swap_status (%s)",
 	    swapStatusStr[e->swap_status]);
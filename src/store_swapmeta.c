@@ -35,6 +35,23 @@
 
 #include "squid.h"
 
+/*
+ * The on-disk STORE_META_STD block keeps full time_t timestamps; the
+ * in-memory StoreEntry only holds offsets from STORE_TIME_BASE.
+ */
+static void
+storeSwapMetaStd(const StoreEntry * e, storeMetaIndexNew * mi)
+{
+    memset(mi, '\0', sizeof(*mi));
+    mi->timestamp = STORE_TIME(e->timestamp);
+    mi->lastref = STORE_TIME(e->lastref);
+    mi->expires = STORE_TIME(e->expires);
+    mi->lastmod = STORE_TIME(e->lastmod);
+    mi->swap_file_sz = e->swap_file_sz;
+    mi->refcount = e->refcount;
+    mi->flags = e->flags;
+}
+
 /*
  * Build a TLV list for a StoreEntry
  */
@@ -46,15 +63,17 @@ storeSwapMetaBuild(StoreEntry * e)
     const char *url;
     const char *vary;
     const squid_off_t objsize = objectLen(e);
+    storeMetaIndexNew mi;
     assert(e->mem_obj != NULL);
     assert(e->swap_status == SWAPOUT_WRITING);
     url = storeUrl(e);
     debugs(20, 3, "storeSwapMetaBuild: %s", url);
-    T = tlv_add(STORE_META_KEY, e->hash.key, SQUID_MD5_DIGEST_LENGTH, T);
+    T = tlv_add(STORE_META_KEY, storeEntryKey(e), SQUID_MD5_DIGEST_LENGTH, T);
+    storeSwapMetaStd(e, &mi);
 #if SIZEOF_SQUID_FILE_SZ == SIZEOF_SIZE_T
-    T = tlv_add(STORE_META_STD, &e->timestamp, STORE_HDR_METASIZE, T);
+    T = tlv_add(STORE_META_STD, &mi, STORE_HDR_METASIZE, T);
 #else
-    T = tlv_add(STORE_META_STD_LFS, &e->timestamp, STORE_HDR_METASIZE, T);
+    T = tlv_add(STORE_META_STD_LFS, &mi, STORE_HDR_METASIZE, T);
 #endif
     T = tlv_add(STORE_META_URL, url, strlen(url) + 1, T);
     if (objsize > -1) {
@@ -68,6 +87,9 @@ storeSwapMetaBuild(StoreEntry * e)
     else if (e->compression_type & SQUID_CACHE_DEFLATE) {
 	T = tlv_add(STORE_META_GZIP, "deflate", sizeof("deflate"), T);
     }
+    else if (e->compression_type & SQUID_CACHE_IDENTITY) {
+	T = tlv_add(STORE_META_GZIP, "identity", sizeof("identity"), T);
+    }
 #endif
 
     vary = e->mem_obj->vary_headers;
@@ -103,6 +125,7 @@ storeSwapMetaAssemble(StoreEntry *e, int *length)
 	const squid_off_t objsize = objectLen(e);
 	const char *vary, *url, *storeurl;
 	int v_len = 0, u_len = 0, s_len = 0;
+	storeMetaIndexNew mi;
 
 	/* calculate length of entire buffer */
 	vary = e->mem_obj->vary_headers;
@@ -126,13 +149,14 @@ storeSwapMetaAssemble(StoreEntry *e, int *length)
 	b = storeSwapMetaAssemblePart(b, STORE_META_OK, &buflen, sizeof(int));
 
 	/* Meta key */
-	b = storeSwapMetaAssemblePart(b, STORE_META_KEY, e->hash.key, SQUID_MD5_DIGEST_LENGTH);
+	b = storeSwapMetaAssemblePart(b, STORE_META_KEY, storeEntryKey(e), SQUID_MD5_DIGEST_LENGTH);
 
 	/* timestamp */
+	storeSwapMetaStd(e, &mi);
 #if SIZEOF_SQUID_FILE_SZ == SIZEOF_SIZE_T
-	b = storeSwapMetaAssemblePart(b, STORE_META_STD, &e->timestamp, STORE_HDR_METASIZE);
+	b = storeSwapMetaAssemblePart(b, STORE_META_STD, &mi, STORE_HDR_METASIZE);
 #else
-	b = storeSwapMetaAssemblePart(b, STORE_META_STD_LFS, &e->timestamp, STORE_HDR_METASIZE);
+	b = storeSwapMetaAssemblePart(b, STORE_META_STD_LFS, &mi, STORE_HDR_METASIZE);
 #endif
 
 	/* url */
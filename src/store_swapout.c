@@ -39,6 +39,7 @@ static void storeSwapOutStart(StoreEntry * e);
 static STIOCB storeSwapOutFileClosed;
 static STIOCB storeSwapOutFileNotify;
 static int storeSwapOutAble(const StoreEntry * e);
+static int storeSwapOutWriteChunk(StoreEntry * e);
 
 /* start swapping object to disk */
 static void
@@ -81,9 +82,52 @@ storeSwapOutStart(StoreEntry * e)
     /* Pick up the file number if it was assigned immediately */
     e->swap_filen = mem->swapout.sio->swap_filen;
     e->swap_dirn = mem->swapout.sio->swap_dirn;
-    /* write out the swap metadata */
     cbdataLock(mem->swapout.sio);
-    storeWrite(mem->swapout.sio, buf, mem->swap_hdr_sz, xfree);
+    /* the swap metadata is written with the first chunk of data */
+    mem->swapout.meta = buf;
+}
+
+/*
+ * Write the next chunk of object data, preceded by the swap metadata
+ * if that hasn't gone out yet.  Chunks end on write_size boundaries
+ * of the swap file.  While the object is still coming in we wait for
+ * a whole chunk; once it is complete the rest goes out as is.
+ * Returns 0 if there is no chunk to write yet.
+ */
+static int
+storeSwapOutWriteChunk(StoreEntry * e)
+{
+    MemObject *mem = e->mem_obj;
+    size_t write_size = INDEXSD(mem->swapout.sio->swap_dirn)->write_size;
+    size_t meta_sz = mem->swapout.meta ? mem->swap_hdr_sz : 0;
+    squid_off_t file_offset = mem->swap_hdr_sz - meta_sz + mem->swapout.queue_offset;
+    squid_off_t avail = mem->inmem_hi - mem->swapout.queue_offset;
+    size_t len = write_size - (size_t) (file_offset % write_size);
+    size_t buf_sz;
+    char *buf;
+
+    while (len <= meta_sz)
+	len += write_size;
+    len -= meta_sz;
+    if (avail < (squid_off_t) len) {
+	if (e->store_status == STORE_PENDING)
+	    return 0;
+	len = (size_t) avail;
+    }
+    debugs(20, 3, "storeSwapOutWriteChunk: swapping out %d bytes from %" PRINTF_OFF_T " (%d bytes metadata)",
+	(int) len, mem->swapout.queue_offset, (int) meta_sz);
+    buf = memAllocBuf(meta_sz + len, &buf_sz);
+    if (meta_sz) {
+	xmemcpy(buf, mem->swapout.meta, meta_sz);
+	safe_free(mem->swapout.meta);
+    }
+    if (len > 0) {
+	ssize_t copied = stmemCopy(&mem->data_hdr, mem->swapout.queue_offset, buf + meta_sz, len);
+	assert(copied == (ssize_t) len);
+    }
+    mem->swapout.queue_offset += len;
+    storeWrite(mem->swapout.sio, buf, meta_sz + len, memFreeBufFunc(buf_sz));
+    return 1;
 }
 
 static void
@@ -169,7 +213,6 @@ storeSwapOut(StoreEntry * e)
     MemObject *mem = e->mem_obj;
     int swapout_able;
     squid_off_t swapout_size;
-    size_t swap_buf_len;
     if (mem == NULL)
 	return;
     /* should we swap something out to disk? */
@@ -227,8 +270,12 @@ storeSwapOut(StoreEntry * e)
     debugs(20, 7, "storeSwapOut: swapout_size = %" PRINTF_OFF_T "",
 	swapout_size);
     if (swapout_size == 0) {
-	if (e->store_status == STORE_OK)
+	if (e->store_status == STORE_OK) {
+	    /* an empty object still needs its metadata on disk */
+	    if (mem->swapout.sio && mem->swapout.meta)
+		storeSwapOutWriteChunk(e);
 	    storeSwapOutFileClose(e);
+	}
 	return;			/* Nevermore! */
     }
     if (e->store_status == STORE_PENDING) {
@@ -260,43 +307,12 @@ storeSwapOut(StoreEntry * e)
     if (NULL == mem->swapout.sio)
 	return;
     do {
-	/*
-	 * Evil hack time.
-	 * We are paging out to disk in page size chunks. however, later on when
-	 * we update the queue position, we might not have a page (I *think*),
-	 * so we do the actual page update here.
-	 */
-
-	if (mem->swapout.memnode == NULL) {
-	    /* We need to swap out the first page */
-	    mem->swapout.memnode = mem->data_hdr.head;
-	} else {
-	    /* We need to swap out the next page */
-	    mem->swapout.memnode = mem->swapout.memnode->next;
-	}
-	/*
-	 * Get the length of this buffer. We are assuming(!) that the buffer
-	 * length won't change on this buffer, or things are going to be very
-	 * strange. I think that after the copy to a buffer is done, the buffer
-	 * size should stay fixed regardless so that this code isn't confused,
-	 * but we can look at this at a later date or whenever the code results
-	 * in bad swapouts, whichever happens first. :-)
-	 */
-	swap_buf_len = mem->swapout.memnode->len;
-
-	debugs(20, 3, "storeSwapOut: swap_buf_len = %d", (int) swap_buf_len);
-	assert(swap_buf_len > 0);
-	debugs(20, 3, "storeSwapOut: swapping out %d bytes from %" PRINTF_OFF_T "",
-	    (int) swap_buf_len, mem->swapout.queue_offset);
-	mem->swapout.queue_offset += swap_buf_len;
-	storeWrite(mem->swapout.sio, stmemNodeGet(mem->swapout.memnode), swap_buf_len, stmemNodeFree);
+	if (!storeSwapOutWriteChunk(e))
+	    break;
 	/* the storeWrite() call might generate an error */
 	if (e->swap_status != SWAPOUT_WRITING)
 	    break;
 	swapout_size = mem->inmem_hi - mem->swapout.queue_offset;
-	if (e->store_status == STORE_PENDING)
-	    if (swapout_size < SM_PAGE_SIZE)
-		break;
     } while (swapout_size > 0);
     if (NULL == mem->swapout.sio)
 	/* oops, we're not swapping out any more */
@@ -318,8 +334,9 @@ storeSwapOutFileClose(StoreEntry * e)
     MemObject *mem = e->mem_obj;
     storeIOState *sio = mem->swapout.sio;
     assert(mem != NULL);
-    debugs(20, 3, "storeSwapOutFileClose: %s", storeKeyText(e->hash.key));
+    debugs(20, 3, "storeSwapOutFileClose: %s", storeKeyText(storeEntryKey(e)));
     debugs(20, 3, "storeSwapOutFileClose: sio = %p", mem->swapout.sio);
+    safe_free(mem->swapout.meta);
     if (sio == NULL)
 	return;
     mem->swapout.sio = NULL;
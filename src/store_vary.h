@@ -7,5 +7,6 @@ extern void storeLocateVary(StoreEntry * e, int offset, const char *vary_data,
 extern void storeAddVary(const char *store_url, const char *url, method_t * method, const cache_key * key,
     const char *etag, const char *vary, const char *vary_headers,
     const char *accept_encoding);
+extern void storeVaryIndexRelease(const cache_key * key);
 
 #endif
@@ -350,6 +350,9 @@ struct _http_port_list {
     unsigned int tproxy;
     unsigned int act_as_origin;	/* Fake Date: headers in accelerator mode */
     unsigned int allow_direct:1;	/* Allow direct forwarding in accelerator mode */
+    unsigned int worker_queues:1;	/* SMP: one SO_REUSEPORT listener per worker */
+    int defer_accept;		/* TCP_DEFER_ACCEPT seconds, 0 = off */
+    int tcp_fastopen;		/* TCP_FASTOPEN queue length, 0 = off */
     struct {
 	unsigned int enabled;
 	unsigned int idle;
@@ -391,11 +394,13 @@ struct _delaySpecSet {
     delaySpec aggregate;
     delaySpec individual;
     delaySpec network;
+    delaySpec connection;
 };
 
 struct _delayConfig {
     unsigned short pools;
     unsigned short initial;
+    unsigned short network_prefix;
     unsigned char *class;
     delaySpecSet **rates;
     acl_access **access;
@@ -422,6 +427,11 @@ struct _SquidConfig {
 	squid_off_t max;
     } quickAbort;
     squid_off_t readAheadGap;
+    struct {
+	squid_off_t min;
+	squid_off_t max;
+    } swapinReadAhead;
+    squid_off_t sendfileMinSize;
     RemovalPolicySettings *replPolicy;
     RemovalPolicySettings *memPolicy;
     time_t negativeTtl;
@@ -513,6 +523,7 @@ struct _SquidConfig {
 	logformat *logformats;
 	customlog *accesslogs;
 	int rotateNumber;
+	squid_off_t daemon_ring_size;
     } Log;
     char *adminEmail;
     char *EmailFrom;
@@ -654,7 +665,6 @@ struct _SquidConfig {
 	int log_ip_on_direct;
 	int ie_refresh;
 	int vary_ignore_expire;
-	int pipeline_prefetch;
 	int request_entities;
 	int detect_broken_server_pconns;
 	int balance_on_multiple_ip;
@@ -682,8 +692,16 @@ struct _SquidConfig {
 	int log_http_violations;
 	int tcp_reset_on_all_errors;
 	int blank_error_pages;
+	int carp_maglev;
+	int client_sendfile;
+	int epoll_edge_triggered;
     } onoff;
     int collapsed_forwarding_timeout;
+    int carp_bounded_load;
+    struct {
+	int max_idle_per_dest;
+	int order;
+    } pconn;
     acl *aclList;
     struct {
 	acl_access *http;
@@ -759,6 +777,7 @@ struct _SquidConfig {
 #endif
     int max_open_disk_fds;
     int uri_whitespace;
+    int pipeline_max_prefetch;
     squid_off_t rangeOffsetLimit;
 #if MULTICAST_MISS_STREAM
     struct {
@@ -778,12 +797,17 @@ struct _SquidConfig {
 	time_t rewrite_period;
 	squid_off_t swapout_chunk_size;
 	int rebuild_chunk_percentage;
+	int blocked;
+	int counting;
+	int delta;
     } digest;
 #endif
 #if USE_SSL
     struct {
 	int unclean_shutdown;
 	char *ssl_engine;
+	squid_off_t session_cache_size;
+	time_t ticket_key_rotate;
     } SSL;
 #endif
     struct {
@@ -794,6 +818,7 @@ struct _SquidConfig {
     char *store_dir_select_algorithm;
     int sleep_after_fork;	/* microseconds */
     time_t minimum_expiry_time;	/* seconds */
+    time_t metrics_update_period;
     int externalAclMaxQueue;
     external_acl *externalAclHelperList;
     enum zph_mode {
@@ -824,20 +849,28 @@ struct _SquidConfig {
     time_t refresh_stale_window;
     int umask;
     rewrite *rewrites;
+    rewrite_rules *urlRewriteRules;
+    rewrite_rules *storeurlRewriteRules;
     int max_filedescriptors;
     char *accept_filter;
     int incoming_rate;
+    int event_loops;
+    struct {
+	int lag;		/* msec, 0 = no admission control */
+	int shed;
+    } admission;
 #if HTTP_GZIP
     struct {
 	int enable;
 	int prefer_gzip;
 	int prefer_deflate;
-	char *types;
+	wordlist *types;
 	int level;
 	int wbits;
 	int memlevel;
 	int min_length;
 	squid_off_t prealloc_size;
+	int threads;
     } http_gzip;
 #endif
     struct {
@@ -910,6 +943,7 @@ struct _HttpStateData {
     int body_buf_sz;
     squid_off_t chunk_size;
     String chunkhdr;
+    struct timeval request_sent;	/* cleared once the first reply byte arrives */
 #if HTTP_GZIP
     void *context;
 #endif
@@ -1028,6 +1062,7 @@ struct _clientHttpRequest {
 	unsigned int done_copying:1;
 	unsigned int purging:1;
 	unsigned int hit:1;
+	unsigned int sendfile:1;
     } flags;
     struct {
 	http_status status;
@@ -1040,6 +1075,8 @@ struct _clientHttpRequest {
     squid_off_t delayMaxBodySize;
     ushort delayAssignedPool;
     mem_node_ref nr;
+    struct iovec body_iov[COMM_WRITEV_MAX];	/* framed body write in flight */
+    char chunk_hdr[20];
     int is_modified;
     int client_tos;
 };
@@ -1087,6 +1124,7 @@ struct _ConnStateData {
 	peer *peer;		/* peer the connection goes via */
     } pinning;
     int tos_priority;		/* Used by zph to avoid updating the tos/priority when not needed */
+    iapp_msg handoff;		/* start on another event loop */
 };
 
 struct _domain_ping {
@@ -1116,8 +1154,12 @@ struct _StoreDigestCBlock {
     int mask_size;
     unsigned char bits_per_entry;
     unsigned char hash_func_count;
-    short int reserved_short;
-    int reserved[32 - 6];
+    unsigned char flags;	/* CD_FLAG_* */
+    unsigned char reserved_char;
+    int generation;		/* identifies this mask, 0 if unknown */
+    int base_generation;	/* delta: mask the changes apply to */
+    int delta_size;		/* delta: bytes of change records */
+    int reserved[32 - 9];
 };
 
 struct _DigestFetchState {
@@ -1129,6 +1171,9 @@ struct _DigestFetchState {
     request_t *request;
     squid_off_t offset;
     squid_off_t mask_offset;
+    StoreDigestCBlock cblock;	/* host byte order copy of the received cblock */
+    char *delta;		/* change records of a delta digest */
+    int delta_used;
     time_t start_time;
     time_t resp_time;
     time_t expires;
@@ -1159,7 +1204,12 @@ struct _PeerDigest {
 	unsigned int needed:1;	/* there were requests for this digest */
 	unsigned int usable:1;	/* can be used for lookups */
 	unsigned int requested:1;	/* in process of receiving [fresh] digest */
+	unsigned int delta:1;	/* current request is for a delta */
+	unsigned int no_delta:1;	/* peer does not publish deltas */
+	unsigned int need_full:1;	/* last delta did not apply */
     } flags;
+    int generation;		/* generation of the mask in cd */
+    int delta_failures;		/* consecutive deltas which did not apply */
     struct {
 	/* all times are absolute unless augmented with _delay */
 	time_t initialized;	/* creation */
@@ -1177,7 +1227,7 @@ struct _PeerDigest {
 	struct {
 	    int msgs;
 	    kb_t kbytes;
-	} sent, recv;
+	} sent, recv, delta;
     } stats;
 };
 
@@ -1416,6 +1466,8 @@ struct _store_client {
     void *header_cbdata;
     StoreEntry *entry;		/* ptr to the parent StoreEntry, argh! */
     storeIOState *swapin_sio;
+    char *swapin_buf;		/* read-ahead block while its read is in flight */
+    size_t swapin_buf_sz;
     struct {
 	unsigned int disk_io_pending:1;
 	unsigned int store_copying:1;
@@ -1433,8 +1485,12 @@ struct _store_client {
 
 /* Removal policies */
 
-struct _RemovalPolicyNode {
+union _RemovalPolicyNode {
     void *data;
+    struct {
+	sentryno prev;
+	sentryno next;
+    } link;			/* for policies that list entries in place */
 };
 
 struct _RemovalPolicy {
@@ -1448,6 +1504,7 @@ struct _RemovalPolicy {
     RemovalPolicyWalker *(*WalkInit) (RemovalPolicy * policy);
     RemovalPurgeWalker *(*PurgeInit) (RemovalPolicy * policy, int max_scan);
     void (*Stats) (RemovalPolicy * policy, StoreEntry * entry);
+    size_t (*MemoryUsed) (RemovalPolicy * policy);	/* bytes held for the entries */
 };
 
 struct _RemovalPolicyWalker {
@@ -1479,9 +1536,19 @@ struct _MemObject {
     int nclients;
     struct {
 	squid_off_t queue_offset;	/* relative to in-mem data */
-	mem_node *memnode;	/* which node we're currently paging out */
+	char *meta;		/* swap metadata, goes out with the first chunk */
 	storeIOState *sio;
     } swapout;
+    struct {
+	mem_hdr data;		/* body read ahead from the swap file */
+	squid_off_t hi;		/* body offset just past the read-ahead data */
+	size_t size;		/* next read-ahead size */
+	store_client *reader;	/* disk client whose read is in flight */
+	squid_off_t read_offset;
+	size_t read_size;
+	double started;		/* when the last read was issued */
+	double done;		/* when the last read completed */
+    } swapin;
     HttpReply *reply;
     request_t *request;
     struct timeval start_ping;
@@ -1511,31 +1578,37 @@ struct _MemObject {
 
 #define SQUID_CACHE_GZIP 1
 #define SQUID_CACHE_DEFLATE 2
+#define SQUID_CACHE_IDENTITY 4	/* not compressed, but has compressed variants */
 
 #endif
 
+/*
+ * One of these per cached object, so keep it small.  Entries live in
+ * the store.c arena and refer to each other by sentryno; the fields
+ * looked at while walking a hash chain come first.
+ */
 struct _StoreEntry {
-    hash_link hash;		/* must be first */
+    cache_key key[SQUID_MD5_DIGEST_LENGTH];	/* valid while hashed */
+    sentryno hash_next;		/* hash chain, or free list */
+    sfileno swap_filen:25;
+    sdirno swap_dirn:7;
     MemObject *mem_obj;
     RemovalPolicyNode repl;
-    /* START OF ON-DISK STORE_META_STD TLV field */
-    time_t timestamp;
-    time_t lastref;
-    time_t expires;
-    time_t lastmod;
     squid_file_sz swap_file_sz;
+    store_time_t timestamp;	/* use STORE_TIME() / storeTimeOffset() */
+    store_time_t lastref;
+    store_time_t expires;
+    store_time_t lastmod;
+    u_short lock_count;		/* Assume < 65536! */
     u_short refcount;
     u_short flags;
-    /* END OF ON-DISK STORE_META_STD */
-    sfileno swap_filen:25;
-    sdirno swap_dirn:7;
-    u_short lock_count;		/* Assume < 65536! */
     mem_status_t mem_status:3;
     ping_status_t ping_status:3;
     store_status_t store_status:3;
     swap_status_t swap_status:3;
+    unsigned int hashed:1;	/* key is set and the entry is in the store hash */
 #if HTTP_GZIP
-    int compression_type;
+    unsigned int compression_type:3;	/* SQUID_CACHE_* bits */
 #endif
 };
 
@@ -1548,6 +1621,7 @@ struct _SwapDir {
     int index;			/* This entry's index into the swapDirs array */
     squid_off_t min_objsize;
     squid_off_t max_objsize;
+    size_t write_size;		/* swap-out write chunk */
     RemovalPolicy *repl;
     int removals;
     int scanned;
@@ -1578,6 +1652,7 @@ struct _SwapDir {
 	STOBJWRITE *write;
 	STOBJUNLINK *unlink;
 	STOBJRECYCLE *recycle;
+	STOBJFD *fd;		/* OS descriptor of an idle open file, optional */
     } obj;
     struct {
 	STLOGOPEN *open;
@@ -1801,6 +1876,8 @@ struct _action_table {
 struct _StatCounters {
     struct {
 	int clients;
+	int accepts;
+	int accepts_shed;	/* reset by admission control */
 	int requests;
 	int hits;
 	int mem_hits;
@@ -1809,6 +1886,7 @@ struct _StatCounters {
 	kb_t kbytes_in;
 	kb_t kbytes_out;
 	kb_t hit_kbytes_out;
+	kb_t sendfile_kbytes_out;
 	StatHist miss_svc_time;
 	StatHist nm_svc_time;
 	StatHist nh_svc_time;
@@ -1913,6 +1991,12 @@ struct _StatCounters {
 	int outs;
 	int ins;
     } swap;
+    struct {
+	int accepts;		/* client handshakes completed */
+	int connects;		/* server handshakes completed */
+	int ktls_send;		/* of those, with kernel TLS transmit */
+	int ktls_recv;		/* of those, with kernel TLS receive */
+    } ssl;
 };
 
 struct _InfoActionData
@@ -1920,6 +2004,9 @@ struct _InfoActionData
     struct timeval squid_start;
     struct timeval current_time;
     double client_http_clients;
+    double client_http_accepts;
+    double kid_accepts[MAX_KID_SUPPORT + 1];	/* indexed by KidIdentifier */
+    double client_http_accepts_shed;
     double client_http_requests;
     double icp_pkts_recv;
     double icp_pkts_sent;
@@ -1990,6 +2077,7 @@ struct _InfoActionData
 	double store_mem_object_count;
 	double store_mem_count;
 	double store_swap_count;
+	double store_index_bytes;
 	
     unsigned int count;
 };
@@ -2107,6 +2195,7 @@ struct _CountersActionData
     double client_http_kbytes_in;
     double client_http_kbytes_out;
     double client_http_hit_kbytes_out;
+    double client_http_sendfile_kbytes_out;
     double server_all_requests;
     double server_all_errors;
     double server_all_kbytes_in;
@@ -2158,6 +2247,10 @@ struct _CountersActionData
     double swap_ins;
     double swap_files_cleaned;
     double aborted_requests;
+    double ssl_accepts;
+    double ssl_connects;
+    double ssl_ktls_send;
+    double ssl_ktls_recv;
 };
 
 struct _CacheDigest {
@@ -2168,6 +2261,8 @@ struct _CacheDigest {
     int bits_per_entry;		/* number of bits allocated for each entry from capacity */
     int count;			/* number of digested entries */
     int del_count;		/* number of deletions performed so far */
+    int blocked;		/* CD_FLAG_BLOCKED layout */
+    unsigned char *counts;	/* per-bit counters when deletions are supported */
 };
 
 
@@ -2260,6 +2355,7 @@ struct _Logfile {
     char path[MAXPATHLEN];
     struct {
 	unsigned int fatal;
+	unsigned int binary;	/* module can carry arbitrary bytes */
     } flags;
 
     void *data;
@@ -2291,6 +2387,7 @@ struct _customlog {
 	CLF_CUSTOM,
 	CLF_SQUID,
 	CLF_COMMON,
+	CLF_BINARY,
 	CLF_NONE
     } type;
 };
@@ -2323,6 +2420,7 @@ struct _rewritetoken {
     const char *str;
     size_t str_len;
     int urlEncode;
+    int submatch;		/* RFT_SUBMATCH: match group number */
     rewritetoken *next;
 };
 
@@ -2333,6 +2431,34 @@ struct _rewrite {
     rewrite *next;
 };
 
+struct _rewrite_rule {
+    hash_link hash;		/* must be first; key is the host for host rules */
+    rewrite_rule_type type;
+    int index;			/* position in the configuration */
+    char *pattern;
+    size_t pattern_len;
+    regex_t regex;
+    int icase;
+    char *dsturl;		/* NULL for "-" */
+    rewritetoken *tokens;
+    acl_list *aclList;
+    int hits;
+    rewrite_rule *next;		/* configuration order */
+    rewrite_rule *match_next;	/* next prefix/regex rule */
+    rewrite_rule *host_next;	/* next host rule for the same host */
+};
+
+struct _rewrite_rules {
+    rewrite_rule *head;
+    rewrite_rule **tail;
+    rewrite_rule *match;	/* prefix and regex rules, in order */
+    rewrite_rule **match_tail;
+    hash_table *hosts;		/* host rules, keyed by lowercase host */
+    int count;
+    int lookups;
+    int misses;
+};
+
 typedef enum {ptInt = 1, ptString} ParamType;
 
 struct _QueryParam{
@@ -34,6 +34,9 @@
 #ifndef SQUID_TYPEDEFS_H
 #define SQUID_TYPEDEFS_H
 
+typedef int store_time_t;	/* seconds from STORE_TIME_BASE */
+typedef unsigned int sentryno;	/* StoreEntry number, 0 is none */
+
 /*
  * grep '^struct' structs.h \
  * | perl -ne '($a,$b)=split;$c=$b;$c=~s/^_//; print "typedef struct $b $c;\n";'
@@ -133,10 +136,12 @@ typedef struct _logformat logformat;
 typedef struct _customlog customlog;
 typedef struct _rewrite rewrite;
 typedef struct _rewritetoken rewritetoken;
+typedef struct _rewrite_rule rewrite_rule;
+typedef struct _rewrite_rules rewrite_rules;
 typedef struct _RemovalPolicy RemovalPolicy;
 typedef struct _RemovalPolicyWalker RemovalPolicyWalker;
 typedef struct _RemovalPurgeWalker RemovalPurgeWalker;
-typedef struct _RemovalPolicyNode RemovalPolicyNode;
+typedef union _RemovalPolicyNode RemovalPolicyNode;
 typedef struct _RemovalPolicySettings RemovalPolicySettings;
 typedef struct _errormap errormap;
 typedef struct _PeerMonitor PeerMonitor;
@@ -212,6 +217,7 @@ typedef void STOBJREAD(SwapDir *, storeIOState *, char *, size_t, squid_off_t, S
 typedef void STOBJWRITE(SwapDir *, storeIOState *, char *, size_t, squid_off_t, FREE *);
 typedef void STOBJUNLINK(SwapDir *, StoreEntry *);
 typedef void STOBJRECYCLE(SwapDir *, StoreEntry *);
+typedef int STOBJFD(SwapDir *, storeIOState *);
 
 typedef void STLOGOPEN(SwapDir *);
 typedef void STLOGCLOSE(SwapDir *);
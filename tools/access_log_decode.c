@@ -0,0 +1,128 @@
+#include "config.h"
+
+#if HAVE_STDIO_H
+#include <stdio.h>
+#endif
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#if HAVE_STRING_H
+#include <string.h>
+#endif
+#if HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#if HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+#if HAVE_ARPA_INET_H
+#include <arpa/inet.h>
+#endif
+
+#include "../include/util.h"
+
+#include "../src/access_log_binary.h"
+
+/*
+ * Turn a "binary" format access log back into native squid format
+ * lines, one per record, on stdout.
+ */
+
+static int
+decode_record(FILE * fp, const char *name)
+{
+    access_log_binary_hdr h;
+    struct in_addr caddr;
+    char *str[ALB_NSTR];
+    char *raw, *buf, *p, *q;
+    size_t want;
+    int i;
+
+    if (fread(&h, sizeof(h), 1, fp) != 1)
+	return 0;
+    if (h.magic != ALB_MAGIC || h.version != ALB_VERSION || h.length < sizeof(h)) {
+	fprintf(stderr, "%s: bad record header at offset %ld\n", name, ftell(fp) - (long) sizeof(h));
+	return 0;
+    }
+    want = h.length - sizeof(h);
+    raw = malloc(want + 1);
+    buf = malloc(want + ALB_NSTR);
+    if (raw == NULL || buf == NULL) {
+	perror("malloc");
+	exit(1);
+    }
+    if (want > 0 && fread(raw, want, 1, fp) != 1) {
+	fprintf(stderr, "%s: truncated record\n", name);
+	free(raw);
+	free(buf);
+	return 0;
+    }
+    /* copy the strings out so each one gets a terminator */
+    p = raw;
+    q = buf;
+    for (i = 0; i < ALB_NSTR; i++) {
+	if (p + h.len[i] > raw + want) {
+	    fprintf(stderr, "%s: corrupt record\n", name);
+	    free(raw);
+	    free(buf);
+	    return 0;
+	}
+	memcpy(q, p, h.len[i]);
+	str[i] = q;
+	q += h.len[i];
+	*q++ = '\0';
+	p += h.len[i];
+    }
+    free(raw);
+    caddr.s_addr = h.caddr;
+    printf("%9ld.%03d %6d %s %s/%03d %llu %s %s %s %s%s/%s %s\n",
+	(long int) h.sec,
+	(int) h.usec / 1000,
+	(int) h.msec,
+	inet_ntoa(caddr),
+	str[ALB_STR_STATUS],
+	(int) h.http_code,
+	h.size,
+	str[ALB_STR_METHOD],
+	rfc1738_escape_unescaped(str[ALB_STR_URL]),
+	*str[ALB_STR_USER] ? str[ALB_STR_USER] : "-",
+	(h.flags & ALB_F_TIMEDOUT) ? "TIMEOUT_" : "",
+	str[ALB_STR_HIERARCHY],
+	str[ALB_STR_PEER],
+	str[ALB_STR_MIME]);
+    free(buf);
+    return 1;
+}
+
+static void
+decode_file(FILE * fp, const char *name)
+{
+    while (decode_record(fp, name))
+	;
+}
+
+int
+main(int argc, char *argv[])
+{
+    FILE *fp;
+    int i;
+
+    if (argc < 2) {
+	decode_file(stdin, "stdin");
+	return 0;
+    }
+    for (i = 1; i < argc; i++) {
+	if (strcmp(argv[i], "-h") == 0) {
+	    fprintf(stderr, "Usage: %s [binary access.log ...]\n", argv[0]);
+	    return 1;
+	}
+	fp = fopen(argv[i], "r");
+	if (fp == NULL) {
+	    perror(argv[i]);
+	    continue;
+	}
+	decode_file(fp, argv[i]);
+	fclose(fp);
+    }
+    return 0;
+}